@@ -12,5 +12,7 @@
 #define EMALLOC 3               /**< \c malloc() fails */
 #define EREALLOC EMALLOC        /**< \c realloc() fails */
 #define EFPERM 4                /**< File permission error */
+#define ECONFL 5                /**< The database has changed since the request was made */
+#define EDUP 6                  /**< A unique key (e.g. an email address) is held by another client */
 
 #endif //REPAIRSHOP_ERRORCODES_H
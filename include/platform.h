@@ -0,0 +1,28 @@
+/**
+ * @file platform.h
+ * @brief The platform the program is written for. Every source file includes this first, before the system headers.
+ * @details The program needs POSIX.1-2008 with the X/Open extensions (threads, reader-writer locks, sockets, signals,
+ *          \c open_memstream() ), and GCC or Clang: the counters shared by the threads use the \c __atomic builtins,
+ *          and the probes use the \c cleanup attribute. Otherwise it's C99, so it builds with \c -std=c99 \c -pedantic
+ *          as well as with C11.
+ */
+
+#ifndef REPAIRSHOP_PLATFORM_H
+#define REPAIRSHOP_PLATFORM_H
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#ifndef __GNUC__
+#error "GCC or Clang is required, see platform.h."
+#endif
+
+/** Gives each thread its own copy of a static variable. \c _Thread_local is C11, GCC and Clang have \c __thread . */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#endif //REPAIRSHOP_PLATFORM_H
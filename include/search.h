@@ -18,8 +18,54 @@ typedef struct sres {
         int err;                /**<  Error code */
 } sres;
 
+/**
+ * @struct sentry search.h
+ * @brief A key of a prefix index and the database indexes it belongs to.
+ */
+typedef struct sentry {
+        const char *key;        /**< The client's name or the car's plate, a copy stored by the index. */
+        idx cl;                 /**< The client's index. */
+        idx car;                /**< The car's index, unused for names. */
+} sentry;
+
+/**
+ * @struct sindex search.h
+ * @brief A prefix index: the client names or the plates of a database, sorted case-insensitively.
+ * @note It's a copy of the keys, the database may change after it has been built. See \c search_index() .
+ */
+typedef struct sindex {
+        vector *blocks;         /**< The storage of the keys, blocks of \c SEARCH_BLOCK bytes. */
+        size_t used;            /**< The used bytes of the last block. */
+        sentry *items;          /**< The sorted entries. */
+        size_t size;            /**< The number of entries. */
+        size_t capacity;        /**< The number of entries \c items has space for. */
+        int depth;              /**< \c 1 for client names, \c 2 for plates, like the \c sres of the search. */
+} sindex;
+
+/**
+ * @struct sprefix search.h
+ * @brief A prefix typed character by character, and the range of the index entries starting with it.
+ * @details The ranges of the shorter prefixes are kept, so a character is added or removed in a single step.
+ */
+typedef struct sprefix {
+        const sindex *ix;               /**< The index searched in. */
+        char term[NAME_SIZE + 1];       /**< The prefix. */
+        size_t len;                     /**< The length of the prefix. */
+        size_t lo[NAME_SIZE + 1];       /**< The first matching entry for every length of the prefix. */
+        size_t hi[NAME_SIZE + 1];       /**< The end of the matching entries for every length of the prefix. */
+} sprefix;
+
 sres search_cl(database *db, const char *term);
 sres search_plate(database *db, const char *term);
 sres search_expiration(database *db);
+void search_res_del(vector *map, int depth);
+
+int search_index(database *db, sindex *ix, bool plates);
+void search_index_del(sindex *ix);
+
+void search_prefix_init(sprefix *p, const sindex *ix);
+bool search_prefix_push(sprefix *p, char c);
+bool search_prefix_pop(sprefix *p);
+sres search_prefix_res(const sprefix *p);
 
 #endif //REPAIRSHOP_SEARCH_H
@@ -5,11 +5,20 @@
  *       \c 0 information about how the program works. Visit the individual module documentation for more info.
  */
 
+#include "include/platform.h"
+
 #include <stdio.h>
 
 #include "module-database/include/database.h"
+#include "module-database/include/purge.h"
+#include "module-database/include/uniq.h"
 #include "module-interface/include/intf.h"
 #include "module-filehandler/include/fh.h"
+#include "module-server/include/srv.h"
+#include "module-pool/include/pool.h"
+#include "module-bench/include/bench.h"
+#include "module-test/include/test.h"
+#include "module-probe/include/probe.h"
 
 /**
  * @brief Cleans up the allocated memory and exits the program with the given error code.
@@ -20,6 +29,7 @@
 void err_cleanup(database *db, int err_code)
 {
         fprintf(stderr, "Takaritas es kilepes...\n");
+        fh_autosave_stop(db);
         db_del(db);
         exit(err_code);
 }
@@ -38,15 +48,20 @@ int errh_call(int (*function)(database *), database *db)
                 case EMALLOC:
                         fprintf(stderr, "\nMemoriakezelesi hiba.\n");
 
-                        /* If this is not a read error, try to save to a file.*/
-                        if (function != fh_import)
-                                fh_export(db);
+                        /*
+                         * If the database is complete, try to save to a file. (The journal has every change anyway,
+                         * but a snapshot is still better than nothing if the journal couldn't be opened.)
+                         */
+                        if (function == intf_main) {
+                                fh_autosave_stop(db);
+                                fh_jrnl_checkpoint(db);
+                        }
 
                         err_cleanup(db, error_code);
                         break;
                 case EINV:
                         /*
-                         * Only fh_import() will return EINV. (as of now)
+                         * Only fh_lz_restore(), fh_import_lazy() and fh_jrnl_replay() will return EINV. (as of now)
                          * Other functions ignore EINV.
                          */
                         fprintf(stderr, "\nA fajl formatuma nem megfelelo.\n");
@@ -59,22 +74,551 @@ int errh_call(int (*function)(database *), database *db)
         return error_code;
 }
 
+/**
+ * @brief Compresses the snapshot's files and reports the compression ratio.
+ */
+void compressed_backup(void)
+{
+        size_t raw = 0;
+        size_t packed = 0;
+
+        if (fh_lz_backup(&raw, &packed)) {
+                fprintf(stderr, "\nNem sikerult a tomoritett mentes.\n");
+                return;
+        }
+
+        printf("Tomoritett mentes: %zu -> %zu bajt (%.1f%%)\n", raw, packed, raw ? 100.0 * packed / raw : 0.0);
+}
+
+/**
+ * @brief Reports the damaged blocks found by the import.
+ */
+void damage_report(void)
+{
+        fprintf(stderr, "\nSerult blokkok a mentesben: %zu, kihagyott ugyfelek: %zu\n", fh_check.damaged, fh_check.lost);
+
+        for (size_t i = 0; i < fh_check.damaged && i < FH_DAMAGE_LOG; i++) {
+                const fh_damage *d = &fh_check.log[i];
+                char path[FILENAME_MAX];
+                fh_shard_path(path, d->shard, fh_config.disk_gen, false);
+
+                if (d->len == 0)
+                        fprintf(stderr, "%s: a fajl csonka, a vegerol %zu ugyfel hianyzik.\n", path, d->clients);
+                else
+                        fprintf(stderr, "%s: %zu. sor, %zu bajt, %zu ugyfel\n", path, d->line, d->len, d->clients);
+        }
+
+        if (fh_check.damaged > FH_DAMAGE_LOG)
+                fprintf(stderr, "... es meg %zu blokk.\n", fh_check.damaged - FH_DAMAGE_LOG);
+
+        fprintf(stderr, "A serult fajlok masolata (.bad) es a naplo (%s.bad) megmaradt.\n", JOURNAL_FILE);
+}
+
+/**
+ * @brief Ingests a CSV file and reports the throughput and the rejected rows.
+ * @param db Pointer to the main database.
+ * @param path The CSV file's path.
+ * @param mapping The column mapping, \c NULL to map the columns by their headers.
+ * @return \c 0 on success, the error code of \c fh_csv_ingest() on failure.
+ */
+int csv_ingest(database *db, const char *path, const char *mapping)
+{
+        fh_csv_stats stats;
+        int retval = fh_csv_ingest(db, path, mapping, &stats);
+
+        if (retval == EFPERM)
+                fprintf(stderr, "A CSV fajl nem olvashato: %s\n", path);
+        else if (retval == EINV)
+                fprintf(stderr, "A CSV fejlec nem felel meg az oszlop-megfeleltetesnek.\n");
+
+        if (retval == EFPERM || retval == EINV)
+                return retval;
+
+        printf("Beolvasott sorok: %zu (%.0f sor/s), elutasitva: %zu\n", stats.rows,
+               stats.secs > 0 ? stats.rows / stats.secs : 0.0, stats.rejected);
+        printf("Uj ugyfelek: %zu, uj autok: %zu, uj javitasok: %zu\n", stats.clients, stats.cars, stats.ops);
+
+        for (size_t i = 0; i < stats.rejected && i < FH_CSV_REJECT_LOG; i++)
+                fprintf(stderr, "Elutasitott sor: %zu\n", stats.reject_lines[i]);
+
+        if (stats.rejected > FH_CSV_REJECT_LOG)
+                fprintf(stderr, "... es meg %zu sor.\n", stats.rejected - FH_CSV_REJECT_LOG);
+
+        return retval;
+}
+
+/**
+ * @brief Runs a command script and reports the throughput and the failed commands.
+ * @param db Pointer to the main database.
+ * @param path The script's path, \c - for the standard input.
+ * @return \c 0 on success, the error code of \c srv_batch() on failure.
+ * @note The report goes to \c stderr , so \c stdout only has the results of the queries.
+ */
+int batch(database *db, const char *path)
+{
+        srv_batch_stats stats;
+        int retval = srv_batch(db, path, &stats);
+
+        if (retval == EFPERM) {
+                fprintf(stderr, "A parancsfajl nem olvashato: %s\n", path);
+                return retval;
+        }
+
+        fprintf(stderr, "Parancsok: %zu (%.0f parancs/s), sikertelen: %zu\n", stats.cmds,
+                stats.secs > 0 ? stats.cmds / stats.secs : 0.0, stats.failed);
+
+        for (size_t i = 0; i < stats.failed && i < SRV_BATCH_ERROR_LOG; i++)
+                fprintf(stderr, "Sikertelen parancs: %zu. sor (hiba: %d)\n", stats.fail_lines[i], stats.fail_codes[i]);
+
+        if (stats.failed > SRV_BATCH_ERROR_LOG)
+                fprintf(stderr, "... es meg %zu parancs.\n", stats.failed - SRV_BATCH_ERROR_LOG);
+
+        return retval;
+}
+
+/**
+ * @brief Adds a synthetic database and reports the number of the generated objects.
+ * @param db Pointer to the main database.
+ * @param cfg The parameters of the generated database, see \c bench_gen.c .
+ * @return \c 0 on success, the error code of \c bench_fill() on failure.
+ */
+int generate(database *db, const bench_cfg *cfg)
+{
+        bench_stats stats;
+        int retval = bench_fill(db, cfg, &stats);
+
+        printf("Generalt ugyfelek: %zu (%.0f ugyfel/s), autok: %zu, javitasok: %zu\n", stats.clients,
+               stats.secs > 0 ? stats.clients / stats.secs : 0.0, stats.cars, stats.ops);
+
+        return retval;
+}
+
+/**
+ * @brief Applies a retention policy and reports what was removed.
+ * @param db Pointer to the main database.
+ * @param policy The retention policy, see \c db_retention .
+ * @return \c 0 on success, the error code of \c db_retention_run() on failure.
+ */
+int retention(database *db, const db_retention *policy)
+{
+        db_purge_stats stats = {0};
+        int retval = db_retention_run(db, policy, &stats);
+
+        printf("Torolt ugyfelek: %zu, autok: %zu, javitasok: %zu, felszabaditott memoria: %.1f KiB\n", stats.clients,
+               stats.cars, stats.ops, stats.bytes / 1024.0);
+
+        if (retval)
+                fprintf(stderr, "A torles nem sikerult teljesen (hiba: %d).\n", retval);
+
+        return retval;
+}
+
+/**
+ * @brief Makes some fields of the clients unique and reports the existing duplicates.
+ * @param db Pointer to the main database.
+ * @param fields The unique fields, see \c db_unique() .
+ * @return \c 0 on success, the error code of \c db_unique() on failure.
+ */
+int unique(database *db, unsigned fields)
+{
+        size_t dups = 0;
+        int retval = db_unique(db, fields, &dups);
+
+        if (dups)
+                fprintf(stderr, "Ismetlodo email cimek vagy telefonszamok: %zu (lista: -D)\n", dups);
+
+        return retval;
+}
+
+/**
+ * @brief Prints a client sharing an email address or a phone number with an earlier one. See \c db_dupes() .
+ * @param arg Pointer to the main database.
+ * @param field The shared field.
+ * @param key The shared key.
+ * @param first The index of the earlier client.
+ * @param dup The index of the client.
+ */
+void dedupe_line(void *arg, db_uniq_field field, const char *key, idx first, idx dup)
+{
+        const database *db = arg;
+        printf("%s %s: [%zu] %s, [%zu] %s\n", field == DB_UNIQ_EMAIL ? "Email" : "Telefon", key, first,
+               db_cl_get(db, first)->name, dup, db_cl_get(db, dup)->name);
+}
+
+/**
+ * @brief Lists the clients sharing an email address or a phone number.
+ * @param db Pointer to the main database.
+ * @return \c 0 on success, the error code of \c db_dupes() on failure.
+ */
+int dedupe(database *db)
+{
+        size_t cnt = 0;
+        int retval = db_dupes(db, dedupe_line, db, &cnt);
+
+        printf("Ismetlodo email cimek es telefonszamok: %zu\n", cnt);
+        return retval;
+}
+
+/**
+ * @brief Runs the menus on a database served by another process.
+ * @param db Pointer to the main database, used as the local mirror.
+ * @param path The server's socket.
+ * @return \c 0 on success, the error code of \c srv_connect() or \c intf_main() on failure.
+ * @note Nothing is saved locally, every change is saved by the server.
+ */
+int thin_client(database *db, const char *path)
+{
+        int retval = srv_connect(db, path);
+        if (retval == EFPERM)
+                fprintf(stderr, "A szerver nem erheto el: %s\n", path);
+        else if (retval)
+                fprintf(stderr, "Nem sikerult letolteni az adatbazist a szerverrol (hiba: %d).\n", retval);
+
+        if (retval)
+                return retval;
+
+        intf_io_refresh = srv_pull;
+        retval = intf_main(db);
+        if (retval == EMALLOC)
+                fprintf(stderr, "\nMemoriakezelesi hiba.\n");
+
+        srv_disconnect(db);
+        return retval;
+}
+
+/**
+ * @brief Parses a positive number from the command line.
+ * @param str The argument to be parsed.
+ * @param max The largest valid number.
+ * @return The number, \c 0 if it's invalid.
+ */
+unsigned num_arg(const char *str, unsigned long max)
+{
+        char *end = NULL;
+        unsigned long num = str ? strtoul(str, &end, 10) : 0;
+
+        if (!str || *end != '\0' || num > max)
+                return 0;
+
+        return (unsigned)num;
+}
+
 /**
  * @brief The (fake) program entry. We all know that the program starts at the label \c _start .
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.\n
+ *             \c -z : write a compressed backup of the snapshot on exit.\n
+ *             \c -d \c dir : use a sharded database directory instead of \c export.txt .\n
+ *             \c -n \c N : the number of shards of a new database directory.\n
+ *             \c -r \c N : reshard the database directory into \c N shards and exit.\n
+ *             \c -c \c file : ingest a CSV file and exit.\n
+ *             \c -m \c mapping : the column mapping of the CSV file, see \c fh_csv.c .\n
+ *             \c -a \c sec : autosave in the background at most every \c sec seconds, if the database has changed.\n
+ *             \c -t \c N : autosave in the background after every \c N changes.\n
+ *             \c -b \c file : run a command script (\c - for \c stdin ) instead of the menus, see \c srv_batch.c .\n
+ *             \c -l \c socket : serve the database to other terminals on a Unix socket instead of the menus.\n
+ *             \c -s \c socket : run the menus on a database served by another process (see \c -l ).\n
+ *             \c -w \c N : the number of threads of the parallel jobs, see \c pool.c .\n
+ *             \c -v : print the statistics of the parallel jobs, the latencies and the memory of the database on exit,
+ *             see \c probe.c and \c probe_mem.c . \c SIGUSR1 prints the latter two while the program runs.\n
+ *             \c -T \c file : record the timeline of the startup, the saves and the queries, and write it to \c file
+ *             on exit in the Chrome trace-event format, see \c probe_trace.c .\n
+ *             \c -g \c spec : add a synthetic database of the given shape and exit, see \c bench_gen.c .\n
+ *             \c -R \c policy : remove the old operations and the idle clients and exit, e.g. \c ops=5,idle=3 (in
+ *             years), see \c purge.c .\n
+ *             \c -u \c fields : reject the clients whose email address or phone number is held by another client, e.g.
+ *             \c email,phone , see \c uniq.c .\n
+ *             \c -D : list the clients sharing an email address or a phone number and exit.\n
+ *             \c -p \c scales : run the benchmarks in an empty database directory and exit, see \c bench.c .\n
+ *             \c -X \c suites : run the self-tests in an empty database directory and exit, e.g. \c all , see
+ *             \c test.c .
  */
-int main(void)
+int main(int argc, char **argv)
 {
-        setbuf(stdout, NULL);
+        bool compress = false;
+        const char *dir = NULL;
+        unsigned shards = 1;
+        unsigned reshard = 0;
+        const char *csv = NULL;
+        const char *mapping = NULL;
+        unsigned interval = 0;
+        unsigned threshold = 0;
+        unsigned threads = 0;
+        const char *serve = NULL;
+        const char *script = NULL;
+        const char *remote = NULL;
+        const char *spec = NULL;
+        const char *scales = NULL;
+        const char *suites = NULL;
+        const char *trace = NULL;
+        const char *policy_spec = NULL;
+        const char *unique_spec = NULL;
+        bool dupes = false;
+        bool report = false;
+
+        for (int i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "-z")) {
+                        compress = true;
+                }
+                else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+                        dir = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+                        csv = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+                        mapping = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+                        script = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+                        serve = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+                        remote = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+                        spec = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-R") && i + 1 < argc) {
+                        policy_spec = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+                        unique_spec = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-D")) {
+                        dupes = true;
+                }
+                else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+                        scales = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-X") && i + 1 < argc) {
+                        suites = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+                        trace = argv[++i];
+                }
+                else if (!strcmp(argv[i], "-v")) {
+                        report = true;
+                }
+                else if (!strcmp(argv[i], "-n") && (shards = num_arg(argv[i + 1], FH_MAX_SHARDS)) != 0) {
+                        i++;
+                }
+                else if (!strcmp(argv[i], "-r") && (reshard = num_arg(argv[i + 1], FH_MAX_SHARDS)) != 0) {
+                        i++;
+                }
+                else if (!strcmp(argv[i], "-a") && (interval = num_arg(argv[i + 1], 86400)) != 0) {
+                        i++;
+                }
+                else if (!strcmp(argv[i], "-t") && (threshold = num_arg(argv[i + 1], 1000000)) != 0) {
+                        i++;
+                }
+                else if (!strcmp(argv[i], "-w") && (threads = num_arg(argv[i + 1], POOL_MAX_THREADS)) != 0) {
+                        i++;
+                }
+                else {
+                        fprintf(stderr, "Ismeretlen vagy hibas kapcsolo: %s\n", argv[i]);
+                        return EINV;
+                }
+        }
+
+        if (reshard && !dir) {
+                fprintf(stderr, "Az ujraosztashoz adatbazis mappa kell (-d).\n");
+                return EINV;
+        }
+
+        if (remote && (serve || dir || reshard || csv || script || spec || policy_spec || unique_spec || dupes)) {
+                fprintf(stderr, "A -s kapcsolo nem hasznalhato a -l, -d, -r, -c, -b, -g, -R, -u es -D kapcsolokkal.\n");
+                return EINV;
+        }
+
+        db_retention policy;
+        if (policy_spec && db_retention_parse(policy_spec, &policy)) {
+                fprintf(stderr, "Hibas megorzesi szabaly: %s\n", policy_spec);
+                return EINV;
+        }
+
+        unsigned fields = 0;
+        if (unique_spec && db_unique_parse(unique_spec, &fields)) {
+                fprintf(stderr, "Hibas egyedi mezok: %s\n", unique_spec);
+                return EINV;
+        }
+
+        bench_cfg cfg;
+        bench_defaults(&cfg);
+        if (spec && bench_parse(spec, &cfg)) {
+                fprintf(stderr, "Hibas generator parameterek: %s\n", spec);
+                return EINV;
+        }
+
+        if (scales && (!dir || remote || serve || reshard || csv || script || policy_spec || unique_spec || dupes)) {
+                fprintf(stderr, "A meresekhez ures adatbazis mappa kell (-d), a -p kapcsolo nem hasznalhato a -l, -s, "
+                                "-r, -c, -b, -R, -u es -D kapcsolokkal.\n");
+                return EINV;
+        }
+
+        if (suites && (!dir || scales || remote || serve || reshard || csv || script || spec || policy_spec ||
+                       unique_spec || dupes)) {
+                fprintf(stderr, "A tesztekhez ures adatbazis mappa kell (-d), a -X kapcsolo nem hasznalhato a -p, -l, "
+                                "-s, -r, -c, -b, -g, -R, -u es -D kapcsolokkal.\n");
+                return EINV;
+        }
+
+        if (fh_setup(dir, shards)) {
+                fprintf(stderr, "Nem hasznalhato adatbazis mappa vagy shard szam.\n");
+                return EINV;
+        }
+
+        if (trace && !probe_trace_start(trace)) {
+                fprintf(stderr, "Nem sikerult megnyitni az idovonal fajlt, vagy az idomeres ki van kapcsolva: %s\n",
+                        trace);
+                return EINV;
+        }
+
+        pool_setup(threads);
+        probe_signals();
+        if (scales) {
+                int retval = bench_run(scales, &cfg, stdout);
+                if (retval == EINV)
+                        fprintf(stderr, "Hibas meretek: %s\n", scales);
+                else if (retval == ECONFL)
+                        fprintf(stderr, "A mappa mar tartalmaz adatbazist: %s\n", dir);
+                else if (retval)
+                        fprintf(stderr, "A meres nem sikerult (hiba: %d).\n", retval);
+
+                if (report) {
+                        pool_report(stderr);
+                        probe_report(stderr);
+                        probe_mem_report(stderr);
+                }
+
+                pool_stop();
+                return retval;
+        }
+
+        if (suites) {
+                size_t failed = 0;
+                int retval = test_run(suites, stdout, &failed);
+                if (retval == EINV)
+                        fprintf(stderr, "Ismeretlen teszt: %s\n", suites);
+                else if (retval == ECONFL)
+                        fprintf(stderr, "A mappa mar tartalmaz adatbazist: %s\n", dir);
+                else if (failed)
+                        retval = EINV;
+
+                pool_stop();
+                return retval;
+        }
+
         database *db = db_init("(nincs nev)", "(nincs leiras)\n");
         if (!db) {
                 fprintf(stderr, "\nNem lehet letrehozni az adatbazist.\n");
                 return EMALLOC;
         }
 
-        errh_call(fh_import, db);
-        errh_call(intf_main, db);
-        errh_call(fh_export, db);
+        if (remote) {
+                int retval = thin_client(db, remote);
+                if (report) {
+                        pool_report(stderr);
+                        probe_report(stderr);
+                        probe_mem_report(stderr);
+                }
+
+                pool_stop();
+                db_del(db);
+                return retval;
+        }
+
+        TRACE_BEGIN(span_startup, "startup");
+        errh_call(fh_lz_restore, db);
+        errh_call(fh_import_lazy, db);
+        if (fh_check.damaged)
+                damage_report();
+
+        errh_call(fh_jrnl_replay, db);
+
+        /* The duplicates are only listed, so neither the journal nor the snapshot is touched. */
+        if (!dupes)
+                errh_call(fh_jrnl_open, db);
+
+        /* The snapshot and the journal hold what was accepted, so the indexes only check the changes from now on. */
+        if (fields && unique(db, fields))
+                err_cleanup(db, EMALLOC);
+        TRACE_END(span_startup);
+
+        if (reshard) {
+                /* The clean blocks are copied into their new shards, nothing has to be parsed. */
+                fh_config.shards = reshard;
+        }
+        else if (csv) {
+                int retval = csv_ingest(db, csv, mapping);
+                if (retval)
+                        err_cleanup(db, retval);
+        }
+        else if (script) {
+                int retval = batch(db, script);
+                if (retval)
+                        err_cleanup(db, retval);
+        }
+        else if (spec) {
+                int retval = generate(db, &cfg);
+                if (retval)
+                        err_cleanup(db, retval);
+        }
+        else if (policy_spec) {
+                int retval = retention(db, &policy);
+                if (retval)
+                        err_cleanup(db, retval);
+        }
+        else if (dupes) {
+                int retval = dedupe(db);
+                if (retval)
+                        err_cleanup(db, retval);
+
+                /* No checkpoint: the snapshot isn't rewritten and the journal isn't truncated. */
+                if (report) {
+                        pool_report(stderr);
+                        probe_report(stderr);
+                        probe_mem_report(stderr);
+                }
+
+                pool_stop();
+                db_del(db);
+                return 0;
+        }
+        else {
+                /* The server answers the connections' queries in parallel with the changes. */
+                if (serve)
+                        db_concurrent(db);
+
+                if (interval || threshold)
+                        fh_autosave_start(db, interval, threshold);
+
+                if (!serve) {
+                        errh_call(intf_main, db);
+                }
+                else if (srv_run(db, serve) == EFPERM) {
+                        fprintf(stderr, "Nem sikerult megnyitni a socketet: %s\n", serve);
+                }
+
+                if (fh_autosave_stop(db))
+                        fprintf(stderr, "\nA hatterben mentes nem sikerult, a naplo megmaradt.\n");
+        }
+
+        if (errh_call(fh_jrnl_checkpoint, db) == EFPERM)
+                fprintf(stderr, "\nNem sikerult menteni, a naplo megmaradt.\n");
+
+        if (compress)
+                compressed_backup();
+
+        if (report) {
+                pool_report(stderr);
+                probe_report(stderr);
+                probe_mem_report(stderr);
+        }
 
+        pool_stop();
         db_del(db);
         return 0;
 }
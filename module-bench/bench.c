@@ -0,0 +1,325 @@
+/**
+ * @file bench.c
+ * @brief The end-to-end benchmarks.
+ * @details A benchmark runs at several scales (numbers of clients). At every scale a synthetic database is generated
+ *          (see \c bench_gen.c ), then the following are timed:\n
+ *          \c export : \c fh_export() of the whole database.\n
+ *          \c backup : \c fh_lz_backup() of the exported snapshot. Like the export, it syncs every file it writes.\n
+ *          \c import : \c fh_import() of the exported snapshot into an empty database. Its throughput is reported in
+ *          records (clients, cars and operations) per second, every operation's price and dates are parsed strictly.\n
+ *          \c search_cl , \c search_plate , \c search_expiration : the searches on the imported database, with a name
+ *          and a plate of a client in the middle. Every search runs \c BENCH_REPEAT times, the median is reported.\n
+ *          \c mixed : random client, car and operation additions, modifications and removals.\n
+ *          The results are printed as a single JSON object, so the runs can be compared by scripts.
+ * @note The snapshots are written to the database directory, which must not hold a database. The files are removed
+ *       at the end.
+ */
+
+#include "../include/platform.h"
+
+#include "include/bench.h"
+
+/**
+ * @brief Returns the current time.
+ * @return The seconds since an arbitrary point of time, for measuring durations.
+ */
+double bench_clock(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Orders two durations, for \c qsort() .
+ */
+int bench_cmp(const void *a, const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/**
+ * @brief Times a search.
+ * @param db The database to search in.
+ * @param search The search: \c 0 by name, \c 1 by plate, \c 2 the expiring inspections.
+ * @param term The term of the name and the plate search.
+ * @param matches Pointer to the destination of the number of matches.
+ * @return The median duration in milliseconds, negative if a search has failed.
+ */
+double bench_search(database *db, int search, const char *term, size_t *matches)
+{
+        double ms[BENCH_REPEAT];
+
+        for (int r = 0; r < BENCH_REPEAT; r++) {
+                double start = bench_clock();
+                sres res = search == 0 ? search_cl(db, term) : search == 1 ? search_plate(db, term)
+                                                                            : search_expiration(db);
+                ms[r] = (bench_clock() - start) * 1000;
+
+                *matches = res.map ? res.map->size : 0;
+                search_res_del(res.map, search + 1);
+                if (res.err)
+                        return -1;
+        }
+
+        qsort(ms, BENCH_REPEAT, sizeof(double), bench_cmp);
+        return ms[BENCH_REPEAT / 2];
+}
+
+/**
+ * @brief Makes a random change of the mixed workload.
+ * @param db The database to be changed.
+ * @param state Pointer to the generator's state.
+ * @param cfg The parameters of the generated objects.
+ * @param n The serial number of the new client, if the change adds or modifies one.
+ * @return The error code of the change, e.g. \c EOOB if a removal picked a car without operations.
+ */
+int bench_change(database *db, uint64_t *state, const bench_cfg *cfg, size_t n)
+{
+        idx cnt = db_cl_cnt(db);
+        idx cl = cnt ? bench_rand(state) % cnt : 0;
+        idx cars = cnt ? db_car_cnt(db, cl) : 0;
+        idx cr = cars ? bench_rand(state) % cars : 0;
+        unsigned kind = bench_rand(state) % 100;
+
+        char name[NAME_SIZE + 1];
+        char email[EMAIL_SIZE + 1];
+        char phone[PHNUM_SIZE + 1];
+        char plate[PLATE_SIZE + 1];
+        char desc[DESC_SIZE + 1];
+
+        /* The clients: 20% additions, 10% modifications, 5% removals. */
+        if (kind < 35) {
+                bench_client(state, cfg, n, name, email, phone);
+                if (kind < 20)
+                        return db_cl_add(db, name, email, phone);
+
+                return kind < 30 ? db_cl_mod(db, cl, name, email, phone) : db_cl_rm(db, cl);
+        }
+
+        /* The cars: 20% additions, 10% modifications, 5% removals. */
+        if (kind < 70) {
+                bench_plate(state, plate);
+                if (kind < 55)
+                        return db_car_add(db, cl, bench_model(state), plate);
+
+                return kind < 65 ? db_car_mod(db, cl, cr, bench_model(state), plate) : db_car_rm(db, cl, cr);
+        }
+
+        /* The operations: 20% additions, 10% removals. */
+        const car *car = db_car_get(db, cl, cr);
+        if (!car)
+                return EOOB;
+
+        if (kind < 90) {
+                bench_desc(state, cfg, desc);
+                return db_op_add(db, cl, cr, desc, (double)(5000 + bench_rand(state) % 495000), NULL);
+        }
+
+        return car->operations->size ? db_op_rm(db, cl, cr, bench_rand(state) % car->operations->size) : EOOB;
+}
+
+/**
+ * @brief Counts the bytes of the snapshot on the disk.
+ * @return The size of the snapshot's files.
+ */
+long bench_disk_size(void)
+{
+        long total = 0;
+        for (unsigned s = 0; s < fh_config.disk_shards; s++) {
+                char path[FILENAME_MAX];
+                fh_shard_path(path, s, fh_config.disk_gen, false);
+
+                FILE *f = fopen(path, "rb");
+                if (!f)
+                        continue;
+
+                if (fseek(f, 0, SEEK_END) == 0)
+                        total += ftell(f);
+
+                fclose(f);
+        }
+
+        return total;
+}
+
+/**
+ * @brief Runs the benchmarks at a scale, and prints its results.
+ * @param clients The number of clients.
+ * @param cfg The parameters of the generated database.
+ * @param out The destination of the results.
+ * @param first Set to \c true for the first scale, the others are preceded by a comma.
+ * @retval 0 On success.
+ * @retval EMALLOC If a database cannot be allocated.
+ * @retval EFPERM If the snapshot cannot be written or read.
+ * @retval EINV If a search fails.
+ */
+int bench_scale(size_t clients, const bench_cfg *cfg, FILE *out, bool first)
+{
+        bench_cfg scaled = *cfg;
+        scaled.clients = clients;
+
+        database *gen = db_init("bench", "bench");
+        database *db = db_init("bench", "bench");
+        if (!gen || !db) {
+                if (gen)
+                        db_del(gen);
+                if (db)
+                        db_del(db);
+                return EMALLOC;
+        }
+
+        bench_stats stats;
+        int retval = bench_fill(gen, &scaled, &stats);
+
+        /* A new generation, so the previous scale's files are replaced. */
+        double export_ms = 0;
+        if (!retval) {
+                gen->gen = fh_config.disk_gen + 1;
+                double start = bench_clock();
+                retval = fh_export(gen);
+                export_ms = (bench_clock() - start) * 1000;
+        }
+
+        double backup_ms = 0;
+        if (!retval) {
+                size_t raw = 0;
+                size_t packed = 0;
+                double start = bench_clock();
+                retval = fh_lz_backup(&raw, &packed);
+                backup_ms = (bench_clock() - start) * 1000;
+        }
+
+        double import_ms = 0;
+        if (!retval) {
+                double start = bench_clock();
+                retval = fh_import(db);
+                import_ms = (bench_clock() - start) * 1000;
+        }
+
+        /* The terms are taken from a client in the middle, who has a car if possible. */
+        char name[NAME_SIZE + 1] = "";
+        char plate[PLATE_SIZE + 1] = "";
+        idx cnt = db_cl_cnt(db);
+        for (idx i = cnt / 2; i < cnt && !plate[0]; i++) {
+                if (!name[0])
+                        strcpy(name, db_cl_get(db, i)->name);
+                if (db_car_cnt(db, i))
+                        strcpy(plate, db_car_get(db, i, 0)->plate);
+        }
+
+        db_del(gen);
+
+        size_t found[3] = {0};
+        double search_ms[3] = {0};
+        for (int s = 0; s < 3 && !retval; s++) {
+                search_ms[s] = bench_search(db, s, s == 0 ? name : plate, &found[s]);
+                if (search_ms[s] < 0)
+                        retval = EINV;
+        }
+
+        uint64_t state = cfg->seed * 0x9E3779B97F4A7C15ull + clients;
+        size_t failed = 0;
+        double mixed_ms = 0;
+        if (!retval) {
+                double start = bench_clock();
+                for (size_t i = 0; i < cfg->mixed && retval != EMALLOC; i++) {
+                        retval = bench_change(db, &state, cfg, clients + i);
+                        failed += retval != 0;
+                }
+                mixed_ms = (bench_clock() - start) * 1000;
+
+                if (retval != EMALLOC)
+                        retval = 0;
+        }
+
+        if (!retval) {
+                fprintf(out, "%s    {\"clients\": %zu, \"cars\": %zu, \"operations\": %zu, \"bytes\": %ld,\n",
+                        first ? "" : ",\n", stats.clients, stats.cars, stats.ops, bench_disk_size());
+                fprintf(out, "     \"generate_ms\": %.3f, \"export_ms\": %.3f, \"backup_ms\": %.3f, "
+                             "\"import_ms\": %.3f, \"import_rows_per_sec\": %.0f,\n", stats.secs * 1000, export_ms,
+                        backup_ms, import_ms,
+                        import_ms > 0 ? (stats.clients + stats.cars + stats.ops) / (import_ms / 1000) : 0.0);
+                fprintf(out, "     \"search_cl_ms\": %.3f, \"search_cl_matches\": %zu,\n", search_ms[0], found[0]);
+                fprintf(out, "     \"search_plate_ms\": %.3f, \"search_plate_matches\": %zu,\n", search_ms[1], found[1]);
+                fprintf(out, "     \"search_expiration_ms\": %.3f, \"search_expiration_matches\": %zu,\n", search_ms[2],
+                        found[2]);
+                fprintf(out, "     \"mixed_changes\": %zu, \"mixed_failed\": %zu, \"mixed_ms\": %.3f, "
+                             "\"mixed_per_sec\": %.0f}", cfg->mixed, failed, mixed_ms,
+                        mixed_ms > 0 ? cfg->mixed / (mixed_ms / 1000) : 0.0);
+        }
+
+        db_del(db);
+        return retval;
+}
+
+/**
+ * @brief Runs the benchmarks and prints the results as JSON.
+ * @param scales The numbers of clients, separated by commas, e.g. \c 1000,10000,100000 .
+ * @param cfg The parameters of the generated databases, except for the number of clients.
+ * @param out The destination of the results.
+ * @retval 0 On success.
+ * @retval EINV If \c scales is malformed.
+ * @retval ECONFL If the database directory already holds a database.
+ * @retval EMALLOC If a database cannot be allocated.
+ * @retval EFPERM If a snapshot cannot be written or read.
+ * @note Progress is reported on \c stderr .
+ */
+int bench_run(const char *scales, const bench_cfg *cfg, FILE *out)
+{
+        size_t sizes[BENCH_MAX_SCALES];
+        size_t cnt = 0;
+
+        for (const char *pos = scales; *pos; cnt++) {
+                char *end = NULL;
+                unsigned long long n = strtoull(pos, &end, 10);
+                if (cnt == BENCH_MAX_SCALES || end == pos || n == 0 || n > 100000000 || (*end && *end != ','))
+                        return EINV;
+
+                sizes[cnt] = (size_t)n;
+                pos = *end ? end + 1 : end;
+        }
+
+        if (cnt == 0)
+                return EINV;
+
+        char path[FILENAME_MAX];
+        fh_path(path, MANIFEST_FILE);
+        FILE *manifest = fopen(path, "r");
+        if (manifest) {
+                fclose(manifest);
+                return ECONFL;
+        }
+
+        fprintf(out, "{\"shards\": %u, \"seed\": %llu, \"cars\": [%u, %u], \"ops\": [%u, %u], \"name\": [%u, %u], "
+                     "\"desc\": [%u, %u], \"exp\": %u, \"spread\": %u, \"age\": %u,\n \"runs\": [\n",
+                fh_config.shards, (unsigned long long)cfg->seed, cfg->cars.min, cfg->cars.max, cfg->ops.min,
+                cfg->ops.max, cfg->name.min, cfg->name.max, cfg->desc.min, cfg->desc.max, cfg->exp, cfg->spread,
+                cfg->age);
+
+        int retval = 0;
+        for (size_t i = 0; i < cnt && !retval; i++) {
+                fprintf(stderr, "Meres: %zu ugyfel...\n", sizes[i]);
+                retval = bench_scale(sizes[i], cfg, out, i == 0);
+        }
+
+        fprintf(out, "\n ],\n \"error\": %d}\n", retval);
+        fflush(out);
+
+        /* The scratch snapshot is removed. */
+        for (unsigned s = 0; s < fh_config.disk_shards; s++) {
+                fh_shard_path(path, s, fh_config.disk_gen, false);
+                remove(path);
+                fh_shard_path(path, s, fh_config.disk_gen, true);
+                remove(path);
+        }
+
+        fh_path(path, MANIFEST_FILE);
+        remove(path);
+        fh_path(path, BACKUP_FILE);
+        remove(path);
+        fh_config.disk_shards = 0;
+        return retval;
+}
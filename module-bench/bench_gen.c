@@ -0,0 +1,366 @@
+/**
+ * @file bench_gen.c
+ * @brief Generates synthetic databases.
+ * @details The shape of the database is given as a list of \c key=value pairs, separated by commas, e.g.
+ *          \c clients=100000,cars=1-3,ops=0-5,exp=40 . A value is a number or an inclusive range (\c min-max ), the
+ *          generated values are uniformly distributed in it. The keys:\n
+ *          \c clients : the number of clients.\n
+ *          \c cars : the number of cars of a client.\n
+ *          \c ops : the number of operations (repairs, inspections) of a car.\n
+ *          \c name : the length of a client's name.\n
+ *          \c desc : the length of an operation's description.\n
+ *          \c exp : the percentage of the operations with an expiration date.\n
+ *          \c spread : the expiration dates are at most this many days before or after today.\n
+ *          \c age : the operations were created at most this many days ago.\n
+ *          \c mixed : the number of changes of the mixed workload, see \c bench.c .\n
+ *          \c seed : the seed of the generator. The same seed and parameters generate the same clients, cars and
+ *          operations (the dates are relative to the current day).
+ * @note The e-mail addresses and phone numbers are unique within a generated database.
+ */
+
+#include "../include/platform.h"
+
+#include <ctype.h>
+
+#include "include/bench.h"
+
+/** Family names for the clients. */
+static const char *bench_family[] = {
+        "Nagy", "Kovacs", "Toth", "Szabo", "Horvath", "Varga", "Kiss", "Molnar", "Nemeth", "Farkas",
+        "Balogh", "Papp", "Takacs", "Juhasz", "Lakatos", "Meszaros", "Olah", "Simon", "Racz", "Fekete"
+};
+
+/** Given names for the clients. */
+static const char *bench_given[] = {
+        "Laszlo", "Istvan", "Jozsef", "Janos", "Zoltan", "Sandor", "Gabor", "Ferenc", "Attila", "Peter",
+        "Maria", "Erzsebet", "Katalin", "Eva", "Ilona", "Anna", "Zsuzsanna", "Judit", "Agnes", "Andrea"
+};
+
+/** Mail domains for the clients. */
+static const char *bench_domains[] = {"gmail.com", "freemail.hu", "citromail.hu", "outlook.com", "t-online.hu"};
+
+/** Car models. */
+static const char *bench_models[] = {
+        "Opel Astra", "Suzuki Swift", "Skoda Octavia", "Volkswagen Golf", "Toyota Corolla",
+        "Ford Focus", "Renault Clio", "BMW 320d", "Dacia Logan", "Kia Ceed"
+};
+
+/** Words of the operations' descriptions. */
+static const char *bench_works[] = {
+        "olajcsere", "fekbetet csere", "muszaki vizsga", "gumicsere", "vezerles csere", "futomu beallitas",
+        "klima toltes", "akkumulator csere", "hibakod olvasas", "kipufogo javitas", "szurok cserei", "fenyszoro csere"
+};
+
+#define BENCH_CNT(arr) (sizeof(arr) / sizeof((arr)[0])) /**< The number of items of a static array. */
+
+/**
+ * @brief Sets the default parameters: ten thousand clients with a few cars and repairs each.
+ * @param cfg Pointer to the destination.
+ */
+void bench_defaults(bench_cfg *cfg)
+{
+        *cfg = (bench_cfg){
+                .clients = 10000,
+                .cars = {1, 3},
+                .ops = {0, 4},
+                .name = {8, 30},
+                .desc = {8, 40},
+                .exp = 30,
+                .spread = 365,
+                .age = 1095,
+                .mixed = 10000,
+                .seed = 1
+        };
+}
+
+/**
+ * @brief Parses a number or a range of a parameter.
+ * @param str The value, \c min-max or a single number.
+ * @param len The length of the value.
+ * @param dst Pointer to the destination.
+ * @return \c 0 on success, \c EINV if the value is malformed.
+ */
+int bench_range_parse(const char *str, size_t len, bench_range *dst)
+{
+        char buf[DEFAULT_BUF_SIZE];
+        if (len == 0 || len >= sizeof(buf))
+                return EINV;
+
+        memcpy(buf, str, len);
+        buf[len] = '\0';
+
+        char *end = NULL;
+        unsigned long min = strtoul(buf, &end, 10);
+        unsigned long max = min;
+        if (*end == '-')
+                max = strtoul(end + 1, &end, 10);
+
+        if (!isdigit((unsigned char)buf[0]) || *end != '\0' || min > max || max > 100000000)
+                return EINV;
+
+        *dst = (bench_range){(unsigned)min, (unsigned)max};
+        return 0;
+}
+
+/**
+ * @brief Parses the parameters of a synthetic database, see the file's description.
+ * @param spec The parameters. The missing ones keep their values in \c cfg .
+ * @param cfg Pointer to the destination, filled with \c bench_defaults() first.
+ * @return \c 0 on success, \c EINV if a parameter is unknown, malformed or out of range.
+ */
+int bench_parse(const char *spec, bench_cfg *cfg)
+{
+        while (spec && *spec) {
+                const char *eq = strchr(spec, '=');
+                const char *end = strchr(spec, ',');
+                if (!end)
+                        end = spec + strlen(spec);
+                if (!eq || eq > end)
+                        return EINV;
+
+                size_t key = (size_t)(eq - spec);
+                bench_range val;
+                if (bench_range_parse(eq + 1, (size_t)(end - eq - 1), &val))
+                        return EINV;
+
+                /* Only the ranged parameters may have a range. */
+                bool single = val.min == val.max;
+                if (key == 7 && !strncmp(spec, "clients", key) && single)
+                        cfg->clients = val.min;
+                else if (key == 4 && !strncmp(spec, "cars", key))
+                        cfg->cars = val;
+                else if (key == 3 && !strncmp(spec, "ops", key))
+                        cfg->ops = val;
+                else if (key == 4 && !strncmp(spec, "name", key) && val.min > 0 && val.max <= NAME_SIZE)
+                        cfg->name = val;
+                else if (key == 4 && !strncmp(spec, "desc", key) && val.min > 0 && val.max <= DESC_SIZE)
+                        cfg->desc = val;
+                else if (key == 3 && !strncmp(spec, "exp", key) && single && val.min <= 100)
+                        cfg->exp = val.min;
+                else if (key == 6 && !strncmp(spec, "spread", key) && single && val.min <= 36500)
+                        cfg->spread = val.min;
+                else if (key == 3 && !strncmp(spec, "age", key) && single && val.min <= 36500)
+                        cfg->age = val.min;
+                else if (key == 5 && !strncmp(spec, "mixed", key) && single)
+                        cfg->mixed = val.min;
+                else if (key == 4 && !strncmp(spec, "seed", key) && single)
+                        cfg->seed = val.min;
+                else
+                        return EINV;
+
+                spec = *end ? end + 1 : end;
+        }
+
+        return 0;
+}
+
+/**
+ * @brief The generator's next random number (xorshift64*), independent of \c rand() .
+ * @param state Pointer to the generator's state, must not be zero.
+ * @return The number.
+ */
+uint64_t bench_rand(uint64_t *state)
+{
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        return *state * 2685821657736338717ull;
+}
+
+/**
+ * @brief Picks a number of a range.
+ * @param state Pointer to the generator's state.
+ * @param r The range.
+ * @return The number.
+ */
+unsigned bench_pick(uint64_t *state, bench_range r)
+{
+        return r.min + (unsigned)(bench_rand(state) % ((uint64_t)r.max - r.min + 1));
+}
+
+/**
+ * @brief Appends words picked from a list to a text, separated by \c sep , up to a given length.
+ * @details Only whole words are appended, except if not even one fits, so the text may be a bit shorter than \c len .
+ * @param state Pointer to the generator's state.
+ * @param dst The text, at least \c len + 1 long.
+ * @param pos The length of the text already in \c dst .
+ * @param len The length of the text.
+ * @param words The list of the words.
+ * @param cnt The number of words.
+ * @param sep The separator of the words.
+ */
+void bench_words(uint64_t *state, char *dst, size_t pos, size_t len, const char **words, size_t cnt, const char *sep)
+{
+        bool first = pos == 0;
+        while (pos < len) {
+                const char *word = words[bench_rand(state) % cnt];
+                size_t n = strlen(word);
+                size_t gap = first ? 0 : strlen(sep);
+
+                if (gap + n > len - pos) {
+                        if (!first)
+                                break;
+
+                        n = len - pos;
+                }
+
+                memcpy(dst + pos, sep, gap);
+                memcpy(dst + pos + gap, word, n);
+                pos += gap + n;
+                first = false;
+        }
+
+        dst[pos] = '\0';
+}
+
+/**
+ * @brief Prints a date a number of days (and a random time of day) away from now.
+ * @param state Pointer to the generator's state.
+ * @param days The number of days, negative for the past.
+ * @param dst The destination, at least 17 long.
+ */
+void bench_date(uint64_t *state, long days, char *dst)
+{
+        time_t t = time(NULL) + days * 24 * 60 * 60;
+        struct tm *tm = localtime(&t);
+
+        date d = {tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, (int)(8 + bench_rand(state) % 10),
+                  (int)(bench_rand(state) % 60)};
+        date_printf(&d, dst);
+}
+
+/**
+ * @brief Generates a client.
+ * @param state Pointer to the generator's state.
+ * @param cfg The parameters.
+ * @param n The client's serial number, which makes its e-mail address and phone number unique.
+ * @param name The destination of the name.
+ * @param email The destination of the e-mail address.
+ * @param phone The destination of the phone number.
+ */
+void bench_client(uint64_t *state, const bench_cfg *cfg, size_t n, char *name, char *email, char *phone)
+{
+        const char *family = bench_family[bench_rand(state) % BENCH_CNT(bench_family)];
+        size_t len = bench_pick(state, cfg->name);
+
+        /* The family name is followed by given names, up to the picked length. */
+        size_t pos = strlen(family) < len ? strlen(family) : len;
+        memcpy(name, family, pos);
+        bench_words(state, name, pos, len, bench_given, BENCH_CNT(bench_given), " ");
+
+        /* The address is the name in lower case, cut to fit the number and the domain. */
+        char local[17];
+        pos = 0;
+        for (size_t i = 0; name[i] && pos < sizeof(local) - 1; i++)
+                local[pos++] = name[i] == ' ' ? '.' : (char)tolower((unsigned char)name[i]);
+
+        local[pos] = '\0';
+        const char *domain = bench_domains[bench_rand(state) % BENCH_CNT(bench_domains)];
+        snprintf(email, EMAIL_SIZE + 1, "%.16s.%zu@%.12s", local, n % 100000000000u, domain);
+        snprintf(phone, PHNUM_SIZE + 1, "+36%02d%07zu", n % 3 == 0 ? 20 : n % 3 == 1 ? 30 : 70, n % 10000000);
+}
+
+/**
+ * @brief Generates a plate number, in the old (\c ABC123 ) or the new (\c ABCD123 ) format.
+ * @param state Pointer to the generator's state.
+ * @param dst The destination, at least 8 long.
+ */
+void bench_plate(uint64_t *state, char *dst)
+{
+        size_t letters = bench_rand(state) % 10 < 3 ? 4 : 3;
+        for (size_t i = 0; i < letters; i++)
+                dst[i] = (char)('A' + bench_rand(state) % 26);
+
+        snprintf(dst + letters, 4, "%03u", (unsigned)(bench_rand(state) % 1000));
+}
+
+/**
+ * @brief Picks a car model.
+ * @param state Pointer to the generator's state.
+ * @return The model's name.
+ */
+const char *bench_model(uint64_t *state)
+{
+        return bench_models[bench_rand(state) % BENCH_CNT(bench_models)];
+}
+
+/**
+ * @brief Generates the description of an operation.
+ * @param state Pointer to the generator's state.
+ * @param cfg The parameters.
+ * @param dst The destination, at least \c DESC_SIZE + 1 long.
+ */
+void bench_desc(uint64_t *state, const bench_cfg *cfg, char *dst)
+{
+        bench_words(state, dst, 0, bench_pick(state, cfg->desc), bench_works, BENCH_CNT(bench_works), ", ");
+}
+
+/**
+ * @brief Adds synthetic clients, cars and operations to a database.
+ * @details The objects are not journaled one by one, the caller should make a checkpoint afterwards (like
+ *          \c fh_csv_ingest() ).
+ * @param db Pointer to the database.
+ * @param cfg The parameters, see the file's description.
+ * @param stats Pointer to the destination of the number of the new objects.
+ * @retval 0 On success.
+ * @retval EMALLOC If the database expansion fails. The objects generated until then are kept.
+ */
+int bench_fill(database *db, const bench_cfg *cfg, bench_stats *stats)
+{
+        *stats = (bench_stats){0};
+        uint64_t state = cfg->seed * 0x9E3779B97F4A7C15ull + 1;
+        double start = bench_clock();
+
+        FILE *journal = db->journal;
+        db->journal = NULL;
+
+        int retval = 0;
+        size_t first = db_cl_cnt(db);
+        for (size_t n = 0; n < cfg->clients && !retval; n++) {
+                char name[NAME_SIZE + 1];
+                char email[EMAIL_SIZE + 1];
+                char phone[PHNUM_SIZE + 1];
+                bench_client(&state, cfg, first + n, name, email, phone);
+
+                retval = db_cl_add(db, name, email, phone);
+                if (retval)
+                        break;
+
+                idx cl = db_cl_cnt(db) - 1;
+                stats->clients++;
+
+                unsigned cars = bench_pick(&state, cfg->cars);
+                for (idx cr = 0; cr < cars && !retval; cr++) {
+                        char plate[PLATE_SIZE + 1];
+                        bench_plate(&state, plate);
+
+                        retval = db_car_add(db, cl, bench_model(&state), plate);
+                        if (retval)
+                                break;
+
+                        stats->cars++;
+
+                        unsigned ops = bench_pick(&state, cfg->ops);
+                        for (unsigned op = 0; op < ops && !retval; op++) {
+                                char desc[DESC_SIZE + 1];
+                                char date_cr[17];
+                                char date_exp[17] = "0";
+                                bench_desc(&state, cfg, desc);
+                                bench_date(&state, -(long)(bench_rand(&state) % (cfg->age + 1)), date_cr);
+
+                                if (bench_rand(&state) % 100 < cfg->exp)
+                                        bench_date(&state, (long)(bench_rand(&state) % (2 * cfg->spread + 1)) -
+                                                           (long)cfg->spread, date_exp);
+
+                                double price = (double)(5000 + bench_rand(&state) % 495000);
+                                retval = fh_db_op_add(db, cl, cr, desc, price, date_cr, date_exp);
+                                if (!retval)
+                                        stats->ops++;
+                        }
+                }
+        }
+
+        db->journal = journal;
+        stats->secs = bench_clock() - start;
+        return retval == EREALLOC ? EMALLOC : retval;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file bench.h
+ * @brief Module header file. Include this to generate synthetic databases and to run the benchmarks.
+ * @details See \c bench_gen.c for the generator and \c bench.c for the benchmarks.
+ */
+
+#ifndef REPAIRSHOP_BENCH_H
+#define REPAIRSHOP_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../module-database/include/database.h"
+#include "../../module-filehandler/include/fh.h"
+#include "../../include/errorcodes.h"
+#include "../../include/search.h"
+
+/** The number of runs of a search in a benchmark, the median is reported. */
+#define BENCH_REPEAT 5
+/** The largest number of scales of a benchmark. */
+#define BENCH_MAX_SCALES 16
+
+/**
+ * @struct bench_range bench.h
+ * @brief An inclusive range of numbers, the generated values are uniformly distributed in it.
+ */
+typedef struct bench_range {
+        unsigned min;   /**< The smallest value. */
+        unsigned max;   /**< The largest value. */
+} bench_range;
+
+/**
+ * @struct bench_cfg bench.h
+ * @brief The parameters of a synthetic database. See \c bench_parse() for the format.
+ */
+typedef struct bench_cfg {
+        size_t clients;         /**< The number of clients. */
+        bench_range cars;       /**< The number of cars of a client. */
+        bench_range ops;        /**< The number of operations of a car. */
+        bench_range name;       /**< The length of a client's name. */
+        bench_range desc;       /**< The length of an operation's description. */
+        unsigned exp;           /**< The percentage of the operations with an expiration date (inspections). */
+        unsigned spread;        /**< The expiration dates are at most this many days before or after today. */
+        unsigned age;           /**< The operations were created at most this many days ago. */
+        size_t mixed;           /**< The number of changes of the mixed workload of a benchmark. */
+        uint64_t seed;          /**< The seed of the generator, the same seed generates the same database. */
+} bench_cfg;
+
+/**
+ * @struct bench_stats bench.h
+ * @brief The number of the generated objects.
+ */
+typedef struct bench_stats {
+        size_t clients;         /**< The number of new clients. */
+        size_t cars;            /**< The number of new cars. */
+        size_t ops;             /**< The number of new operations. */
+        double secs;            /**< The duration of the generation in seconds. */
+} bench_stats;
+
+void bench_defaults(bench_cfg *cfg);
+int bench_parse(const char *spec, bench_cfg *cfg);
+int bench_fill(database *db, const bench_cfg *cfg, bench_stats *stats);
+
+uint64_t bench_rand(uint64_t *state);
+void bench_client(uint64_t *state, const bench_cfg *cfg, size_t n, char *name, char *email, char *phone);
+void bench_plate(uint64_t *state, char *dst);
+const char *bench_model(uint64_t *state);
+void bench_desc(uint64_t *state, const bench_cfg *cfg, char *dst);
+
+double bench_clock(void);
+int bench_run(const char *scales, const bench_cfg *cfg, FILE *out);
+
+#endif //REPAIRSHOP_BENCH_H
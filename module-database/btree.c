@@ -0,0 +1,585 @@
+/**
+ * @file btree.c
+ * @brief B+-tree implementation.
+ * @details The entries are kept in leaves of at most \c BT_ORDER entries, chained in order, so walking the tree reads
+ *          contiguous arrays instead of chasing a pointer per entry. The inner nodes route by copies of their
+ *          children's lower bounds, and count the entries under every child, so an entry is found by its key or by
+ *          its rank in \c O(log n) steps. An entry is identified by its key and the id of the object it stands for,
+ *          so the entries of equal keys are found and removed in \c O(log n) steps too.\n
+ *          Insertions split the full nodes on the way down, removals fill the nodes at the minimum on the way down
+ *          (from a sibling, or by merging with it), so a single pass from the root reaches a leaf that has room. An
+ *          insertion that fails to allocate a node leaves the tree unchanged (a split alone changes nothing visible).
+ *          Removals never allocate, so they cannot fail.\n
+ *          Like in the hash map, the keys are copied to the heap. The ids are stable: unlike the indexes of a vector,
+ *          they don't change when other entries are removed.
+ */
+
+#include "../include/platform.h"
+
+#include <strings.h>
+
+#include "include/btree.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @brief Compares a key and its id to another one: case-insensitively, then by the id, then case-sensitively.
+ * @details The last step keeps both names of a renamed object apart (e.g. \c "kiss anna" and \c "Kiss Anna" ), while
+ *          the new one is added and the old one is not yet removed.
+ * @param key The key.
+ * @param id The key's id.
+ * @param other The other key.
+ * @param other_id The other key's id.
+ * @return Negative if \c key comes first, positive if \c other does, \c 0 if they are equal.
+ */
+int bt_cmp(const char *key, unsigned long id, const char *other, unsigned long other_id)
+{
+        int diff = strcasecmp(key, other);
+        if (diff)
+                return diff;
+
+        if (id != other_id)
+                return id < other_id ? -1 : 1;
+
+        return strcmp(key, other);
+}
+
+/**
+ * @brief Allocates an empty node.
+ * @param leaf Set to \c true for a leaf, \c false for an inner node.
+ * @return The node, \c NULL if it cannot be allocated.
+ */
+bt_node *bt_node_new(bool leaf)
+{
+        size_t size = leaf ? sizeof(bt_leaf) : sizeof(bt_inner);
+        bt_node *node = malloc(size);
+        if (!node)
+                return NULL;
+
+        node->leaf = leaf;
+        node->n = 0;
+        if (leaf)
+                ((bt_leaf *)node)->next = NULL;
+
+        PROBE_ALLOC(PROBE_MEM_INDEX, size, 0);
+        return node;
+}
+
+/**
+ * @brief Frees a node, without its children and keys.
+ * @param node Pointer to the node.
+ */
+void bt_node_free(bt_node *node)
+{
+        PROBE_FREE(PROBE_MEM_INDEX, node->leaf ? sizeof(bt_leaf) : sizeof(bt_inner), 0);
+        free(node);
+}
+
+/**
+ * @brief Finds the child of an inner node whose entries may contain a key.
+ * @param in Pointer to the inner node.
+ * @param key The key.
+ * @param id The key's id.
+ * @return The last child whose lower bound isn't greater than the key, the first child if there is none.
+ */
+unsigned bt_child(const bt_inner *in, const char *key, unsigned long id)
+{
+        unsigned lo = 1;
+        unsigned hi = in->head.n;
+        while (lo < hi) {
+                unsigned mid = lo + (hi - lo) / 2;
+                if (bt_cmp(key, id, in->sep[mid].key, in->sep[mid].id) >= 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo - 1;
+}
+
+/**
+ * @brief Finds the place of a key in a leaf.
+ * @param leaf Pointer to the leaf.
+ * @param key The key.
+ * @param id The key's id.
+ * @return The position of the first entry that isn't less than the key, \c leaf->head.n if there is none.
+ */
+unsigned bt_pos(const bt_leaf *leaf, const char *key, unsigned long id)
+{
+        unsigned lo = 0;
+        unsigned hi = leaf->head.n;
+        while (lo < hi) {
+                unsigned mid = lo + (hi - lo) / 2;
+                if (bt_cmp(leaf->e[mid].key, leaf->e[mid].id, key, id) < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+/**
+ * @brief Sets a separator to the bound of an entry.
+ * @param sep Pointer to the separator.
+ * @param e The entry.
+ */
+void bt_sep_set(bt_sep *sep, const bt_entry *e)
+{
+        strcpy(sep->key, e->key);
+        sep->id = e->id;
+}
+
+/**
+ * @brief Allocates and initializes an empty tree on the heap.
+ * @return The tree on success, \c NULL if it cannot be allocated.
+ */
+btree *bt_init(void)
+{
+        btree *t = malloc(sizeof(btree));
+        if (!t)
+                return NULL;
+
+        t->root = bt_node_new(true);
+        if (!t->root) {
+                free(t);
+                return NULL;
+        }
+
+        t->size = 0;
+        PROBE_ALLOC(PROBE_MEM_INDEX, sizeof(btree), 0);
+        return t;
+}
+
+/**
+ * @brief Splits a full child of an inner node in two halves.
+ * @param in Pointer to the inner node, it must not be full.
+ * @param i The child's position.
+ * @retval 0 On success.
+ * @retval EMALLOC If the new node cannot be allocated. Nothing is changed in this case.
+ */
+int bt_split(bt_inner *in, unsigned i)
+{
+        bt_node *left = in->child[i];
+        bt_node *right = bt_node_new(left->leaf);
+        if (!right)
+                return EMALLOC;
+
+        unsigned moved = BT_ORDER - BT_MIN;
+        size_t cnt = moved;
+        bt_sep sep;
+
+        if (left->leaf) {
+                bt_leaf *l = (bt_leaf *)left;
+                bt_leaf *r = (bt_leaf *)right;
+                memcpy(r->e, l->e + BT_MIN, moved * sizeof(bt_entry));
+                r->next = l->next;
+                l->next = r;
+                bt_sep_set(&sep, &r->e[0]);
+        }
+        else {
+                bt_inner *l = (bt_inner *)left;
+                bt_inner *r = (bt_inner *)right;
+                memcpy(r->child, l->child + BT_MIN, moved * sizeof(bt_node *));
+                memcpy(r->cnt, l->cnt + BT_MIN, moved * sizeof(size_t));
+                memcpy(r->sep + 1, l->sep + BT_MIN + 1, (moved - 1) * sizeof(bt_sep));
+                sep = l->sep[BT_MIN];
+
+                cnt = 0;
+                for (unsigned k = 0; k < moved; k++)
+                        cnt += r->cnt[k];
+        }
+
+        left->n = BT_MIN;
+        right->n = moved;
+
+        unsigned tail = in->head.n - i - 1;
+        memmove(in->child + i + 2, in->child + i + 1, tail * sizeof(bt_node *));
+        memmove(in->cnt + i + 2, in->cnt + i + 1, tail * sizeof(size_t));
+        memmove(in->sep + i + 2, in->sep + i + 1, tail * sizeof(bt_sep));
+        in->child[i + 1] = right;
+        in->cnt[i + 1] = cnt;
+        in->cnt[i] -= cnt;
+        in->sep[i + 1] = sep;
+        in->head.n++;
+        return 0;
+}
+
+/**
+ * @brief Adds an entry to a tree.
+ * @param t Pointer to the tree.
+ * @param key The key, copied to the heap.
+ * @param id The id of the keyed object, the tree must not hold an entry of the same key and id.
+ * @retval 0 On success.
+ * @retval EINV If \c t or \c key is \c NULL , or \c key is longer than \c BT_KEY_SIZE .
+ * @retval EMALLOC If the key or a node cannot be allocated. The entry isn't added in this case.
+ * @note To move an entry to a new key, add the new key with the same id, then remove the old one. The entry keeps its
+ *       place among the equal keys.
+ */
+int bt_insert(btree *t, const char *key, unsigned long id)
+{
+        if (!t || !key)
+                return EINV;
+
+        size_t len = strlen(key) + 1;
+        if (len > BT_KEY_SIZE)
+                return EINV;
+
+        char *copy = malloc(len);
+        if (!copy)
+                return EMALLOC;
+
+        memcpy(copy, key, len);
+
+        /* A full root is split first, the tree grows at the top. */
+        if (t->root->n == BT_ORDER) {
+                bt_inner *root = (bt_inner *)bt_node_new(false);
+                if (root) {
+                        root->head.n = 1;
+                        root->child[0] = t->root;
+                        root->cnt[0] = t->size;
+                }
+
+                if (!root || bt_split(root, 0)) {
+                        if (root)
+                                bt_node_free(&root->head);
+
+                        free(copy);
+                        return EMALLOC;
+                }
+
+                t->root = &root->head;
+        }
+
+        /* The counts of the path are only raised once the entry has its place. */
+        bt_inner *path[BT_DEPTH];
+        unsigned slot[BT_DEPTH];
+        unsigned depth = 0;
+
+        bt_node *node = t->root;
+        while (!node->leaf) {
+                bt_inner *in = (bt_inner *)node;
+                unsigned i = bt_child(in, key, id);
+
+                if (in->child[i]->n == BT_ORDER) {
+                        if (bt_split(in, i)) {
+                                free(copy);
+                                return EMALLOC;
+                        }
+
+                        if (bt_cmp(key, id, in->sep[i + 1].key, in->sep[i + 1].id) >= 0)
+                                i++;
+                }
+
+                path[depth] = in;
+                slot[depth++] = i;
+                node = in->child[i];
+        }
+
+        bt_leaf *leaf = (bt_leaf *)node;
+        unsigned pos = bt_pos(leaf, key, id);
+        memmove(leaf->e + pos + 1, leaf->e + pos, (leaf->head.n - pos) * sizeof(bt_entry));
+        leaf->e[pos] = (bt_entry){copy, id};
+        leaf->head.n++;
+
+        for (unsigned d = 0; d < depth; d++)
+                path[d]->cnt[slot[d]]++;
+
+        t->size++;
+        PROBE_ALLOC(PROBE_MEM_INDEX, len, 1);
+        return 0;
+}
+
+/**
+ * @brief Finds the leaf whose entries may contain a key.
+ * @param t Pointer to the tree.
+ * @param key The key.
+ * @param id The key's id.
+ * @return The leaf.
+ */
+bt_leaf *bt_leaf_of(const btree *t, const char *key, unsigned long id)
+{
+        bt_node *node = t->root;
+        while (!node->leaf) {
+                bt_inner *in = (bt_inner *)node;
+                node = in->child[bt_child(in, key, id)];
+        }
+
+        return (bt_leaf *)node;
+}
+
+/**
+ * @brief Checks if a tree holds an entry.
+ * @param t Pointer to the tree.
+ * @param key The entry's key.
+ * @param id The entry's id.
+ * @return \c true if the entry is found, \c false if not.
+ */
+bool bt_find(const btree *t, const char *key, unsigned long id)
+{
+        if (!t || !key)
+                return false;
+
+        const bt_leaf *leaf = bt_leaf_of(t, key, id);
+        unsigned pos = bt_pos(leaf, key, id);
+        return pos < leaf->head.n && bt_cmp(key, id, leaf->e[pos].key, leaf->e[pos].id) == 0;
+}
+
+/**
+ * @brief Moves an entry or a child from the left sibling of a child to the child.
+ * @param in Pointer to the parent.
+ * @param i The child's position, at least \c 1 .
+ */
+void bt_borrow_left(bt_inner *in, unsigned i)
+{
+        bt_node *node = in->child[i];
+        bt_node *left = in->child[i - 1];
+        size_t cnt = 1;
+
+        if (node->leaf) {
+                bt_leaf *c = (bt_leaf *)node;
+                bt_leaf *l = (bt_leaf *)left;
+                memmove(c->e + 1, c->e, c->head.n * sizeof(bt_entry));
+                c->e[0] = l->e[l->head.n - 1];
+                bt_sep_set(&in->sep[i], &c->e[0]);
+        }
+        else {
+                bt_inner *c = (bt_inner *)node;
+                bt_inner *l = (bt_inner *)left;
+                unsigned last = l->head.n - 1;
+                memmove(c->child + 1, c->child, c->head.n * sizeof(bt_node *));
+                memmove(c->cnt + 1, c->cnt, c->head.n * sizeof(size_t));
+                memmove(c->sep + 2, c->sep + 1, (c->head.n - 1) * sizeof(bt_sep));
+                c->child[0] = l->child[last];
+                c->cnt[0] = cnt = l->cnt[last];
+                c->sep[1] = in->sep[i];
+                in->sep[i] = l->sep[last];
+        }
+
+        left->n--;
+        node->n++;
+        in->cnt[i - 1] -= cnt;
+        in->cnt[i] += cnt;
+}
+
+/**
+ * @brief Moves an entry or a child from the right sibling of a child to the child.
+ * @param in Pointer to the parent.
+ * @param i The child's position, not the last one.
+ */
+void bt_borrow_right(bt_inner *in, unsigned i)
+{
+        bt_node *node = in->child[i];
+        bt_node *right = in->child[i + 1];
+        size_t cnt = 1;
+
+        if (node->leaf) {
+                bt_leaf *c = (bt_leaf *)node;
+                bt_leaf *r = (bt_leaf *)right;
+                c->e[c->head.n] = r->e[0];
+                memmove(r->e, r->e + 1, (r->head.n - 1) * sizeof(bt_entry));
+                bt_sep_set(&in->sep[i + 1], &r->e[0]);
+        }
+        else {
+                bt_inner *c = (bt_inner *)node;
+                bt_inner *r = (bt_inner *)right;
+                unsigned end = c->head.n;
+                c->child[end] = r->child[0];
+                c->cnt[end] = cnt = r->cnt[0];
+                c->sep[end] = in->sep[i + 1];
+                in->sep[i + 1] = r->sep[1];
+                memmove(r->child, r->child + 1, (r->head.n - 1) * sizeof(bt_node *));
+                memmove(r->cnt, r->cnt + 1, (r->head.n - 1) * sizeof(size_t));
+                memmove(r->sep + 1, r->sep + 2, (r->head.n - 2) * sizeof(bt_sep));
+        }
+
+        right->n--;
+        node->n++;
+        in->cnt[i + 1] -= cnt;
+        in->cnt[i] += cnt;
+}
+
+/**
+ * @brief Merges a child with its right sibling, and frees the sibling.
+ * @param in Pointer to the parent.
+ * @param i The child's position, not the last one.
+ */
+void bt_merge(bt_inner *in, unsigned i)
+{
+        bt_node *left = in->child[i];
+        bt_node *right = in->child[i + 1];
+        unsigned end = left->n;
+
+        if (left->leaf) {
+                bt_leaf *l = (bt_leaf *)left;
+                bt_leaf *r = (bt_leaf *)right;
+                memcpy(l->e + end, r->e, r->head.n * sizeof(bt_entry));
+                l->next = r->next;
+        }
+        else {
+                bt_inner *l = (bt_inner *)left;
+                bt_inner *r = (bt_inner *)right;
+                memcpy(l->child + end, r->child, r->head.n * sizeof(bt_node *));
+                memcpy(l->cnt + end, r->cnt, r->head.n * sizeof(size_t));
+                l->sep[end] = in->sep[i + 1];
+                memcpy(l->sep + end + 1, r->sep + 1, (r->head.n - 1) * sizeof(bt_sep));
+        }
+
+        left->n += right->n;
+        in->cnt[i] += in->cnt[i + 1];
+        bt_node_free(right);
+
+        unsigned tail = in->head.n - i - 2;
+        memmove(in->child + i + 1, in->child + i + 2, tail * sizeof(bt_node *));
+        memmove(in->cnt + i + 1, in->cnt + i + 2, tail * sizeof(size_t));
+        memmove(in->sep + i + 1, in->sep + i + 2, tail * sizeof(bt_sep));
+        in->head.n--;
+}
+
+/**
+ * @brief Makes sure a child has more than \c BT_MIN entries or children, so one can be removed from it.
+ * @param in Pointer to the parent.
+ * @param i The child's position.
+ * @return The position of the child after the change (a merge with its left sibling moves it).
+ */
+unsigned bt_fill(bt_inner *in, unsigned i)
+{
+        if (i > 0 && in->child[i - 1]->n > BT_MIN) {
+                bt_borrow_left(in, i);
+                return i;
+        }
+
+        if (i + 1 < in->head.n && in->child[i + 1]->n > BT_MIN) {
+                bt_borrow_right(in, i);
+                return i;
+        }
+
+        if (i > 0) {
+                bt_merge(in, i - 1);
+                return i - 1;
+        }
+
+        bt_merge(in, i);
+        return i;
+}
+
+/**
+ * @brief Removes an entry from a tree.
+ * @param t Pointer to the tree.
+ * @param key The entry's key.
+ * @param id The entry's id.
+ * @return \c true if the entry was removed, \c false if it isn't in the tree.
+ */
+bool bt_rm(btree *t, const char *key, unsigned long id)
+{
+        if (!bt_find(t, key, id))
+                return false;
+
+        /* The entry exists, so the counts are lowered on the way down. */
+        bt_node *node = t->root;
+        while (!node->leaf) {
+                bt_inner *in = (bt_inner *)node;
+                unsigned i = bt_child(in, key, id);
+                if (in->child[i]->n == BT_MIN)
+                        i = bt_fill(in, i);
+
+                in->cnt[i]--;
+                node = in->child[i];
+        }
+
+        bt_leaf *leaf = (bt_leaf *)node;
+        unsigned pos = bt_pos(leaf, key, id);
+
+        PROBE_FREE(PROBE_MEM_INDEX, strlen(leaf->e[pos].key) + 1, 1);
+        free(leaf->e[pos].key);
+        memmove(leaf->e + pos, leaf->e + pos + 1, (leaf->head.n - pos - 1) * sizeof(bt_entry));
+        leaf->head.n--;
+        t->size--;
+
+        /* A root left with a single child is replaced by the child, the tree shrinks at the top. */
+        while (!t->root->leaf && t->root->n == 1) {
+                bt_node *root = t->root;
+                t->root = ((bt_inner *)root)->child[0];
+                bt_node_free(root);
+        }
+
+        return true;
+}
+
+/**
+ * @brief Finds an entry by its rank.
+ * @param t Pointer to the tree.
+ * @param rank The number of entries before the entry.
+ * @param it The destination position, the entry is returned by the next \c bt_next() .
+ * @return \c true on success, \c false if the tree has at most \c rank entries.
+ */
+bool bt_seek(const btree *t, size_t rank, bt_iter *it)
+{
+        if (!t || rank >= t->size)
+                return false;
+
+        const bt_node *node = t->root;
+        while (!node->leaf) {
+                const bt_inner *in = (const bt_inner *)node;
+                unsigned i = 0;
+                while (rank >= in->cnt[i])
+                        rank -= in->cnt[i++];
+
+                node = in->child[i];
+        }
+
+        it->leaf = (const bt_leaf *)node;
+        it->pos = (unsigned)rank;
+        return true;
+}
+
+/**
+ * @brief Steps to the next entry.
+ * @param it Pointer to the position, see \c bt_seek() .
+ * @return The entry at the position, \c NULL at the end of the tree.
+ */
+const bt_entry *bt_next(bt_iter *it)
+{
+        while (it->leaf && it->pos == it->leaf->head.n) {
+                it->leaf = it->leaf->next;
+                it->pos = 0;
+        }
+
+        return it->leaf ? &it->leaf->e[it->pos++] : NULL;
+}
+
+/**
+ * @brief Frees a node with its children and keys.
+ * @param node Pointer to the node.
+ * @return The bytes of the freed keys.
+ */
+size_t bt_node_del(bt_node *node)
+{
+        size_t keys = 0;
+        for (unsigned k = 0; k < node->n; k++) {
+                if (node->leaf) {
+                        bt_entry *e = &((bt_leaf *)node)->e[k];
+                        keys += strlen(e->key) + 1;
+                        free(e->key);
+                }
+                else {
+                        keys += bt_node_del(((bt_inner *)node)->child[k]);
+                }
+        }
+
+        bt_node_free(node);
+        return keys;
+}
+
+/**
+ * @brief Frees a tree with all of its keys.
+ * @param t Pointer to the tree to be deleted.
+ */
+void bt_del(btree *t)
+{
+        if (!t)
+                return;
+
+        size_t keys = bt_node_del(t->root);
+        PROBE_FREE(PROBE_MEM_INDEX, sizeof(btree) + keys, t->size);
+        free(t);
+}
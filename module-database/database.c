@@ -8,11 +8,121 @@
  *          \c vector.h. The objects are: clients, cars and operations. They have the same hierarchy as mentioned.\n
  *          Operaitions are linked to cars and cars are linked to clients. Clients can be linked to any vector. This
  *          type of arrangement will allow the program to link multiple objects to the same, higher precedence one
- *          without any duplicate data.
+ *          without any duplicate data.\n
+ *          Every mutation marks the affected client as dirty, so the filehandler only has to serialize the clients that
+ *          changed since the last snapshot.\n
+ *          The filehandler may load the clients lazily. In that case a client's cars and operations are only loaded by
+ *          \c db->loader when they are accessed for the first time.\n
+ *          The writers lock the client they modify, so the writers of different clients run in parallel. Adding and
+ *          removing clients locks the whole database. A concurrent database (see \c db_concurrent() ) can be read
+ *          without locks: a modified client is replaced by its modified copy, and the replaced one is freed after the
+ *          readers.\n
+ *          The clients' order by name (see \c db_order() ) is built once, then the mutations keep it up to date.
+ *          So are the unique indexes of the email addresses and phone numbers, if they are enabled (see \c uniq.c ).
  * @note Not all function return values are documented. Visit \c vector.c and \c date.c for all possible return values.
  */
 
+/* The writer preference of glibc's reader-writer locks is a GNU extension, see db_locks_init(). */
+#define _GNU_SOURCE
+#include "../include/platform.h"
+
+#include <stdarg.h>
+
 #include "include/database.h"
+#include "include/uniq.h"
+#include "include/epoch.h"
+#include "../module-probe/include/probe.h"
+
+static unsigned long cl_ids = 0;        /**< The number of client ids drawn, see \c db_cl_id() . Accessed atomically. */
+
+/**
+ * @brief Draws a new client id. The ids are drawn in ascending order, shared by every database.
+ * @details A database keeps its clients in the order of their ids: a client gets its id when it's appended to the
+ *          client vector (under the database's lock), and the removals and copies keep the order. So a client is found
+ *          by its id with a binary search, and unlike its index, its id doesn't change when other clients are removed
+ *          (see \c db_order() ).
+ * @return The new id.
+ */
+unsigned long db_cl_id(void)
+{
+        return __atomic_fetch_add(&cl_ids, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Finds a client by its id.
+ * @param db The pointer to the database.
+ * @param id The client's id.
+ * @param dst The destination of the client's index. Not modified if the client isn't found.
+ * @return \c true if the client is found, \c false if not.
+ * @note A concurrent database must be read in a read section, see \c db_read_begin() .
+ */
+bool db_cl_find(const database *db, unsigned long id, idx *dst)
+{
+        void **items;
+        size_t size = vct_view(db->cl, &items);
+        size_t lo = 0;
+        size_t hi = size;
+        const client *cl = NULL;
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                cl = __atomic_load_n(&items[mid], __ATOMIC_ACQUIRE);
+
+                /* The pointers being removed are NULL at the end of a shrunk array, see vct_publish(). */
+                if (cl && cl->id < id)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        cl = lo < size ? __atomic_load_n(&items[lo], __ATOMIC_ACQUIRE) : NULL;
+        if (!cl || cl->id != id)
+                return false;
+
+        *dst = lo;
+        return true;
+}
+
+/**
+ * @brief Allocates and initializes the locks of a database.
+ * @param db The pointer to the database.
+ * @retval 0 On success.
+ * @retval EMALLOC If a lock cannot be allocated or initialized.
+ */
+int db_locks_init(database *db)
+{
+        db->lock = malloc(sizeof(pthread_mutex_t));
+        db->rw = malloc(sizeof(pthread_rwlock_t));
+        db->stripes = malloc(DB_STRIPES * sizeof(pthread_mutex_t));
+        if (!db->lock || !db->rw || !db->stripes)
+                goto fail_alloc;
+
+        if (pthread_mutex_init(db->lock, NULL))
+                goto fail_alloc;
+
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        /* A stream of client writers must not starve the structural changes. */
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        int err = pthread_rwlock_init(db->rw, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (err)
+                goto fail_rw;
+
+        for (size_t i = 0; i < DB_STRIPES; i++)
+                pthread_mutex_init(&db->stripes[i], NULL);
+
+        return 0;
+
+fail_rw:
+        pthread_mutex_destroy(db->lock);
+fail_alloc:
+        free(db->lock);
+        free(db->rw);
+        free(db->stripes);
+        return EMALLOC;
+}
 
 /**
  * @brief Allocates and initializes a database on the heap.
@@ -31,12 +141,237 @@ database *db_init(const char *name, const char *desc)
         if (!db)
                 return EMEMNULL;
 
+        if (db_locks_init(db)) {
+                free(db);
+                return EMEMNULL;
+        }
+
         strcpy(db->name, name);
         strcpy(db->desc, desc);
         db->cl = vct();
+        db->order = NULL;
+        db->uniq[DB_UNIQ_EMAIL] = NULL;
+        db->uniq[DB_UNIQ_PHONE] = NULL;
+        db->journal = NULL;
+        db->gen = 0;
+        db->loader = NULL;
+        db->on_change = NULL;
+        db->snapshot = false;
+        db->concurrent = false;
         return db;
 }
 
+/**
+ * @brief Lets other threads read and modify the database.
+ * @details From now on every modified client is replaced by a modified copy instead of being changed in place, and the
+ *          replaced clients and pointer arrays are freed only after the readers are done with them (see \c epoch.c ).
+ *          The readers don't take locks, they only have to enclose their lookups by \c db_read_begin() and
+ *          \c db_read_end() . The writers of different clients run in parallel, the writers of the same client and the
+ *          structural changes (adding and removing clients) are serialized.
+ * @param db The pointer to the database.
+ * @note Must be called before the other threads are started. Copying costs a client's subtree per mutation, so a
+ *       single-threaded program shouldn't use it.
+ */
+void db_concurrent(database *db)
+{
+        db->concurrent = true;
+        db->cl->shared = true;
+}
+
+/**
+ * @brief Starts a read section. The clients, cars and operations looked up in it stay valid until \c db_read_end() .
+ * @param db The pointer to the database.
+ * @note Read sections can be nested. A thread may modify the database inside its read section, but it must not wait
+ *       for another thread's writes there, and long sections delay freeing the replaced clients.
+ */
+void db_read_begin(const database *db)
+{
+        (void)db;
+        epoch_enter();
+}
+
+/**
+ * @brief Ends a read section started by \c db_read_begin() .
+ * @param db The pointer to the database.
+ */
+void db_read_end(const database *db)
+{
+        (void)db;
+        epoch_exit();
+}
+
+/**
+ * @brief Locks the whole database for a structural change. Waits for the running writers to finish.
+ * @param db The pointer to the database.
+ * @note Readers are not blocked. The database's own functions must not be called while it's held, except for
+ *       \c db_journal() and \c db_snap() .
+ */
+void db_lock(const database *db)
+{
+        pthread_rwlock_wrlock(db->rw);
+}
+
+/**
+ * @brief Unlocks a database locked by \c db_lock() .
+ * @param db The pointer to the database.
+ */
+void db_unlock(const database *db)
+{
+        pthread_rwlock_unlock(db->rw);
+}
+
+/**
+ * @brief Locks a client for modification. The writers of other clients are not blocked.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ */
+void db_w_lock(const database *db, idx cl)
+{
+        pthread_rwlock_rdlock(db->rw);
+        pthread_mutex_lock(&db->stripes[cl % DB_STRIPES]);
+}
+
+/**
+ * @brief Unlocks a client locked by \c db_w_lock() .
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ */
+void db_w_unlock(const database *db, idx cl)
+{
+        pthread_mutex_unlock(&db->stripes[cl % DB_STRIPES]);
+        pthread_rwlock_unlock(db->rw);
+}
+
+/**
+ * @brief Appends a record to the database's journal (if there is one).
+ * @details Every successful mutation is recorded as a single line, so the filehandler can replay them on top of the
+ *          last snapshot. See \c fh_journal.c for the record formats.
+ * @param db The pointer to the database.
+ * @param fmt A \c printf() style format string of the record. Must end with a newline.
+ * @note The stream is flushed after every record, so a crash loses at most the record being written.\n
+ *       The mutations record themselves while they hold the client's lock, so the records of a client are in the same
+ *       order as its changes.
+ */
+void db_journal(const database *db, const char *fmt, ...)
+{
+        if (!db || !db->journal)
+                return;
+
+        va_list args;
+        va_start(args, fmt);
+        vfprintf(db->journal, fmt, args);
+        va_end(args);
+
+        fflush(db->journal);
+}
+
+/**
+ * @brief Calls \c db->on_change after a mutation (if it's set).
+ * @param db The pointer to the database.
+ * @note Called after the locks are released, since the autosave takes a snapshot of the whole database.
+ */
+void db_changed(const database *db)
+{
+        if (db->on_change)
+                db->on_change(db);
+}
+
+/**
+ * @brief Modifies the name and the description of a database.
+ * @param db The pointer to the database.
+ * @param name The database's new name.
+ * @param desc The database's new description.
+ * @retval 0 On success.
+ * @retval EINV If \c db is \c NULL or at least 1 string is too large.
+ */
+int db_mod(database *db, const char *name, const char *desc)
+{
+        if (!db || strlen(name) > NAME_SIZE || strlen(desc) > DESC_SIZE)
+                return EINV;
+
+        db_lock(db);
+        strcpy(db->name, name);
+        strcpy(db->desc, desc);
+
+        db_journal(db, "~D>%s|%s\n", name, desc);
+        db_unlock(db);
+
+        db_changed(db);
+        return 0;
+}
+
+/**
+ * @brief Formats a date for the journal.
+ * @param date The date to be formatted.
+ * @param dst The destination string, must be at least 17 bytes long.
+ * @note Uninitialized dates are written as \c 0 , the same way the filehandler does it.
+ */
+void db_journal_date(const date *date, char *dst)
+{
+        if (date->y == 0)
+                strcpy(dst, "0");
+        else
+                date_printf(date, dst);
+}
+
+/**
+ * @brief Frees a client with all of its cars and operations.
+ * @param cl Pointer to the client.
+ */
+void db_cl_free(client *cl)
+{
+        for (idx i = 0; i < cl->cars->size; i++) {
+                car *car_ = vct_subptr(cl->cars, i);
+                PROBE_FREE(PROBE_MEM_OP, car_->operations->size * sizeof(operation), car_->operations->size);
+                vct_del(car_->operations);
+        }
+
+        PROBE_FREE(PROBE_MEM_CAR, cl->cars->size * sizeof(car), cl->cars->size);
+        vct_del(cl->cars);
+
+        PROBE_FREE(PROBE_MEM_CLIENT, sizeof(client), 1);
+        free(cl);
+}
+
+/**
+ * @brief Frees a retired client. Passed to \c epoch_retire() .
+ * @param cl Pointer to the client.
+ */
+void db_cl_retired(void *cl)
+{
+        db_cl_free(cl);
+}
+
+/**
+ * @brief Frees a client that no database holds anymore.
+ * @details The readers of a concurrent database may still use it, so it's only freed after them.
+ * @param db The pointer to the database that held the client.
+ * @param cl Pointer to the client.
+ */
+void db_cl_drop(const database *db, client *cl)
+{
+        if (db->concurrent)
+                epoch_retire(cl, db_cl_retired);
+        else
+                db_cl_free(cl);
+}
+
+/**
+ * @brief Releases a client removed or replaced in a database.
+ * @details A client held by a snapshot is only released, the snapshot frees it.
+ * @param db The pointer to the database.
+ * @param cl Pointer to the client.
+ */
+void db_cl_release(const database *db, client *cl)
+{
+        pthread_mutex_lock(db->lock);
+        bool unused = --cl->refs == 0;
+        pthread_mutex_unlock(db->lock);
+
+        if (unused)
+                db_cl_drop(db, cl);
+}
+
 /**
  * @brief Adds a client to the database.
  * @param db The pointer of the destination database.
@@ -46,9 +381,11 @@ database *db_init(const char *name, const char *desc)
  * @retval 0 On success.
  * @retval EINV If \c db is \c NULL or at least 1 string is too large.
  * @retval EMALLOC If the new client cannot be allocated.
+ * @retval EDUP If the email address or the phone number is unique and another client holds it, see \c db_unique() .
  */
 int db_cl_add(const database *db, const char *name, const char *email, const char *phone)
 {
+        PROBE(PROBE_DB_CL_ADD);
         if (!db || strlen(name) > NAME_SIZE + 1 || strlen(email) > EMAIL_SIZE + 1 || strlen(phone) > PHNUM_SIZE + 1)
                 return EINV;
 
@@ -56,12 +393,345 @@ int db_cl_add(const database *db, const char *name, const char *email, const cha
         if (!cl)
                 return EMALLOC;
 
+        PROBE_ALLOC(PROBE_MEM_CLIENT, sizeof(client), 1);
         strcpy(cl->name, name);
         strcpy(cl->email, email);
         strcpy(cl->phone, phone);
         cl->cars = vct();
+        cl->loaded = true;
+        cl->lazy_cars = 0;
+        cl->dirty = true;
+        cl->refs = 1;
+        cl->shard = 0;
+        cl->blk_off = 0;
+        cl->blk_len = 0;
+
+        db_lock(db);
+        cl->id = db_cl_id();
+        int retval = db_uniq_put(db, email, phone, NULL, NULL);
+        if (!retval && (retval = db_order_put(db, cl->id, name)))
+                db_uniq_rm(db, email, phone, NULL, NULL);
+
+        if (!retval && (retval = vct_push(db->cl, cl))) {
+                db_order_rm(db, cl->id, name);
+                db_uniq_rm(db, email, phone, NULL, NULL);
+        }
+
+        if (!retval)
+                db_journal(db, "+U>%s|%s|%s\n", name, email, phone);
+        db_unlock(db);
+
+        if (retval)
+                db_cl_free(cl);
+        else
+                db_changed(db);
+
+        return retval;
+}
+
+/**
+ * @brief Copies the cars and operations of a client.
+ * @param dst Pointer to the destination client, its car vector must be empty.
+ * @param src Pointer to the source client.
+ * @retval 0 On success.
+ * @retval EMALLOC If the copies cannot be allocated. The already copied ones stay in \c dst .
+ */
+int db_cl_copy_cars(client *dst, const client *src)
+{
+        if (vct_reserve(dst->cars, src->cars->size))
+                return EMALLOC;
+
+        for (idx i = 0; i < src->cars->size; i++) {
+                const car *src_car = vct_subptr(src->cars, i);
+                car *car_ = malloc(sizeof(car));
+                if (!car_)
+                        return EMALLOC;
+
+                PROBE_ALLOC(PROBE_MEM_CAR, sizeof(car), 1);
+                *car_ = *src_car;
+                car_->operations = vct();
+                if (!car_->operations || vct_push(dst->cars, car_)) {
+                        vct_del(car_->operations);
+                        PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                        free(car_);
+                        return EMALLOC;
+                }
+
+                if (vct_reserve(car_->operations, src_car->operations->size))
+                        return EMALLOC;
+
+                for (idx j = 0; j < src_car->operations->size; j++) {
+                        operation *op = malloc(sizeof(operation));
+                        if (!op)
+                                return EMALLOC;
+
+                        PROBE_ALLOC(PROBE_MEM_OP, sizeof(operation), 1);
+                        *op = *(const operation *)vct_subptr(src_car->operations, j);
+                        vct_push(car_->operations, op);
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Loads an unloaded client in place. The caller must hold \c db->lock and the client's lock.
+ * @details The loader links the cars through the client's index. The client is only marked loaded when it's complete,
+ *          so a reader doesn't look at its cars before that. A failed load is undone, the next access tries again.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @return The loader's return value.
+ */
+int db_cl_fill(const database *db, idx cl)
+{
+        client *client_ = db_cl_get(db, cl);
+        int retval = db->loader(db, cl);
+
+        if (!retval) {
+                __atomic_store_n(&client_->loaded, true, __ATOMIC_RELEASE);
+                return 0;
+        }
+
+        while (client_->cars->size) {
+                car *car_ = vct_subptr(client_->cars, client_->cars->size - 1);
+                PROBE_FREE(PROBE_MEM_OP, car_->operations->size * sizeof(operation), car_->operations->size);
+                PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                vct_del(car_->operations);
+                vct_rm(client_->cars, client_->cars->size - 1);
+        }
+
+        return retval;
+}
+
+/**
+ * @brief Replaces an unloaded client shared with a snapshot by its own loaded copy. The caller must hold \c db->lock
+ *        and the client's lock.
+ * @details The copy is always dirty, since it has no block in the snapshot the background save is writing.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @retval 0 On success.
+ * @retval EMALLOC If the copy cannot be allocated.
+ * @retval EINV If the copy cannot be loaded.
+ */
+int db_cl_unshare(const database *db, idx cl)
+{
+        client *old = db_cl_get(db, cl);
+        client *new = malloc(sizeof(client));
+        if (!new)
+                return EMALLOC;
+
+        *new = *old;
+        new->cars = vct();
+        new->refs = 1;
+        new->dirty = true;
+        if (!new->cars) {
+                free(new);
+                return EMALLOC;
+        }
+
+        PROBE_ALLOC(PROBE_MEM_CLIENT, sizeof(client), 1);
+
+        /* The loader looks the client up by its index, so the copy must be in place first. */
+        vct_swap(db->cl, cl, new);
+
+        int retval = db_cl_fill(db, cl);
+        if (retval) {
+                vct_swap(db->cl, cl, old);
+                db_cl_drop(db, new);
+                return retval;
+        }
+
+        old->refs--;
+        return 0;
+}
+
+/**
+ * @brief Loads a client's cars and operations, if they haven't been loaded yet. The caller must hold the client's lock.
+ * @param db The pointer to the source database.
+ * @param cl The client's index in the database.
+ * @return See \c db_cl_load() .
+ */
+int db_cl_load_locked(const database *db, idx cl)
+{
+        client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return EOOB;
+
+        if (__atomic_load_n(&client_->loaded, __ATOMIC_ACQUIRE) || !db->loader)
+                return 0;
+
+        /* Only the real loads are timed, the loaded clients would pull the histogram towards zero. */
+        PROBE(PROBE_DB_CL_LOAD);
+
+        /* The loader reads the snapshot by the client's offsets, which are updated by a background save. */
+        pthread_mutex_lock(db->lock);
+
+        int retval = 0;
+        if (client_->refs > 1)
+                /* A shared client is not modified, its loaded copy takes its place. */
+                retval = db_cl_unshare(db, cl);
+        else
+                retval = db_cl_fill(db, cl);
 
-        return vct_push(db->cl, cl);
+        pthread_mutex_unlock(db->lock);
+        return retval;
+}
+
+/**
+ * @brief Loads a client's cars and operations, if they haven't been loaded yet.
+ * @param db The pointer to the source database.
+ * @param cl The client's index in the database.
+ * @retval 0 On success or if the client is already loaded.
+ * @retval EOOB If the client doesn't exist.
+ * @retval EINV If the client's block in the snapshot is missing or malformed.
+ * @retval EMALLOC If the cars or operations cannot be allocated.
+ * @note Loading a shared client replaces it with its copy, so the client has to be looked up again.
+ */
+int db_cl_load(const database *db, idx cl)
+{
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return EOOB;
+
+        if (__atomic_load_n(&client_->loaded, __ATOMIC_ACQUIRE) || !db->loader)
+                return 0;
+
+        db_w_lock(db, cl);
+        int retval = db_cl_load_locked(db, cl);
+        db_w_unlock(db, cl);
+        return retval;
+}
+
+/**
+ * @brief Makes a loaded, private copy of a client. The caller must hold the client's lock.
+ * @details The copy is dirty and nothing else holds it, so it can be modified freely. It's either put in place of the
+ *          client by \c db_cl_commit() , or freed by \c db_cl_free() .
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @param dst The destination of the copy.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist.
+ * @retval EMALLOC If the copy cannot be allocated.
+ * @retval EINV If the client cannot be loaded from the snapshot.
+ */
+int db_cl_copy(const database *db, idx cl, client **dst)
+{
+        int retval = db_cl_load_locked(db, cl);
+        if (retval)
+                return retval;
+
+        /* Loading a shared client replaces it with its copy. */
+        const client *old = db_cl_get(db, cl);
+        client *new = malloc(sizeof(client));
+        if (!new)
+                return EMALLOC;
+
+        /* The background save updates the offsets of the shared clients. */
+        pthread_mutex_lock(db->lock);
+        *new = *old;
+        pthread_mutex_unlock(db->lock);
+
+        new->cars = vct();
+        new->refs = 1;
+        new->dirty = true;
+        if (!new->cars) {
+                free(new);
+                return EMALLOC;
+        }
+
+        PROBE_ALLOC(PROBE_MEM_CLIENT, sizeof(client), 1);
+
+        retval = db_cl_copy_cars(new, old);
+        if (retval) {
+                db_cl_free(new);
+                return retval;
+        }
+
+        *dst = new;
+        return 0;
+}
+
+/**
+ * @brief Returns a loaded version of a client the caller can modify. The caller must hold the client's lock.
+ * @details A client shared with a snapshot, or any client of a concurrent database, is copied. The copy replaces the
+ *          client in \c db_cl_commit() , so the snapshot and the readers keep seeing the original. Otherwise the client
+ *          is modified in place. Every mutation calls this first.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @param dst The destination of the modifiable client.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist.
+ * @retval EMALLOC If the copy cannot be allocated.
+ * @retval EINV If the client cannot be loaded from the snapshot.
+ */
+int db_cl_write(const database *db, idx cl, client **dst)
+{
+        int retval = db_cl_load_locked(db, cl);
+        if (retval)
+                return retval;
+
+        /* A background save may release the snapshot in the meantime, which only makes an unneeded copy. */
+        client *old = db_cl_get(db, cl);
+        pthread_mutex_lock(db->lock);
+        bool in_place = !db->concurrent && old->refs == 1;
+        pthread_mutex_unlock(db->lock);
+
+        if (in_place) {
+                *dst = old;
+                return 0;
+        }
+
+        return db_cl_copy(db, cl, dst);
+}
+
+/**
+ * @brief Finishes a modification started by \c db_cl_write() . The caller must hold the client's lock.
+ * @details On success the modified copy replaces the client, on failure it's discarded.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @param new The client returned by \c db_cl_write() , \c NULL if it failed.
+ * @param err The error code of the modification.
+ * @return \c err
+ */
+int db_cl_commit(const database *db, idx cl, client *new, int err)
+{
+        client *old = db_cl_get(db, cl);
+        if (!new || new == old)
+                return err;
+
+        if (err) {
+                db_cl_free(new);
+                return err;
+        }
+
+        vct_swap(db->cl, cl, new);
+        db_cl_release(db, old);
+        return 0;
+}
+
+/**
+ * @brief Makes sure a client isn't shared with a snapshot, so it can be modified in place.
+ * @details If a snapshot holds the client, it's replaced by a loaded copy in the database. The snapshot keeps the
+ *          original.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist.
+ * @retval EMALLOC If the copy cannot be allocated.
+ * @retval EINV If the copy cannot be loaded from the snapshot.
+ * @note Modifying a client in place is only allowed if the database isn't concurrent (see \c db_concurrent() ).
+ */
+int db_cl_own(const database *db, idx cl)
+{
+        if (!db_cl_get(db, cl))
+                return EOOB;
+
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+        return retval;
 }
 
 /**
@@ -77,22 +747,62 @@ int db_cl_add(const database *db, const char *name, const char *email, const cha
  */
 int db_car_add(const database *db, idx cl, const char *name, const char *plate)
 {
+        PROBE(PROBE_DB_CAR_ADD);
         if (!db || strlen(name) > NAME_SIZE + 1 || strlen(plate) > PLATE_SIZE + 1)
                 return EINV;
 
-        client *client_ = vct_subptr(db->cl, cl);
-        if (!client_)
-                return EOOB;
-
         car *c = malloc(sizeof(car));
         if (!c)
                 return EMALLOC;
 
+        PROBE_ALLOC(PROBE_MEM_CAR, sizeof(car), 1);
         strcpy(c->name, name);
         strcpy(c->plate, plate);
         c->operations = vct();
 
-        return vct_push(client_->cars, c);
+        /* The new car must be appended after the ones in the snapshot, so the client is loaded first. */
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
+        if (!retval)
+                retval = vct_push(client_->cars, c);
+
+        if (!retval) {
+                client_->dirty = true;
+                db_journal(db, "+A>%zu|%s|%s\n", cl, name, plate);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (retval) {
+                vct_del(c->operations);
+                PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                free(c);
+                return retval;
+        }
+
+        db_changed(db);
+        return 0;
+}
+
+/**
+ * @brief Checks the price and the expiration date of an operation.
+ * @param price The operation's price.
+ * @param date The expiration date, \c NULL if it has none. Format: 'YYYY-MM-DD HH:MM', see \c date_parse_strict() .
+ * @param dst The parsed expiration date is written here, its year is \c 0 if it has none.
+ * @return \c 0 if both are valid, \c EINV if the price is not finite or larger than \c PRICE_MAX , or the date is
+ *         malformed.
+ * @note What's accepted here is journaled in a form that the import accepts too.
+ */
+int db_op_check(double price, const char *date, struct date *dst)
+{
+        /* NaN fails both comparisons. */
+        if (!(price >= -PRICE_MAX && price <= PRICE_MAX))
+                return EINV;
+
+        dst->y = 0;
+        return date ? date_parse_strict(date, dst) : 0;
 }
 
 /**
@@ -102,37 +812,87 @@ int db_car_add(const database *db, idx cl, const char *name, const char *plate)
  * @param cr The car's index in the database.
  * @param desc The operation's description.
  * @param price The operation's price.
- * @param date The expiration date (if applicable). Pass to \c NULL to ignore. Format: 'YYYY:MM:DD HH:MM'
+ * @param date The expiration date (if applicable). Pass to \c NULL to ignore. Format: 'YYYY-MM-DD HH:MM'
  * @retval 0 On success.
- * @retval EINV If \c db is \c NULL or at least 1 string is too large.
+ * @retval EINV If \c db is \c NULL , at least 1 string is too large, or the price or the date is invalid (see
+ *              \c db_op_check() ).
  * @retval EOOB If the client or the car doesn't exist in the database.
  * @retval EMALLOC If the new operation cannot be allocated.
  */
 int db_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date)
 {
-        if (!db || strlen(desc) > DESC_SIZE)
+        PROBE(PROBE_DB_OP_ADD);
+        struct date exp;
+        if (!db || strlen(desc) > DESC_SIZE || db_op_check(price, date, &exp))
                 return EINV;
 
-        car *car_ = db_car_get(db, cl, cr);
-        if (!car_)
-                return EOOB;
-
         operation *op = malloc(sizeof(operation));
         if (!op)
                 return EMALLOC;
 
+        PROBE_ALLOC(PROBE_MEM_OP, sizeof(operation), 1);
         strcpy(op->desc, desc);
         op->price = price;
+        op->date_exp = exp;
+        op->date_cr = date_now();
 
-        if (date)
-                op->date_exp = date_parse(date);
-        else
-                /* Set the first element to 0 to know this is not used. */
-                op->date_exp.y = 0;
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
 
-        op->date_cr = date_now();
+        car *car_ = retval ? NULL : vct_subptr(client_->cars, cr);
+        if (!retval && !car_)
+                retval = EOOB;
+        if (!retval)
+                retval = vct_push(car_->operations, op);
+
+        if (!retval) {
+                client_->dirty = true;
+
+                char date_cr[17], date_exp[17];
+                db_journal_date(&op->date_cr, date_cr);
+                db_journal_date(&op->date_exp, date_exp);
+                db_journal(db, "+J>%zu|%zu|%s|%f|%s|%s\n", cl, cr, desc, price, date_cr, date_exp);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (retval) {
+                PROBE_FREE(PROBE_MEM_OP, sizeof(operation), 1);
+                free(op);
+                return retval;
+        }
+
+        db_changed(db);
+        return 0;
+}
+
+/**
+ * @brief Counts the clients of the database.
+ * @param db The pointer to the source database.
+ * @return The number of clients.
+ * @note Other threads may add or remove clients in the meantime, see \c db_concurrent() .
+ */
+idx db_cl_cnt(const database *db)
+{
+        void **items;
+        return vct_view(db->cl, &items);
+}
+
+/**
+ * @brief Counts a client's cars without loading them.
+ * @param db The pointer to the source database.
+ * @param cl The client's index in the database.
+ * @return The number of cars, \c 0 if the client doesn't exist.
+ */
+idx db_car_cnt(const database *db, idx cl)
+{
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return 0;
 
-        return vct_push(car_->operations, op);
+        return __atomic_load_n(&client_->loaded, __ATOMIC_ACQUIRE) ? client_->cars->size : client_->lazy_cars;
 }
 
 /**
@@ -157,14 +917,16 @@ client *db_cl_get(const database *db, idx cl)
  * @return A cast \c vct_subptr() .
  * @retval car* On success.
  * @retval NULL On failure.
+ * @note Loads the client's cars if they haven't been loaded yet.
  */
 car *db_car_get(const database *db, idx cl, idx car)
 {
-        const client *client_ = db_cl_get(db, cl);
-        if (!client_)
+        if (db_cl_load(db, cl))
                 return NULL;
 
-        return vct_subptr(client_->cars, car);
+        /* Loading a shared client replaces it with its copy. */
+        const client *client_ = db_cl_get(db, cl);
+        return client_ ? vct_subptr(client_->cars, car) : NULL;
 }
 
 /**
@@ -186,6 +948,136 @@ operation *db_op_get(const database *db, idx cl, idx cr, idx op)
         return vct_subptr(car_->operations, op);
 }
 
+/**
+ * @brief Orders the clients of a database by their names, see \c db_cl_ordered() .
+ * @details The clients are sorted once, into a B+-tree of their names and ids (see \c btree.c ). From then on the
+ *          mutations update it in \c O(log n) steps, the removals too: the tree holds the ids instead of the indexes,
+ *          so the clients after the removed ones don't have to be renumbered. The indexes are only looked up for the
+ *          listed clients, see \c db_cl_find() .
+ * @param db The pointer to the database.
+ * @retval 0 On success, or if the clients are already ordered.
+ * @retval EINV If \c db is \c NULL .
+ * @retval EMALLOC If the tree cannot be allocated.
+ * @note Only the menus list the clients in order, so the other modes don't pay for keeping the order.
+ */
+int db_order(database *db)
+{
+        if (!db)
+                return EINV;
+
+        if (db->order)
+                return 0;
+
+        btree *order = bt_init();
+        int retval = order ? 0 : EMALLOC;
+
+        db_lock(db);
+        for (idx i = 0; i < db->cl->size && !retval; i++)
+                retval = bt_insert(order, db_cl_get(db, i)->name, db_cl_get(db, i)->id);
+
+        if (!retval) {
+                pthread_mutex_lock(db->lock);
+                db->order = order;
+                pthread_mutex_unlock(db->lock);
+        }
+        db_unlock(db);
+
+        if (retval)
+                bt_del(order);
+
+        return retval;
+}
+
+/**
+ * @brief Lists the indexes of some clients in the order of their names. The clients of the same name are in the order
+ *        they were added in (the order of their ids).
+ * @param db The pointer to the database.
+ * @param rank The number of clients before the first one in the order.
+ * @param dst The destination of the indexes.
+ * @param n The size of \c dst .
+ * @return The number of indexes written to \c dst , less than \c n at the end of the clients.
+ * @note If the clients aren't ordered (see \c db_order() ), they are listed in the database's order.
+ */
+size_t db_cl_ordered(const database *db, idx rank, idx *dst, size_t n)
+{
+        size_t cnt = 0;
+
+        db_read_begin(db);
+        pthread_mutex_lock(db->lock);
+        bt_iter it;
+        if (db->order && bt_seek(db->order, rank, &it)) {
+                /* A client being removed may be gone from the vector, but not yet from the order. */
+                for (const bt_entry *e; cnt < n && (e = bt_next(&it)); )
+                        cnt += db_cl_find(db, e->id, &dst[cnt]);
+        }
+        else if (!db->order) {
+                for (idx size = db_cl_cnt(db); cnt < n && rank + cnt < size; cnt++)
+                        dst[cnt] = rank + cnt;
+        }
+        pthread_mutex_unlock(db->lock);
+        db_read_end(db);
+
+        return cnt;
+}
+
+/**
+ * @brief Adds a client's name to the clients' order (if they are ordered, see \c db_order() ). The caller must hold
+ *        the database's lock, or the client's lock if it's renamed.
+ * @param db The pointer to the database.
+ * @param id The client's id, see \c db_cl_id() .
+ * @param name The client's name.
+ * @retval 0 On success.
+ * @retval EMALLOC If the tree cannot grow. The order is unchanged.
+ * @note A renamed client keeps its place among the clients of the same name, since it keeps its id. Its current name
+ *       must be removed by \c db_order_rm() once the change is done.
+ */
+int db_order_put(const database *db, unsigned long id, const char *name)
+{
+        if (!db->order)
+                return 0;
+
+        pthread_mutex_lock(db->lock);
+        int retval = bt_insert(db->order, name, id);
+        pthread_mutex_unlock(db->lock);
+
+        return retval;
+}
+
+/**
+ * @brief Removes a client's name from the clients' order, see \c db_order_put() .
+ * @param db The pointer to the database.
+ * @param id The client's id.
+ * @param name The name to be removed.
+ */
+void db_order_rm(const database *db, unsigned long id, const char *name)
+{
+        if (!db->order)
+                return;
+
+        pthread_mutex_lock(db->lock);
+        bt_rm(db->order, name, id);
+        pthread_mutex_unlock(db->lock);
+}
+
+/**
+ * @brief Removes clients from the clients' order after they were removed from the client vector. The caller must hold
+ *        the database's lock.
+ * @param db The pointer to the database.
+ * @param gone The removed clients.
+ * @param cnt The number of removed clients.
+ * @note The rest keep their ids, so it costs \c O(log n) steps per removed client, wherever they were.
+ */
+void db_order_splice(const database *db, client *const *gone, size_t cnt)
+{
+        if (!db->order || cnt == 0)
+                return;
+
+        pthread_mutex_lock(db->lock);
+        for (size_t k = 0; k < cnt; k++)
+                bt_rm(db->order, gone[k]->name, gone[k]->id);
+        pthread_mutex_unlock(db->lock);
+}
+
 /**
  * @brief Looks for and modifies a client in the database.
  * @param db The pointer to the source database.
@@ -196,22 +1088,56 @@ operation *db_op_get(const database *db, idx cl, idx cr, idx op)
  * @retval 0 On success.
  * @retval EINV If \c db is \c NULL or at least 1 string is too large.
  * @retval EOOB If the client doesn't exist in the database.
+ * @retval EDUP If the new email address or phone number is unique and another client holds it.
  * @note For input formattting see \c db_cl_add() .
  */
 int db_cl_mod(const database *db, idx cl, const char *name, const char *email, const char *phone)
 {
+        PROBE(PROBE_DB_CL_MOD);
         if (!db || strlen(name) > NAME_SIZE + 1 || strlen(email) > EMAIL_SIZE + 1 || strlen(phone) > PHNUM_SIZE + 1)
                 return EINV;
 
-        client *client = db_cl_get(db, cl);
-        if (!client)
-                return EOOB;
+        db_w_lock(db, cl);
+        client *client = NULL;
+        int retval = db_cl_write(db, cl, &client);
 
-        strcpy(client->name, name);
-        strcpy(client->email, email);
-        strcpy(client->phone, phone);
+        /* The new keys and name are added first, the old ones are only removed once the change cannot fail. */
+        char old[NAME_SIZE + 1] = "";
+        char old_email[EMAIL_SIZE + 1] = "";
+        char old_phone[PHNUM_SIZE + 1] = "";
+        if (!retval) {
+                strcpy(old_email, client->email);
+                strcpy(old_phone, client->phone);
+                retval = db_uniq_put(db, email, phone, old_email, old_phone);
+        }
 
-        return 0;
+        bool renamed = !retval && strcmp(client->name, name) != 0;
+        if (renamed) {
+                strcpy(old, client->name);
+                if ((retval = db_order_put(db, client->id, name)))
+                        db_uniq_rm(db, email, phone, old_email, old_phone);
+        }
+
+        if (!retval) {
+                strcpy(client->name, name);
+                strcpy(client->email, email);
+                strcpy(client->phone, phone);
+                client->dirty = true;
+
+                db_journal(db, "~U>%zu|%s|%s|%s\n", cl, name, email, phone);
+        }
+
+        retval = db_cl_commit(db, cl, client, retval);
+        if (!retval && renamed)
+                db_order_rm(db, client->id, old);
+        if (!retval)
+                db_uniq_rm(db, old_email, old_phone, email, phone);
+        db_w_unlock(db, cl);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
 }
 
 /**
@@ -228,17 +1154,33 @@ int db_cl_mod(const database *db, idx cl, const char *name, const char *email, c
  */
 int db_car_mod(const database *db, idx cl, idx cr, const char *name, const char *plate)
 {
+        PROBE(PROBE_DB_CAR_MOD);
         if (!db || strlen(name) > NAME_SIZE + 1 || strlen(plate) > PLATE_SIZE + 1)
                 return EINV;
 
-        car *car_ = db_car_get(db, cl, cr);
-        if (!car_)
-                return EOOB;
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
 
-        strcpy(car_->name, name);
-        strcpy(car_->plate, plate);
+        car *car_ = retval ? NULL : vct_subptr(client_->cars, cr);
+        if (!retval && !car_)
+                retval = EOOB;
 
-        return 0;
+        if (!retval) {
+                strcpy(car_->name, name);
+                strcpy(car_->plate, plate);
+                client_->dirty = true;
+
+                db_journal(db, "~A>%zu|%zu|%s|%s\n", cl, cr, name, plate);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
 }
 
 /**
@@ -251,29 +1193,44 @@ int db_car_mod(const database *db, idx cl, idx cr, const char *name, const char
  * @param price The operation's new price.
  * @param date The new expiration date (if applicable). Pass to \c NULL to ignore.
  * @retval 0 On success.
- * @retval EINV If \c db is \c NULL or at least 1 string is too large.
+ * @retval EINV If \c db is \c NULL , at least 1 string is too large, or the price or the date is invalid.
  * @retval EOOB If the client/car/operation doesn't exist in the database.
  * @note For input formattting see \c db_op_add() .
  */
 int db_op_mod(const database *db, idx cl, idx car, idx op, const char *desc, double price, const char *date)
 {
-        if (!db || strlen(desc) > NAME_SIZE + 1)
+        PROBE(PROBE_DB_OP_MOD);
+        struct date exp;
+        if (!db || strlen(desc) > DESC_SIZE || db_op_check(price, date, &exp))
                 return EINV;
 
-        operation *op_ = db_op_get(db, cl, car, op);
-        if (!op_)
-                return EOOB;
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
 
-        strcpy(op_->desc, desc);
-        op_->price = price;
+        const struct car *car_ = retval ? NULL : vct_subptr(client_->cars, car);
+        operation *op_ = car_ ? vct_subptr(car_->operations, op) : NULL;
+        if (!retval && !op_)
+                retval = EOOB;
 
-        if (date)
-                op_->date_exp = date_parse(date);
-        else
-                /* Set the first element to 0 to know this is not used. */
-                op_->date_exp.y = 0;
+        if (!retval) {
+                strcpy(op_->desc, desc);
+                op_->price = price;
+                op_->date_exp = exp;
+                client_->dirty = true;
 
-        return 0;
+                char date_exp[17];
+                db_journal_date(&op_->date_exp, date_exp);
+                db_journal(db, "~J>%zu|%zu|%zu|%s|%f|%s\n", cl, car, op, desc, price, date_exp);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
 }
 
 /**
@@ -282,20 +1239,29 @@ int db_op_mod(const database *db, idx cl, idx car, idx op, const char *desc, dou
  * @param cl The client's index in the database.
  * @retval 0 On success.
  * @retval EOOB If the client doesn't exist.
+ * @retval EREALLOC If the client vector of a concurrent database cannot be copied. The client is kept.
  */
 int db_cl_rm(const database *db, idx cl)
 {
+        PROBE(PROBE_DB_CL_RM);
+        db_lock(db);
         client *client = db_cl_get(db, cl);
-        if (!client)
-                return EOOB;
+        int retval = client ? vct_detach(db->cl, cl) : EOOB;
 
-        idx client_cars = client->cars->size;
-        for (size_t i = 0; i < client_cars; i++) {
-                db_car_rm(db, cl, 0);
+        /* The cars are removed together with the client, so they are not journaled one by one. */
+        if (!retval) {
+                db_order_splice(db, &client, 1);
+                db_uniq_rm(db, client->email, client->phone, NULL, NULL);
+                db_cl_release(db, client);
+                db_journal(db, "-U>%zu\n", cl);
         }
 
-        vct_del(client->cars);
-        return vct_rm(db->cl, cl);
+        db_unlock(db);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
 }
 
 /**
@@ -309,13 +1275,33 @@ int db_cl_rm(const database *db, idx cl)
  */
 int db_car_rm(const database *db, idx cl, idx cr)
 {
-        client *client = db_cl_get(db, cl);
-        car *car_ = db_car_get(db, cl, cr);
-        if (!client || !car_)
-                return EOOB;
+        PROBE(PROBE_DB_CAR_RM);
+        db_w_lock(db, cl);
+        client *client = NULL;
+        int retval = db_cl_write(db, cl, &client);
+
+        car *car_ = retval ? NULL : vct_subptr(client->cars, cr);
+        if (!retval && !car_)
+                retval = EOOB;
+
+        if (!retval) {
+                PROBE_FREE(PROBE_MEM_OP, car_->operations->size * sizeof(operation), car_->operations->size);
+                PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                vct_del(car_->operations);
+                retval = vct_rm(client->cars, cr);
+                client->dirty = true;
+        }
+
+        if (!retval)
+                db_journal(db, "-A>%zu|%zu\n", cl, cr);
 
-        vct_del(car_->operations);
-        return vct_rm(client->cars, cr);
+        retval = db_cl_commit(db, cl, client, retval);
+        db_w_unlock(db, cl);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
 }
 
 /**
@@ -330,11 +1316,129 @@ int db_car_rm(const database *db, idx cl, idx cr)
  */
 int db_op_rm(const database *db, idx cl, idx cr, idx op)
 {
-        car *car_ = db_car_get(db, cl, cr);
-        if (!car_)
-                return EOOB;
+        PROBE(PROBE_DB_OP_RM);
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        int retval = db_cl_write(db, cl, &client_);
+
+        car *car_ = retval ? NULL : vct_subptr(client_->cars, cr);
+        if (!retval && !car_)
+                retval = EOOB;
+
+        if (!retval) {
+                retval = vct_rm(car_->operations, op);
+                client_->dirty = true;
+        }
+
+        if (!retval) {
+                PROBE_FREE(PROBE_MEM_OP, sizeof(operation), 1);
+                db_journal(db, "-J>%zu|%zu|%zu\n", cl, cr, op);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (!retval)
+                db_changed(db);
+
+        return retval;
+}
+
+/**
+ * @brief Takes a point-in-time snapshot of a database.
+ * @details The snapshot shares the clients with the database instead of copying them. A shared client is copied by the
+ *          next mutation (see \c db_cl_write() ), so the snapshot keeps seeing the original. Taking a snapshot only
+ *          costs a pointer per client, so it can be saved in the background while the database is being edited.
+ * @param db The pointer to the database, locked by \c db_lock() .
+ * @return The snapshot on success, \c NULL if it cannot be allocated or a changed client cannot be loaded.
+ * @note The snapshot has no journal and no loader, its changed clients are loaded here. It must only be read, and it
+ *       must be released by \c db_snap_rel() before the database is deleted.
+ */
+database *db_snap(database *db)
+{
+        for (idx i = 0; i < db->cl->size; i++) {
+                if (db_cl_get(db, i)->dirty && db_cl_load_locked(db, i))
+                        return NULL;
+        }
+
+        database *snap = malloc(sizeof(database));
+        if (!snap)
+                return NULL;
 
-        return vct_rm(car_->operations, op);
+        *snap = *db;
+        snap->cl = vct();
+        snap->order = NULL;
+        snap->uniq[DB_UNIQ_EMAIL] = NULL;
+        snap->uniq[DB_UNIQ_PHONE] = NULL;
+        snap->journal = NULL;
+        snap->loader = NULL;
+        snap->on_change = NULL;
+        snap->snapshot = true;
+
+        if (!snap->cl || vct_reserve(snap->cl, db->cl->size)) {
+                vct_del(snap->cl);
+                free(snap);
+                return NULL;
+        }
+
+        pthread_mutex_lock(db->lock);
+        for (idx i = 0; i < db->cl->size; i++) {
+                client *cl = db_cl_get(db, i);
+                cl->refs++;
+                vct_push(snap->cl, cl);
+        }
+        pthread_mutex_unlock(db->lock);
+
+        return snap;
+}
+
+/**
+ * @brief Pins the current version of a database for a long-running reader, e.g. a report.
+ * @details The version is a snapshot (see \c db_snap() ): the writers keep working on the database, and a client they
+ *          modify or remove is copied or unlinked instead, so the version doesn't change under the reader. The old
+ *          client versions are freed when the last snapshot holding them is released.\n
+ *          Unlike the snapshots of the background save, the version loads its unloaded clients on access. A loaded copy
+ *          belongs to the version, so the database doesn't grow because of a report.
+ * @param db The pointer to the database.
+ * @return The version on success, \c NULL if it cannot be allocated. It must be released by \c db_snap_rel() .
+ * @note The writers only wait while the client pointers are copied, never for the reader. A version must be read by
+ *       one thread at a time.
+ */
+database *db_pin(database *db)
+{
+        db_lock(db);
+        database *ver = db_snap(db);
+        db_unlock(db);
+
+        if (ver)
+                ver->loader = db->loader;
+
+        return ver;
+}
+
+/**
+ * @brief Releases a snapshot taken by \c db_snap() .
+ * @details The clients that were copied or removed in the database since the snapshot was taken are freed.
+ * @param snap The pointer to the snapshot.
+ * @note Can be called from any thread.
+ */
+void db_snap_rel(database *snap)
+{
+        if (!snap)
+                return;
+
+        pthread_mutex_lock(snap->lock);
+        for (idx i = 0; i < snap->cl->size; i++) {
+                client *cl = db_cl_get(snap, i);
+                if (--cl->refs == 0)
+                        db_cl_drop(snap, cl);
+        }
+        pthread_mutex_unlock(snap->lock);
+
+        /* The clients are released above, only the vector is freed. */
+        snap->cl->size = 0;
+        vct_del(snap->cl);
+        free(snap);
 }
 
 /**
@@ -342,18 +1446,44 @@ int db_op_rm(const database *db, idx cl, idx cr, idx op)
  * @param db The pointer to the database to be destroyed.
  * @retval 0 On success
  * @retval EINV If \c db is \c NULL .
+ * @note The other threads must have stopped using the database.
  */
 int db_del(database *db)
 {
         if (!db)
                 return EINV;
 
-        const size_t cl_size = db->cl->size;
-        for (idx cl = 0; cl < cl_size; cl++) {
-                db_cl_rm(db, 0);
+        /* The database owns the journal. */
+        if (db->journal) {
+                fclose(db->journal);
+                db->journal = NULL;
         }
 
+        /* The clients are released at once, removing them one by one would shift the rest every time. */
+        for (idx cl = 0; cl < db->cl->size; cl++)
+                db_cl_release(db, db_cl_get(db, cl));
+
+        db->cl->size = 0;
         vct_del(db->cl);
+        bt_del(db->order);
+        hmap_del(db->uniq[DB_UNIQ_EMAIL]);
+        hmap_del(db->uniq[DB_UNIQ_PHONE]);
+
+        /* Free what the readers have left behind. */
+        if (db->concurrent)
+                epoch_flush();
+
+        if (!db->snapshot) {
+                pthread_mutex_destroy(db->lock);
+                pthread_rwlock_destroy(db->rw);
+                for (size_t i = 0; i < DB_STRIPES; i++)
+                        pthread_mutex_destroy(&db->stripes[i]);
+
+                free(db->lock);
+                free(db->rw);
+                free(db->stripes);
+        }
+
         free(db);
 
         /* To avoid calling this function twice, set db to NULL.*/
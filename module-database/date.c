@@ -4,6 +4,8 @@
  * @details The functions defined in here manage the custom date structure, which is based on \c struct \c tm .
  */
 
+#include "../include/platform.h"
+
 #include "include/date.h"
 
 /**
@@ -14,7 +16,15 @@
 date date_now(void)
 {
         const time_t now = time(NULL);
-        const struct tm *src = localtime(&now);
+        struct tm tm_now;
+
+        /* localtime() returns a shared buffer, the writer threads would overwrite each other's. */
+#ifdef _WIN32
+        localtime_s(&tm_now, &now);
+#else
+        localtime_r(&now, &tm_now);
+#endif
+        const struct tm *src = &tm_now;
         /*
          * struct tm handles time differently:
          * tm_year is 0 when its 1900
@@ -41,6 +51,61 @@ date date_parse(const char *str)
         return ret;
 }
 
+/**
+ * @brief Strictly parses a date in a YYYY-MM-DD HH:MM format.
+ * @details Unlike \c date_parse() , this function doesn't use \c sscanf() . The digits are validated and converted
+ *          in a single pass without branching on every character, which makes it considerably faster on large
+ *          imports. On valid input the result is identical to \c date_parse() .
+ * @param str The date to be parsed. Exactly 16 characters long, every field is zero padded.
+ * @param dst Pointer to the destination date structure.
+ * @retval 0 On success.
+ * @retval EINV If the format is incorrect or a field is out of range, the year \c 0 and the days past the end of the
+ *              month included. \c dst is not modified in this case.
+ */
+int date_parse_strict(const char *str, date *dst)
+{
+        static const char layout[] = "0000-00-00 00:00";
+        static const int mdays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+        if (strlen(str) != sizeof(layout) - 1)
+                return EINV;
+
+        unsigned bad = 0;
+        int digit[sizeof(layout) - 1];
+
+        for (size_t i = 0; i < sizeof(layout) - 1; i++) {
+                digit[i] = (unsigned char)str[i] - '0';
+
+                /* Separators must match exactly, everything else must be a digit. */
+                if (layout[i] == '0')
+                        bad |= (unsigned)digit[i] > 9;
+                else
+                        bad |= str[i] != layout[i];
+        }
+
+        if (bad)
+                return EINV;
+
+        date ret;
+        ret.y = digit[0] * 1000 + digit[1] * 100 + digit[2] * 10 + digit[3];
+        ret.mon = digit[5] * 10 + digit[6];
+        ret.d = digit[8] * 10 + digit[9];
+        ret.h = digit[11] * 10 + digit[12];
+        ret.min = digit[14] * 10 + digit[15];
+
+        /* The year 0 marks the dates that aren't set, see \c db_journal_date() . */
+        if (ret.y == 0 || ret.mon < 1 || ret.mon > 12 || ret.d < 1 || ret.d > mdays[ret.mon - 1] || ret.h > 23 ||
+            ret.min > 59)
+                return EINV;
+
+        /* February 29 only exists in the leap years. */
+        if (ret.mon == 2 && ret.d == 29 && (ret.y % 4 != 0 || (ret.y % 100 == 0 && ret.y % 400 != 0)))
+                return EINV;
+
+        *dst = ret;
+        return 0;
+}
+
 /**
  * @brief Similarly to \c asctime() , this function makes a user-readable string from a date.
  * @param date The date to be 'printed'.
@@ -50,29 +115,43 @@ date date_parse(const char *str)
  */
 void date_printf(const date *date, char *dst)
 {
-        snprintf(dst, 17, "%d-%02d-%02d %02d:%02d", date->y, date->mon, date->d, date->h, date->min);
+        snprintf(dst, 17, "%04d-%02d-%02d %02d:%02d", date->y, date->mon, date->d, date->h, date->min);
+}
+
+/**
+ * @brief Counts the days from 1970-01-01 to a day of the (proleptic) Gregorian calendar.
+ * @param y The year.
+ * @param mon The month, out of range months are carried into the year like \c mktime() does.
+ * @param d The day of the month, may be out of range too.
+ * @return The number of days, negative before 1970.
+ */
+long date_days(long y, long mon, long d)
+{
+        /* Floor division, so the negative months are carried correctly. */
+        long carry = mon >= 1 ? (mon - 1) / 12 : -((12 - mon) / 12);
+        y += carry;
+        mon -= carry * 12;
+
+        /* The year is counted from March, so the leap day is the last day of the year. */
+        y -= mon <= 2;
+        long era = (y >= 0 ? y : y - 399) / 400;
+        long yoe = y - era * 400;
+        long doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + d - 1;
+        long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+        return era * 146097 + doe - 719468;
 }
 
 /**
  * @brief Calculates the difference between date and date2.
  * @return The time difference in days.
+ * @note It's plain calendar arithmetic instead of \c mktime() , which takes a process-wide lock for the time zone,
+ *       so the searches' parallel scans don't wait for each other.
  */
 double date_diff(const date *d1, const date *d2)
 {
-        struct tm t1 = {0};
-        t1.tm_year = d1->y - 1900;
-        t1.tm_mon = d1->mon - 1;
-        t1.tm_mday = d1->d;
-        t1.tm_hour = d1->h;
-        t1.tm_min = d1->min;
-
-        struct tm t2 = {0};
-        t2.tm_year = d2->y - 1900;
-        t2.tm_mon = d2->mon - 1;
-        t2.tm_mday = d2->d;
-        t2.tm_hour = d2->h;
-        t2.tm_min = d2->min;
-
-        double ret = difftime(mktime(&t1), mktime(&t2)) / (60 * 60 * 24);
-        return ret;
+        long days = date_days(d1->y, d1->mon, d1->d) - date_days(d2->y, d2->mon, d2->d);
+        long mins = (long)(d1->h - d2->h) * 60 + (d1->min - d2->min);
+
+        return (double)(days * 60 * 60 * 24 + mins * 60) / (60 * 60 * 24);
 }
@@ -0,0 +1,227 @@
+/**
+ * @file epoch.c
+ * @brief Epoch-based memory reclamation.
+ * @details Readers of a concurrent database don't take locks, so a writer can't free a client or a pointer array it
+ *          has replaced: a reader may still be using it. The writer retires the block instead, and it's freed once
+ *          every reader that could have seen it has left its read section.\n
+ *          There is a global epoch counter. A reader announces the epoch it has seen in its own slot when it enters a
+ *          read section ( \c epoch_enter() ), and clears the slot when it leaves ( \c epoch_exit() ). The global epoch
+ *          is only advanced when every active reader has seen the current one. A block retired in epoch \c e was
+ *          unlinked before any reader of epoch \c e+1 entered, so it's freed when the global epoch reaches \c e+2 .\n
+ *          Entering and leaving a read section costs two stores in the thread's own slot, reading is lock-free. A
+ *          reader that stays in its read section for a long time only delays the reclamation.
+ * @note The retired blocks of every database share the same list. A thread gets its slot on its first read section
+ *       and gives it back when it exits.
+ */
+
+#include "../include/platform.h"
+
+#include <sched.h>
+
+#include "include/epoch.h"
+
+/**
+ * @struct epoch_slot epoch.c
+ * @brief A reader thread's announced epoch. Padded to a cache line, so the readers don't share lines.
+ */
+typedef struct epoch_slot {
+        unsigned long epoch;    /**< The epoch seen by the reader, \c 0 if it's outside of a read section. */
+        bool used;              /**< Set if a thread owns the slot. */
+        char pad[64 - sizeof(unsigned long) - sizeof(bool)];    /**< Padding to 64 bytes. */
+} epoch_slot;
+
+/**
+ * @struct epoch_node epoch.c
+ * @brief A retired block waiting for the readers.
+ */
+typedef struct epoch_node {
+        void *ptr;                      /**< The retired block. */
+        void (*free_fn)(void *);        /**< Frees the block. */
+        unsigned long epoch;            /**< The global epoch when the block was retired. */
+        struct epoch_node *next;        /**< The block retired before this one. */
+} epoch_node;
+
+static unsigned long epoch_global = 1;
+static epoch_slot epoch_slots[EPOCH_SLOTS];
+
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_node *epoch_retired;       /**< Newest first, so the epochs are decreasing. Protected by epoch_lock. */
+static size_t epoch_pending;            /**< Length of epoch_retired. Protected by epoch_lock. */
+
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static THREAD_LOCAL epoch_slot *epoch_self;
+static THREAD_LOCAL unsigned epoch_depth;
+
+/**
+ * @brief Gives a slot back when its thread exits. The destructor of \c epoch_key .
+ * @param slot Pointer to the slot.
+ */
+void epoch_release(void *slot)
+{
+        epoch_slot *self = slot;
+        __atomic_store_n(&self->epoch, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&self->used, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates \c epoch_key . Called once.
+ */
+void epoch_init(void)
+{
+        pthread_key_create(&epoch_key, epoch_release);
+}
+
+/**
+ * @brief Finds a free slot for the calling thread. Waits if every slot is taken.
+ * @return Pointer to the slot.
+ */
+epoch_slot *epoch_claim(void)
+{
+        pthread_once(&epoch_once, epoch_init);
+
+        for (;;) {
+                for (size_t i = 0; i < EPOCH_SLOTS; i++) {
+                        bool expected = false;
+                        if (__atomic_compare_exchange_n(&epoch_slots[i].used, &expected, true, false,
+                                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                                pthread_setspecific(epoch_key, &epoch_slots[i]);
+                                return &epoch_slots[i];
+                        }
+                }
+
+                sched_yield();
+        }
+}
+
+/**
+ * @brief Enters a read section. The blocks retired from now on are not freed until \c epoch_exit() .
+ * @note Read sections can be nested, only the outermost one counts.
+ */
+void epoch_enter(void)
+{
+        if (epoch_depth++ > 0)
+                return;
+
+        if (!epoch_self)
+                epoch_self = epoch_claim();
+
+        unsigned long e = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&epoch_self->epoch, e, __ATOMIC_RELAXED);
+
+        /* The announcement must be visible before anything is read in the section. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Leaves a read section. The pointers read in it must not be used anymore.
+ */
+void epoch_exit(void)
+{
+        if (epoch_depth == 0 || --epoch_depth > 0)
+                return;
+
+        __atomic_store_n(&epoch_self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Advances the global epoch, if every active reader has seen the current one.
+ */
+void epoch_advance(void)
+{
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        unsigned long e = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+
+        for (size_t i = 0; i < EPOCH_SLOTS; i++) {
+                if (!__atomic_load_n(&epoch_slots[i].used, __ATOMIC_ACQUIRE))
+                        continue;
+
+                unsigned long seen = __atomic_load_n(&epoch_slots[i].epoch, __ATOMIC_ACQUIRE);
+                if (seen != 0 && seen != e)
+                        return;
+        }
+
+        __atomic_compare_exchange_n(&epoch_global, &e, e + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Frees the retired blocks no reader can see anymore.
+ */
+void epoch_collect(void)
+{
+        epoch_advance();
+
+        pthread_mutex_lock(&epoch_lock);
+        unsigned long e = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+
+        /* The list is ordered by epoch, so everything after the first old enough block is old enough too. */
+        epoch_node **link = &epoch_retired;
+        while (*link && (*link)->epoch + 2 > e)
+                link = &(*link)->next;
+
+        epoch_node *old = *link;
+        *link = NULL;
+        for (epoch_node *node = old; node; node = node->next)
+                epoch_pending--;
+        pthread_mutex_unlock(&epoch_lock);
+
+        while (old) {
+                epoch_node *next = old->next;
+                old->free_fn(old->ptr);
+                free(old);
+                old = next;
+        }
+}
+
+/**
+ * @brief Frees a block once the readers that could have seen it have left their read sections.
+ * @param ptr The block, it must already be unreachable for new readers.
+ * @param free_fn The function that frees the block.
+ * @note If the list node cannot be allocated, waits for the readers and frees the block right away. A reader can't wait
+ *       for itself, the block is leaked in that case.
+ */
+void epoch_retire(void *ptr, void (*free_fn)(void *))
+{
+        if (!ptr)
+                return;
+
+        epoch_node *node = malloc(sizeof(epoch_node));
+        if (!node) {
+                /* Two advances make every current reader leave, unless the caller is one of them. */
+                unsigned long target = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE) + 2;
+                while (epoch_depth == 0 && __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE) < target) {
+                        epoch_advance();
+                        sched_yield();
+                }
+
+                if (epoch_depth == 0)
+                        free_fn(ptr);
+                return;
+        }
+
+        node->ptr = ptr;
+        node->free_fn = free_fn;
+
+        /* The block was unlinked before the epoch is read, see epoch_enter() for the other side. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        pthread_mutex_lock(&epoch_lock);
+        node->epoch = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+        node->next = epoch_retired;
+        epoch_retired = node;
+        bool due = ++epoch_pending % EPOCH_BATCH == 0;
+        pthread_mutex_unlock(&epoch_lock);
+
+        if (due)
+                epoch_collect();
+}
+
+/**
+ * @brief Frees every retired block that isn't protected by an active read section.
+ * @note Used when the database is deleted. Without readers every retired block is freed.
+ */
+void epoch_flush(void)
+{
+        for (int i = 0; i < 3; i++)
+                epoch_collect();
+}
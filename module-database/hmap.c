@@ -0,0 +1,218 @@
+/**
+ * @file hmap.c
+ * @brief String keyed hash map implementation.
+ * @details Open addressing with linear probing. The table is kept at most half full, so a lookup usually touches one or
+ *          two slots. The keys are copied to the heap, the values are plain indexes (e.g. a client's index).
+ */
+
+#include "../include/platform.h"
+
+#include "include/hmap.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @brief Hashes a string. (64 bit FNV-1a)
+ * @param key The string to be hashed.
+ * @return The hash of \c key .
+ */
+size_t hmap_hash(const char *key)
+{
+        unsigned long long hash = 14695981039346656037ULL;
+        for (const unsigned char *c = (const unsigned char *)key; *c; c++)
+                hash = (hash ^ *c) * 1099511628211ULL;
+
+        return (size_t)hash;
+}
+
+/**
+ * @brief Allocates and initializes a hash map on the heap.
+ * @param hint The expected number of keys. The map grows past it if needed.
+ * @return The hash map on success, \c NULL if it cannot be allocated.
+ */
+hmap *hmap_init(size_t hint)
+{
+        hmap *m = malloc(sizeof(hmap));
+        if (!m)
+                return NULL;
+
+        m->cap = 16;
+        while (m->cap < hint * 2)
+                m->cap *= 2;
+
+        m->size = 0;
+        m->slots = calloc(m->cap, sizeof(hmap_entry));
+        if (!m->slots) {
+                free(m);
+                return NULL;
+        }
+
+        PROBE_ALLOC(PROBE_MEM_INDEX, sizeof(hmap) + m->cap * sizeof(hmap_entry), 0);
+        return m;
+}
+
+/**
+ * @brief Finds the slot of a key.
+ * @param m Pointer to the hash map.
+ * @param key The key to be found.
+ * @param hash The hash of \c key .
+ * @return The slot of \c key , or the empty slot where it should be inserted.
+ */
+hmap_entry *hmap_slot(const hmap *m, const char *key, size_t hash)
+{
+        size_t mask = m->cap - 1;
+        size_t i = hash & mask;
+
+        while (m->slots[i].key && (m->slots[i].hash != hash || strcmp(m->slots[i].key, key) != 0))
+                i = (i + 1) & mask;
+
+        return &m->slots[i];
+}
+
+/**
+ * @brief Doubles the number of slots of a hash map.
+ * @param m Pointer to the hash map.
+ * @retval 0 On success.
+ * @retval EMALLOC If the new slots cannot be allocated. The map is left intact.
+ */
+int hmap_grow(hmap *m)
+{
+        hmap old = *m;
+
+        m->slots = calloc(old.cap * 2, sizeof(hmap_entry));
+        if (!m->slots) {
+                m->slots = old.slots;
+                return EMALLOC;
+        }
+
+        m->cap = old.cap * 2;
+        for (size_t i = 0; i < old.cap; i++) {
+                if (old.slots[i].key)
+                        *hmap_slot(m, old.slots[i].key, old.slots[i].hash) = old.slots[i];
+        }
+
+        PROBE_ALLOC(PROBE_MEM_INDEX, old.cap * sizeof(hmap_entry), 0);
+        free(old.slots);
+        return 0;
+}
+
+/**
+ * @brief Stores a value with a key. An existing key's value is overwritten.
+ * @param m Pointer to the hash map.
+ * @param key The key.
+ * @param val The value.
+ * @retval 0 On success.
+ * @retval EINV If \c m or \c key is \c NULL .
+ * @retval EMALLOC If the key cannot be copied or the map cannot grow. An existing key's value is always overwritten.
+ */
+int hmap_put(hmap *m, const char *key, idx val)
+{
+        if (!m || !key)
+                return EINV;
+
+        size_t hash = hmap_hash(key);
+        hmap_entry *slot = hmap_slot(m, key, hash);
+
+        /* Only a new key grows the map, so overwriting a value cannot fail. */
+        if (!slot->key && (m->size + 1) * 2 > m->cap) {
+                if (hmap_grow(m))
+                        return EMALLOC;
+
+                slot = hmap_slot(m, key, hash);
+        }
+
+        if (!slot->key) {
+                size_t len = strlen(key) + 1;
+                slot->key = malloc(len);
+                if (!slot->key)
+                        return EMALLOC;
+
+                memcpy(slot->key, key, len);
+                slot->hash = hash;
+                m->size++;
+                PROBE_ALLOC(PROBE_MEM_INDEX, len, 1);
+        }
+
+        slot->val = val;
+        return 0;
+}
+
+/**
+ * @brief Looks up a key.
+ * @param m Pointer to the hash map.
+ * @param key The key.
+ * @param val Pointer to the destination of the value. Not modified if the key isn't found.
+ * @return \c true if the key is found, \c false if not.
+ */
+bool hmap_get(const hmap *m, const char *key, idx *val)
+{
+        if (!m || !key)
+                return false;
+
+        const hmap_entry *slot = hmap_slot(m, key, hmap_hash(key));
+        if (!slot->key)
+                return false;
+
+        *val = slot->val;
+        return true;
+}
+
+/**
+ * @brief Removes a key with its value.
+ * @details The entries after the removed one are moved back into the gap, until an empty slot or an entry that is
+ *          already at its home slot, so the lookups never stop at a hole and no tombstones are needed.
+ * @param m Pointer to the hash map.
+ * @param key The key.
+ * @return \c true if the key was removed, \c false if it wasn't found.
+ */
+bool hmap_rm(hmap *m, const char *key)
+{
+        if (!m || !key)
+                return false;
+
+        hmap_entry *slot = hmap_slot(m, key, hmap_hash(key));
+        if (!slot->key)
+                return false;
+
+        size_t len = strlen(slot->key) + 1;
+        free(slot->key);
+        slot->key = NULL;
+        m->size--;
+        PROBE_FREE(PROBE_MEM_INDEX, len, 1);
+
+        size_t mask = m->cap - 1;
+        size_t gap = (size_t)(slot - m->slots);
+        for (size_t i = (gap + 1) & mask; m->slots[i].key; i = (i + 1) & mask) {
+                /* An entry may fill the gap if its home slot isn't between the gap and itself. */
+                size_t home = m->slots[i].hash & mask;
+                if (((i - home) & mask) < ((i - gap) & mask))
+                        continue;
+
+                m->slots[gap] = m->slots[i];
+                m->slots[i].key = NULL;
+                gap = i;
+        }
+
+        return true;
+}
+
+/**
+ * @brief Frees a hash map with all of its keys.
+ * @param m Pointer to the hash map to be deleted.
+ */
+void hmap_del(hmap *m)
+{
+        if (!m)
+                return;
+
+        size_t keys = 0;
+        for (size_t i = 0; i < m->cap; i++) {
+                if (m->slots[i].key)
+                        keys += strlen(m->slots[i].key) + 1;
+
+                free(m->slots[i].key);
+        }
+
+        PROBE_FREE(PROBE_MEM_INDEX, sizeof(hmap) + m->cap * sizeof(hmap_entry) + keys, m->size);
+        free(m->slots);
+        free(m);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file btree.h
+ * @brief B+-tree struct definitions and function prototypes.
+ * @details Defines an ordered, string keyed container used to walk database objects in the order of their keys
+ *          without sorting them. The entries are identified by their keys and ids. See \c btree.c .
+ */
+
+#ifndef REPAIRSHOP_BTREE_H
+#define REPAIRSHOP_BTREE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../../include/errorcodes.h"
+#include "vector.h"
+
+#define BT_ORDER 32                     /**< The most entries of a leaf and the most children of an inner node. */
+#define BT_MIN (BT_ORDER / 2)           /**< The fewest entries or children of a node, except the root. */
+#define BT_KEY_SIZE 128                 /**< The size of the longest key, with its terminating null. */
+#define BT_DEPTH 16                     /**< The most levels of a tree, more than enough for \c SIZE_MAX entries. */
+
+/**
+ * @struct bt_entry btree.h
+ * @brief An entry of a leaf.
+ */
+typedef struct bt_entry {
+        char *key;              /**< The key on the heap. */
+        unsigned long id;       /**< The id of the keyed object (e.g. a client's id), orders the equal keys. */
+} bt_entry;
+
+/**
+ * @struct bt_sep btree.h
+ * @brief A separator of an inner node: the lower bound of a child's entries.
+ * @note A copy of a key, so removing the entry it was taken from doesn't invalidate it.
+ */
+typedef struct bt_sep {
+        char key[BT_KEY_SIZE];  /**< The key of the bound. */
+        unsigned long id;       /**< The id of the bound. */
+} bt_sep;
+
+/**
+ * @struct bt_node btree.h
+ * @brief The common head of the leaves and the inner nodes.
+ */
+typedef struct bt_node {
+        bool leaf;              /**< Set if the node is a \c bt_leaf , cleared if it's a \c bt_inner . */
+        unsigned n;             /**< The number of entries of a leaf, or the number of children of an inner node. */
+} bt_node;
+
+/**
+ * @struct bt_leaf btree.h
+ * @brief A leaf: a sorted run of entries. The leaves are chained in the order of their keys.
+ */
+typedef struct bt_leaf {
+        bt_node head;           /**< The node's head. */
+        struct bt_leaf *next;   /**< The next leaf, \c NULL for the last one. */
+        bt_entry e[BT_ORDER];   /**< The entries, sorted. */
+} bt_leaf;
+
+/**
+ * @struct bt_inner btree.h
+ * @brief An inner node. The number of entries under every child is kept, so an entry can be found by its rank.
+ */
+typedef struct bt_inner {
+        bt_node head;                   /**< The node's head. */
+        bt_node *child[BT_ORDER];       /**< The children, sorted. */
+        size_t cnt[BT_ORDER];           /**< The number of entries under each child. */
+        bt_sep sep[BT_ORDER];           /**< \c sep[i] is the lower bound of \c child[i] , \c sep[0] is unused. */
+} bt_inner;
+
+/**
+ * @struct btree btree.h
+ * @brief A B+-tree. The entries are ordered by their keys case-insensitively, then by their ids.
+ */
+typedef struct btree {
+        bt_node *root;          /**< The root, an empty leaf in an empty tree. */
+        size_t size;            /**< The number of entries. */
+} btree;
+
+/**
+ * @struct bt_iter btree.h
+ * @brief A position in a tree, for walking its entries in order. Invalidated by the tree's next modification.
+ */
+typedef struct bt_iter {
+        const bt_leaf *leaf;    /**< The leaf of the next entry, \c NULL at the end. */
+        unsigned pos;           /**< The next entry's position in \c leaf . */
+} bt_iter;
+
+btree *bt_init(void);
+int bt_insert(btree *t, const char *key, unsigned long id);
+bool bt_find(const btree *t, const char *key, unsigned long id);
+bool bt_rm(btree *t, const char *key, unsigned long id);
+
+bool bt_seek(const btree *t, size_t rank, bt_iter *it);
+const bt_entry *bt_next(bt_iter *it);
+
+void bt_del(btree *t);
+
+#endif //REPAIRSHOP_BTREE_H
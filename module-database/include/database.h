@@ -9,8 +9,11 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "vector.h"
+#include "btree.h"
+#include "hmap.h"
 #include "date.h"
 
 #define NAME_SIZE 100   /**< Size of a name string. */
@@ -18,6 +21,17 @@
 #define PLATE_SIZE 15   /**< Size of a car plate string. */
 #define DESC_SIZE 100   /**< Size of a description string. */
 #define PHNUM_SIZE 20   /**< Size of a phone number string. */
+#define PRICE_MAX 1e12  /**< The largest absolute value of a price, so its \c %f form fits a journal record. */
+
+#define DB_STRIPES 64   /**< Number of client locks. The writers of a client take \c stripes[cl % DB_STRIPES] . */
+
+/**
+ * @enum db_uniq_field database.h
+ * @brief The client fields that can be made unique, see \c db_unique() .
+ */
+typedef enum db_uniq_field {
+        DB_UNIQ_EMAIL, DB_UNIQ_PHONE, DB_UNIQ_FIELDS
+} db_uniq_field;
 
 /**
  * @struct database database.h
@@ -27,6 +41,19 @@ typedef struct database {
         char name[NAME_SIZE + 1];       /**< The database's name */
         char desc[DESC_SIZE + 1];       /**< The database's description. */
         vector *cl;              /**< The database's client vector. */
+        btree *order;            /**< The clients' ids ordered by their names, \c NULL until \c db_order() . */
+        hmap *uniq[DB_UNIQ_FIELDS];     /**< The unique indexes, \c NULL if a field isn't unique, see \c uniq.c . */
+        FILE *journal;           /**< Mutation journal stream, \c NULL if journaling is disabled. */
+        unsigned long gen;       /**< Checkpoint generation of the last loaded or saved snapshot. */
+        /** Loads a client's cars and operations on demand, \c NULL if every client is loaded. */
+        int (*loader)(const struct database *db, idx cl);
+        /** Called after every journaled mutation, \c NULL if unused. */
+        void (*on_change)(const struct database *db);
+        pthread_mutex_t *lock;   /**< Protects the clients shared with snapshots. Shared by the snapshots. */
+        pthread_rwlock_t *rw;    /**< Held exclusively by structural changes, shared by client writers. See \c db_lock() . */
+        pthread_mutex_t *stripes;       /**< The client locks, see \c db_w_lock() . */
+        bool snapshot;           /**< Set if this is a snapshot of another database, see \c db_snap() . */
+        bool concurrent;         /**< Set if other threads read the database, see \c db_concurrent() . */
 } database;
 
 /**
@@ -37,7 +64,15 @@ typedef struct client {
         char name[NAME_SIZE + 1];       /**< The client's name */
         char email[EMAIL_SIZE + 1];     /**< The client's email address. */
         char phone[PHNUM_SIZE + 1];     /**< The client's phone number. */
+        unsigned long id;        /**< The client's id, ascending in the client vector. See \c db_cl_id() . */
         vector *cars;            /**< This client's car vector. */
+        bool loaded;             /**< Cleared if the client's cars and operations haven't been loaded yet. */
+        idx lazy_cars;           /**< The number of cars in the snapshot, while the client isn't loaded. */
+        bool dirty;              /**< Set if the client has changed since the last snapshot. */
+        unsigned refs;           /**< Number of databases holding the client: the live one and the snapshots. */
+        unsigned shard;          /**< The snapshot file (shard) that holds the client's block. */
+        long blk_off;            /**< Offset of the client's block in the last snapshot. */
+        size_t blk_len;          /**< Length of the client's block in the last snapshot, \c 0 if it has none. */
 } client;
 
 /**
@@ -64,11 +99,28 @@ typedef struct operation {
 } operation;
 
 database *db_init(const char *name, const char *desc);
+int db_mod(database *db, const char *name, const char *desc);
+void db_journal(const database *db, const char *fmt, ...);
+void db_journal_date(const date *date, char *dst);
+
+void db_concurrent(database *db);
+void db_read_begin(const database *db);
+void db_read_end(const database *db);
+void db_lock(const database *db);
+void db_unlock(const database *db);
 
 int db_cl_add(const database *db, const char *name, const char *email, const char *phone);
 int db_car_add(const database *db, idx cl, const char *name, const char *plate);
+int db_op_check(double price, const char *date, struct date *dst);
 int db_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date);
 
+int db_cl_load(const database *db, idx cl);
+int db_cl_own(const database *db, idx cl);
+idx db_cl_cnt(const database *db);
+int db_order(database *db);
+size_t db_cl_ordered(const database *db, idx rank, idx *dst, size_t n);
+idx db_car_cnt(const database *db, idx cl);
+
 client *db_cl_get(const database *db, idx cl);
 car *db_car_get(const database *db, idx cl, idx car);
 operation *db_op_get(const database *db, idx cl, idx cr, idx op);
@@ -81,5 +133,25 @@ int db_cl_rm(const database *db, idx cl);
 int db_car_rm(const database *db, idx cl, idx cr);
 int db_op_rm(const database *db, idx cl, idx cr, idx op);
 
+/* The building blocks of the mutations, used by the batched ones too (see tx.c and purge.c ). */
+void db_w_lock(const database *db, idx cl);
+void db_w_unlock(const database *db, idx cl);
+int db_cl_load_locked(const database *db, idx cl);
+int db_cl_copy(const database *db, idx cl, client **dst);
+int db_cl_write(const database *db, idx cl, client **dst);
+int db_cl_commit(const database *db, idx cl, client *new, int err);
+void db_cl_free(client *cl);
+void db_cl_release(const database *db, client *cl);
+void db_changed(const database *db);
+unsigned long db_cl_id(void);
+bool db_cl_find(const database *db, unsigned long id, idx *dst);
+int db_order_put(const database *db, unsigned long id, const char *name);
+void db_order_rm(const database *db, unsigned long id, const char *name);
+void db_order_splice(const database *db, client *const *gone, size_t cnt);
+
+database *db_snap(database *db);
+database *db_pin(database *db);
+void db_snap_rel(database *snap);
+
 int db_del(database *db);
 #endif //REPAIRSHOP_DATABASE_H
@@ -8,6 +8,9 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "../../include/errorcodes.h"
 
 /**
  * @struct date date.h
@@ -23,6 +26,7 @@ typedef struct date {
 
 date date_now(void);
 date date_parse(const char *str);
+int date_parse_strict(const char *str, date *dst);
 void date_printf(const date *date, char *dst);
 double date_diff(const date *d1, const date *d2);
 
@@ -0,0 +1,21 @@
+/**
+ * @file epoch.h
+ * @brief Epoch-based memory reclamation, function prototypes.
+ * @details See \c epoch.c for the details.
+ */
+
+#ifndef REPAIRSHOP_EPOCH_H
+#define REPAIRSHOP_EPOCH_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define EPOCH_SLOTS 256 /**< The maximum number of threads inside read sections at the same time. */
+#define EPOCH_BATCH 64  /**< Number of retired blocks that trigger a reclamation attempt. */
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, void (*free_fn)(void *));
+void epoch_flush(void);
+#endif //REPAIRSHOP_EPOCH_H
@@ -0,0 +1,46 @@
+/**
+ * @file hmap.h
+ * @brief Hash map struct definition and function prototypes.
+ * @details Defines a string keyed hash map used to look up database objects by key instead of iterating through the
+ *          vectors. See \c hmap.c .
+ */
+
+#ifndef REPAIRSHOP_HMAP_H
+#define REPAIRSHOP_HMAP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../../include/errorcodes.h"
+#include "vector.h"
+
+/**
+ * @struct hmap_entry hmap.h
+ * @brief A slot of the hash map.
+ */
+typedef struct hmap_entry {
+        char *key;      /**< The key on the heap, \c NULL if the slot is empty. */
+        size_t hash;    /**< The hash of \c key , compared before the keys themselves. */
+        idx val;        /**< The value stored with \c key . */
+} hmap_entry;
+
+/**
+ * @struct hmap hmap.h
+ * @brief A string keyed hash map with open addressing.
+ */
+typedef struct hmap {
+        hmap_entry *slots;      /**< The slots, their number is always a power of 2. */
+        size_t cap;             /**< The number of slots. */
+        size_t size;            /**< The number of stored keys. */
+} hmap;
+
+size_t hmap_hash(const char *key);
+
+hmap *hmap_init(size_t hint);
+int hmap_put(hmap *m, const char *key, idx val);
+bool hmap_get(const hmap *m, const char *key, idx *val);
+bool hmap_rm(hmap *m, const char *key);
+void hmap_del(hmap *m);
+
+#endif //REPAIRSHOP_HMAP_H
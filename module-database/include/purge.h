@@ -0,0 +1,47 @@
+/**
+ * @file purge.h
+ * @brief Bulk deletion function prototypes.
+ * @details Removes the clients or the operations matching a predicate, and applies the retention policies. See
+ *          \c purge.c .
+ */
+
+#ifndef REPAIRSHOP_PURGE_H
+#define REPAIRSHOP_PURGE_H
+
+#include "database.h"
+
+/** Decides if an operation is removed. \c arg is the predicate's parameter, e.g. a date. */
+typedef bool (*db_op_pred)(const operation *op, const void *arg);
+/** Decides if a client is removed with its cars and operations. \c arg is the predicate's parameter. */
+typedef bool (*db_cl_pred)(const client *cl, const void *arg);
+
+/**
+ * @struct db_purge_stats purge.h
+ * @brief The removed objects. The functions add to it, so it can sum several purges.
+ */
+typedef struct db_purge_stats {
+        size_t clients;         /**< Number of removed clients. */
+        size_t cars;            /**< Number of removed cars, with their clients. */
+        size_t ops;             /**< Number of removed operations, with their clients or by themselves. */
+        size_t bytes;           /**< The size of the removed structs, see \c probe_mem.c . */
+} db_purge_stats;
+
+/**
+ * @struct db_retention purge.h
+ * @brief A retention policy. \c 0 turns a rule off.
+ */
+typedef struct db_retention {
+        unsigned ops;           /**< The operations created more than this many years ago are removed. */
+        unsigned idle;          /**< The clients without operations in this many years are removed. */
+} db_retention;
+
+int db_op_purge(const database *db, db_op_pred pred, const void *arg, db_purge_stats *stats);
+int db_cl_purge(const database *db, db_cl_pred pred, const void *arg, db_purge_stats *stats);
+
+bool db_op_older(const operation *op, const void *limit);
+bool db_cl_idle(const client *cl, const void *limit);
+
+int db_retention_parse(const char *spec, db_retention *dst);
+int db_retention_run(const database *db, const db_retention *policy, db_purge_stats *stats);
+
+#endif //REPAIRSHOP_PURGE_H
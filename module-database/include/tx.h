@@ -0,0 +1,91 @@
+/**
+ * @file tx.h
+ * @brief Transaction struct definition and function prototypes.
+ * @details Stages several mutations of a database and applies them as a whole or not at all. See \c tx.c .
+ */
+
+#ifndef REPAIRSHOP_TX_H
+#define REPAIRSHOP_TX_H
+
+#include "database.h"
+#include "hmap.h"
+
+/**
+ * @enum db_tx_kind tx.h
+ * @brief The staged mutations, one for every \c db_*_add/mod/rm function.
+ */
+typedef enum db_tx_kind {
+        DB_TX_CL_ADD, DB_TX_CL_MOD, DB_TX_CL_RM,
+        DB_TX_CAR_ADD, DB_TX_CAR_MOD, DB_TX_CAR_RM,
+        DB_TX_OP_ADD, DB_TX_OP_MOD, DB_TX_OP_RM
+} db_tx_kind;
+
+/**
+ * @struct db_tx_step tx.h
+ * @brief A staged mutation with its parameters. The unused fields are empty.
+ */
+typedef struct db_tx_step {
+        db_tx_kind kind;                /**< The mutation. */
+        idx cl;                         /**< The client's index. */
+        idx cr;                         /**< The car's index. */
+        idx op;                         /**< The operation's index. */
+        char name[NAME_SIZE + 1];       /**< The client's or the car's name. */
+        char email[EMAIL_SIZE + 1];     /**< The client's email address. */
+        char phone[PHNUM_SIZE + 1];     /**< The client's phone number. */
+        char plate[PLATE_SIZE + 1];     /**< The car's plate number. */
+        char desc[DESC_SIZE + 1];       /**< The operation's description. */
+        double price;                   /**< The operation's price. */
+        date date_cr;                   /**< The operation's creation date, the commit's time if its year is \c 0 . */
+        date date_exp;                  /**< The operation's expiration date, its year is \c 0 if it has none. */
+} db_tx_step;
+
+/**
+ * @struct db_tx_client tx.h
+ * @brief An existing client touched by a transaction.
+ */
+typedef struct db_tx_client {
+        idx cl;                 /**< The client's index in the database. */
+        client *copy;           /**< The private copy the steps modify, \c NULL until a step modifies the client. */
+        bool removed;           /**< Set if the client is removed by the transaction. */
+} db_tx_client;
+
+/**
+ * @struct db_tx tx.h
+ * @brief A transaction: the staged mutations of a database, and what they have built so far during the commit.
+ */
+typedef struct db_tx {
+        const database *db;     /**< The database to be modified. */
+        idx base;               /**< The number of clients at \c db_tx_begin() . The added clients follow it. */
+        vector *steps;          /**< The staged \c db_tx_step s, in order. */
+        size_t added;           /**< Number of staged client additions. */
+        int err;                /**< The first error of the staging, \c 0 if there was none. */
+        idx err_step;           /**< The step that failed, see \c db_tx_commit() . */
+        vector *touched;        /**< The \c db_tx_client s of the commit. */
+        hmap *lookup;           /**< The positions in \c touched , by the clients' indexes. */
+        vector *fresh;          /**< The clients added by the commit, not in the database yet. */
+        char *records;          /**< The journal records of the commit, \c NULL if the database has no journal. */
+        size_t rec_len;         /**< The length of \c records . */
+        size_t rec_cap;         /**< The size of \c records . */
+        size_t rec_cnt;         /**< The number of records. */
+} db_tx;
+
+db_tx *db_tx_begin(const database *db);
+
+int db_tx_cl_add(db_tx *tx, const char *name, const char *email, const char *phone);
+int db_tx_car_add(db_tx *tx, idx cl, const char *name, const char *plate);
+int db_tx_op_add(db_tx *tx, idx cl, idx cr, const char *desc, double price, const char *date);
+int db_tx_op_add_dated(db_tx *tx, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+                       const char *date_exp);
+
+int db_tx_cl_mod(db_tx *tx, idx cl, const char *name, const char *email, const char *phone);
+int db_tx_car_mod(db_tx *tx, idx cl, idx cr, const char *name, const char *plate);
+int db_tx_op_mod(db_tx *tx, idx cl, idx cr, idx op, const char *desc, double price, const char *date);
+
+int db_tx_cl_rm(db_tx *tx, idx cl);
+int db_tx_car_rm(db_tx *tx, idx cl, idx cr);
+int db_tx_op_rm(db_tx *tx, idx cl, idx cr, idx op);
+
+int db_tx_commit(db_tx *tx, idx *failed);
+void db_tx_abort(db_tx *tx);
+
+#endif //REPAIRSHOP_TX_H
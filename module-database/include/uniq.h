@@ -0,0 +1,34 @@
+/**
+ * @file uniq.h
+ * @brief Unique index function prototypes.
+ * @details Keeps the clients' email addresses and phone numbers unique, and lists the existing duplicates. See
+ *          \c uniq.c .
+ */
+
+#ifndef REPAIRSHOP_UNIQ_H
+#define REPAIRSHOP_UNIQ_H
+
+#include "database.h"
+
+#define DB_UNIQ_KEY_SIZE (EMAIL_SIZE + 2)       /**< The size of a normalized key, the email address is the longest. */
+
+/** Called with every duplicate key by \c db_dupes() : \c first and \c dup are the indexes of the two clients. */
+typedef void (*db_dup_fn)(void *arg, db_uniq_field field, const char *key, idx first, idx dup);
+
+int db_unique_parse(const char *spec, unsigned *dst);
+int db_unique(database *db, unsigned fields, size_t *dups);
+int db_dupes(const database *db, db_dup_fn fn, void *arg, size_t *cnt);
+
+/* The building blocks of the mutations, see database.c , tx.c and purge.c . */
+const char *db_uniq_val(const client *cl, db_uniq_field field);
+void db_uniq_key(db_uniq_field field, const char *src, char *dst);
+void db_uniq_key_diff(db_uniq_field field, const char *src, const char *other, char *dst);
+size_t db_uniq_held(const database *db, db_uniq_field field, const char *key);
+int db_uniq_ref(const database *db, db_uniq_field field, const char *key);
+void db_uniq_unref(const database *db, db_uniq_field field, const char *key);
+int db_uniq_put(const database *db, const char *email, const char *phone, const char *old_email,
+                const char *old_phone);
+void db_uniq_rm(const database *db, const char *email, const char *phone, const char *kept_email,
+                const char *kept_phone);
+
+#endif //REPAIRSHOP_UNIQ_H
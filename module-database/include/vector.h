@@ -2,7 +2,8 @@
  * @file vector.h
  * @brief Vector struct definition and function prototypes.
  * @details Defines the vector and its funtion prototypes used in \c vector.c.
- *          Include \c debugmalloc.h for memory analysis.
+ *          Define \c REPAIRSHOP_DEBUGMALLOC to include \c debugmalloc.h for memory analysis. It's off by default, since
+ *          it isn't thread-safe and it limits the size of a single block to 1 MiB.
  * @note \c debugmalloc.h is an external library not maintained by this project:
  *       \htmlonly <a href=https://infoc.eet.bme.hu/debugmalloc/>Documentation (Hungarian)</a>\endhtmlonly |
  *       \htmlonly<a href=https://infoc.eet.bme.hu/debugmalloc/debugmalloc.h>File mirror</a>\endhtmlonly
@@ -16,7 +17,9 @@
 #include <stdbool.h>
 
 #include "../../include/errorcodes.h"
+#ifdef REPAIRSHOP_DEBUGMALLOC
 #include "../../include/external/debugmalloc.h"
+#endif
 
 #define idx size_t /**< Macro for size_t */
 
@@ -27,17 +30,24 @@
 typedef struct vector {
         void **items; /**< Generic dynamically allocated pointer array. */
         size_t size; /**< The size of the vector */
+        size_t capacity; /**< The number of pointers \c items has space for. */
+        bool shared; /**< Set if the vector is read by other threads while it's modified, see \c vct_view() . */
 } vector;
 
 vector *vct(void);
 
 bool inbounds(const vector *v, idx pos);
 
+int vct_reserve(vector *v, size_t n);
 int vct_push(vector *v, void *data);
 int vct_insert(vector *v, void *data, idx pos);
 
 void *vct_subptr(const vector *v, idx pos);
+size_t vct_view(const vector *v, void ***items);
 
+void *vct_swap(vector *v, idx pos, void *data);
+int vct_detach(vector *v, idx pos);
+int vct_splice(vector *v, const idx *pos, size_t cnt, size_t extra);
 int vct_pop(vector *v);
 int vct_rm(vector *v, idx pos);
 
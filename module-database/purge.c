@@ -0,0 +1,315 @@
+/**
+ * @file purge.c
+ * @brief Bulk deletion by predicates, and the retention policies built on it.
+ * @details Removing many objects one by one shifts the rest of their vector every time, which is quadratic. The purges
+ *          collect the positions to be removed first, then compact every vector in a single pass (see
+ *          \c vct_splice() ):\n
+ *          \c db_op_purge() removes the matching operations of every car. The clients are modified one at a time like
+ *          by \c db_op_rm() , so the other clients can be modified meanwhile.\n
+ *          \c db_cl_purge() removes the matching clients with their cars and operations. The database is locked like
+ *          by \c db_cl_rm() , but the client vector is only copied once.\n
+ *          The removals are journaled as transactions (see \c tx.c ): a client's operations, or the removed clients,
+ *          from the last to the first, so the replay removes the same objects.
+ * @note The predicates see every client loaded, so a purge loads the clients that haven't been loaded yet.
+ */
+
+#include "../include/platform.h"
+
+#include "include/purge.h"
+#include "include/uniq.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @brief Finds the matching operations of a car.
+ * @param cr Pointer to the car.
+ * @param pred The predicate.
+ * @param arg The predicate's parameter.
+ * @param pos The destination of the positions, in ascending order, \c NULL to only count them. It must have space for
+ *            every operation of the car.
+ * @return The number of matching operations.
+ */
+size_t db_purge_find(const car *cr, db_op_pred pred, const void *arg, idx *pos)
+{
+        size_t cnt = 0;
+        for (idx i = 0; i < cr->operations->size; i++) {
+                if (!pred(vct_subptr(cr->operations, i), arg))
+                        continue;
+
+                if (pos)
+                        pos[cnt] = i;
+                cnt++;
+        }
+
+        return cnt;
+}
+
+/**
+ * @brief Removes the matching operations of a client and journals them. The caller must hold the client's lock.
+ * @param db The pointer to the database.
+ * @param cl The client's index in the database.
+ * @param client_ The modifiable client, see \c db_cl_write() .
+ * @param pred The predicate.
+ * @param arg The predicate's parameter.
+ * @param cnt The number of matching operations of the client.
+ * @param stats Pointer to the statistics.
+ * @return \c 0 on success, \c EMALLOC if the positions cannot be allocated. Nothing is removed in this case.
+ */
+int db_purge_ops(const database *db, idx cl, client *client_, db_op_pred pred, const void *arg, size_t cnt,
+                 db_purge_stats *stats)
+{
+        size_t most = 0;
+        for (idx i = 0; i < client_->cars->size; i++) {
+                const car *cr = vct_subptr(client_->cars, i);
+                if (cr->operations->size > most)
+                        most = cr->operations->size;
+        }
+
+        idx *pos = malloc(most * sizeof(idx));
+        if (!pos)
+                return EMALLOC;
+
+        if (db->journal)
+                fprintf(db->journal, "T>%zu\n", cnt);
+
+        for (idx i = 0; i < client_->cars->size; i++) {
+                car *cr = vct_subptr(client_->cars, i);
+                size_t found = db_purge_find(cr, pred, arg, pos);
+
+                for (size_t k = found; k > 0; k--) {
+                        if (db->journal)
+                                fprintf(db->journal, "-J>%zu|%zu|%zu\n", cl, i, pos[k - 1]);
+
+                        free(vct_subptr(cr->operations, pos[k - 1]));
+                }
+
+                /* The vector doesn't grow, so this cannot fail. */
+                vct_splice(cr->operations, pos, found, 0);
+                PROBE_FREE(PROBE_MEM_OP, found * sizeof(operation), found);
+                stats->ops += found;
+                stats->bytes += found * sizeof(operation);
+        }
+
+        if (db->journal)
+                fflush(db->journal);
+
+        client_->dirty = true;
+        free(pos);
+        return 0;
+}
+
+/**
+ * @brief Removes the operations matching a predicate from every car.
+ * @param db The pointer to the database.
+ * @param pred The predicate, called with every operation.
+ * @param arg The predicate's parameter.
+ * @param stats Pointer to the statistics, the removed operations are added to it.
+ * @retval 0 On success.
+ * @retval EINV If \c db or \c pred is \c NULL , or a client cannot be loaded from the snapshot.
+ * @retval EMALLOC If a client cannot be copied. The clients before it are purged.
+ * @note The clients without matching operations are not modified.
+ */
+int db_op_purge(const database *db, db_op_pred pred, const void *arg, db_purge_stats *stats)
+{
+        if (!db || !pred)
+                return EINV;
+
+        int retval = 0;
+        bool changed = false;
+
+        for (idx cl = 0; cl < db_cl_cnt(db) && !retval; cl++) {
+                db_w_lock(db, cl);
+                retval = db_cl_load_locked(db, cl);
+
+                /* The client is only copied if it has something to be removed. */
+                size_t cnt = 0;
+                const client *cur = retval ? NULL : db_cl_get(db, cl);
+                for (idx i = 0; cur && i < cur->cars->size; i++)
+                        cnt += db_purge_find(vct_subptr(cur->cars, i), pred, arg, NULL);
+
+                client *client_ = NULL;
+                if (cnt)
+                        retval = db_cl_write(db, cl, &client_);
+                if (cnt && !retval)
+                        retval = db_purge_ops(db, cl, client_, pred, arg, cnt, stats);
+
+                retval = db_cl_commit(db, cl, client_, retval);
+                db_w_unlock(db, cl);
+
+                if (cnt && !retval)
+                        changed = true;
+        }
+
+        /* A client of the snapshot that is missing or damaged is only skipped. */
+        if (retval == EOOB)
+                retval = 0;
+
+        if (changed)
+                db_changed(db);
+
+        return retval;
+}
+
+/**
+ * @brief Removes the clients matching a predicate, with their cars and operations.
+ * @param db The pointer to the database.
+ * @param pred The predicate, called with every client.
+ * @param arg The predicate's parameter.
+ * @param stats Pointer to the statistics, the removed objects are added to it.
+ * @retval 0 On success.
+ * @retval EINV If \c db or \c pred is \c NULL , or a client cannot be loaded from the snapshot.
+ * @retval EMALLOC If the positions or the client vector's copy cannot be allocated.
+ * @note Nothing is removed on failure.
+ */
+int db_cl_purge(const database *db, db_cl_pred pred, const void *arg, db_purge_stats *stats)
+{
+        if (!db || !pred)
+                return EINV;
+
+        db_lock(db);
+        size_t size = db->cl->size;
+        idx *pos = malloc((size ? size : 1) * sizeof(idx));
+        int retval = pos ? 0 : EMALLOC;
+
+        size_t cnt = 0;
+        for (idx cl = 0; cl < size && !retval; cl++) {
+                retval = db_cl_load_locked(db, cl);
+                if (!retval && pred(db_cl_get(db, cl), arg))
+                        pos[cnt++] = cl;
+        }
+
+        /* The removed clients are collected before their positions are reused. */
+        client **gone = retval || !cnt ? NULL : malloc(cnt * sizeof(client *));
+        if (!retval && cnt && !gone)
+                retval = EMALLOC;
+
+        for (size_t k = 0; k < cnt && !retval; k++)
+                gone[k] = db_cl_get(db, pos[k]);
+
+        if (!retval)
+                retval = vct_splice(db->cl, pos, cnt, 0);
+
+        if (!retval && cnt && db->journal) {
+                fprintf(db->journal, "T>%zu\n", cnt);
+                for (size_t k = cnt; k > 0; k--)
+                        fprintf(db->journal, "-U>%zu\n", pos[k - 1]);
+
+                fflush(db->journal);
+        }
+
+        if (!retval)
+                db_order_splice(db, gone, cnt);
+
+        for (size_t k = 0; k < cnt && !retval; k++) {
+                const client *cl = gone[k];
+                stats->clients++;
+                stats->cars += cl->cars->size;
+                stats->bytes += sizeof(client) + cl->cars->size * sizeof(car);
+
+                for (idx i = 0; i < cl->cars->size; i++) {
+                        size_t ops = ((const car *)vct_subptr(cl->cars, i))->operations->size;
+                        stats->ops += ops;
+                        stats->bytes += ops * sizeof(operation);
+                }
+
+                db_uniq_rm(db, cl->email, cl->phone, NULL, NULL);
+                db_cl_release(db, gone[k]);
+        }
+
+        db_unlock(db);
+
+        if (!retval && cnt)
+                db_changed(db);
+
+        free(pos);
+        free(gone);
+        return retval;
+}
+
+/**
+ * @brief Matches the operations created before a date. A predicate of \c db_op_purge() .
+ * @param op Pointer to the operation.
+ * @param limit Pointer to the date.
+ * @return \c true if the operation is older. The operations without a creation date are kept.
+ */
+bool db_op_older(const operation *op, const void *limit)
+{
+        return op->date_cr.y != 0 && date_diff(&op->date_cr, limit) < 0;
+}
+
+/**
+ * @brief Matches the clients without operations created since a date. A predicate of \c db_cl_purge() .
+ * @param cl Pointer to the client.
+ * @param limit Pointer to the date.
+ * @return \c true if the client is idle, including the clients that have no operations at all.
+ */
+bool db_cl_idle(const client *cl, const void *limit)
+{
+        for (idx i = 0; i < cl->cars->size; i++) {
+                const car *cr = vct_subptr(cl->cars, i);
+                for (idx j = 0; j < cr->operations->size; j++) {
+                        const operation *op = vct_subptr(cr->operations, j);
+                        if (op->date_cr.y == 0 || date_diff(&op->date_cr, limit) >= 0)
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * @brief Parses a retention policy.
+ * @param spec The policy: \c key=years pairs separated by commas, the keys are \c ops and \c idle , e.g.
+ *             \c ops=5,idle=3 . See \c db_retention .
+ * @param dst Pointer to the destination policy. The rules not in \c spec are turned off.
+ * @return \c 0 on success, \c EINV if \c spec is malformed or it has no rules.
+ */
+int db_retention_parse(const char *spec, db_retention *dst)
+{
+        *dst = (db_retention){0};
+
+        while (*spec) {
+                const char *eq = strchr(spec, '=');
+                char *end = NULL;
+                unsigned long years = eq ? strtoul(eq + 1, &end, 10) : 0;
+                if (!eq || end == eq + 1 || (*end && *end != ',') || years == 0 || years > 1000)
+                        return EINV;
+
+                size_t key = (size_t)(eq - spec);
+                if (key == 3 && !strncmp(spec, "ops", key))
+                        dst->ops = (unsigned)years;
+                else if (key == 4 && !strncmp(spec, "idle", key))
+                        dst->idle = (unsigned)years;
+                else
+                        return EINV;
+
+                spec = *end ? end + 1 : end;
+        }
+
+        return dst->ops || dst->idle ? 0 : EINV;
+}
+
+/**
+ * @brief Applies a retention policy: removes the idle clients first, then the old operations of the rest.
+ * @param db The pointer to the database.
+ * @param policy The policy, see \c db_retention .
+ * @param stats Pointer to the statistics, the removed objects are added to it.
+ * @return \c 0 on success, the error code of \c db_cl_purge() or \c db_op_purge() on failure.
+ */
+int db_retention_run(const database *db, const db_retention *policy, db_purge_stats *stats)
+{
+        int retval = 0;
+
+        if (policy->idle) {
+                date limit = date_now();
+                limit.y -= (int)policy->idle;
+                retval = db_cl_purge(db, db_cl_idle, &limit, stats);
+        }
+
+        if (!retval && policy->ops) {
+                date limit = date_now();
+                limit.y -= (int)policy->ops;
+                retval = db_op_purge(db, db_op_older, &limit, stats);
+        }
+
+        return retval;
+}
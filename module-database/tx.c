@@ -0,0 +1,933 @@
+/**
+ * @file tx.c
+ * @brief Transactions: several mutations of a database applied as a whole or not at all.
+ * @details A multi-step edit made by the \c db_*_add/mod/rm functions (e.g. a new client with its cars and their
+ *          operations) locks, copies and journals once per call, and a failure halfway leaves the changes before it in
+ *          the database. A transaction stages the mutations first (\c db_tx_*() ), checking their parameters. The
+ *          commit locks the database once and applies the steps in order to private copies of the touched clients and
+ *          to the new clients, so a failing step leaves the database untouched.\n
+ *          If every step succeeds, the client vector is changed in a single pass (see \c vct_splice() ): the removed
+ *          clients are left out, the space of the new ones is reserved, then the copies replace the originals and the
+ *          new clients are appended. The journal gets the records of the steps in a single write, after a \c T>n
+ *          marker, so a transaction torn by a crash is not replayed halfway (see \c fh_journal.c ). \c db->on_change is
+ *          called once.\n
+ *          The indexes of the steps are the ones the \c db_* functions would use one after the other, with one
+ *          exception: the clients are removed at the end of the commit, so the steps after a client's removal still use
+ *          the indexes before it. A removed client cannot be used by the later steps. The clients added by the
+ *          transaction get the indexes \c tx->base , \c tx->base+1 and so on, in their order.
+ * @note The commit holds the database's lock (see \c db_lock() ), so the other writers wait for it, the readers don't.
+ */
+
+#include "../include/platform.h"
+
+#include <stdarg.h>
+
+#include "include/tx.h"
+#include "include/uniq.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @brief Starts a transaction.
+ * @param db The pointer to the database to be modified.
+ * @return The transaction on success, \c NULL if \c db is \c NULL or the transaction cannot be allocated. It must be
+ *         finished by \c db_tx_commit() or \c db_tx_abort() .
+ */
+db_tx *db_tx_begin(const database *db)
+{
+        if (!db)
+                return NULL;
+
+        db_tx *tx = calloc(1, sizeof(db_tx));
+        if (!tx)
+                return NULL;
+
+        tx->db = db;
+        tx->base = db_cl_cnt(db);
+        tx->steps = vct();
+        if (!tx->steps) {
+                free(tx);
+                return NULL;
+        }
+
+        return tx;
+}
+
+/**
+ * @brief Copies a parameter of a step.
+ * @param dst The destination field.
+ * @param src The parameter, \c NULL for an empty one.
+ * @param size The maximum length of the field.
+ * @return \c true on success, \c false if the parameter is too long.
+ */
+bool db_tx_str(char *dst, const char *src, size_t size)
+{
+        if (!src) {
+                dst[0] = '\0';
+                return true;
+        }
+
+        if (strlen(src) > size)
+                return false;
+
+        strcpy(dst, src);
+        return true;
+}
+
+/**
+ * @brief Stages a step.
+ * @details After the first failure nothing is staged, and the commit fails with its error code.
+ * @param tx The pointer to the transaction.
+ * @param step The step to be staged.
+ * @param valid Set to \c false if the step's parameters are invalid.
+ * @retval 0 On success.
+ * @retval EINV If \c tx is \c NULL or the step is invalid.
+ * @retval EMALLOC If the step cannot be allocated.
+ */
+int db_tx_stage(db_tx *tx, const db_tx_step *step, bool valid)
+{
+        if (!tx)
+                return EINV;
+
+        if (tx->err)
+                return tx->err;
+
+        db_tx_step *new = valid ? malloc(sizeof(db_tx_step)) : NULL;
+        if (new)
+                *new = *step;
+
+        if (!valid || !new || vct_push(tx->steps, new)) {
+                free(new);
+                tx->err = valid ? EMALLOC : EINV;
+                tx->err_step = tx->steps->size;
+                return tx->err;
+        }
+
+        if (step->kind == DB_TX_CL_ADD)
+                tx->added++;
+
+        return 0;
+}
+
+/**
+ * @brief Stages adding a client. Its index is \c tx->base plus the number of clients staged before it.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_cl_add() .
+ */
+int db_tx_cl_add(db_tx *tx, const char *name, const char *email, const char *phone)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CL_ADD;
+        bool valid = db_tx_str(step.name, name, NAME_SIZE) && db_tx_str(step.email, email, EMAIL_SIZE) &&
+                     db_tx_str(step.phone, phone, PHNUM_SIZE);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages adding a car.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_car_add() .
+ */
+int db_tx_car_add(db_tx *tx, idx cl, const char *name, const char *plate)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CAR_ADD;
+        step.cl = cl;
+        bool valid = db_tx_str(step.name, name, NAME_SIZE) && db_tx_str(step.plate, plate, PLATE_SIZE);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages adding an operation.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_op_add() .
+ */
+int db_tx_op_add(db_tx *tx, idx cl, idx cr, const char *desc, double price, const char *date)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_OP_ADD;
+        step.cl = cl;
+        step.cr = cr;
+        step.price = price;
+        bool valid = db_tx_str(step.desc, desc, DESC_SIZE) && !db_op_check(price, date, &step.date_exp);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages adding an operation with its original creation date, e.g. one made on another copy of the database.
+ * @param date_cr The creation date, see \c date_parse_strict() .
+ * @param date_exp The expiration date, \c NULL if it has none.
+ * @return See \c db_tx_stage() .
+ * @note For the other parameters see \c db_op_add() .
+ */
+int db_tx_op_add_dated(db_tx *tx, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+                       const char *date_exp)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_OP_ADD;
+        step.cl = cl;
+        step.cr = cr;
+        step.price = price;
+        bool valid = db_tx_str(step.desc, desc, DESC_SIZE) && !db_op_check(price, date_exp, &step.date_exp) &&
+                     date_cr && !date_parse_strict(date_cr, &step.date_cr);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages modifying a client.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_cl_mod() .
+ */
+int db_tx_cl_mod(db_tx *tx, idx cl, const char *name, const char *email, const char *phone)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CL_MOD;
+        step.cl = cl;
+        bool valid = db_tx_str(step.name, name, NAME_SIZE) && db_tx_str(step.email, email, EMAIL_SIZE) &&
+                     db_tx_str(step.phone, phone, PHNUM_SIZE);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages modifying a car.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_car_mod() .
+ */
+int db_tx_car_mod(db_tx *tx, idx cl, idx cr, const char *name, const char *plate)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CAR_MOD;
+        step.cl = cl;
+        step.cr = cr;
+        bool valid = db_tx_str(step.name, name, NAME_SIZE) && db_tx_str(step.plate, plate, PLATE_SIZE);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages modifying an operation.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_op_mod() .
+ */
+int db_tx_op_mod(db_tx *tx, idx cl, idx cr, idx op, const char *desc, double price, const char *date)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_OP_MOD;
+        step.cl = cl;
+        step.cr = cr;
+        step.op = op;
+        step.price = price;
+        bool valid = db_tx_str(step.desc, desc, DESC_SIZE) && !db_op_check(price, date, &step.date_exp);
+
+        return db_tx_stage(tx, &step, valid);
+}
+
+/**
+ * @brief Stages removing a client. It's removed at the end of the commit, see \c tx.c .
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_cl_rm() .
+ */
+int db_tx_cl_rm(db_tx *tx, idx cl)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CL_RM;
+        step.cl = cl;
+
+        return db_tx_stage(tx, &step, true);
+}
+
+/**
+ * @brief Stages removing a car.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_car_rm() .
+ */
+int db_tx_car_rm(db_tx *tx, idx cl, idx cr)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_CAR_RM;
+        step.cl = cl;
+        step.cr = cr;
+
+        return db_tx_stage(tx, &step, true);
+}
+
+/**
+ * @brief Stages removing an operation.
+ * @return See \c db_tx_stage() .
+ * @note For the parameters see \c db_op_rm() .
+ */
+int db_tx_op_rm(db_tx *tx, idx cl, idx cr, idx op)
+{
+        db_tx_step step = {0};
+        step.kind = DB_TX_OP_RM;
+        step.cl = cl;
+        step.cr = cr;
+        step.op = op;
+
+        return db_tx_stage(tx, &step, true);
+}
+
+/**
+ * @brief Appends a record to the journal records of the commit, if the database has a journal.
+ * @param tx The pointer to the transaction.
+ * @param fmt A \c printf() style format string of the record, see \c db_journal() .
+ * @return \c 0 on success, \c EMALLOC if the records cannot be expanded.
+ */
+int db_tx_record(db_tx *tx, const char *fmt, ...)
+{
+        if (!tx->db->journal)
+                return 0;
+
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(NULL, 0, fmt, args);
+        va_end(args);
+
+        if (len < 0)
+                return EINV;
+
+        if (tx->rec_len + (size_t)len + 1 > tx->rec_cap) {
+                size_t cap = tx->rec_cap ? tx->rec_cap * 2 : 4096;
+                while (cap < tx->rec_len + (size_t)len + 1)
+                        cap *= 2;
+
+                char *tmp = realloc(tx->records, cap);
+                if (!tmp)
+                        return EMALLOC;
+
+                tx->records = tmp;
+                tx->rec_cap = cap;
+        }
+
+        va_start(args, fmt);
+        vsnprintf(tx->records + tx->rec_len, tx->rec_cap - tx->rec_len, fmt, args);
+        va_end(args);
+
+        tx->rec_len += (size_t)len;
+        tx->rec_cnt++;
+        return 0;
+}
+
+/**
+ * @brief Looks up an existing client touched by the commit, and adds it if it's new.
+ * @param tx The pointer to the transaction.
+ * @param cl The client's index in the database.
+ * @param dst The destination of the client's entry.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist.
+ * @retval EMALLOC If the entry cannot be allocated.
+ */
+int db_tx_touch(db_tx *tx, idx cl, db_tx_client **dst)
+{
+        if (!db_cl_get(tx->db, cl))
+                return EOOB;
+
+        char key[24];
+        snprintf(key, sizeof(key), "%zu", cl);
+
+        idx pos = 0;
+        if (hmap_get(tx->lookup, key, &pos)) {
+                *dst = vct_subptr(tx->touched, pos);
+                return 0;
+        }
+
+        db_tx_client *entry = calloc(1, sizeof(db_tx_client));
+        if (!entry || vct_push(tx->touched, entry)) {
+                free(entry);
+                return EMALLOC;
+        }
+
+        entry->cl = cl;
+        *dst = entry;
+        return hmap_put(tx->lookup, key, tx->touched->size - 1);
+}
+
+/**
+ * @brief Finds the client a step modifies: the private copy of an existing client, or a client added by the commit.
+ * @param tx The pointer to the transaction.
+ * @param cl The client's index.
+ * @param dst The destination of the client.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist, or if it's removed by an earlier step.
+ * @retval EMALLOC If the copy cannot be allocated.
+ * @retval EINV If the client cannot be loaded from the snapshot.
+ */
+int db_tx_target(db_tx *tx, idx cl, client **dst)
+{
+        if (cl >= tx->base) {
+                *dst = vct_subptr(tx->fresh, cl - tx->base);
+                return *dst ? 0 : EOOB;
+        }
+
+        db_tx_client *entry = NULL;
+        int retval = db_tx_touch(tx, cl, &entry);
+        if (!retval && entry->removed)
+                retval = EOOB;
+        if (!retval && !entry->copy)
+                retval = db_cl_copy(tx->db, cl, &entry->copy);
+
+        *dst = retval ? NULL : entry->copy;
+        return retval;
+}
+
+/**
+ * @brief Applies a client addition to the commit's new clients.
+ * @param tx The pointer to the transaction.
+ * @param s The step.
+ * @return \c 0 on success, \c EMALLOC if the client cannot be allocated.
+ */
+int db_tx_cl_new(db_tx *tx, const db_tx_step *s)
+{
+        client *cl = malloc(sizeof(client));
+        if (!cl)
+                return EMALLOC;
+
+        PROBE_ALLOC(PROBE_MEM_CLIENT, sizeof(client), 1);
+        strcpy(cl->name, s->name);
+        strcpy(cl->email, s->email);
+        strcpy(cl->phone, s->phone);
+        cl->id = db_cl_id();
+        cl->cars = vct();
+        cl->loaded = true;
+        cl->lazy_cars = 0;
+        cl->dirty = true;
+        cl->refs = 1;
+        cl->shard = 0;
+        cl->blk_off = 0;
+        cl->blk_len = 0;
+
+        if (!cl->cars || vct_push(tx->fresh, cl)) {
+                db_cl_free(cl);
+                return EMALLOC;
+        }
+
+        return db_tx_record(tx, "+U>%s|%s|%s\n", s->name, s->email, s->phone);
+}
+
+/**
+ * @brief Marks an existing client removed. Its copy made by the earlier steps is discarded.
+ * @param tx The pointer to the transaction.
+ * @param cl The client's index.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist, or if it's already removed.
+ * @retval EINV If the client is added by the transaction.
+ * @retval EMALLOC If the client's entry cannot be allocated.
+ */
+int db_tx_cl_drop(db_tx *tx, idx cl)
+{
+        if (cl >= tx->base)
+                return cl - tx->base < tx->fresh->size ? EINV : EOOB;
+
+        db_tx_client *entry = NULL;
+        int retval = db_tx_touch(tx, cl, &entry);
+        if (retval)
+                return retval;
+
+        if (entry->removed)
+                return EOOB;
+
+        if (entry->copy)
+                db_cl_free(entry->copy);
+
+        entry->copy = NULL;
+        entry->removed = true;
+        return 0;
+}
+
+/**
+ * @brief Applies a step to the commit's clients.
+ * @param tx The pointer to the transaction.
+ * @param s The step.
+ * @retval 0 On success.
+ * @retval EOOB If an object of the step doesn't exist.
+ * @retval EMALLOC If a new object or a copy cannot be allocated.
+ * @retval EINV If a client cannot be loaded from the snapshot, or a client added by the transaction is removed.
+ */
+int db_tx_apply(db_tx *tx, const db_tx_step *s)
+{
+        if (s->kind == DB_TX_CL_ADD)
+                return db_tx_cl_new(tx, s);
+
+        if (s->kind == DB_TX_CL_RM)
+                return db_tx_cl_drop(tx, s->cl);
+
+        client *cl = NULL;
+        int retval = db_tx_target(tx, s->cl, &cl);
+        if (retval)
+                return retval;
+
+        car *car_ = s->kind == DB_TX_CL_MOD || s->kind == DB_TX_CAR_ADD ? NULL : vct_subptr(cl->cars, s->cr);
+        if (!car_ && s->kind != DB_TX_CL_MOD && s->kind != DB_TX_CAR_ADD)
+                return EOOB;
+
+        operation *op = s->kind == DB_TX_OP_MOD || s->kind == DB_TX_OP_RM ? vct_subptr(car_->operations, s->op) : NULL;
+        if (!op && (s->kind == DB_TX_OP_MOD || s->kind == DB_TX_OP_RM))
+                return EOOB;
+
+        char date_cr[17], date_exp[17];
+        cl->dirty = true;
+
+        switch (s->kind) {
+                case DB_TX_CL_MOD:
+                        strcpy(cl->name, s->name);
+                        strcpy(cl->email, s->email);
+                        strcpy(cl->phone, s->phone);
+                        return db_tx_record(tx, "~U>%zu|%s|%s|%s\n", s->cl, s->name, s->email, s->phone);
+                case DB_TX_CAR_ADD:
+                        car_ = malloc(sizeof(car));
+                        if (!car_)
+                                return EMALLOC;
+
+                        PROBE_ALLOC(PROBE_MEM_CAR, sizeof(car), 1);
+                        strcpy(car_->name, s->name);
+                        strcpy(car_->plate, s->plate);
+                        car_->operations = vct();
+                        if (!car_->operations || vct_push(cl->cars, car_)) {
+                                vct_del(car_->operations);
+                                PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                                free(car_);
+                                return EMALLOC;
+                        }
+
+                        return db_tx_record(tx, "+A>%zu|%s|%s\n", s->cl, s->name, s->plate);
+                case DB_TX_CAR_MOD:
+                        strcpy(car_->name, s->name);
+                        strcpy(car_->plate, s->plate);
+                        return db_tx_record(tx, "~A>%zu|%zu|%s|%s\n", s->cl, s->cr, s->name, s->plate);
+                case DB_TX_CAR_RM:
+                        PROBE_FREE(PROBE_MEM_OP, car_->operations->size * sizeof(operation), car_->operations->size);
+                        PROBE_FREE(PROBE_MEM_CAR, sizeof(car), 1);
+                        vct_del(car_->operations);
+                        vct_rm(cl->cars, s->cr);
+                        return db_tx_record(tx, "-A>%zu|%zu\n", s->cl, s->cr);
+                case DB_TX_OP_ADD:
+                        op = malloc(sizeof(operation));
+                        if (!op || vct_push(car_->operations, op)) {
+                                free(op);
+                                return EMALLOC;
+                        }
+
+                        PROBE_ALLOC(PROBE_MEM_OP, sizeof(operation), 1);
+                        strcpy(op->desc, s->desc);
+                        op->price = s->price;
+                        op->date_cr = s->date_cr.y != 0 ? s->date_cr : date_now();
+                        op->date_exp = s->date_exp;
+
+                        db_journal_date(&op->date_cr, date_cr);
+                        db_journal_date(&op->date_exp, date_exp);
+                        return db_tx_record(tx, "+J>%zu|%zu|%s|%f|%s|%s\n", s->cl, s->cr, s->desc, s->price, date_cr,
+                                            date_exp);
+                case DB_TX_OP_MOD:
+                        strcpy(op->desc, s->desc);
+                        op->price = s->price;
+                        op->date_exp = s->date_exp;
+
+                        db_journal_date(&op->date_exp, date_exp);
+                        return db_tx_record(tx, "~J>%zu|%zu|%zu|%s|%f|%s\n", s->cl, s->cr, s->op, s->desc, s->price,
+                                            date_exp);
+                case DB_TX_OP_RM:
+                        PROBE_FREE(PROBE_MEM_OP, sizeof(operation), 1);
+                        vct_rm(car_->operations, s->op);
+                        return db_tx_record(tx, "-J>%zu|%zu|%zu\n", s->cl, s->cr, s->op);
+                default:
+                        return EINV;
+        }
+}
+
+/**
+ * @brief Orders two client indexes, for \c qsort() .
+ */
+int db_tx_idx_cmp(const void *a, const void *b)
+{
+        idx x = *(const idx *)a;
+        idx y = *(const idx *)b;
+        return (x > y) - (x < y);
+}
+
+/**
+ * @brief Checks if a step of the commit has renamed a client.
+ * @param tx The pointer to the transaction.
+ * @param entry The client's entry.
+ * @return \c true if the client's copy has a new name.
+ */
+bool db_tx_renamed(const db_tx *tx, const db_tx_client *entry)
+{
+        return entry->copy && strcmp(entry->copy->name, db_cl_get(tx->db, entry->cl)->name) != 0;
+}
+
+/**
+ * @brief Removes the names added by \c db_tx_order() , after a failure.
+ * @param tx The pointer to the transaction.
+ * @param touched The number of the commit's clients whose new names were added.
+ * @param fresh The number of the new clients that were added.
+ */
+void db_tx_order_undo(const db_tx *tx, idx touched, idx fresh)
+{
+        const database *db = tx->db;
+        for (idx i = 0; i < touched; i++) {
+                const db_tx_client *entry = vct_subptr(tx->touched, i);
+                if (db_tx_renamed(tx, entry))
+                        db_order_rm(db, entry->copy->id, entry->copy->name);
+        }
+
+        for (idx i = 0; i < fresh; i++) {
+                const client *cl = vct_subptr(tx->fresh, i);
+                db_order_rm(db, cl->id, cl->name);
+        }
+}
+
+/**
+ * @brief Adds the new names of the commit's clients and the new clients to the clients' order (see \c db_order() ).
+ * @details The old names are removed by \c db_tx_publish() , once nothing can fail.
+ * @param tx The pointer to the transaction.
+ * @return \c 0 on success, \c EMALLOC if a name cannot be added. The order is unchanged in this case.
+ */
+int db_tx_order(const db_tx *tx)
+{
+        const database *db = tx->db;
+        if (!db->order)
+                return 0;
+
+        for (idx i = 0; i < tx->touched->size; i++) {
+                const db_tx_client *entry = vct_subptr(tx->touched, i);
+                if (db_tx_renamed(tx, entry) && db_order_put(db, entry->copy->id, entry->copy->name)) {
+                        db_tx_order_undo(tx, i, 0);
+                        return EMALLOC;
+                }
+        }
+
+        for (idx i = 0; i < tx->fresh->size; i++) {
+                const client *cl = vct_subptr(tx->fresh, i);
+                if (db_order_put(db, cl->id, cl->name)) {
+                        db_tx_order_undo(tx, tx->touched->size, i);
+                        return EMALLOC;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Finds a key the commit gives up: the key of a removed client, or the old key of a modified one.
+ * @param tx The pointer to the transaction.
+ * @param field The key's field.
+ * @param i The client's position in \c tx->touched .
+ * @param dst The destination of the key, empty if the client keeps its key. See \c db_uniq_key() .
+ */
+void db_tx_key_old(const db_tx *tx, db_uniq_field field, idx i, char *dst)
+{
+        const db_tx_client *entry = vct_subptr(tx->touched, i);
+        const client *cl = db_cl_get(tx->db, entry->cl);
+        dst[0] = '\0';
+
+        if (entry->removed)
+                db_uniq_key(field, db_uniq_val(cl, field), dst);
+        else if (entry->copy)
+                db_uniq_key_diff(field, db_uniq_val(cl, field), db_uniq_val(entry->copy, field), dst);
+}
+
+/**
+ * @brief Finds a key the commit takes: the new key of a modified client, or the key of a new client.
+ * @param tx The pointer to the transaction.
+ * @param field The key's field.
+ * @param i The client's position in \c tx->touched , or \c tx->touched->size plus its position in \c tx->fresh .
+ * @param dst The destination of the key, empty if the client takes no key. See \c db_uniq_key() .
+ */
+void db_tx_key_new(const db_tx *tx, db_uniq_field field, idx i, char *dst)
+{
+        dst[0] = '\0';
+        if (i >= tx->touched->size) {
+                db_uniq_key(field, db_uniq_val(vct_subptr(tx->fresh, i - tx->touched->size), field), dst);
+                return;
+        }
+
+        const db_tx_client *entry = vct_subptr(tx->touched, i);
+        if (entry->copy)
+                db_uniq_key_diff(field, db_uniq_val(entry->copy, field),
+                                 db_uniq_val(db_cl_get(tx->db, entry->cl), field), dst);
+}
+
+/**
+ * @brief Removes the keys added by \c db_tx_uniq() , after a failure.
+ * @param tx The pointer to the transaction.
+ * @param done The number of keys added, counted field by field over every client of the commit.
+ */
+void db_tx_uniq_undo(const db_tx *tx, size_t done)
+{
+        size_t n = tx->touched->size + tx->fresh->size;
+        char key[DB_UNIQ_KEY_SIZE];
+
+        pthread_mutex_lock(tx->db->lock);
+        for (size_t k = 0; k < done; k++) {
+                db_tx_key_new(tx, k / n, k % n, key);
+                db_uniq_unref(tx->db, k / n, key);
+        }
+        pthread_mutex_unlock(tx->db->lock);
+}
+
+/**
+ * @brief Checks the keys the commit takes against the unique indexes (see \c uniq.c ), then adds them.
+ * @details The keys the commit gives up are free for its other clients, e.g. two clients may swap their phone numbers.
+ *          They are removed by \c db_tx_publish() , once nothing can fail.
+ * @param tx The pointer to the transaction.
+ * @retval 0 On success.
+ * @retval EDUP If a key is held by a client that keeps it, or two clients of the commit take it.
+ * @retval EMALLOC If a map cannot be allocated. The indexes are unchanged on failure.
+ */
+int db_tx_uniq(const db_tx *tx)
+{
+        const database *db = tx->db;
+        if (!db->uniq[DB_UNIQ_EMAIL] && !db->uniq[DB_UNIQ_PHONE])
+                return 0;
+
+        size_t n = tx->touched->size + tx->fresh->size;
+        char key[DB_UNIQ_KEY_SIZE];
+        int retval = 0;
+
+        pthread_mutex_lock(db->lock);
+        for (int f = 0; f < DB_UNIQ_FIELDS && !retval; f++) {
+                if (!db->uniq[f])
+                        continue;
+
+                hmap *freed = hmap_init(tx->touched->size);
+                hmap *taken = hmap_init(n);
+                retval = freed && taken ? 0 : EMALLOC;
+
+                for (idx i = 0; i < tx->touched->size && !retval; i++) {
+                        db_tx_key_old(tx, f, i, key);
+                        if (!key[0])
+                                continue;
+
+                        idx cnt = 0;
+                        hmap_get(freed, key, &cnt);
+                        retval = hmap_put(freed, key, cnt + 1);
+                }
+
+                for (idx i = 0; i < n && !retval; i++) {
+                        db_tx_key_new(tx, f, i, key);
+                        idx gone = 0, cnt = 0;
+                        if (!key[0])
+                                continue;
+
+                        hmap_get(freed, key, &gone);
+                        hmap_get(taken, key, &cnt);
+                        retval = db_uniq_held(db, f, key) - gone + cnt ? EDUP : hmap_put(taken, key, 1);
+                }
+
+                hmap_del(freed);
+                hmap_del(taken);
+        }
+
+        /* Checked, so only an index that cannot grow fails from here. */
+        size_t done = 0;
+        while (!retval && done < DB_UNIQ_FIELDS * n) {
+                db_tx_key_new(tx, done / n, done % n, key);
+                if (!(retval = db_uniq_ref(db, done / n, key)))
+                        done++;
+        }
+        pthread_mutex_unlock(db->lock);
+
+        if (retval)
+                db_tx_uniq_undo(tx, done);
+
+        return retval;
+}
+
+/**
+ * @brief Puts the commit's clients in place, and writes its journal records.
+ * @details Only the unique indexes, the splice of the client vector and the clients' order can fail, before anything
+ *          is changed. The rest cannot fail.
+ * @param tx The pointer to the transaction, its steps are applied.
+ * @return \c 0 on success, \c EDUP if a key of a unique index is taken (see \c db_tx_uniq() ), \c EMALLOC if the
+ *         client vector or the journal records cannot be expanded.
+ */
+int db_tx_publish(db_tx *tx)
+{
+        const database *db = tx->db;
+        size_t cnt = 0;
+        for (idx i = 0; i < tx->touched->size; i++)
+                cnt += ((db_tx_client *)vct_subptr(tx->touched, i))->removed;
+
+        idx *rm = malloc((cnt ? cnt : 1) * sizeof(idx));
+        client **gone = malloc((cnt ? cnt : 1) * sizeof(client *));
+        int retval = rm && gone ? 0 : EMALLOC;
+
+        for (idx i = 0, k = 0; i < tx->touched->size && !retval; i++) {
+                const db_tx_client *entry = vct_subptr(tx->touched, i);
+                if (entry->removed)
+                        rm[k++] = entry->cl;
+        }
+
+        if (!retval && cnt)
+                qsort(rm, cnt, sizeof(idx), db_tx_idx_cmp);
+
+        /* From the last to the first, so the earlier indexes in the journal don't shift. */
+        for (size_t k = cnt; k > 0 && !retval; k--) {
+                gone[k - 1] = db_cl_get(db, rm[k - 1]);
+                retval = db_tx_record(tx, "-U>%zu\n", rm[k - 1]);
+        }
+
+        size_t keys = DB_UNIQ_FIELDS * (tx->touched->size + tx->fresh->size);
+        if (!retval)
+                retval = db_tx_uniq(tx);
+
+        if (!retval && (retval = db_tx_order(tx)))
+                db_tx_uniq_undo(tx, keys);
+
+        if (!retval && (retval = vct_splice(db->cl, rm, cnt, tx->fresh->size))) {
+                db_tx_order_undo(tx, tx->touched->size, tx->fresh->size);
+                db_tx_uniq_undo(tx, keys);
+        }
+
+        if (retval) {
+                free(rm);
+                free(gone);
+                return retval;
+        }
+
+        /* The copies move to the positions after the removals. */
+        for (idx i = 0; i < tx->touched->size; i++) {
+                db_tx_client *entry = vct_subptr(tx->touched, i);
+                if (!entry->copy)
+                        continue;
+
+                size_t before = 0;
+                while (before < cnt && rm[before] < entry->cl)
+                        before++;
+
+                client *old = vct_swap(db->cl, entry->cl - before, entry->copy);
+                if (strcmp(old->name, entry->copy->name) != 0)
+                        db_order_rm(db, old->id, old->name);
+
+                db_uniq_rm(db, old->email, old->phone, entry->copy->email, entry->copy->phone);
+
+                db_cl_release(db, old);
+                entry->copy = NULL;
+        }
+
+        for (idx i = 0; i < tx->fresh->size; i++)
+                vct_push(db->cl, vct_subptr(tx->fresh, i));
+
+        tx->fresh->size = 0;
+
+        db_order_splice(db, gone, cnt);
+        for (size_t k = 0; k < cnt; k++) {
+                db_uniq_rm(db, gone[k]->email, gone[k]->phone, NULL, NULL);
+                db_cl_release(db, gone[k]);
+        }
+
+        if (db->journal && tx->rec_cnt) {
+                fprintf(db->journal, "T>%zu\n", tx->rec_cnt);
+                fwrite(tx->records, 1, tx->rec_len, db->journal);
+                fflush(db->journal);
+        }
+
+        free(rm);
+        free(gone);
+        return 0;
+}
+
+/**
+ * @brief Frees a transaction with the clients its commit has built but not put in place.
+ * @param tx The pointer to the transaction.
+ */
+void db_tx_free(db_tx *tx)
+{
+        for (idx i = 0; tx->touched && i < tx->touched->size; i++) {
+                const db_tx_client *entry = vct_subptr(tx->touched, i);
+                if (entry->copy)
+                        db_cl_free(entry->copy);
+        }
+
+        for (idx i = 0; tx->fresh && i < tx->fresh->size; i++)
+                db_cl_free(vct_subptr(tx->fresh, i));
+
+        /* The clients are freed above, only the vector is freed. */
+        if (tx->fresh)
+                tx->fresh->size = 0;
+
+        vct_del(tx->fresh);
+        vct_del(tx->touched);
+        vct_del(tx->steps);
+        if (tx->lookup)
+                hmap_del(tx->lookup);
+
+        free(tx->records);
+        free(tx);
+}
+
+/**
+ * @brief Applies the staged steps of a transaction, as a whole or not at all, and frees the transaction.
+ * @param tx The pointer to the transaction.
+ * @param failed The destination of the failed step's position (from \c 0 ) on failure, \c NULL if unused. It's the
+ *               number of steps if the whole transaction failed, e.g. because of \c ECONFL .
+ * @retval 0 On success.
+ * @retval EINV If \c tx is \c NULL , if a step was invalid when it was staged, if a client cannot be loaded from the
+ *              snapshot, or if a client added by the transaction is removed.
+ * @retval EOOB If an object of a step doesn't exist.
+ * @retval EMALLOC If a new object, a copy or the client vector's expansion cannot be allocated.
+ * @retval ECONFL If the transaction adds clients, but the number of clients has changed since \c db_tx_begin() .
+ * @retval EDUP If the commit's clients would take an email address or a phone number held by another client, see
+ *              \c db_unique() .
+ * @note The database is not modified on failure.
+ */
+int db_tx_commit(db_tx *tx, idx *failed)
+{
+        PROBE(PROBE_DB_TX_COMMIT);
+        if (!tx)
+                return EINV;
+
+        const database *db = tx->db;
+        int retval = tx->err;
+        idx step = tx->err ? tx->err_step : tx->steps->size;
+
+        if (!retval) {
+                tx->touched = vct();
+                tx->fresh = vct();
+                tx->lookup = hmap_init(16);
+                if (!tx->touched || !tx->fresh || !tx->lookup)
+                        retval = EMALLOC;
+        }
+
+        db_lock(db);
+
+        /* The new clients' indexes were handed out by the number of clients at the start. */
+        if (!retval && tx->added && db->cl->size != tx->base)
+                retval = ECONFL;
+        else if (!tx->added)
+                tx->base = db->cl->size;
+
+        for (idx i = 0; i < tx->steps->size && !retval; i++) {
+                retval = db_tx_apply(tx, vct_subptr(tx->steps, i));
+                if (retval)
+                        step = i;
+        }
+
+        if (!retval)
+                retval = db_tx_publish(tx);
+
+        db_unlock(db);
+
+        if (!retval && tx->steps->size)
+                db_changed(db);
+
+        if (retval && failed)
+                *failed = step;
+
+        db_tx_free(tx);
+        return retval;
+}
+
+/**
+ * @brief Discards a transaction without applying its steps.
+ * @param tx The pointer to the transaction.
+ */
+void db_tx_abort(db_tx *tx)
+{
+        if (tx)
+                db_tx_free(tx);
+}
@@ -0,0 +1,332 @@
+/**
+ * @file uniq.c
+ * @brief Unique indexes of the clients' email addresses and phone numbers.
+ * @details Checking a new client against every other one is \c O(n) , and finding the duplicates of a whole database
+ *          that way is \c O(n^2) . A unique index is a hash map (see \c hmap.c ) from a normalized key to the number of
+ *          clients holding it, so a client is checked in \c O(1) expected steps. The email addresses are compared
+ *          case-insensitively and without spaces, the phone numbers by their digits and a leading \c + . Empty keys
+ *          are not indexed.\n
+ *          The indexes are optional. \c db_unique() builds them in a single pass once the snapshot and the journal are
+ *          loaded: the snapshot may hold duplicates from before, and the journal must replay what was accepted. The
+ *          existing duplicates are counted, not removed (\c db_dupes() lists them). From then on an addition or a
+ *          modification that takes a key held by another client fails with \c EDUP .
+ * @note The indexes are guarded by \c db->lock , like the clients' order.
+ */
+
+#include "../include/platform.h"
+
+#include <ctype.h>
+
+#include "include/uniq.h"
+
+/** The names of the fields in \c db_unique_parse() . */
+static const char *db_uniq_names[DB_UNIQ_FIELDS] = {"email", "phone"};
+
+/**
+ * @brief Returns the indexed field of a client.
+ * @param cl Pointer to the client.
+ * @param field The field.
+ * @return The field's value.
+ */
+const char *db_uniq_val(const client *cl, db_uniq_field field)
+{
+        return field == DB_UNIQ_EMAIL ? cl->email : cl->phone;
+}
+
+/**
+ * @brief Normalizes a value to its key in the unique index.
+ * @param field The field of the value.
+ * @param src The value.
+ * @param dst The destination of the key, \c DB_UNIQ_KEY_SIZE bytes. Empty if the value has no key, e.g. a phone
+ *            number without digits.
+ */
+void db_uniq_key(db_uniq_field field, const char *src, char *dst)
+{
+        size_t len = 0;
+        for (const unsigned char *c = (const unsigned char *)src; *c && len < DB_UNIQ_KEY_SIZE - 1; c++) {
+                if (field == DB_UNIQ_EMAIL && !isspace(*c))
+                        dst[len++] = (char)tolower(*c);
+                else if (field == DB_UNIQ_PHONE && (isdigit(*c) || (*c == '+' && len == 0)))
+                        dst[len++] = (char)*c;
+        }
+
+        if (field == DB_UNIQ_PHONE && len == 1 && dst[0] == '+')
+                len = 0;
+
+        dst[len] = '\0';
+}
+
+/**
+ * @brief Normalizes a value, unless it has the same key as another one.
+ * @param field The field of the values.
+ * @param src The value.
+ * @param other The other value, \c NULL if there is none.
+ * @param dst The destination of the key, empty if the keys are the same. See \c db_uniq_key() .
+ */
+void db_uniq_key_diff(db_uniq_field field, const char *src, const char *other, char *dst)
+{
+        db_uniq_key(field, src, dst);
+        if (!other || !dst[0])
+                return;
+
+        char key[DB_UNIQ_KEY_SIZE];
+        db_uniq_key(field, other, key);
+        if (!strcmp(key, dst))
+                dst[0] = '\0';
+}
+
+/**
+ * @brief Counts the clients holding a key. The caller must hold \c db->lock .
+ * @param db The pointer to the database.
+ * @param field The key's field.
+ * @param key The key, see \c db_uniq_key() .
+ * @return The number of clients, \c 0 if the field isn't unique or the key is empty.
+ */
+size_t db_uniq_held(const database *db, db_uniq_field field, const char *key)
+{
+        idx cnt = 0;
+        if (db->uniq[field] && key[0])
+                hmap_get(db->uniq[field], key, &cnt);
+
+        return cnt;
+}
+
+/**
+ * @brief Adds a client to the holders of a key, without checking it. The caller must hold \c db->lock .
+ * @param db The pointer to the database.
+ * @param field The key's field.
+ * @param key The key, see \c db_uniq_key() .
+ * @return \c 0 on success (or if the field isn't unique or the key is empty), \c EMALLOC if the index cannot grow.
+ */
+int db_uniq_ref(const database *db, db_uniq_field field, const char *key)
+{
+        if (!db->uniq[field] || !key[0])
+                return 0;
+
+        idx cnt = 0;
+        hmap_get(db->uniq[field], key, &cnt);
+        return hmap_put(db->uniq[field], key, cnt + 1);
+}
+
+/**
+ * @brief Removes a client from the holders of a key. The last holder removes the key. The caller must hold
+ *        \c db->lock .
+ * @param db The pointer to the database.
+ * @param field The key's field.
+ * @param key The key, see \c db_uniq_key() .
+ */
+void db_uniq_unref(const database *db, db_uniq_field field, const char *key)
+{
+        idx cnt = 0;
+        if (!db->uniq[field] || !key[0] || !hmap_get(db->uniq[field], key, &cnt))
+                return;
+
+        /* The key exists, so this cannot fail. */
+        if (cnt > 1)
+                hmap_put(db->uniq[field], key, cnt - 1);
+        else
+                hmap_rm(db->uniq[field], key);
+}
+
+/**
+ * @brief Adds a client's keys to the unique indexes (if they are enabled, see \c db_unique() ). The caller must hold
+ *        the database's lock, or the client's lock if it's modified.
+ * @param db The pointer to the database.
+ * @param email The client's email address.
+ * @param phone The client's phone number.
+ * @param old_email The client's current email address if it's modified, \c NULL for a new client. A key that doesn't
+ *                  change is not checked.
+ * @param old_phone The client's current phone number, like \c old_email .
+ * @retval 0 On success.
+ * @retval EDUP If a key is held by another client.
+ * @retval EMALLOC If an index cannot grow.
+ * @note The indexes are unchanged on failure. The keys the client gives up must be removed by \c db_uniq_rm() once the
+ *       change is done.
+ */
+int db_uniq_put(const database *db, const char *email, const char *phone, const char *old_email,
+                const char *old_phone)
+{
+        if (!db->uniq[DB_UNIQ_EMAIL] && !db->uniq[DB_UNIQ_PHONE])
+                return 0;
+
+        const char *val[DB_UNIQ_FIELDS] = {email, phone};
+        const char *old[DB_UNIQ_FIELDS] = {old_email, old_phone};
+        char key[DB_UNIQ_FIELDS][DB_UNIQ_KEY_SIZE];
+        int retval = 0;
+
+        pthread_mutex_lock(db->lock);
+        for (int f = 0; f < DB_UNIQ_FIELDS; f++) {
+                db_uniq_key_diff(f, val[f], old[f], key[f]);
+                if (db_uniq_held(db, f, key[f]))
+                        retval = EDUP;
+        }
+
+        for (int f = 0; f < DB_UNIQ_FIELDS && !retval; f++) {
+                retval = db_uniq_ref(db, f, key[f]);
+
+                /* The keys added before the failed one are removed. */
+                for (int g = 0; retval && g < f; g++)
+                        db_uniq_unref(db, g, key[g]);
+        }
+        pthread_mutex_unlock(db->lock);
+
+        return retval;
+}
+
+/**
+ * @brief Removes a client's keys from the unique indexes, see \c db_uniq_put() .
+ * @param db The pointer to the database.
+ * @param email The email address to be removed.
+ * @param phone The phone number to be removed.
+ * @param kept_email The client's email address if it's modified, \c NULL if it's removed. The key is kept if it's the
+ *                   same as \c email 's.
+ * @param kept_phone The client's phone number, like \c kept_email .
+ */
+void db_uniq_rm(const database *db, const char *email, const char *phone, const char *kept_email,
+                const char *kept_phone)
+{
+        if (!db->uniq[DB_UNIQ_EMAIL] && !db->uniq[DB_UNIQ_PHONE])
+                return;
+
+        const char *val[DB_UNIQ_FIELDS] = {email, phone};
+        const char *kept[DB_UNIQ_FIELDS] = {kept_email, kept_phone};
+        char key[DB_UNIQ_KEY_SIZE];
+
+        pthread_mutex_lock(db->lock);
+        for (int f = 0; f < DB_UNIQ_FIELDS; f++) {
+                db_uniq_key_diff(f, val[f], kept[f], key);
+                db_uniq_unref(db, f, key);
+        }
+        pthread_mutex_unlock(db->lock);
+}
+
+/**
+ * @brief Parses the unique fields.
+ * @param spec The field names separated by commas: \c email , \c phone , e.g. \c email,phone .
+ * @param dst Pointer to the destination: the bit \c 1<<field of every unique field, see \c db_uniq_field .
+ * @return \c 0 on success, \c EINV if \c spec is malformed or empty.
+ */
+int db_unique_parse(const char *spec, unsigned *dst)
+{
+        *dst = 0;
+
+        while (*spec) {
+                size_t len = strcspn(spec, ",");
+                int f = 0;
+                while (f < DB_UNIQ_FIELDS && (strlen(db_uniq_names[f]) != len || strncmp(spec, db_uniq_names[f], len)))
+                        f++;
+
+                if (f == DB_UNIQ_FIELDS || (spec[len] == ',' && spec[len + 1] == '\0'))
+                        return EINV;
+
+                *dst |= 1u << f;
+                spec += spec[len] ? len + 1 : len;
+        }
+
+        return *dst ? 0 : EINV;
+}
+
+/**
+ * @brief Makes some fields of the clients unique, see the file's description.
+ * @param db The pointer to the database.
+ * @param fields The bit \c 1<<field of every unique field, see \c db_uniq_field . The fields that are already unique
+ *               are skipped.
+ * @param dups Pointer to the destination of the number of clients holding a key of an earlier client.
+ * @retval 0 On success.
+ * @retval EINV If \c db is \c NULL .
+ * @retval EMALLOC If an index cannot be allocated. No field is made unique in this case.
+ */
+int db_unique(database *db, unsigned fields, size_t *dups)
+{
+        if (!db)
+                return EINV;
+
+        *dups = 0;
+        hmap *index[DB_UNIQ_FIELDS] = {NULL};
+        int retval = 0;
+
+        db_lock(db);
+        for (int f = 0; f < DB_UNIQ_FIELDS && !retval; f++) {
+                if ((fields & 1u << f) && !db->uniq[f] && !(index[f] = hmap_init(db->cl->size)))
+                        retval = EMALLOC;
+        }
+
+        char key[DB_UNIQ_KEY_SIZE];
+        for (idx i = 0; i < db->cl->size && !retval; i++) {
+                for (int f = 0; f < DB_UNIQ_FIELDS && !retval; f++) {
+                        if (!index[f])
+                                continue;
+
+                        db_uniq_key(f, db_uniq_val(db_cl_get(db, i), f), key);
+                        if (!key[0])
+                                continue;
+
+                        idx cnt = 0;
+                        if (hmap_get(index[f], key, &cnt))
+                                (*dups)++;
+
+                        retval = hmap_put(index[f], key, cnt + 1);
+                }
+        }
+
+        if (!retval) {
+                pthread_mutex_lock(db->lock);
+                for (int f = 0; f < DB_UNIQ_FIELDS; f++) {
+                        if (index[f])
+                                db->uniq[f] = index[f];
+                }
+                pthread_mutex_unlock(db->lock);
+        }
+        db_unlock(db);
+
+        for (int f = 0; f < DB_UNIQ_FIELDS && retval; f++)
+                hmap_del(index[f]);
+
+        return retval;
+}
+
+/**
+ * @brief Lists the clients whose email address or phone number is held by an earlier client.
+ * @details A single pass over the clients: every key is looked up in a hash map of the keys seen so far, so the report
+ *          doesn't need the unique indexes, nor compares every pair of clients.
+ * @param db The pointer to the database.
+ * @param fn Called with every duplicate, in the order of the clients. The database is locked meanwhile.
+ * @param arg The parameter of \c fn .
+ * @param cnt Pointer to the destination of the number of duplicates.
+ * @retval 0 On success.
+ * @retval EINV If \c db or \c fn is \c NULL .
+ * @retval EMALLOC If the maps cannot be allocated. The duplicates before the failure are listed.
+ */
+int db_dupes(const database *db, db_dup_fn fn, void *arg, size_t *cnt)
+{
+        if (!db || !fn)
+                return EINV;
+
+        *cnt = 0;
+        db_lock(db);
+        hmap *seen[DB_UNIQ_FIELDS] = {hmap_init(db->cl->size), hmap_init(db->cl->size)};
+        int retval = seen[DB_UNIQ_EMAIL] && seen[DB_UNIQ_PHONE] ? 0 : EMALLOC;
+
+        char key[DB_UNIQ_KEY_SIZE];
+        for (idx i = 0; i < db->cl->size && !retval; i++) {
+                for (int f = 0; f < DB_UNIQ_FIELDS && !retval; f++) {
+                        db_uniq_key(f, db_uniq_val(db_cl_get(db, i), f), key);
+                        if (!key[0])
+                                continue;
+
+                        idx first = 0;
+                        if (hmap_get(seen[f], key, &first)) {
+                                fn(arg, f, key, first, i);
+                                (*cnt)++;
+                        }
+                        else {
+                                retval = hmap_put(seen[f], key, i);
+                        }
+                }
+        }
+        db_unlock(db);
+
+        hmap_del(seen[DB_UNIQ_EMAIL]);
+        hmap_del(seen[DB_UNIQ_PHONE]);
+        return retval;
+}
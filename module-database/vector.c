@@ -5,9 +5,20 @@
  *          \c void** is used. The type can also be different, however all data must be preallocated and properly cast
  *          by the caller. Deallocation (to some extent) is handled by the implementation, more specifically if the data
  *          inside is not dynamically allocated.\n
+ *          A shared vector (\c v->shared ) can be read by other threads while one thread modifies it. Its pointer array
+ *          is never changed in a way a reader could see half-done: an append writes the new pointer before the size,
+ *          and a reallocation or a removal builds a new array, publishes it and retires the old one (see \c epoch.c ).
+ *          Readers must use \c vct_view() or \c vct_subptr() inside a read section. The writers still have to be
+ *          serialized by the caller.
  */
 
+#include "../include/platform.h"
+
+#include <string.h>
+
 #include "include/vector.h"
+#include "include/epoch.h"
+#include "../module-probe/include/probe.h"
 
 /**
  * @brief Allocates and initializes a vector on the heap.
@@ -20,11 +31,100 @@ vector *vct(void)
         if (!new)
                 return EMEMNULL;
 
+        PROBE_ALLOC(PROBE_MEM_VECTOR, sizeof(vector), 1);
         new->items = NULL;
         new->size = 0;
+        new->capacity = 0;
+        new->shared = false;
         return new;
 }
 
+/**
+ * @brief Replaces the pointer array of a shared vector by a copy, leaving out some pointers.
+ * @details The readers see either the old array and size, or the new ones (see \c vct_view() ). The copy is published
+ *          before the size, so a reader of the old size finds \c NULL at the end of a shrunk copy instead of reading
+ *          past it.
+ * @param v Pointer to the vector.
+ * @param capacity The capacity of the copy, at least \c v->size-cnt .
+ * @param skip The positions to be left out, in ascending order. \c NULL if \c cnt is \c 0 .
+ * @param cnt The number of positions to be left out.
+ * @retval 0 On success.
+ * @retval EREALLOC If the copy cannot be allocated.
+ */
+int vct_publish(vector *v, size_t capacity, const idx *skip, size_t cnt)
+{
+        void **tmp = calloc(capacity ? capacity : 1, sizeof(void*));
+        if (!tmp)
+                return EREALLOC;
+
+        /* The kept pointers are copied in runs, between the left out ones. */
+        size_t size = 0;
+        idx from = 0;
+        for (size_t i = 0; i <= cnt; i++) {
+                idx to = i < cnt ? skip[i] : v->size;
+                if (to > from)
+                        memcpy(tmp + size, v->items + from, (to - from) * sizeof(void*));
+
+                size += to - from;
+                from = to + 1;
+        }
+
+        void **old = v->items;
+        __atomic_store_n(&v->items, tmp, __ATOMIC_RELEASE);
+        __atomic_store_n(&v->size, size, __ATOMIC_RELEASE);
+        PROBE_ALLOC(PROBE_MEM_VECTOR, capacity * sizeof(void*), 0);
+        PROBE_FREE(PROBE_MEM_VECTOR, v->capacity * sizeof(void*), 0);
+        v->capacity = capacity;
+
+        epoch_retire(old, free);
+        return 0;
+}
+
+/**
+ * @brief Makes sure a vector can hold at least \c n pointers without reallocating.
+ * @param v Pointer to the vector.
+ * @param n The number of pointers.
+ * @retval 0 On success.
+ * @retval EINV If \c v is \c NULL.
+ * @retval EREALLOC If the vector expansion fails.
+ * @note Use this before adding a lot of items at once, it saves the reallocations.
+ */
+int vct_reserve(vector *v, size_t n)
+{
+        if (!v)
+                return EINV;
+
+        if (n <= v->capacity)
+                return 0;
+
+        if (v->shared)
+                return vct_publish(v, n, NULL, 0);
+
+        void **tmp = realloc(v->items, n * sizeof(void*));
+        if (!tmp)
+                return EREALLOC;
+
+        PROBE_ALLOC(PROBE_MEM_VECTOR, (n - v->capacity) * sizeof(void*), 0);
+        v->items = tmp;
+        v->capacity = n;
+        return 0;
+}
+
+/**
+ * @brief Makes space for one more pointer in a vector.
+ * @details The capacity is doubled, so adding \c n items only takes \c log(n) reallocations.
+ * @param v Pointer to the vector.
+ * @retval 0 On success.
+ * @retval EREALLOC If the vector expansion fails.
+ */
+int vct_grow(vector *v)
+{
+        if (v->size < v->capacity)
+                return 0;
+
+        return vct_reserve(v, v->capacity ? v->capacity * 2 : 4);
+}
+
 /**
  * @brief Appends a memory block pointer to a vector.
  * @param v A vector pointer to add \c data to.
@@ -40,22 +140,17 @@ int vct_push(vector *v, void *data)
         if (!v || !data)
                 return EINV;
 
-        /* vec->items is NULL, we have to allocate it */
-        if (v->size == 0) {
-                v->items = malloc(sizeof(void*));
-                if (!v->items)
-                        return EMALLOC;
+        int retval = vct_grow(v);
+        if (retval)
+                return retval;
 
-                v->items[0] = data;
-                v->size++;
+        if (v->shared) {
+                /* The pointer must be in place before a reader can see the new size. */
+                __atomic_store_n(&v->items[v->size], data, __ATOMIC_RELEASE);
+                __atomic_store_n(&v->size, v->size + 1, __ATOMIC_RELEASE);
                 return 0;
         }
 
-        void **tmp = realloc(v->items, (v->size + 1) * sizeof(void*));
-        if (!tmp)
-                return EREALLOC;
-
-        v->items = tmp;
         v->items[v->size] = data;
         v->size++;
         return 0;
@@ -69,7 +164,7 @@ int vct_push(vector *v, void *data)
  */
 inline bool inbounds(const vector *v, idx pos)
 {
-        return pos < v->size;
+        return pos < (v->shared ? __atomic_load_n(&v->size, __ATOMIC_ACQUIRE) : v->size);
 }
 
 /**
@@ -83,11 +178,11 @@ inline bool inbounds(const vector *v, idx pos)
  * @retval EINV If \c v or \c data is \c NULL.
  * @retval EOOB If the given \c pos is out of bounds.
  * @retval EREALLOC If the vector expansion fails.
- * @note Indexing starts from \c 0.
+ * @note Indexing starts from \c 0. Shared vectors only support appending.
  */
 int vct_insert(vector *v, void *data, idx pos)
 {
-        if (!v || !data)
+        if (!v || !data || v->shared)
                 return EINV;
 
         if (!inbounds(v, pos))
@@ -96,11 +191,10 @@ int vct_insert(vector *v, void *data, idx pos)
         if (pos == v->size)
                 return vct_push(v, data);
 
-        void **tmp = realloc(v->items, (v->size + 1) * sizeof(void*));
-        if (!tmp)
-                return EREALLOC;
+        int retval = vct_grow(v);
+        if (retval)
+                return retval;
 
-        v->items = tmp;
         v->size++;
 
         /* Shift the others to the right to make space at items[index]. */
@@ -118,10 +212,20 @@ int vct_insert(vector *v, void *data, idx pos)
  * @param pos Subpointer position.
  * @retval void* On success.
  * @retval NULL On failure.
- * @note The given pointer must not be freed. Use \c vct_rm() for that.
+ * @note The given pointer must not be freed. Use \c vct_rm() for that.\n
+ *       A shared vector can return \c NULL for an index a reader has just seen in bounds, if the pointer is being
+ *       removed.
  */
 void *vct_subptr(const vector *v, idx pos)
 {
+        if (v->shared) {
+                void **items;
+                if (pos >= vct_view(v, &items))
+                        return NULL;
+
+                return __atomic_load_n(&items[pos], __ATOMIC_ACQUIRE);
+        }
+
         if (!inbounds(v, pos))
                 return NULL;
 
@@ -129,15 +233,63 @@ void *vct_subptr(const vector *v, idx pos)
 }
 
 /**
- * @brief Deallocates and removes a memory block pointer from a vector at the given position.
+ * @brief Reads a consistent pointer array and size of a vector.
+ * @details The array and the size of a shared vector are published separately, so the array is read again to check
+ *          that it didn't change in the meantime.
+ * @param v Pointer to the vector.
+ * @param items The destination of the pointer array. It stays valid until the end of the caller's read section.
+ * @return The number of pointers in \c items . Pointers being removed can be \c NULL .
+ */
+size_t vct_view(const vector *v, void ***items)
+{
+        if (!v->shared) {
+                *items = v->items;
+                return v->size;
+        }
+
+        void **first;
+        size_t size;
+        do {
+                first = __atomic_load_n(&v->items, __ATOMIC_ACQUIRE);
+                size = __atomic_load_n(&v->size, __ATOMIC_ACQUIRE);
+        } while (first != __atomic_load_n(&v->items, __ATOMIC_ACQUIRE));
+
+        *items = first;
+        return size;
+}
+
+/**
+ * @brief Replaces a memory block pointer in a vector.
+ * @param v Pointer to the vector.
+ * @param pos Position of the memory block pointer in \c v->items.
+ * @param data The new memory block pointer.
+ * @return The replaced pointer, \c NULL if \c pos is out of range. It's not freed.
+ */
+void *vct_swap(vector *v, idx pos, void *data)
+{
+        if (!v || !inbounds(v, pos))
+                return NULL;
+
+        void *old = v->items[pos];
+        if (v->shared)
+                __atomic_store_n(&v->items[pos], data, __ATOMIC_RELEASE);
+        else
+                v->items[pos] = data;
+
+        return old;
+}
+
+/**
+ * @brief Removes a memory block pointer from a vector at the given position, without deallocating it.
  * @param v Pointer to the source vector.
  * @param pos Position of the memory block pointer in \c v->items.
  * @retval 0 On success.
  * @retval EINV If \c v is \c NULL.
  * @retval EOOB If \c pos is out of range.
- * @retval REALLOC If the vector shrinking fails.
+ * @retval EREALLOC If the pointer array of a shared vector cannot be copied. Nothing is removed in this case.
+ * @note Use this if the memory block is still used somewhere else.
  */
-int vct_rm(vector *v, idx pos)
+int vct_detach(vector *v, idx pos)
 {
         if (!v)
                 return EINV;
@@ -145,13 +297,20 @@ int vct_rm(vector *v, idx pos)
         if (!inbounds(v, pos))
                 return EOOB;
 
-        free(v->items[pos]);
+        if (v->shared) {
+                size_t capacity = v->size - 1 > v->capacity / 4 ? v->capacity : v->capacity / 2;
+                return vct_publish(v, capacity < v->size ? v->size : capacity, &pos, 1);
+        }
+
         /* reduce the size first to avoid shifting in OOB values later */
         v->size--;
 
         /* no items left, free the pointer array. */
         if (v->size == 0) {
+                PROBE_FREE(PROBE_MEM_VECTOR, v->capacity * sizeof(void*), 0);
                 free(v->items);
+                v->items = NULL;
+                v->capacity = 0;
                 return 0;
         }
 
@@ -159,14 +318,88 @@ int vct_rm(vector *v, idx pos)
                 v->items[i] = v->items[i + 1];
         }
 
-        void **tmp = realloc(v->items, (v->size + 1) * sizeof(void*));
+        /* Only shrink if most of the array is unused, so removing and adding items doesn't reallocate every time. */
+        if (v->size > v->capacity / 4)
+                return 0;
+
+        /* If the array cannot be shrunk, it's kept as it is. The pointer has already been removed. */
+        void **tmp = realloc(v->items, (v->capacity / 2) * sizeof(void*));
         if (!tmp)
-                return EREALLOC;
+                return 0;
 
+        PROBE_FREE(PROBE_MEM_VECTOR, (v->capacity - v->capacity / 2) * sizeof(void*), 0);
         v->items = tmp;
+        v->capacity /= 2;
+        return 0;
+}
+
+/**
+ * @brief Removes memory block pointers from a vector and makes space for new ones, in a single pass.
+ * @details Nothing is changed if the vector cannot be expanded, so a batch of removals and additions can be applied
+ *          either as a whole or not at all: after this, \c extra pointers can be added by \c vct_push() without
+ *          failing. A shared vector's array is copied only once.
+ * @param v Pointer to the vector.
+ * @param pos The positions to be removed, in ascending order, without duplicates.
+ * @param cnt The number of positions.
+ * @param extra The number of pointers that will be added.
+ * @retval 0 On success.
+ * @retval EINV If \c v is \c NULL.
+ * @retval EOOB If a position is out of range.
+ * @retval EREALLOC If the vector expansion fails. Nothing is removed in this case.
+ * @note The removed memory blocks are not freed.
+ */
+int vct_splice(vector *v, const idx *pos, size_t cnt, size_t extra)
+{
+        if (!v)
+                return EINV;
+
+        if (cnt && !inbounds(v, pos[cnt - 1]))
+                return EOOB;
+
+        size_t size = v->size - cnt;
+        if (v->shared && cnt)
+                return vct_publish(v, size + extra > v->capacity ? size + extra : v->capacity, pos, cnt);
+
+        /* The array only grows if the removals don't make enough space, so reserving first doesn't waste it. */
+        int retval = vct_reserve(v, size + extra);
+        if (retval || !cnt)
+                return retval;
+
+        idx dst = pos[0];
+        for (idx src = pos[0], next = 0; src < v->size; src++) {
+                if (next < cnt && src == pos[next]) {
+                        next++;
+                        continue;
+                }
+
+                v->items[dst++] = v->items[src];
+        }
+
+        v->size = size;
         return 0;
 }
 
+/**
+ * @brief Deallocates and removes a memory block pointer from a vector at the given position.
+ * @param v Pointer to the source vector.
+ * @param pos Position of the memory block pointer in \c v->items.
+ * @retval 0 On success.
+ * @retval EINV If \c v is \c NULL.
+ * @retval EOOB If \c pos is out of range.
+ * @note Not for shared vectors, a reader may still use the memory block. Use \c vct_detach() there.
+ */
+int vct_rm(vector *v, idx pos)
+{
+        if (!v || v->shared)
+                return EINV;
+
+        if (!inbounds(v, pos))
+                return EOOB;
+
+        free(v->items[pos]);
+        return vct_detach(v, pos);
+}
+
 /**
  * @brief Frees all memory blocks and the vector.
  * @param v Pointer to the vector to be deleted.
@@ -178,7 +411,11 @@ int vct_del(vector *v)
         if (!v)
                 return EINV;
 
+        PROBE_FREE(PROBE_MEM_VECTOR, sizeof(vector) + v->capacity * sizeof(void*), 1);
+
+        /* A shared vector keeps its (empty) array. */
         if (v->size == 0){
+                free(v->items);
                 free(v);
                 return 0;
         }
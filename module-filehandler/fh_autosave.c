@@ -0,0 +1,185 @@
+/**
+ * @file fh_autosave.c
+ * @brief Function definitions for the background autosave.
+ * @details Saving a large database takes a while, so the autosave doesn't export the database on the interface's
+ *          thread. It takes a snapshot instead (see \c db_snap() ), which costs a pointer per client, and a worker
+ *          thread exports the snapshot while the database is being edited. The clients changed in the meantime are
+ *          copied by the database, so the snapshot stays consistent.\n
+ *          An autosave is a checkpoint: the journal is marked with the next generation when the snapshot is taken, and
+ *          the records before the marker are dropped from the journal after the snapshot has been saved.\n
+ *          The autosave is triggered by the changes of the database (\c db->on_change ): either \c threshold changes
+ *          have been made, or \c interval seconds have passed since the last autosave. Only one autosave runs at a
+ *          time, the finished one is cleaned up by the next change or by \c fh_autosave_stop() .\n
+ *          The changes can come from several writer threads, they are counted one at a time.
+ */
+
+#include "../include/platform.h"
+
+#include "include/fh.h"
+
+/**
+ * @struct fh_autosave_ctx fh_autosave.c
+ * @brief The state of the autosave.
+ */
+typedef struct fh_autosave_ctx {
+        database *db;           /**< The database to be saved, \c NULL if the autosave isn't running. */
+        database *snap;         /**< The snapshot being saved, \c NULL if there is none. */
+        pthread_t thread;       /**< The worker thread saving \c snap . */
+        bool done;              /**< Set by the worker when it's finished. Protected by \c db->lock . */
+        int err;                /**< The error code of the last save. */
+        unsigned long gen;      /**< The generation of \c snap . */
+        unsigned interval;      /**< Seconds between two autosaves, \c 0 to disable. */
+        unsigned threshold;     /**< Number of changes that trigger an autosave, \c 0 to disable. */
+        unsigned changes;       /**< Number of changes since the last autosave. */
+        time_t last;            /**< The time of the last autosave. */
+        pthread_mutex_t tick;   /**< Serializes the changes counted by the writer threads. */
+} fh_autosave_ctx;
+
+static fh_autosave_ctx autosave = {.tick = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Exports the snapshot. The thread function of the autosave.
+ * @param arg Pointer to the autosave's state.
+ * @return \c NULL
+ */
+void *fh_autosave_worker(void *arg)
+{
+        fh_autosave_ctx *ctx = arg;
+        int retval = fh_export(ctx->snap);
+
+        /* The clients replaced in the database since the snapshot are freed here. */
+        db_snap_rel(ctx->snap);
+
+        pthread_mutex_lock(ctx->db->lock);
+        ctx->err = retval;
+        ctx->done = true;
+        pthread_mutex_unlock(ctx->db->lock);
+        return NULL;
+}
+
+/**
+ * @brief Cleans up after a finished autosave.
+ * @param wait If \c true , waits for a running autosave to finish.
+ * @return \c true if there is no autosave running anymore.
+ */
+bool fh_autosave_finish(bool wait)
+{
+        if (!autosave.snap)
+                return true;
+
+        pthread_mutex_lock(autosave.db->lock);
+        bool done = autosave.done;
+        pthread_mutex_unlock(autosave.db->lock);
+
+        if (!done && !wait)
+                return false;
+
+        pthread_join(autosave.thread, NULL);
+        autosave.snap = NULL;
+
+        /* The journal is replaced, nobody may write it in the meantime. */
+        if (!autosave.err) {
+                db_lock(autosave.db);
+                autosave.err = fh_jrnl_compact(autosave.db, autosave.gen);
+                db_unlock(autosave.db);
+        }
+
+        return true;
+}
+
+/**
+ * @brief Takes a snapshot of the database and starts saving it in the background.
+ */
+void fh_autosave_begin(void)
+{
+        database *db = autosave.db;
+
+        autosave.changes = 0;
+        autosave.last = time(NULL);
+
+        /* The records after the marker are not in the snapshot. No writer may come in between. */
+        db_lock(db);
+        db->gen++;
+        db_journal(db, "G>%lu\n", db->gen);
+        autosave.snap = db_snap(db);
+        db_unlock(db);
+
+        if (!autosave.snap) {
+                autosave.err = EMALLOC;
+                return;
+        }
+
+        autosave.gen = db->gen;
+        autosave.done = false;
+
+        if (pthread_create(&autosave.thread, NULL, fh_autosave_worker, &autosave)) {
+                /* Better late than never. */
+                fh_autosave_worker(&autosave);
+                autosave.snap = NULL;
+                if (!autosave.err) {
+                        db_lock(db);
+                        autosave.err = fh_jrnl_compact(db, autosave.gen);
+                        db_unlock(db);
+                }
+        }
+}
+
+/**
+ * @brief Counts the changes of the database and starts an autosave if it's due. Used as \c db->on_change .
+ * @param db The pointer to the database.
+ */
+void fh_autosave_tick(const database *db)
+{
+        if (db != autosave.db)
+                return;
+
+        pthread_mutex_lock(&autosave.tick);
+        autosave.changes++;
+
+        bool due = (autosave.threshold && autosave.changes >= autosave.threshold) ||
+                   (autosave.interval && time(NULL) - autosave.last >= (time_t)autosave.interval);
+
+        if (fh_autosave_finish(false) && due)
+                fh_autosave_begin();
+
+        pthread_mutex_unlock(&autosave.tick);
+}
+
+/**
+ * @brief Starts autosaving a database.
+ * @param db The pointer to the database.
+ * @param interval Seconds between two autosaves, \c 0 to disable.
+ * @param threshold Number of changes that trigger an autosave, \c 0 to disable.
+ * @note Only one database can be autosaved at a time. \c fh_autosave_stop() must be called before the database is
+ *       deleted or exported on its own.
+ */
+void fh_autosave_start(database *db, unsigned interval, unsigned threshold)
+{
+        autosave.db = db;
+        autosave.snap = NULL;
+        autosave.err = 0;
+        autosave.interval = interval;
+        autosave.threshold = threshold;
+        autosave.changes = 0;
+        autosave.last = time(NULL);
+
+        db->on_change = fh_autosave_tick;
+}
+
+/**
+ * @brief Stops autosaving a database. Waits for the running autosave to finish.
+ * @param db The pointer to the database.
+ * @return The error code of the last autosave, \c 0 if it was successful or there was none.
+ */
+int fh_autosave_stop(database *db)
+{
+        if (autosave.db != db)
+                return 0;
+
+        db->on_change = NULL;
+        pthread_mutex_lock(&autosave.tick);
+        fh_autosave_finish(true);
+        autosave.db = NULL;
+        pthread_mutex_unlock(&autosave.tick);
+        return autosave.err;
+}
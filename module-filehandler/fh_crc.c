@@ -0,0 +1,343 @@
+/**
+ * @file fh_crc.c
+ * @brief Function definitions for the checksums of the snapshot.
+ * @details Every snapshot file is split into blocks: the header (\c D , \c G and \c N lines) and every client with its
+ *          cars and operations. A block is closed by a checksum line, \c C>xxxxxxxx , the CRC32C of the block's bytes
+ *          before the line in hexadecimal. A damaged block only loses its own client, the rest of the file still
+ *          loads. The header's \c N>count line is the number of clients in the file, so a truncated file is detected
+ *          even if it was cut at a block boundary.\n
+ *          The CRC32C is computed by the SSE4.2 \c crc32 instruction if the CPU has it, otherwise by a table driven
+ *          implementation (slicing-by-8). At load, the blocks are verified in parallel, see \c fh_verify() .\n
+ *          Files without checksum lines were written by an older version. They are loaded unchecked and sealed by the
+ *          next export.
+ */
+
+#include "../include/platform.h"
+
+#include <pthread.h>
+
+#include "include/fh.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define FH_CRC_SSE42
+#endif
+
+#define CRC_POLY 0x82f63b78U    /**< The CRC32C (Castagnoli) polynomial, bit reversed. */
+#define CRC_CHUNK 1024          /**< Number of blocks verified by a task. */
+
+/** The tables of the slicing-by-8 implementation. \c crc_table[0] is the usual byte-wise table. */
+static uint32_t crc_table[8][256];
+/** The implementation chosen for the CPU. */
+static uint32_t (*crc_impl)(uint32_t crc, const unsigned char *p, size_t n);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+/** The digits of the checksum lines. */
+static const char crc_hex[] = "0123456789abcdef";
+
+/** The integrity checks of the last import. */
+fh_integrity fh_check;
+/** Protects \c fh_check , the shards are verified by different threads. */
+static pthread_mutex_t fh_check_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @struct crc_job fh_crc.c
+ * @brief The blocks shared by the verifier tasks.
+ */
+typedef struct crc_job {
+        const char *data;       /**< The file's contents. */
+        fh_damage *blocks;      /**< The blocks of the file. */
+        bool *bad;              /**< Set for every block whose checksum doesn't match. */
+        size_t cnt;             /**< Number of blocks. */
+} crc_job;
+
+/**
+ * @brief Table driven CRC32C, 8 bytes per step.
+ * @param crc The CRC of the preceding data, not inverted.
+ * @param p The data.
+ * @param n The size of the data.
+ * @return The CRC of the preceding data and \c p , not inverted.
+ */
+uint32_t crc_sw(uint32_t crc, const unsigned char *p, size_t n)
+{
+        for (; n >= 8; n -= 8, p += 8) {
+                uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+                uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+
+                crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+                      crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+                      crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+                      crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+        }
+
+        while (n--)
+                crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+        return crc;
+}
+
+#ifdef FH_CRC_SSE42
+/**
+ * @brief CRC32C with the SSE4.2 \c crc32 instruction.
+ * @param crc The CRC of the preceding data, not inverted.
+ * @param p The data.
+ * @param n The size of the data.
+ * @return The CRC of the preceding data and \c p , not inverted.
+ * @warning Only call it if the CPU supports SSE4.2.
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t n)
+{
+#ifdef __x86_64__
+        uint64_t crc64 = crc;
+        for (; n >= 8; n -= 8, p += 8) {
+                uint64_t word;
+                memcpy(&word, p, 8);
+                crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+#endif
+        for (; n >= 4; n -= 4, p += 4) {
+                uint32_t word;
+                memcpy(&word, p, 4);
+                crc = _mm_crc32_u32(crc, word);
+        }
+
+        while (n--)
+                crc = _mm_crc32_u8(crc, *p++);
+
+        return crc;
+}
+#endif
+
+/**
+ * @brief Builds the tables and chooses the implementation. Called once, by \c fh_crc32c() .
+ */
+void crc_init(void)
+{
+        for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                        crc = crc & 1 ? (crc >> 1) ^ CRC_POLY : crc >> 1;
+
+                crc_table[0][i] = crc;
+        }
+
+        for (int t = 1; t < 8; t++) {
+                for (int i = 0; i < 256; i++)
+                        crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+
+        crc_impl = crc_sw;
+#ifdef FH_CRC_SSE42
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+                crc_impl = crc_hw;
+#endif
+}
+
+/**
+ * @brief Computes the CRC32C of a memory block.
+ * @param crc The CRC of the preceding data, \c 0 at the beginning.
+ * @param data The memory block.
+ * @param n The size of \c data .
+ * @return The CRC of the preceding data and \c data .
+ */
+uint32_t fh_crc32c(uint32_t crc, const void *data, size_t n)
+{
+        pthread_once(&crc_once, crc_init);
+        return ~crc_impl(~crc, data, n);
+}
+
+/**
+ * @brief Formats a checksum line.
+ * @param dst The destination, at least \c FH_CRC_LINE long. It's not null-terminated.
+ * @param crc The checksum.
+ */
+void fh_crc_line(char *dst, uint32_t crc)
+{
+        dst[0] = 'C';
+        dst[1] = '>';
+        for (int i = 0; i < 8; i++)
+                dst[2 + i] = crc_hex[(crc >> (28 - 4 * i)) & 0xf];
+
+        dst[FH_CRC_LINE - 1] = '\n';
+}
+
+/**
+ * @brief Verifies a block against its checksum line.
+ * @param blk The block, its last line must be the checksum line.
+ * @param len The length of the block.
+ * @retval 0 If the checksum matches.
+ * @retval EINV If it doesn't, or the block doesn't end with a checksum line.
+ */
+int fh_crc_check(const char *blk, size_t len)
+{
+        if (len < FH_CRC_LINE)
+                return EINV;
+
+        const char *line = blk + len - FH_CRC_LINE;
+        if (line[0] != 'C' || line[1] != '>' || line[FH_CRC_LINE - 1] != '\n' || (line != blk && line[-1] != '\n'))
+                return EINV;
+
+        uint32_t stored = 0;
+        for (int i = 2; i < FH_CRC_LINE - 1; i++) {
+                const char *digit = memchr(crc_hex, line[i], 16);
+                if (!digit)
+                        return EINV;
+
+                stored = stored << 4 | (uint32_t)(digit - crc_hex);
+        }
+
+        return fh_crc32c(0, blk, len - FH_CRC_LINE) == stored ? 0 : EINV;
+}
+
+/**
+ * @brief A verifier task, see \c pool_for() .
+ * @param arg Pointer to the shared \c crc_job .
+ * @param from The first block to be verified.
+ * @param to The end of the blocks to be verified.
+ */
+void crc_verify_part(void *arg, size_t from, size_t to)
+{
+        crc_job *job = arg;
+
+        for (size_t i = from; i < to; i++)
+                job->bad[i] = fh_crc_check(job->data + job->blocks[i].off, job->blocks[i].len) != 0;
+}
+
+/**
+ * @brief Appends a block to an array of blocks.
+ * @param arr Pointer to the array.
+ * @param cnt Pointer to the number of blocks.
+ * @param cap Pointer to the capacity of the array.
+ * @param blk The block to be appended.
+ * @return \c 0 on success, \c EMALLOC if the array cannot grow.
+ */
+int crc_push(fh_damage **arr, size_t *cnt, size_t *cap, fh_damage blk)
+{
+        if (*cnt == *cap) {
+                size_t new_cap = *cap ? *cap * 2 : 64;
+                fh_damage *tmp = realloc(*arr, new_cap * sizeof(fh_damage));
+                if (!tmp)
+                        return EMALLOC;
+
+                *arr = tmp;
+                *cap = new_cap;
+        }
+
+        (*arr)[(*cnt)++] = blk;
+        return 0;
+}
+
+/**
+ * @brief Records the result of a file's verification in \c fh_check .
+ * @param bad The damaged blocks of the file.
+ * @param cnt The number of damaged blocks.
+ * @param blocks The number of verified blocks.
+ */
+void crc_report(const fh_damage *bad, size_t cnt, size_t blocks)
+{
+        pthread_mutex_lock(&fh_check_lock);
+
+        if (blocks == 0)
+                fh_check.unchecked++;
+
+        fh_check.blocks += blocks;
+        for (size_t i = 0; i < cnt; i++) {
+                if (fh_check.damaged < FH_DAMAGE_LOG)
+                        fh_check.log[fh_check.damaged] = bad[i];
+
+                fh_check.damaged++;
+                fh_check.lost += bad[i].clients;
+        }
+
+        pthread_mutex_unlock(&fh_check_lock);
+}
+
+/**
+ * @brief Verifies the blocks of a snapshot file.
+ * @details The file is split into blocks by the checksum lines, then the blocks are verified in parallel, see \c pool.c . If
+ *          the header's \c N>count line is intact, the clients missing from the end of the file are reported as a
+ *          block of zero length at the end of the file. The result is also recorded in \c fh_check .
+ * @param data The file's contents.
+ * @param len The size of the file.
+ * @param shard The shard of the file, recorded in the damaged blocks.
+ * @param bad Pointer to the destination of the damaged blocks, in the order of the file.
+ * @param cnt Pointer to the destination of the number of damaged blocks.
+ * @retval 0 On success, even if there are damaged blocks. The caller must free \c *bad .
+ * @retval EMALLOC If the blocks cannot be allocated.
+ * @note A file without any checksum lines was written by an older version, it has no damaged blocks.
+ */
+int fh_verify(const char *data, size_t len, unsigned shard, fh_damage **bad, size_t *cnt)
+{
+        crc_job job = {data, NULL, NULL, 0};
+        size_t cap = 0;
+        size_t clients = 0;
+        size_t expected = 0;
+        size_t header = (size_t)-1;
+        size_t line = 1;
+        int retval = 0;
+
+        *bad = NULL;
+        *cnt = 0;
+
+        /* Split the file by the checksum lines, and count the clients before every block. */
+        fh_damage blk = {shard, 1, 0, 0, 0, 0};
+        for (size_t pos = 0; pos < len && !retval; line++) {
+                const char *nl = memchr(data + pos, '\n', len - pos);
+                size_t end = nl ? (size_t)(nl - data) + 1 : len;
+
+                if (end - pos >= 2 && data[pos + 1] == '>') {
+                        if (data[pos] == 'U') {
+                                blk.clients++;
+                        }
+                        else if (data[pos] == 'N') {
+                                expected = strtoul(data + pos + 2, NULL, 10);
+                                header = job.cnt;
+                        }
+                        else if (data[pos] == 'C') {
+                                blk.len = end - blk.off;
+                                retval = crc_push(&job.blocks, &job.cnt, &cap, blk);
+                                clients += blk.clients;
+                                blk = (fh_damage){shard, line + 1, end, 0, clients, 0};
+                        }
+                }
+
+                pos = end;
+        }
+
+        /* The end of a checksummed file must be checksummed too. */
+        if (!retval && job.cnt && blk.off < len) {
+                blk.len = len - blk.off;
+                retval = crc_push(&job.blocks, &job.cnt, &cap, blk);
+                clients += blk.clients;
+        }
+
+        job.bad = calloc(job.cnt ? job.cnt : 1, sizeof(bool));
+        if (retval || !job.bad) {
+                free(job.blocks);
+                free(job.bad);
+                return EMALLOC;
+        }
+
+        pool_for("crc", job.cnt, CRC_CHUNK, crc_verify_part, &job);
+
+        /* The damaged blocks are moved to the front of the array. */
+        size_t damaged = 0;
+        for (size_t i = 0; i < job.cnt; i++) {
+                if (job.bad[i])
+                        job.blocks[damaged++] = job.blocks[i];
+        }
+
+        if (header < job.cnt && !job.bad[header] && clients < expected) {
+                blk = (fh_damage){shard, line, len, 0, clients, expected - clients};
+                job.blocks[damaged++] = blk;
+        }
+
+        crc_report(job.blocks, damaged, job.cnt);
+
+        free(job.bad);
+        *bad = job.blocks;
+        *cnt = damaged;
+        return 0;
+}
@@ -0,0 +1,546 @@
+/**
+ * @file fh_csv.c
+ * @brief Function definitions for the bulk CSV ingestion.
+ * @details Loads rows exported from another system straight into the database, without going through the interface
+ *          or calling \c db_*_add() with a lookup per row.\n
+ *          The first row of the file is the header. The mapping tells which column holds which field:
+ *          \c name=Nev,plate=3,... where the value is either the header of the column or its 1-based number. The
+ *          fields are: \c name , \c email , \c phone , \c car , \c plate , \c desc , \c price , \c date , \c exp .
+ *          Without a mapping every field is taken from the column with the same header, if there is one.\n
+ *          A row adds a client (identified by its name), a car of the client (identified by its plate) and an
+ *          operation of the car (if it has a description). Existing clients and cars are reused, so a client with
+ *          several cars and operations may take up several rows. The clients and cars are looked up in hash maps.\n
+ *          The rows are read and validated in batches. The client vector is reserved for the batch's new clients
+ *          before they are added, then the rows are applied in order. Invalid rows are rejected as a whole, and so are
+ *          the rows of a new client whose email address or phone number is held by another client (see \c uniq.c ).
+ *          The dates have the \c YYYY-MM-DD \c HH:MM format, an empty creation date means the time of the ingest.
+ * @note The rows are not journaled one by one, the caller should make a checkpoint after the ingest.
+ */
+
+#include "../include/platform.h"
+
+#include "include/fh.h"
+#include "../module-database/include/hmap.h"
+
+#define CSV_MAX_COLS 64                 /**< Maximum number of columns in a row. */
+#define CSV_RECORD_SIZE 4096            /**< Maximum size of a row, after unquoting. */
+#define CSV_BATCH 4096                  /**< Number of rows validated before they are applied. */
+#define CSV_NEW ((idx)-1)               /**< The index of a client added by the current batch, before it's added. */
+#define CSV_DUP ((idx)-2)               /**< The index of a rejected new client, see \c db_cl_add() and \c EDUP . */
+#define CSV_KEY_SIZE (DESC_SIZE + 22)   /**< Size of a car's key: a client index (20 digits), a \c | and a field. */
+
+/**
+ * @enum csv_field fh_csv.c
+ * @brief The fields a column can be mapped to.
+ */
+typedef enum csv_field {
+        CSV_NAME, CSV_EMAIL, CSV_PHONE, CSV_CAR, CSV_PLATE, CSV_DESC, CSV_PRICE, CSV_DATE, CSV_EXP, CSV_FIELD_CNT
+} csv_field;
+
+/** The names of the fields in the mapping. */
+static const char *csv_field_names[CSV_FIELD_CNT] = {
+        "name", "email", "phone", "car", "plate", "desc", "price", "date", "exp"
+};
+
+/** The maximum length of the fields. */
+static const size_t csv_field_size[CSV_FIELD_CNT] = {
+        NAME_SIZE, EMAIL_SIZE, PHNUM_SIZE, NAME_SIZE, PLATE_SIZE, DESC_SIZE, DEFAULT_BUF_SIZE, DEFAULT_BUF_SIZE,
+        DEFAULT_BUF_SIZE
+};
+
+/**
+ * @struct csv_reader fh_csv.c
+ * @brief A buffered CSV reader.
+ */
+typedef struct csv_reader {
+        FILE *src;                      /**< The source file. */
+        char buf[EXPORT_BUF_SIZE];      /**< The buffered bytes of the file. */
+        size_t len;                     /**< Number of buffered bytes. */
+        size_t pos;                     /**< Position of the next byte in \c buf . */
+        char rec[CSV_RECORD_SIZE];      /**< The unquoted fields of the current row, separated by \c \\0 . */
+        char *col[CSV_MAX_COLS];        /**< Pointers to the fields in \c rec . */
+        size_t cols;                    /**< Number of fields in the current row. */
+        size_t line;                    /**< The line number where the current row starts. */
+        size_t next_line;               /**< The line number where the next row starts. */
+        bool bad;                       /**< Set if the current row is too long or its quotes are unbalanced. */
+} csv_reader;
+
+/**
+ * @struct csv_row fh_csv.c
+ * @brief A validated row, waiting to be applied.
+ */
+typedef struct csv_row {
+        char f[CSV_FIELD_CNT][DESC_SIZE + 1];   /**< The fields of the row. Unmapped fields are empty. */
+        double price;                           /**< The parsed price. */
+        size_t line;                            /**< The row's line number in the file. */
+        idx cl;                                 /**< The client's index, assigned before the batch is applied. */
+} csv_row;
+
+/**
+ * @brief Refills the reader's buffer, if it's empty.
+ * @param r Pointer to the reader.
+ * @return \c true if there are bytes to read, \c false at the end of the file.
+ */
+bool csv_fill(csv_reader *r)
+{
+        if (r->pos < r->len)
+                return true;
+
+        r->len = fread(r->buf, 1, sizeof(r->buf), r->src);
+        r->pos = 0;
+        return r->len > 0;
+}
+
+/**
+ * @brief Reads the next row of a CSV file. (RFC 4180, quoted fields may contain commas, quotes and line breaks.)
+ * @param r Pointer to the reader.
+ * @return \c true if a row was read, \c false at the end of the file.
+ * @note Check \c r->bad before using the row.
+ */
+bool csv_record(csv_reader *r)
+{
+        if (!csv_fill(r))
+                return false;
+
+        size_t n = 0;
+        bool quoted = false;
+        bool field_start = true;
+
+        r->line = r->next_line;
+        r->bad = false;
+        r->cols = 1;
+        r->col[0] = r->rec;
+
+        while (csv_fill(r)) {
+                char c = r->buf[r->pos++];
+
+                if (quoted) {
+                        if (c == '"') {
+                                /* A doubled quote is a quote character, a single one closes the field. */
+                                if (!csv_fill(r) || r->buf[r->pos] != '"') {
+                                        quoted = false;
+                                        continue;
+                                }
+                                r->pos++;
+                        }
+                        else if (c == '\n') {
+                                r->next_line++;
+                        }
+                }
+                else if (c == '"' && field_start) {
+                        quoted = true;
+                        field_start = false;
+                        continue;
+                }
+                else if (c == ',') {
+                        if (n + 1 < CSV_RECORD_SIZE && r->cols < CSV_MAX_COLS) {
+                                r->rec[n++] = '\0';
+                                r->col[r->cols++] = r->rec + n;
+                        }
+                        else {
+                                r->bad = true;
+                        }
+
+                        field_start = true;
+                        continue;
+                }
+                else if (c == '\r') {
+                        continue;
+                }
+                else if (c == '\n') {
+                        r->next_line++;
+                        break;
+                }
+
+                field_start = false;
+                if (n + 1 < CSV_RECORD_SIZE)
+                        r->rec[n++] = c;
+                else
+                        r->bad = true;
+        }
+
+        if (quoted)
+                r->bad = true;
+
+        r->rec[n] = '\0';
+        return true;
+}
+
+/**
+ * @brief Compares two strings, ignoring the case of ASCII letters.
+ * @param a The first string.
+ * @param b The second string.
+ * @param b_len The length of \c b , it doesn't have to be terminated.
+ * @return \c true if they are equal, \c false if not.
+ */
+bool csv_name_eq(const char *a, const char *b, size_t b_len)
+{
+        for (size_t i = 0; i < b_len; i++) {
+                char x = (char)(a[i] >= 'A' && a[i] <= 'Z' ? a[i] + 32 : a[i]);
+                char y = (char)(b[i] >= 'A' && b[i] <= 'Z' ? b[i] + 32 : b[i]);
+                if (x != y || x == '\0')
+                        return false;
+        }
+
+        return a[b_len] == '\0';
+}
+
+/**
+ * @brief Finds a column by its header or its 1-based number.
+ * @param header Pointer to the reader holding the header row.
+ * @param str The header or the number of the column.
+ * @param len The length of \c str .
+ * @return The column's index, \c -1 if there is no such column.
+ */
+int csv_column(const csv_reader *header, const char *str, size_t len)
+{
+        size_t digits = 0;
+        while (digits < len && str[digits] >= '0' && str[digits] <= '9')
+                digits++;
+
+        if (digits == len && len > 0 && len < 4) {
+                int col = atoi(str) - 1;
+                return col >= 0 && (size_t)col < header->cols ? col : -1;
+        }
+
+        for (size_t i = 0; i < header->cols; i++) {
+                if (csv_name_eq(header->col[i], str, len))
+                        return (int)i;
+        }
+
+        return -1;
+}
+
+/**
+ * @brief Maps the fields to the columns.
+ * @param header Pointer to the reader holding the header row.
+ * @param mapping The mapping, see the file's description. \c NULL maps the fields by their names.
+ * @param map The destination, the column of every field, \c -1 for the unmapped ones.
+ * @return \c 0 on success, \c EINV if the mapping is malformed, refers to a missing column or \c name is unmapped.
+ */
+int csv_map(const csv_reader *header, const char *mapping, int *map)
+{
+        for (int f = 0; f < CSV_FIELD_CNT; f++)
+                map[f] = mapping ? -1 : csv_column(header, csv_field_names[f], strlen(csv_field_names[f]));
+
+        while (mapping && *mapping) {
+                const char *eq = strchr(mapping, '=');
+                const char *end = strchr(mapping, ',');
+                if (!end)
+                        end = mapping + strlen(mapping);
+                if (!eq || eq > end)
+                        return EINV;
+
+                int field = -1;
+                for (int f = 0; f < CSV_FIELD_CNT; f++) {
+                        if (csv_name_eq(csv_field_names[f], mapping, (size_t)(eq - mapping)))
+                                field = f;
+                }
+
+                if (field < 0 || (map[field] = csv_column(header, eq + 1, (size_t)(end - eq - 1))) < 0)
+                        return EINV;
+
+                mapping = *end ? end + 1 : end;
+        }
+
+        return map[CSV_NAME] < 0 ? EINV : 0;
+}
+
+/**
+ * @brief Copies the mapped fields of the current row and validates them.
+ * @param r Pointer to the reader holding the row.
+ * @param map The column of every field.
+ * @param row Pointer to the destination.
+ * @return \c true if the row is valid, \c false if it must be rejected.
+ */
+bool csv_row_fill(const csv_reader *r, const int *map, csv_row *row)
+{
+        if (r->bad)
+                return false;
+
+        for (int f = 0; f < CSV_FIELD_CNT; f++) {
+                row->f[f][0] = '\0';
+                if (map[f] < 0)
+                        continue;
+
+                /* A short row is missing a mapped column. */
+                if ((size_t)map[f] >= r->cols)
+                        return false;
+
+                const char *src = r->col[map[f]];
+                size_t len = strlen(src);
+
+                /* The pipe character separates the fields in the snapshot. */
+                if (len > csv_field_size[f] || memchr(src, '|', len) || memchr(src, '\n', len))
+                        return false;
+
+                memcpy(row->f[f], src, len + 1);
+        }
+
+        row->line = r->line;
+        row->price = 0;
+
+        if (row->f[CSV_NAME][0] == '\0')
+                return false;
+
+        if (row->f[CSV_DESC][0] == '\0')
+                return true;
+
+        /* An operation needs a car. */
+        date check;
+        if (row->f[CSV_PLATE][0] == '\0' ||
+            (row->f[CSV_PRICE][0] != '\0' && fh_parse_price(row->f[CSV_PRICE], &row->price)) ||
+            (row->f[CSV_DATE][0] != '\0' && date_parse_strict(row->f[CSV_DATE], &check)) ||
+            (row->f[CSV_EXP][0] != '\0' && date_parse_strict(row->f[CSV_EXP], &check)))
+                return false;
+
+        return true;
+}
+
+/**
+ * @struct csv_ctx fh_csv.c
+ * @brief The state of an ingest.
+ */
+typedef struct csv_ctx {
+        database *db;           /**< The destination database. */
+        hmap *clients;          /**< Client name -> client index. */
+        hmap *cars;             /**< \c cl|plate -> car index. */
+        bool *seen;             /**< Set for the clients that existed before the ingest, once their cars are mapped. */
+        idx old_cnt;            /**< Number of clients before the ingest. */
+        char now[DEFAULT_BUF_SIZE];     /**< The creation date of the operations without one. */
+        fh_csv_stats *stats;    /**< The statistics to be updated. */
+} csv_ctx;
+
+/**
+ * @brief Maps the cars of a client that existed before the ingest.
+ * @param ctx Pointer to the ingest's state.
+ * @param cl The client's index.
+ * @retval 0 On success.
+ * @retval EMALLOC If the map cannot grow.
+ * @retval EINV If the client cannot be loaded.
+ */
+int csv_cl_seen(csv_ctx *ctx, idx cl)
+{
+        if (cl >= ctx->old_cnt || ctx->seen[cl])
+                return 0;
+
+        ctx->seen[cl] = true;
+        int retval = db_cl_load(ctx->db, cl);
+        if (retval)
+                return retval;
+
+        const client *client_ = db_cl_get(ctx->db, cl);
+        char key[CSV_KEY_SIZE];
+
+        /* The cars are walked backwards, so the first one wins if there are duplicate plates. */
+        for (idx i = client_->cars->size; i > 0 && !retval; i--) {
+                const car *car_ = vct_subptr(client_->cars, i - 1);
+                snprintf(key, sizeof(key), "%zu|%s", cl, car_->plate);
+                retval = hmap_put(ctx->cars, key, i - 1);
+        }
+
+        return retval;
+}
+
+/**
+ * @brief Counts a rejected row.
+ * @param stats Pointer to the statistics.
+ * @param line The row's line number.
+ */
+void csv_reject(fh_csv_stats *stats, size_t line)
+{
+        if (stats->rejected < FH_CSV_REJECT_LOG)
+                stats->reject_lines[stats->rejected] = line;
+
+        stats->rejected++;
+}
+
+/**
+ * @brief Applies a batch of validated rows.
+ * @param ctx Pointer to the ingest's state.
+ * @param rows The rows.
+ * @param cnt The number of rows.
+ * @retval 0 On success.
+ * @retval EMALLOC If the database expansion fails.
+ * @retval EINV If an existing client cannot be loaded.
+ */
+int csv_batch(csv_ctx *ctx, csv_row *rows, size_t cnt)
+{
+        database *db = ctx->db;
+        size_t fresh = 0;
+        int retval = 0;
+
+        /* Count the new clients first, so their space can be reserved at once. */
+        for (size_t i = 0; i < cnt && !retval; i++) {
+                if (!hmap_get(ctx->clients, rows[i].f[CSV_NAME], &rows[i].cl)) {
+                        rows[i].cl = CSV_NEW;
+                        fresh++;
+                        retval = hmap_put(ctx->clients, rows[i].f[CSV_NAME], CSV_NEW);
+                }
+        }
+
+        if (!retval && vct_reserve(db->cl, db->cl->size + fresh))
+                retval = EMALLOC;
+
+        char key[CSV_KEY_SIZE];
+        for (size_t i = 0; i < cnt && !retval; i++) {
+                csv_row *row = &rows[i];
+
+                /* A new client gets its index when its first row is applied. */
+                if (row->cl == CSV_NEW)
+                        hmap_get(ctx->clients, row->f[CSV_NAME], &row->cl);
+
+                if (row->cl == CSV_NEW) {
+                        int err = db_cl_add(db, row->f[CSV_NAME], row->f[CSV_EMAIL], row->f[CSV_PHONE]);
+                        if (err && err != EDUP)
+                                retval = err;
+
+                        row->cl = err ? CSV_DUP : db->cl->size - 1;
+                        if (!err)
+                                ctx->stats->clients++;
+
+                        /* The name is in the map already, so this cannot fail. */
+                        hmap_put(ctx->clients, row->f[CSV_NAME], row->cl);
+                }
+                else if (row->cl != CSV_DUP) {
+                        retval = csv_cl_seen(ctx, row->cl);
+                }
+
+                if (!retval && row->cl == CSV_DUP) {
+                        csv_reject(ctx->stats, row->line);
+                        continue;
+                }
+
+                if (retval || row->f[CSV_PLATE][0] == '\0')
+                        continue;
+
+                idx cr = 0;
+                snprintf(key, sizeof(key), "%zu|%s", row->cl, row->f[CSV_PLATE]);
+                if (!hmap_get(ctx->cars, key, &cr)) {
+                        retval = db_car_add(db, row->cl, row->f[CSV_CAR], row->f[CSV_PLATE]);
+                        cr = db_cl_get(db, row->cl)->cars->size - 1;
+                        if (!retval)
+                                retval = hmap_put(ctx->cars, key, cr);
+                        ctx->stats->cars++;
+                }
+
+                if (retval || row->f[CSV_DESC][0] == '\0')
+                        continue;
+
+                retval = db_cl_own(db, row->cl);
+                if (retval)
+                        continue;
+
+                const char *date_cr = row->f[CSV_DATE][0] != '\0' ? row->f[CSV_DATE] : ctx->now;
+                const char *date_exp = row->f[CSV_EXP][0] != '\0' ? row->f[CSV_EXP] : "0";
+                retval = fh_db_op_add(db, row->cl, cr, row->f[CSV_DESC], row->price, date_cr, date_exp);
+                db_cl_get(db, row->cl)->dirty = true;
+                ctx->stats->ops++;
+        }
+
+        return retval;
+}
+
+/**
+ * @brief Returns the current time in seconds, for the throughput report.
+ * @return Seconds since an arbitrary point in time.
+ */
+double csv_clock(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Ingests a CSV file into a database.
+ * @param db Pointer to the destination database.
+ * @param path The CSV file's path.
+ * @param mapping The column mapping, \c NULL to map the columns by their headers. See the file's description.
+ * @param stats Pointer to the destination of the statistics.
+ * @retval 0 On success. The rejected rows are only counted in \c stats .
+ * @retval EFPERM If the file cannot be opened.
+ * @retval EINV If the mapping doesn't match the header.
+ * @retval EMALLOC If the database expansion fails. The rows before the failing batch are already added, and the
+ *                 database is saved with them.
+ */
+int fh_csv_ingest(database *db, const char *path, const char *mapping, fh_csv_stats *stats)
+{
+        memset(stats, 0, sizeof(fh_csv_stats));
+
+        FILE *src = fopen(path, "rb");
+        if (!src)
+                return EFPERM;
+
+        csv_reader *r = malloc(sizeof(csv_reader));
+        csv_row *rows = malloc(CSV_BATCH * sizeof(csv_row));
+        csv_ctx ctx = {db, hmap_init(db->cl->size), hmap_init(db->cl->size), calloc(db->cl->size + 1, sizeof(bool)),
+                       db->cl->size, "", stats};
+
+        int retval = 0;
+        if (!r || !rows || !ctx.clients || !ctx.cars || !ctx.seen)
+                retval = EMALLOC;
+
+        for (idx i = 0; i < db->cl->size && !retval; i++)
+                retval = hmap_put(ctx.clients, db_cl_get(db, i)->name, i);
+
+        int map[CSV_FIELD_CNT];
+        if (!retval) {
+                r->src = src;
+                r->len = 0;
+                r->pos = 0;
+                r->next_line = 1;
+                if (!csv_record(r) || r->bad || csv_map(r, mapping, map))
+                        retval = EINV;
+        }
+
+        date now = date_now();
+        date_printf(&now, ctx.now);
+
+        /* Every row is added to the snapshot by the next checkpoint, recording them one by one is a waste. */
+        FILE *journal = db->journal;
+        db->journal = NULL;
+
+        double start = csv_clock();
+        size_t cnt = 0;
+        while (!retval) {
+                bool more = csv_record(r);
+
+                /* Empty lines are skipped. */
+                if (more && r->cols == 1 && r->rec[0] == '\0' && !r->bad)
+                        continue;
+
+                if (more) {
+                        stats->rows++;
+                        if (csv_row_fill(r, map, &rows[cnt])) {
+                                cnt++;
+                        }
+                        else {
+                                csv_reject(stats, r->line);
+                        }
+                }
+
+                if (cnt == CSV_BATCH || (!more && cnt)) {
+                        retval = csv_batch(&ctx, rows, cnt);
+                        cnt = 0;
+                }
+
+                if (!more)
+                        break;
+        }
+
+        stats->secs = csv_clock() - start;
+        db->journal = journal;
+
+        /* The rows before the failed batch aren't journaled, and the caller exits on an error. */
+        if (retval && stats->rows)
+                fh_jrnl_checkpoint(db);
+
+        fclose(src);
+        free(r);
+        free(rows);
+        free(ctx.seen);
+        hmap_del(ctx.clients);
+        hmap_del(ctx.cars);
+        return retval;
+}
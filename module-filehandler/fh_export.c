@@ -5,65 +5,637 @@
  *          line, with and ID char and its contents separated by a pipe (|).\n
  *          ID char: \c U - for clients, \c A - for cars and \c J - for operations. The ID char is followed by a \c >
  *          instead of a \c |.
- * @note The first line is the database name and description with the ID of \c D .
+ * @note The first line is the database name and description with the ID of \c D . The second line is the checkpoint
+ *       generation with the ID of \c G , see \c fh_journal.c . The third line is the number of clients in the file
+ *       with the ID of \c N . The header and every client block are closed by a checksum line, see \c fh_crc.c .
  */
 
+#include "../include/platform.h"
+
+#include <math.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "include/fh.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @brief Writes the contents of an export buffer to its file.
+ * @param b Pointer to the buffer.
+ */
+void fh_buf_flush(fh_buf *b)
+{
+        /* The bytes leave the buffer, so they are added to the block's checksum. */
+        b->crc = fh_crc32c(b->crc, b->data + b->mark, b->len - b->mark);
+        b->mark = 0;
+
+        if (b->len && fwrite(b->data, 1, b->len, b->target) != b->len)
+                b->err = true;
+
+        b->len = 0;
+}
+
+/**
+ * @brief Appends a memory block to an export buffer.
+ * @param b Pointer to the buffer.
+ * @param src Pointer to the memory block.
+ * @param n The size of \c src .
+ * @note Blocks that don't fit into an empty buffer are written directly.
+ */
+void fh_buf_mem(fh_buf *b, const void *src, size_t n)
+{
+        if (b->len + n > EXPORT_BUF_SIZE)
+                fh_buf_flush(b);
+
+        b->pos += (long)n;
+
+        if (n > EXPORT_BUF_SIZE) {
+                b->crc = fh_crc32c(b->crc, src, n);
+                if (fwrite(src, 1, n, b->target) != n)
+                        b->err = true;
+                return;
+        }
+
+        memcpy(b->data + b->len, src, n);
+        b->len += n;
+}
+
+/**
+ * @brief Appends a string to an export buffer.
+ * @param b Pointer to the buffer.
+ * @param str The string to be appended.
+ */
+void fh_buf_str(fh_buf *b, const char *str)
+{
+        fh_buf_mem(b, str, strlen(str));
+}
+
+/**
+ * @brief Appends a character to an export buffer.
+ * @param b Pointer to the buffer.
+ * @param c The character to be appended.
+ */
+void fh_buf_chr(fh_buf *b, char c)
+{
+        if (b->len == EXPORT_BUF_SIZE)
+                fh_buf_flush(b);
+
+        b->data[b->len++] = c;
+        b->pos++;
+}
+
+/**
+ * @brief Starts a new checksummed block in an export buffer.
+ * @param b Pointer to the buffer.
+ */
+void fh_buf_block(fh_buf *b)
+{
+        b->crc = 0;
+        b->mark = b->len;
+}
+
+/**
+ * @brief Closes the current block of an export buffer with its checksum line, then starts a new block.
+ * @param b Pointer to the buffer.
+ */
+void fh_buf_seal(fh_buf *b)
+{
+        char line[FH_CRC_LINE];
+        fh_crc_line(line, fh_crc32c(b->crc, b->data + b->mark, b->len - b->mark));
+
+        fh_buf_mem(b, line, FH_CRC_LINE);
+        fh_buf_block(b);
+}
+
+/**
+ * @brief Appends an unsigned integer to an export buffer. Same as \c printf("%llu") .
+ * @param b Pointer to the buffer.
+ * @param val The number to be appended.
+ * @param width Minimum number of digits, shorter numbers are padded with zeros.
+ */
+void fh_buf_uint(fh_buf *b, unsigned long long val, int width)
+{
+        char digits[24];
+        int n = 0;
+
+        /* Write the digits backwards, then append them in the correct order. */
+        do {
+                digits[sizeof(digits) - 1 - n++] = (char)('0' + val % 10);
+                val /= 10;
+        }
+        while (val || n < width);
+
+        fh_buf_mem(b, digits + sizeof(digits) - n, n);
+}
+
+/**
+ * @brief Appends a signed integer to an export buffer. Same as \c printf("%0*d") .
+ * @param b Pointer to the buffer.
+ * @param val The number to be appended.
+ * @param width Minimum number of digits (including the sign), shorter numbers are padded with zeros.
+ */
+void fh_buf_int(fh_buf *b, int val, int width)
+{
+        if (val < 0) {
+                fh_buf_chr(b, '-');
+                fh_buf_uint(b, -(unsigned long long)val, width - 1);
+                return;
+        }
+
+        fh_buf_uint(b, val, width);
+}
+
+/**
+ * @brief Appends a price to an export buffer. Same as \c printf("%f") .
+ * @details The price is scaled to millionths and written as a fixed-point number. This is only done if the rounding
+ *          error of the scaling provably cannot change the 6th decimal, otherwise \c snprintf() does the job, so the
+ *          output is always identical to \c printf("%f") .
+ * @param b Pointer to the buffer.
+ * @param price The price to be appended.
+ */
+void fh_buf_price(fh_buf *b, double price)
+{
+        /* NaN, infinity, negative numbers and -0 are left to snprintf(). */
+        if (!signbit(price) && price < 1e9) {
+                double scaled = price * 1e6;
+                unsigned long long fixed = (unsigned long long)(scaled + 0.5);
+                double diff = fabs(scaled - (double)fixed);
+
+                /* The product's error is below 1 ulp, which is at most scaled * 2^-52. */
+                if (diff <= 0.5 - scaled * 4.5e-16) {
+                        fh_buf_uint(b, fixed / 1000000, 1);
+                        fh_buf_chr(b, '.');
+                        fh_buf_uint(b, fixed % 1000000, 6);
+                        return;
+                }
+        }
+
+        char str[DEFAULT_BUF_SIZE * 16];
+        int n = snprintf(str, sizeof(str), "%f", price);
+        fh_buf_mem(b, str, n < (int)sizeof(str) ? (size_t)n : sizeof(str) - 1);
+}
+
+/**
+ * @brief Appends a date to an export buffer in a YYYY-MM-DD HH:MM format. Same as \c date_printf() .
+ * @param b Pointer to the buffer.
+ * @param date The date to be appended.
+ */
+void fh_buf_date(fh_buf *b, const date *date)
+{
+        fh_buf_int(b, date->y, 4);
+        fh_buf_chr(b, '-');
+        fh_buf_int(b, date->mon, 2);
+        fh_buf_chr(b, '-');
+        fh_buf_int(b, date->d, 2);
+        fh_buf_chr(b, ' ');
+        fh_buf_int(b, date->h, 2);
+        fh_buf_chr(b, ':');
+        fh_buf_int(b, date->min, 2);
+}
 
 /**
- * @brief Exports an operation to a file.
+ * @brief Exports an operation to a buffer.
  * @param op Pointer to the operation structure to be exported.
- * @param target Pointer to target file.
+ * @param b Pointer to the export buffer.
  * @note  If \c date_exp is uninintialized (marked by \c date_exp.y being \c 0)
  *        the function will write a \c 0 in place of \c date_exp to indicate that.
  */
-void fh_op_export(operation *op, FILE *target)
+void fh_op_export(const operation *op, fh_buf *b)
 {
-        fprintf(target, "J>%s|%f|%d-%02d-%02d %02d:%02d|", op->desc, op->price, op->date_cr.y, op->date_cr.mon,
-                op->date_cr.d, op->date_cr.h, op->date_cr.min);
+        fh_buf_mem(b, "J>", 2);
+        fh_buf_str(b, op->desc);
+        fh_buf_chr(b, '|');
+        fh_buf_price(b, op->price);
+        fh_buf_chr(b, '|');
+        fh_buf_date(b, &op->date_cr);
+        fh_buf_chr(b, '|');
 
         if (op->date_exp.y != 0)
-                fprintf(target, "%d-%02d-%02d %02d:%02d\n", op->date_exp.y, op->date_exp.mon, op->date_exp.d,
-                        op->date_exp.h, op->date_exp.min);
+                fh_buf_date(b, &op->date_exp);
         else
-                fprintf(target, "0\n");
+                fh_buf_chr(b, '0');
+
+        fh_buf_chr(b, '\n');
+}
+
+/**
+ * @brief Serializes a client with all of its cars and operations to a buffer.
+ * @param db Pointer to the source database.
+ * @param i The client's index in the database.
+ * @param b Pointer to the export buffer.
+ */
+void fh_cl_export(database *db, idx i, fh_buf *b)
+{
+        client *cl = db_cl_get(db, i);
+        fh_buf_mem(b, "U>", 2);
+        fh_buf_str(b, cl->name);
+        fh_buf_chr(b, '|');
+        fh_buf_str(b, cl->email);
+        fh_buf_chr(b, '|');
+        fh_buf_str(b, cl->phone);
+        fh_buf_chr(b, '\n');
+
+        for (idx j = 0; j < cl->cars->size; j++) {
+                car *cr = db_car_get(db, i, j);
+                fh_buf_mem(b, "A>", 2);
+                fh_buf_str(b, cr->name);
+                fh_buf_chr(b, '|');
+                fh_buf_str(b, cr->plate);
+                fh_buf_chr(b, '\n');
+
+                for (idx k = 0; k < cr->operations->size; k++)
+                        fh_op_export(db_op_get(db, i, j, k), b);
+        }
+
+        fh_buf_seal(b);
 }
 
 /**
- * @brief Exports a database to file called \c export.txt .
+ * @brief Copies a clean client's block from the previous snapshot.
+ * @details The block is verified by its checksum, so a damaged block is not carried over into the new snapshot. A
+ *          block of an older snapshot without checksums is sealed on the way.
+ * @param cl Pointer to the client, whose block will be copied.
+ * @param src Pointer to the previous snapshot.
+ * @param b Pointer to the export buffer.
+ * @retval 0 On success.
+ * @retval EINV If the block cannot be read back or it's damaged. The caller should serialize the client instead.
+ * @retval EMALLOC If the copy buffer cannot be allocated.
+ */
+int fh_cl_copy(const client *cl, FILE *src, fh_buf *b)
+{
+        if (!src || cl->blk_len == 0 || fseek(src, cl->blk_off, SEEK_SET))
+                return EINV;
+
+        /* Small blocks are read straight into the export buffer, large ones need their own. */
+        if (cl->blk_len <= EXPORT_BUF_SIZE) {
+                if (b->len + cl->blk_len > EXPORT_BUF_SIZE)
+                        fh_buf_flush(b);
+
+                char *block = b->data + b->len;
+                if (fread(block, 1, cl->blk_len, src) != cl->blk_len || block[0] != 'U' ||
+                    (fh_config.sealed && fh_crc_check(block, cl->blk_len)))
+                        return EINV;
+
+                b->len += cl->blk_len;
+                b->pos += (long)cl->blk_len;
+
+                if (fh_config.sealed)
+                        fh_buf_block(b);
+                else
+                        fh_buf_seal(b);
+
+                return 0;
+        }
+
+        char *block = malloc(cl->blk_len);
+        if (!block)
+                return EMALLOC;
+
+        /* Read the whole block first, so a short read doesn't leave half a block in the target. */
+        int retval = 0;
+        if (fread(block, 1, cl->blk_len, src) == cl->blk_len && block[0] == 'U' &&
+            !(fh_config.sealed && fh_crc_check(block, cl->blk_len)))
+                fh_buf_mem(b, block, cl->blk_len);
+        else
+                retval = EINV;
+
+        if (!retval && fh_config.sealed)
+                fh_buf_block(b);
+        else if (!retval)
+                fh_buf_seal(b);
+
+        free(block);
+        return retval;
+}
+
+/**
+ * @brief Flushes a file all the way to the disk.
+ * @param target The file to be synced.
+ * @return \c 0 on success, non-zero if the data might not have reached the disk.
+ */
+int fh_sync(FILE *target)
+{
+        TRACE("fh_sync");
+        if (fflush(target))
+                return EFPERM;
+
+#ifdef _WIN32
+        return _commit(_fileno(target));
+#else
+        return fsync(fileno(target));
+#endif
+}
+
+/**
+ * @brief Flushes a directory entry all the way to the disk, so a file renamed into place survives a crash too.
+ * @param path The path of the renamed file, its directory is synced.
+ * @return \c 0 on success, \c EFPERM if the rename might not have reached the disk.
+ * @note Windows has no way to sync a directory, the rename is durable once \c rename() returns.
+ */
+int fh_sync_dir(const char *path)
+{
+#ifdef _WIN32
+        (void)path;
+        return 0;
+#else
+        TRACE("fh_sync_dir");
+        char dir[FILENAME_MAX];
+        const char *slash = strrchr(path, '/');
+        if (!slash)
+                strcpy(dir, ".");
+        else
+                snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+
+        int fd = open(dir, O_RDONLY);
+        if (fd < 0)
+                return EFPERM;
+
+        int retval = fsync(fd) ? EFPERM : 0;
+        close(fd);
+        return retval;
+#endif
+}
+
+/**
+ * @struct fh_save_job fh_export.c
+ * @brief A shard written by its own task.
+ */
+typedef struct fh_save_job {
+        database *db;                   /**< The exported database. It's only read by the tasks. */
+        unsigned shard;                 /**< The shard's number. */
+        const unsigned *shard_of;       /**< The new shard of every client. */
+        long *blk_off;                  /**< The new block offset of every client. */
+        size_t *blk_len;                /**< The new block length of every client. */
+        int err;                        /**< Error code of the export. */
+} fh_save_job;
+
+/**
+ * @brief Writes a shard of the new snapshot.
+ * @details The shard is written to a temporary file and synced to the disk. \c fh_export() renames it.
+ * @param job Pointer to the shard's \c fh_save_job . The result is stored in \c job->err .
+ * @note The clients to be serialized must be loaded beforehand, the database is not modified here.
+ */
+void fh_save_shard(fh_save_job *job)
+{
+        TRACE("fh_save_shard");
+        database *db = job->db;
+        char path[FILENAME_MAX];
+        char tmp[FILENAME_MAX + 4];
+        fh_shard_path(path, job->shard, db->gen, false);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+        /* The previous snapshot's shards are opened on demand, a client may have moved between shards. */
+        FILE **src = calloc(fh_config.disk_shards + 1, sizeof(FILE*));
+        fh_buf *b = malloc(sizeof(fh_buf));
+        if (!src || !b) {
+                free(src);
+                free(b);
+                job->err = EMALLOC;
+                return;
+        }
+
+        b->target = fopen(tmp, "wb");
+        if (!b->target) {
+                free(src);
+                free(b);
+                job->err = EFPERM;
+                return;
+        }
+
+        b->len = 0;
+        b->pos = 0;
+        b->err = false;
+        b->crc = 0;
+        b->mark = 0;
+
+        size_t clients = 0;
+        for (idx i = 0; i < db->cl->size; i++)
+                clients += job->shard_of[i] == job->shard;
+
+        fh_buf_mem(b, "D>", 2);
+        fh_buf_str(b, db->name);
+        fh_buf_chr(b, '|');
+        fh_buf_str(b, db->desc);
+        fh_buf_mem(b, "\nG>", 3);
+        fh_buf_uint(b, db->gen, 1);
+        fh_buf_mem(b, "\nN>", 3);
+        fh_buf_uint(b, clients, 1);
+        fh_buf_chr(b, '\n');
+        fh_buf_seal(b);
+
+        int retval = 0;
+        for (idx i = 0; i < db->cl->size && !retval; i++) {
+                if (job->shard_of[i] != job->shard)
+                        continue;
+
+                client *cl = db_cl_get(db, i);
+                job->blk_off[i] = b->pos;
+                fh_buf_block(b);
+
+                if (!cl->dirty && cl->shard < fh_config.disk_shards && !src[cl->shard]) {
+                        char src_path[FILENAME_MAX];
+                        fh_shard_path(src_path, cl->shard, fh_config.disk_gen, false);
+                        src[cl->shard] = fopen(src_path, "rb");
+                }
+
+                if (!cl->dirty)
+                        retval = fh_cl_copy(cl, cl->shard < fh_config.disk_shards ? src[cl->shard] : NULL, b);
+
+                /* A block that cannot be copied is serialized, unless it has never been loaded. */
+                if ((cl->dirty || retval == EINV) && cl->loaded) {
+                        fh_cl_export(db, i, b);
+                        retval = 0;
+                }
+
+                job->blk_len[i] = (size_t)(b->pos - job->blk_off[i]);
+        }
+
+        fh_buf_flush(b);
+
+        for (unsigned s = 0; s < fh_config.disk_shards; s++) {
+                if (src[s])
+                        fclose(src[s]);
+        }
+        free(src);
+
+        if (!retval && (b->err || fh_sync(b->target)))
+                retval = EFPERM;
+
+        if (fclose(b->target) && !retval)
+                retval = EFPERM;
+
+        free(b);
+
+        job->err = retval;
+}
+
+/**
+ * @brief Writes shards of the new snapshot. The task of \c fh_export() , see \c pool_for() .
+ * @param arg The \c fh_save_job array of the shards.
+ * @param from The first shard to be written.
+ * @param to The end of the shards to be written.
+ */
+void fh_save_part(void *arg, size_t from, size_t to)
+{
+        for (size_t s = from; s < to; s++)
+                fh_save_shard((fh_save_job *)arg + s);
+}
+
+/**
+ * @brief Moves the shards of the new snapshot in place.
+ * @param shards The number of shards.
+ * @param gen The generation of the new snapshot.
+ * @param commit If \c false , the temporary files are only removed.
+ * @return \c 0 on success, \c EFPERM if a file cannot be renamed.
+ */
+int fh_shards_commit(unsigned shards, unsigned long gen, bool commit)
+{
+        int retval = 0;
+        for (unsigned s = 0; s < shards; s++) {
+                char path[FILENAME_MAX];
+                char tmp[FILENAME_MAX + 4];
+                fh_shard_path(path, s, gen, false);
+                snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+#ifdef _WIN32
+                /* rename() doesn't overwrite existing files on Windows. */
+                if (commit && !retval)
+                        remove(path);
+#endif
+                if (commit && !retval && rename(tmp, path))
+                        retval = EFPERM;
+
+                remove(tmp);
+        }
+
+        /* The shards share the directory, one sync covers their renames. */
+        if (commit && !retval && shards) {
+                char path[FILENAME_MAX];
+                fh_shard_path(path, 0, gen, false);
+                retval = fh_sync_dir(path);
+        }
+
+        return retval;
+}
+
+/**
+ * @brief Removes the files of a snapshot.
+ * @param shards The number of shards.
+ * @param gen The generation of the snapshot.
+ * @note The compressed backups are kept until the next backup, see \c fh_lz_rotate() .
+ */
+void fh_shards_rm(unsigned shards, unsigned long gen)
+{
+        char path[FILENAME_MAX];
+        for (unsigned s = 0; s < shards; s++) {
+                fh_shard_path(path, s, gen, false);
+                remove(path);
+        }
+}
+
+/**
+ * @brief Exports a database to file called \c export.txt , or to the shards of the database directory.
  * @details Exports objects in the following format:\n
  *          Clients: \c U>name|email|phone \n
  *          Cars: \c A>name|plate \n
- *          Objects: \c J>desc|price|date_cr|date_exp
+ *          Objects: \c J>desc|price|date_cr|date_exp \n
+ *          Checksums: \c C>crc32c \n
+ *          Only the dirty clients are serialized, the blocks of the clean ones are copied from the previous snapshot
+ *          using the offsets recorded by the last import/export.\n
+ *          The records are formatted into a large buffer instead of calling \c fprintf() per field. Every file is
+ *          written to a temporary file first, synced to the disk and renamed, so a crash during the export leaves the
+ *          previous snapshot intact. The shards are written in parallel, see \c fh_shard.c .
  * @param db Pointer to the database to be exported.
  * @retval 0 On success.
- * @retval EFPERM If the file cannot be opened/created for writing.
+ * @retval EFPERM If a file cannot be opened/created, written or renamed.
+ * @retval EMALLOC If the export buffer or the new block offsets cannot be allocated.
+ * @retval EINV If a changed client cannot be loaded from the previous snapshot.
  * @note If \c export.txt doesn't exsist, this function creates it.
  */
 int fh_export(database *db)
 {
-        FILE *target = fopen("export.txt", "w");
-        if (!target)
-                return EFPERM;
+        PROBE(PROBE_FH_EXPORT);
+        size_t n = db->cl->size + 1;
+        unsigned shards = fh_config.shards;
+        unsigned *shard_of = malloc(n * sizeof(unsigned));
+        long *blk_off = malloc(n * sizeof(long));
+        size_t *blk_len = malloc(n * sizeof(size_t));
+        fh_save_job *jobs = calloc(shards, sizeof(fh_save_job));
 
-        fprintf(target, "D>%s|%s\n", db->name, db->desc);
+        int retval = 0;
+        if (!shard_of || !blk_off || !blk_len || !jobs)
+                retval = EMALLOC;
 
-        for (idx i = 0; i < db->cl->size; i++) {
+        /* The changed clients are loaded up front, the tasks must not modify the database. */
+        TRACE_BEGIN(span_load, "fh_load_dirty");
+        for (idx i = 0; i < db->cl->size && !retval; i++) {
                 client *cl = db_cl_get(db, i);
-                fprintf(target, "U>%s|%s|%s\n", cl->name, cl->email, cl->phone);
+                if (cl->dirty)
+                        retval = db_cl_load(db, i);
 
-                for (idx j = 0; j < cl->cars->size; j++) {
-                        car *cr = db_car_get(db, i, j);
-                        fprintf(target, "A>%s|%s\n", cr->name, cr->plate);
+                shard_of[i] = fh_shard_of(cl->name);
+        }
+        TRACE_END(span_load);
 
-                        for (idx k = 0; k < cr->operations->size; k++) {
-                                operation *op = db_op_get(db, i, j, k);
-                                fh_op_export(op, target);
-                        }
+        for (unsigned s = 0; s < shards && !retval; s++)
+                jobs[s] = (fh_save_job){db, s, shard_of, blk_off, blk_len, 0};
 
-                }
+        if (!retval)
+                pool_for("export", shards, 1, fh_save_part, jobs);
+
+        for (unsigned s = 0; s < shards && jobs && !retval; s++)
+                retval = jobs[s].err;
+
+        /*
+         * The lazy loader reads the current snapshot by the clients' offsets. If this is a snapshot saved in the
+         * background, the files and the offsets must be replaced while the loader is locked out.
+         */
+        pthread_mutex_lock(db->lock);
+        TRACE_BEGIN(span_commit, "fh_commit");
+
+        bool sharded = fh_config.dir[0] != '\0';
+        if (jobs) {
+                int commit_err = fh_shards_commit(shards, db->gen, !retval);
+                if (!retval)
+                        retval = commit_err;
         }
 
-        fclose(target);
-        return 0;
+        if (!retval && sharded)
+                retval = fh_manifest_write(db, shard_of);
+
+        /* The files of a failed snapshot are useless, unless they have replaced the current ones. */
+        if (retval && sharded && jobs && db->gen != fh_config.disk_gen)
+                fh_shards_rm(shards, db->gen);
+
+        if (!retval && sharded && db->gen != fh_config.disk_gen)
+                fh_shards_rm(fh_config.disk_shards, fh_config.disk_gen);
+
+        /* The offsets only belong to the clients after the new snapshot has taken the old one's place. */
+        for (idx i = 0; i < db->cl->size && !retval; i++) {
+                client *cl = db_cl_get(db, i);
+                cl->shard = shard_of[i];
+                cl->blk_off = blk_off[i];
+                cl->blk_len = blk_len[i];
+                cl->dirty = false;
+        }
+
+        if (!retval) {
+                fh_config.disk_shards = shards;
+                fh_config.disk_gen = db->gen;
+                fh_config.sealed = true;
+        }
+
+        TRACE_END(span_commit);
+        pthread_mutex_unlock(db->lock);
+
+        free(shard_of);
+        free(blk_off);
+        free(blk_len);
+        free(jobs);
+        return retval;
 }
@@ -4,14 +4,19 @@
  * @details The import process is based on the same hierarchical logic as the database.\n The source file is parsed
  *          line-by-line. The program looks for an ID char first (U, A or J), this marks the datatype. When the datatype
  *          has been determined, the program will parse the string accordingly. As for the linkage, the program will
- *          link all clients to the destination database. The others will link to the last stored parent object.
- * @warning The implementation does \b not check file or data integrity and \b cannot detect intentional tampering with
- *          the source file.
+ *          link all clients to the destination database. The others will link to the last stored parent object.\n
+ *          In lazy mode only the clients are parsed, and the location of their block is recorded. Their cars and
+ *          operations are loaded by \c fh_cl_load() , when the database needs them for the first time.\n
+ *          Every block is verified by its checksum, see \c fh_crc.c .
+ * @warning The checksums detect damaged files, but \b cannot detect intentional tampering with the source file.
  */
 
+#include "../include/platform.h"
+
 #include <math.h>
 
 #include "include/fh.h"
+#include "../module-probe/include/probe.h"
 
 /**
  * @brief Fills an array of buffers and checks if it's valid.
@@ -20,29 +25,99 @@
  * @param buf_size Pointer to an array that contains the buffer sizes.
  * @param buf_cnt Number of buffers to be filled.
  * @return \c 0 if it's successful, \c EINV if not.
+ * @note Empty tokens (e.g. a client without an email address) are valid, so the tokens are split by hand instead of
+ *       using \c strtok() , which would silently merge them.
  */
 int fh_buffer_filler(char *str, char **buf, size_t *buf_size, size_t buf_cnt)
 {
-        /* Ignore the ID char */
-        strtok(str, ">");
+        /* Ignore the ID char(s) */
+        char *next_token = strchr(str, '>');
+        if (!next_token)
+                return EINV;
 
-        for (idx i = 0; i < buf_cnt; i++) {
-                char *next_token = strtok(NULL, "|\n");
+        next_token++;
 
-                /* Check if the even token exists. */
-                if (!next_token)
-                        return EINV;
+        for (idx i = 0; i < buf_cnt; i++) {
+                size_t len = strcspn(next_token, "|\r\n");
 
                 /* Check if the token is too long. */
-                if (strlen(next_token) > buf_size[i])
+                if (len > buf_size[i])
                         return EINV;
 
-                strcpy(buf[i], next_token);
+                memcpy(buf[i], next_token, len);
+                buf[i][len] = '\0';
+                next_token += len;
+
+                /* Check if the next token exists. */
+                if (i + 1 < buf_cnt) {
+                        if (*next_token != '|')
+                                return EINV;
+
+                        next_token++;
+                }
         }
 
         return 0;
 }
 
+/**
+ * @brief Strictly parses a price.
+ * @details The accepted format is an optional \c - sign, at least one digit and optionally a \c . followed by at least
+ *          one digit. Unlike \c sscanf() , no whitespace, exponent or trailing characters are accepted.\n
+ *          If the digits fit into 15 significant digits and there are at most 22 decimals, both the digits and the power
+ *          of ten are exact doubles, so a single division gives the correctly rounded result. Longer inputs are
+ *          passed to \c strtod() . Either way, the result is bit-identical to \c sscanf("%lf") .\n
+ *          Prices larger than \c PRICE_MAX are rejected, like the database does (see \c db_op_check() ).
+ * @param str The string to be parsed.
+ * @param dst Pointer to the destination.
+ * @retval 0 On success.
+ * @retval EINV If \c str is not a valid price or it's out of range. \c dst is not modified in this case.
+ */
+int fh_parse_price(const char *str, double *dst)
+{
+        static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                       1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+        const char *c = str;
+        bool neg = *c == '-';
+        c += neg;
+
+        unsigned long long mantissa = 0;
+        size_t digits = 0;
+        size_t decimals = 0;
+
+        for (; (unsigned)(*c - '0') <= 9; c++, digits++)
+                mantissa = mantissa * 10 + (unsigned)(*c - '0');
+
+        if (digits == 0)
+                return EINV;
+
+        if (*c == '.') {
+                c++;
+                for (; (unsigned)(*c - '0') <= 9; c++, decimals++)
+                        mantissa = mantissa * 10 + (unsigned)(*c - '0');
+
+                if (decimals == 0)
+                        return EINV;
+        }
+
+        if (*c != '\0')
+                return EINV;
+
+        /* The mantissa may have overflowed above 19 digits, but then it isn't used. */
+        double ret = 0;
+        if (digits + decimals <= 15 && decimals < sizeof(pow10) / sizeof(pow10[0]))
+                ret = neg ? -((double)mantissa / pow10[decimals]) : (double)mantissa / pow10[decimals];
+        else
+                ret = strtod(str, NULL);
+
+        if (ret < -PRICE_MAX || ret > PRICE_MAX)
+                return EINV;
+
+        *dst = ret;
+        return 0;
+}
+
 /**
  * @brief Adds an operation to a database.
  * @details For the filehandler, a special operation import functions is needed, since \c db_op_add() can only parse
@@ -58,33 +133,90 @@ int fh_buffer_filler(char *str, char **buf, size_t *buf_size, size_t buf_cnt)
  * @returns vct_push() - if the creation was sucessful.
  * @retval 0 On success.
  * @retval EMALLOC If the operation allocation fails.
- * @retval EINV If the parent car doesn't exist.
- * @note Dates should be in 'YYYY-MM-DD HH:MM' format (or 0 if not used).
+ * @retval EINV If the parent car doesn't exist or a date is malformed.
+ * @note Dates should be in 'YYYY-MM-DD HH:MM' format (or 0 if not used). See \c date_parse_strict() .
  * @note For all return values see \c vct_push.
  */
-int fh_db_op_add(database *db, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+int fh_db_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date_cr,
                  const char *date_exp)
 {
-        /* Get the parent object to link to */
-        car *parent = db_car_get(db, cl, cr);
+        /* Get the parent object to link to. Not through db_car_get(), since the loader calls this on an unloaded client. */
+        const client *client_ = db_cl_get(db, cl);
+        car *parent = client_ ? vct_subptr(client_->cars, cr) : NULL;
         if (!parent)
                 return EINV;
 
+        operation *op = NULL;
+        int retval = fh_op_new(desc, price, date_cr, date_exp, &op);
+        if (retval)
+                return retval;
+
+        return vct_push(parent->operations, op);
+}
+
+/**
+ * @brief Allocates an operation with the given dates.
+ * @param desc The operation's description.
+ * @param price The operation's price.
+ * @param date_cr A date string which will be parsed to \c date_cr .
+ * @param date_exp A date string which will be parsed to \c date_exp , \c 0 if it's not used.
+ * @param dst The destination of the new operation.
+ * @retval 0 On success.
+ * @retval EMALLOC If the operation allocation fails.
+ * @retval EINV If a date is malformed.
+ */
+int fh_op_new(const char *desc, double price, const char *date_cr, const char *date_exp, operation **dst)
+{
         operation *op = malloc(sizeof(operation));
         if (!op)
                 return EMALLOC;
 
+        PROBE_ALLOC(PROBE_MEM_OP, sizeof(operation), 1);
         strcpy(op->desc, desc);
         op->price = price;
-        op->date_cr = date_parse(date_cr);
 
         /* Check if date_exp is uninitialized (indicated by a 0 in the file) */
-        if (date_exp[0] != '0')
-                op->date_exp = date_parse(date_exp);
-        else
-                op->date_exp.y = 0;
+        op->date_exp.y = 0;
+        if (date_parse_strict(date_cr, &op->date_cr) ||
+            (strcmp(date_exp, "0") != 0 && date_parse_strict(date_exp, &op->date_exp))) {
+                PROBE_FREE(PROBE_MEM_OP, sizeof(operation), 1);
+                free(op);
+                return EINV;
+        }
 
-        return vct_push(parent->operations, op);
+        *dst = op;
+        return 0;
+}
+
+/**
+ * @brief Adds a car to a database.
+ * @details Same as \c db_car_add() , but the car is not journaled and the client is not marked dirty, since it's
+ *          already in the snapshot.
+ * @param db The pointer to destination database.
+ * @param cl The client's index in the database.
+ * @param name The car's name.
+ * @param plate The car's plate number.
+ * @retval 0 On success.
+ * @retval EMALLOC If the car allocation fails.
+ * @retval EINV If the parent client doesn't exist.
+ * @note For all return values see \c vct_push.
+ */
+int fh_db_car_add(const database *db, idx cl, const char *name, const char *plate)
+{
+        client *parent = db_cl_get(db, cl);
+        if (!parent)
+                return EINV;
+
+        car *c = malloc(sizeof(car));
+        if (!c)
+                return EMALLOC;
+
+        PROBE_ALLOC(PROBE_MEM_CAR, sizeof(car), 1);
+        strcpy(c->name, name);
+        strcpy(c->plate, plate);
+        c->operations = vct();
+
+        return vct_push(parent->cars, c);
 }
 
 /**
@@ -113,10 +245,10 @@ int fh_parse_client(database *dst, char *str)
  * @param dst The pointer to the destination database.
  * @param cl The client's index in the database.
  * @param str The string to be parsed.
- * @return db_car_add() - with the tokenized parameters
+ * @return fh_db_car_add() - with the tokenized parameters
  * @note The format of str should be: \c A>name|plate
  */
-int fh_parse_car(database *dst, idx cl, char *str)
+int fh_parse_car(const database *dst, idx cl, char *str)
 {
         char name[NAME_SIZE + 1] = "\0";
         char plate[PLATE_SIZE + 1] = "\0";
@@ -127,7 +259,7 @@ int fh_parse_car(database *dst, idx cl, char *str)
         if (fh_buffer_filler(str, buf_ptr, expected_size, 2))
                 return EINV;
 
-        return db_car_add(dst, cl, name, plate);
+        return fh_db_car_add(dst, cl, name, plate);
 }
 
 /**
@@ -139,7 +271,7 @@ int fh_parse_car(database *dst, idx cl, char *str)
  * @return db_car_add() - with the tokenized parameters
  * @note The format of str should be: \c J>desc|plate|date_cr|date_exp
  */
-int fh_parse_op(database *dst, idx cl, idx car, char *str)
+int fh_parse_op(const database *dst, idx cl, idx car, char *str)
 {
         char desc[DESC_SIZE + 1] = "\0";
         char price[DEFAULT_BUF_SIZE + 1] = "\0";
@@ -153,7 +285,7 @@ int fh_parse_op(database *dst, idx cl, idx car, char *str)
                 return EINV;
 
         double price_ = 0;
-        if (sscanf(price, "%lf", &price_) != 1)
+        if (fh_parse_price(price, &price_))
                 return EINV;
 
         return fh_db_op_add(dst, cl, car, desc, price_, date_cr, date_exp);
@@ -171,58 +303,428 @@ int fh_parse_dbinfo(database *db, char *str)
 }
 
 /**
- * @brief Imports \c export.txt into a database.
+ * @brief Closes the block of the last imported client.
+ * @details Records where the client's block ends in the source file and marks it clean, so \c fh_export() can copy
+ *          the block as-is until the client changes.
  * @param dst The pointer to the destination database.
- * @retval 0 On success.
+ * @param end The offset right after the client's last line.
+ */
+void fh_block_end(database *dst, size_t end)
+{
+        if (dst->cl->size == 0)
+                return;
+
+        client *cl = db_cl_get(dst, dst->cl->size - 1);
+        cl->blk_len = end - (size_t)cl->blk_off;
+        cl->dirty = false;
+}
+
+/**
+ * @brief Saves a copy of a damaged snapshot file next to it, with a \c .bad extension.
+ * @details The damaged blocks are left out of the database, so the next export would drop them for good. The copy
+ *          keeps them for manual recovery.
+ * @param path The snapshot file's path.
+ * @param data The file's contents.
+ * @param len The size of the file.
+ */
+void fh_keep_damaged(const char *path, const char *data, size_t len)
+{
+        char bad[FILENAME_MAX + 4];
+        snprintf(bad, sizeof(bad), "%s.bad", path);
+
+        FILE *dst = fopen(bad, "wb");
+        if (!dst)
+                return;
+
+        fwrite(data, 1, len, dst);
+        fclose(dst);
+}
+
+/**
+ * @brief Imports a snapshot file into a database.
+ * @details The file is read into memory and its blocks are verified first (see \c fh_verify() ). The damaged blocks
+ *          are skipped, the rest of the file is parsed line-by-line.
+ * @param dst The pointer to the destination database.
+ * @param path The snapshot file's path.
+ * @param shard The shard's number, recorded in the clients for \c fh_cl_load() and \c fh_export() .
+ * @param lazy If \c true , only the clients are loaded, see \c fh_import_lazy() .
+ * @param bad Pointer to the destination of the damaged blocks. The caller must free \c *bad .
+ * @param bad_cnt Pointer to the destination of the number of damaged blocks.
+ * @retval 0 On success, even if there are damaged blocks.
  * @retval EFPERM If the file cannot be opened for reading.
- * @retval EMALLOC If the database expansion fails.
- * @warning The destination database must be initilazed with \c db_init() first.
+ * @retval EMALLOC If the file cannot be read into memory or the database expansion fails.
+ * @retval EINV If an intact block is malformed.
  */
-int fh_import(database *dst)
+int fh_import_file(database *dst, const char *path, unsigned shard, bool lazy, fh_damage **bad, size_t *bad_cnt)
 {
-        FILE *src = fopen("export.txt", "r");
+        *bad = NULL;
+        *bad_cnt = 0;
+
+        /* A missing file is a new database, but a file that cannot be read must not look like one. */
+        FILE *src = fopen(path, "rb");
         if (!src)
                 return EFPERM;
 
-        char read_buffer[LONGEST_VALID_LINE] = "\0";
+        fclose(src);
+
+        size_t len = 0;
+        TRACE_BEGIN(span_read, "fh_read");
+        char *data = fh_read_file(path, &len);
+        TRACE_END(span_read);
+        if (!data)
+                return EMALLOC;
+
+        TRACE_BEGIN(span_verify, "fh_verify");
+        int retval = fh_verify(data, len, shard, bad, bad_cnt);
+        if (!retval && *bad_cnt)
+                fh_keep_damaged(path, data, len);
+        TRACE_END(span_verify);
+
         int last_client_index = -1;
         int last_car_index = -1;
+        bool open = false;
+        size_t next_bad = 0;
+        size_t pos = 0;
+
+        TRACE_BEGIN(span_parse, "fh_parse");
+        while (!retval && pos < len) {
+                /* The blocks start at a line, so a damaged block is skipped as a whole. */
+                if (next_bad < *bad_cnt && pos == (*bad)[next_bad].off) {
+                        if (open)
+                                fh_block_end(dst, pos);
+
+                        open = false;
+                        pos += (*bad)[next_bad++].len;
+                        continue;
+                }
 
-        while (fgets(read_buffer, LONGEST_VALID_LINE, src) != NULL) {
-                int retval = 0;
+                char *line = data + pos;
+                char *nl = memchr(line, '\n', len - pos);
+                size_t end = nl ? (size_t)(nl - data) + 1 : len;
+                if (nl)
+                        *nl = '\0';
 
                 /* check the char ID */
-                switch (read_buffer[0]) {
+                switch (line[0]) {
                         case 'D':
-                                retval = fh_parse_dbinfo(dst, read_buffer);
+                                retval = fh_parse_dbinfo(dst, line);
                                 break;
                         case 'U':
-                                retval = fh_parse_client(dst, read_buffer);
+                                if (open)
+                                        fh_block_end(dst, pos);
+
+                                retval = fh_parse_client(dst, line);
                                 last_client_index++;
                                 last_car_index = -1;
+
+                                if (!retval) {
+                                        client *cl = db_cl_get(dst, last_client_index);
+                                        cl->blk_off = (long)pos;
+                                        cl->shard = shard;
+                                        cl->loaded = !lazy;
+                                        open = true;
+                                }
                                 break;
                         case 'A':
-                                retval = fh_parse_car(dst, last_client_index, read_buffer);
                                 last_car_index++;
+
+                                if (lazy && last_client_index >= 0)
+                                        db_cl_get(dst, last_client_index)->lazy_cars++;
+                                else
+                                        retval = fh_parse_car(dst, last_client_index, line);
                                 break;
                         case 'J':
-                                retval = fh_parse_op(dst, last_client_index, last_car_index, read_buffer);
+                                if (!lazy)
+                                        retval = fh_parse_op(dst, last_client_index, last_car_index, line);
+                                break;
+                        case 'G':
+                                dst->gen = strtoul(line + 2, NULL, 10);
                                 break;
                         default:
                                 break;
                 }
 
-                if (retval == EMALLOC) {
-                        fclose(src);
-                        return EMALLOC;
+                /* Only a malformed line or a failed allocation stops the import. */
+                if (retval != EMALLOC && retval != EINV)
+                        retval = 0;
+
+                pos = end;
+        }
+
+        if (!retval && open)
+                fh_block_end(dst, pos);
+        TRACE_END(span_parse);
+
+        free(data);
+        return retval;
+}
+
+/**
+ * @struct fh_load_job fh_import.c
+ * @brief A shard loaded by its own task into a private database.
+ */
+typedef struct fh_load_job {
+        database *db;           /**< The shard's clients. */
+        unsigned shard;         /**< The shard's number. */
+        bool lazy;              /**< Passed to \c fh_import_file() . */
+        int err;                /**< Error code of the import. */
+        size_t next;            /**< The next client to be moved into the merged database. */
+        fh_damage *bad;         /**< The damaged blocks of the shard. */
+        size_t bad_cnt;         /**< Number of damaged blocks. */
+        size_t seen;            /**< Number of the shard's clients in the manifest's order so far. */
+        size_t next_bad;        /**< The next damaged block in the manifest's order. */
+} fh_load_job;
+
+/**
+ * @brief Imports shard files. The task of \c fh_import_dir() , see \c pool_for() .
+ * @param arg The \c fh_load_job array of the shards.
+ * @param from The first shard to be imported.
+ * @param to The end of the shards to be imported.
+ */
+void fh_load_part(void *arg, size_t from, size_t to)
+{
+        for (size_t s = from; s < to; s++) {
+                fh_load_job *job = (fh_load_job *)arg + s;
+                char path[FILENAME_MAX];
+                fh_shard_path(path, job->shard, fh_config.disk_gen, false);
+
+                job->err = fh_import_file(job->db, path, job->shard, job->lazy, &job->bad, &job->bad_cnt);
+
+                /* The manifest lists the shard, so it's not a new database. */
+                if (job->err == EFPERM)
+                        job->err = EINV;
+        }
+}
+
+/**
+ * @brief Imports the shards of the database directory in parallel.
+ * @details Every shard is loaded into a private database by its own task, then the clients are moved into the
+ *          destination in the order recorded by the manifest.
+ * @param dst The pointer to the destination database.
+ * @param lazy If \c true , only the clients are loaded.
+ * @retval 0 On success.
+ * @retval EFPERM If the directory has no snapshot yet.
+ * @retval EMALLOC If the database expansion fails.
+ * @retval EINV If the manifest or a shard is malformed, or they don't match.
+ */
+int fh_import_dir(database *dst, bool lazy)
+{
+        char *order = NULL;
+        size_t cnt = 0;
+        int retval = fh_manifest_read(&order, &cnt);
+        if (retval)
+                return retval;
+
+        unsigned shards = fh_config.disk_shards;
+        fh_load_job *jobs = calloc(shards, sizeof(fh_load_job));
+        if (!jobs)
+                retval = EMALLOC;
+
+        for (unsigned s = 0; s < shards && !retval; s++) {
+                jobs[s].db = db_init("", "");
+                jobs[s].shard = s;
+                jobs[s].lazy = lazy;
+                if (!jobs[s].db)
+                        retval = EMALLOC;
+        }
+
+        if (!retval)
+                pool_for("import", shards, 1, fh_load_part, jobs);
+
+        for (unsigned s = 0; jobs && s < shards && !retval; s++)
+                retval = jobs[s].err;
+
+        /* Every shard repeats the database's name and description. */
+        if (!retval && shards) {
+                strcpy(dst->name, jobs[0].db->name);
+                strcpy(dst->desc, jobs[0].db->desc);
+                dst->gen = fh_config.disk_gen;
+        }
+
+        TRACE_BEGIN(span_merge, "fh_merge");
+        for (size_t i = 0; i < cnt && !retval; i++) {
+                fh_load_job *job = &jobs[(unsigned char)order[i]];
+                size_t pos = job->seen++;
+
+                /* The clients of the damaged blocks are left out. */
+                while (job->next_bad < job->bad_cnt &&
+                       pos >= job->bad[job->next_bad].first + job->bad[job->next_bad].clients)
+                        job->next_bad++;
+
+                if (job->next_bad < job->bad_cnt && pos >= job->bad[job->next_bad].first)
+                        continue;
+
+                if (job->next == job->db->cl->size) {
+                        retval = EINV;
+                        continue;
                 }
 
-                if (retval == EINV) {
-                        fclose(src);
-                        return EINV;
+                /* The shards were loaded in parallel, the ids are drawn again in the destination's order. */
+                client *moved = vct_subptr(job->db->cl, job->next++);
+                moved->id = db_cl_id();
+                retval = vct_push(dst->cl, moved);
+        }
+        TRACE_END(span_merge);
+
+        for (unsigned s = 0; jobs && s < shards; s++) {
+                if (!jobs[s].db)
+                        continue;
+
+                if (!retval && jobs[s].next != jobs[s].db->cl->size)
+                        retval = EINV;
+
+                /* The moved clients belong to the destination now, only the rest are deleted with the shard. */
+                vector *cl = jobs[s].db->cl;
+                for (size_t i = jobs[s].next; i < cl->size; i++)
+                        cl->items[i - jobs[s].next] = cl->items[i];
+
+                cl->size -= jobs[s].next;
+                if (cl->size == 0) {
+                        PROBE_FREE(PROBE_MEM_VECTOR, cl->capacity * sizeof(void *), 0);
+                        free(cl->items);
+                        cl->items = NULL;
+                        cl->capacity = 0;
                 }
+
+                db_del(jobs[s].db);
+                free(jobs[s].bad);
+        }
+
+        free(jobs);
+        free(order);
+        return retval;
+}
+
+/**
+ * @brief Imports the snapshot into a database, either \c export.txt or the shards of the database directory.
+ * @param dst The pointer to the destination database.
+ * @param lazy If \c true , only the clients are loaded.
+ * @return See \c fh_import() .
+ */
+int fh_import_snapshot(database *dst, bool lazy)
+{
+        int retval = 0;
+        memset(&fh_check, 0, sizeof(fh_check));
+
+        if (fh_config.dir[0] != '\0') {
+                retval = fh_import_dir(dst, lazy);
+
+                /* An existing directory keeps its layout, resharding is explicit. */
+                if (!retval)
+                        fh_config.shards = fh_config.disk_shards;
+        }
+        else {
+                fh_damage *bad = NULL;
+                size_t bad_cnt = 0;
+                retval = fh_import_file(dst, EXPORT_FILE, 0, lazy, &bad, &bad_cnt);
+                if (retval != EFPERM)
+                        fh_config.disk_shards = 1;
+
+                free(bad);
         }
 
+        /* The blocks read back later are only verified if the whole snapshot has checksums. */
+        fh_config.sealed = fh_check.unchecked == 0;
+        return retval;
+}
+
+/**
+ * @brief Imports the snapshot into a database.
+ * @param dst The pointer to the destination database.
+ * @retval 0 On success.
+ * @retval EFPERM If the file cannot be opened for reading.
+ * @retval EMALLOC If the database expansion fails.
+ * @retval EINV If the file is malformed.
+ * @warning The destination database must be initilazed with \c db_init() first.
+ */
+int fh_import(database *dst)
+{
+        PROBE(PROBE_FH_IMPORT);
+        return fh_import_snapshot(dst, false);
+}
+
+/**
+ * @brief Imports the clients of the snapshot into a database, without their cars and operations.
+ * @details A typical session only touches a few clients, so it's a waste of time and memory to parse the whole file at
+ *          startup. The cars and operations are loaded by \c fh_cl_load() on demand, and the untouched clients are
+ *          copied back verbatim by \c fh_export() .
+ * @param dst The pointer to the destination database.
+ * @retval 0 On success.
+ * @retval EFPERM If the file cannot be opened for reading.
+ * @retval EMALLOC If the database expansion fails.
+ * @retval EINV If the file is malformed.
+ * @warning The destination database must be initilazed with \c db_init() first.
+ */
+int fh_import_lazy(database *dst)
+{
+        PROBE(PROBE_FH_IMPORT_LAZY);
+        int retval = fh_import_snapshot(dst, true);
+        if (!retval)
+                dst->loader = fh_cl_load;
+
+        return retval;
+}
+
+/**
+ * @brief Loads a lazily imported client's cars and operations from the snapshot.
+ * @details Used as \c db->loader . Reads back the client's block using the offsets recorded by the import/export.
+ * @param db The pointer to the destination database.
+ * @param cl The client's index in the database.
+ * @retval 0 On success.
+ * @retval EINV If the client's block cannot be read, it's malformed or its checksum doesn't match.
+ * @retval EMALLOC If the block cannot be read into memory or the database expansion fails.
+ */
+int fh_cl_load(const database *db, idx cl)
+{
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_ || client_->blk_len == 0)
+                return EINV;
+
+        char path[FILENAME_MAX];
+        fh_shard_path(path, client_->shard, fh_config.disk_gen, false);
+
+        FILE *src = fopen(path, "rb");
+        if (!src)
+                return EINV;
+
+        char *block = malloc(client_->blk_len + 1);
+        int retval = block ? 0 : EMALLOC;
+
+        if (!retval && (fseek(src, client_->blk_off, SEEK_SET) ||
+                        fread(block, 1, client_->blk_len, src) != client_->blk_len))
+                retval = EINV;
+
         fclose(src);
-        return 0;
+
+        /* The first line is the client itself, it must be there. The file might have been damaged since the import. */
+        if (!retval && (block[0] != 'U' || (fh_config.sealed && fh_crc_check(block, client_->blk_len))))
+                retval = EINV;
+
+        int last_car_index = -1;
+        char *line = retval ? NULL : block;
+        if (line)
+                block[client_->blk_len] = '\0';
+
+        while (!retval && line) {
+                char *next = strchr(line, '\n');
+                if (next)
+                        *next++ = '\0';
+
+                switch (line[0]) {
+                        case 'A':
+                                retval = fh_parse_car(db, cl, line);
+                                last_car_index++;
+                                break;
+                        case 'J':
+                                retval = fh_parse_op(db, cl, last_car_index, line);
+                                break;
+                        default:
+                                break;
+                }
+
+                line = next;
+        }
+
+        free(block);
+        return retval;
 }
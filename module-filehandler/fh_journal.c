@@ -0,0 +1,516 @@
+/**
+ * @file fh_journal.c
+ * @brief Function definitions for the append-only mutation journal.
+ * @details Instead of saving the whole database only at exit, every successful \c db_*_add/mod/rm call is appended to
+ *          \c journal.txt as a single line (see \c db_journal() ). At startup the journal is replayed on top of the last
+ *          snapshot (\c export.txt or the database directory's shards), and a checkpoint folds the journal into a new
+ *          snapshot.\n
+ *          Record formats (the first char is the mutation, the second one is the datatype, same as in the export):\n
+ *          \c +U>name|email|phone , \c ~U>cl|name|email|phone , \c -U>cl \n
+ *          \c +A>cl|name|plate , \c ~A>cl|cr|name|plate , \c -A>cl|cr \n
+ *          \c +J>cl|cr|desc|price|date_cr|date_exp , \c ~J>cl|cr|op|desc|price|date_exp , \c -J>cl|cr|op \n
+ *          \c ~D>name|desc \n
+ *          Generation markers (\c G>gen ) separate the records of different checkpoints. Only the records after the
+ *          marker of the snapshot's generation are replayed, so a crash between writing the snapshot and truncating the
+ *          journal cannot apply the same record twice.\n
+ *          The records of a transaction (see \c tx.c ) follow a \c T>n marker, where \c n is their number. They are
+ *          only replayed if all of them have been written.
+ */
+
+#include "../include/platform.h"
+
+#include "include/fh.h"
+
+/**
+ * @brief Parses a database index.
+ * @param str The string to be parsed.
+ * @param dst Pointer to the destination index.
+ * @return \c 0 if it's successful, \c EINV if not.
+ */
+int fh_parse_idx(const char *str, idx *dst)
+{
+        char *end = NULL;
+        if (str[0] < '0' || str[0] > '9')
+                return EINV;
+
+        *dst = strtoul(str, &end, 10);
+        return *end == '\0' ? 0 : EINV;
+}
+
+/**
+ * @brief Splits a journal record into its fields, and parses its leading indexes.
+ * @param str The record.
+ * @param f The destination of the fields.
+ * @param i The destination of the leading indexes, the rest are left as they were.
+ * @return \c 0 if it's successful, \c EINV if the record is malformed.
+ */
+int fh_jrnl_parse(char *str, char f[6][DESC_SIZE + 1], idx i[3])
+{
+        char *buf_ptr[6] = {f[0], f[1], f[2], f[3], f[4], f[5]};
+        size_t expected_size[6] = {DESC_SIZE, DESC_SIZE, DESC_SIZE, DESC_SIZE, DESC_SIZE, DESC_SIZE};
+
+        /* The number of fields and the number of leading indexes depend on the record type. */
+        size_t field_cnt = 0;
+        size_t idx_cnt = 0;
+
+        switch (str[0] == '\0' ? '\0' : str[1]) {
+                case 'U':
+                        field_cnt = str[0] == '+' ? 3 : str[0] == '~' ? 4 : 1;
+                        idx_cnt = str[0] == '+' ? 0 : 1;
+                        break;
+                case 'A':
+                        field_cnt = str[0] == '+' ? 3 : str[0] == '~' ? 4 : 2;
+                        idx_cnt = str[0] == '+' ? 1 : 2;
+                        break;
+                case 'J':
+                        field_cnt = str[0] == '+' ? 6 : str[0] == '~' ? 6 : 3;
+                        idx_cnt = str[0] == '+' ? 2 : 3;
+                        break;
+                case 'D':
+                        field_cnt = 2;
+                        break;
+                default:
+                        return EINV;
+        }
+
+        if (fh_buffer_filler(str, buf_ptr, expected_size, field_cnt))
+                return EINV;
+
+        for (idx k = 0; k < idx_cnt; k++) {
+                if (fh_parse_idx(f[k], &i[k]))
+                        return EINV;
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Applies a single journal record to a database.
+ * @param db The pointer to the destination database.
+ * @param str The record to be applied. The string will be modified.
+ * @retval 0 On success.
+ * @retval EINV If the record is malformed or it refers to objects that don't exist.
+ * @retval EMALLOC If the database expansion fails.
+ * @note The record is not journaled again, the caller must detach the journal if it's open.
+ */
+int fh_jrnl_apply(database *db, char *str)
+{
+        char f[6][DESC_SIZE + 1] = {"\0"};
+        idx i[3] = {0};
+        int retval = EINV;
+
+        if (fh_jrnl_parse(str, f, i))
+                return EINV;
+
+        char *date_exp = NULL;
+        double price = 0;
+
+        switch (str[0]) {
+                case '+':
+                        if (str[1] == 'U')
+                                retval = db_cl_add(db, f[0], f[1], f[2]);
+                        else if (str[1] == 'A')
+                                retval = db_car_add(db, i[0], f[1], f[2]);
+                        else if (str[1] == 'J' && !fh_parse_price(f[3], &price))
+                                retval = fh_jrnl_op_add(db, i[0], i[1], f[2], price, f[4], f[5]);
+                        break;
+                case '~':
+                        if (str[1] == 'U') {
+                                retval = db_cl_mod(db, i[0], f[1], f[2], f[3]);
+                        }
+                        else if (str[1] == 'A') {
+                                retval = db_car_mod(db, i[0], i[1], f[2], f[3]);
+                        }
+                        else if (str[1] == 'J' && !fh_parse_price(f[4], &price)) {
+                                date_exp = f[5][0] != '0' ? f[5] : NULL;
+                                retval = db_op_mod(db, i[0], i[1], i[2], f[3], price, date_exp);
+                        }
+                        else if (str[1] == 'D') {
+                                retval = db_mod(db, f[0], f[1]);
+                        }
+                        break;
+                case '-':
+                        if (str[1] == 'U')
+                                retval = db_cl_rm(db, i[0]);
+                        else if (str[1] == 'A')
+                                retval = db_car_rm(db, i[0], i[1]);
+                        else if (str[1] == 'J')
+                                retval = db_op_rm(db, i[0], i[1], i[2]);
+                        break;
+                default:
+                        break;
+        }
+
+        /* A record pointing to a nonexistent object means the journal doesn't belong to this snapshot. */
+        if (retval == EOOB)
+                return EINV;
+
+        return retval;
+}
+
+/**
+ * @brief Stages a journal record as a step of a transaction, see \c tx.c .
+ * @param tx The pointer to the transaction.
+ * @param str The record to be staged. The string will be modified.
+ * @retval 0 On success.
+ * @retval EINV If the record is malformed, or it isn't a change of a client, a car or an operation.
+ * @return For the other return values see \c db_tx_stage() .
+ * @note The records' indexes are the ones of the transaction's steps, like in the records after a \c T>n marker.
+ */
+int fh_jrnl_stage(db_tx *tx, char *str)
+{
+        char f[6][DESC_SIZE + 1] = {"\0"};
+        idx i[3] = {0};
+        double price = 0;
+
+        if (fh_jrnl_parse(str, f, i))
+                return EINV;
+
+        switch (str[0]) {
+                case '+':
+                        if (str[1] == 'U')
+                                return db_tx_cl_add(tx, f[0], f[1], f[2]);
+                        else if (str[1] == 'A')
+                                return db_tx_car_add(tx, i[0], f[1], f[2]);
+                        else if (str[1] == 'J' && !fh_parse_price(f[3], &price))
+                                return db_tx_op_add_dated(tx, i[0], i[1], f[2], price, f[4],
+                                                          strcmp(f[5], "0") != 0 ? f[5] : NULL);
+                        break;
+                case '~':
+                        if (str[1] == 'U')
+                                return db_tx_cl_mod(tx, i[0], f[1], f[2], f[3]);
+                        else if (str[1] == 'A')
+                                return db_tx_car_mod(tx, i[0], i[1], f[2], f[3]);
+                        else if (str[1] == 'J' && !fh_parse_price(f[4], &price))
+                                return db_tx_op_mod(tx, i[0], i[1], i[2], f[3], price,
+                                                    strcmp(f[5], "0") != 0 ? f[5] : NULL);
+                        break;
+                case '-':
+                        if (str[1] == 'U')
+                                return db_tx_cl_rm(tx, i[0]);
+                        else if (str[1] == 'A')
+                                return db_tx_car_rm(tx, i[0], i[1]);
+                        else if (str[1] == 'J')
+                                return db_tx_op_rm(tx, i[0], i[1], i[2]);
+                        break;
+                default:
+                        break;
+        }
+
+        return EINV;
+}
+
+/**
+ * @brief Adds an operation with its original creation date to a database, see \c fh_db_op_add() .
+ * @details Unlike \c db_op_add() , the creation date is not the current time, but the record is journaled the same
+ *          way: while the client's lock is held, so the records of a client are journaled in the order they are
+ *          applied.
+ * @param db The pointer to the destination database.
+ * @param cl The client's index in the database.
+ * @param cr The car's index in the database.
+ * @param desc The operation's description.
+ * @param price The operation's price.
+ * @param date_cr The creation date, see \c date_parse_strict() .
+ * @param date_exp The expiration date, \c 0 if it's not used.
+ * @retval 0 On success.
+ * @retval EOOB If the client or the car doesn't exist.
+ * @retval EMALLOC If the operation allocation fails.
+ * @retval EINV If a date is malformed.
+ */
+int fh_jrnl_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+                   const char *date_exp)
+{
+        if (!db_cl_get(db, cl))
+                return EOOB;
+
+        operation *op = NULL;
+        int retval = fh_op_new(desc, price, date_cr, date_exp, &op);
+        if (retval)
+                return retval;
+
+        db_w_lock(db, cl);
+        client *client_ = NULL;
+        retval = db_cl_write(db, cl, &client_);
+
+        car *car_ = retval ? NULL : vct_subptr(client_->cars, cr);
+        if (!retval && !car_)
+                retval = EOOB;
+        if (!retval)
+                retval = vct_push(car_->operations, op);
+
+        if (!retval) {
+                client_->dirty = true;
+
+                char cr_buf[17], exp_buf[17];
+                db_journal_date(&op->date_cr, cr_buf);
+                db_journal_date(&op->date_exp, exp_buf);
+                db_journal(db, "+J>%zu|%zu|%s|%f|%s|%s\n", cl, cr, desc, price, cr_buf, exp_buf);
+        }
+
+        retval = db_cl_commit(db, cl, client_, retval);
+        db_w_unlock(db, cl);
+
+        if (retval) {
+                PROBE_FREE(PROBE_MEM_OP, sizeof(operation), 1);
+                free(op);
+                return retval;
+        }
+
+        db_changed(db);
+        return 0;
+}
+
+/**
+ * @brief Applies a record as a new change, e.g. one sent by another terminal or a script.
+ * @details Unlike a replayed record, the change is journaled by the database, while it holds the client's lock.
+ * @param db The pointer to the destination database.
+ * @param record The record to be applied.
+ * @return See \c fh_jrnl_apply() .
+ */
+int fh_jrnl_exec(database *db, const char *record)
+{
+        char copy[LONGEST_JOURNAL_LINE + 1];
+        if (strlen(record) > LONGEST_JOURNAL_LINE)
+                return EINV;
+
+        strcpy(copy, record);
+        return fh_jrnl_apply(db, copy);
+}
+
+/**
+ * @brief Checks if the records of a transaction are complete. The stream is left where it was.
+ * @param src The journal, after the transaction's marker.
+ * @param cnt The number of the transaction's records.
+ * @return \c true if all of them have been written, \c false if the transaction was torn by a crash.
+ */
+bool fh_jrnl_complete(FILE *src, size_t cnt)
+{
+        long pos = ftell(src);
+        char read_buffer[LONGEST_JOURNAL_LINE];
+        size_t found = 0;
+
+        while (found < cnt && fgets(read_buffer, LONGEST_JOURNAL_LINE, src) != NULL && strchr(read_buffer, '\n'))
+                found++;
+
+        fseek(src, pos, SEEK_SET);
+        return found == cnt;
+}
+
+/**
+ * @brief Replays \c journal.txt on top of the database loaded by \c fh_import() .
+ * @param db The pointer to the destination database.
+ * @retval 0 On success or if there is no journal.
+ * @retval EINV If the journal contains a malformed record, or a line longer than \c LONGEST_JOURNAL_LINE before its
+ *              end.
+ * @retval EMALLOC If the database expansion fails.
+ * @note An incomplete last line (a record torn by a crash) is ignored, so is an incomplete transaction at the end.
+ * @note If the import has found damaged blocks, the journal is not replayed, but renamed to \c journal.txt.bad .
+ */
+int fh_jrnl_replay(database *db)
+{
+        TRACE("fh_jrnl_replay");
+        char path[FILENAME_MAX];
+        fh_path(path, JOURNAL_FILE);
+
+        /*
+         * The records refer to the clients by index, which are off if the clients of a damaged block were left out.
+         * The journal is kept for manual recovery instead.
+         */
+        if (fh_check.damaged) {
+                char bad[FILENAME_MAX + 4];
+                snprintf(bad, sizeof(bad), "%s.bad", path);
+                remove(bad);
+                rename(path, bad);
+                return 0;
+        }
+
+        FILE *src = fopen(path, "r");
+        if (!src)
+                return 0;
+
+        /* Replaying must not append the same records to the journal again. */
+        FILE *journal = db->journal;
+        db->journal = NULL;
+
+        char read_buffer[LONGEST_JOURNAL_LINE] = "\0";
+        bool active = false;
+        bool torn = false;
+        int retval = 0;
+
+        while (!retval && fgets(read_buffer, LONGEST_JOURNAL_LINE, src) != NULL) {
+                /* Only the last line can be torn, a line that doesn't fit the buffer is corrupt anywhere else. */
+                if (!strchr(read_buffer, '\n')) {
+                        int c = 0;
+                        while ((c = getc(src)) != EOF && c != '\n')
+                                ;
+
+                        if (c != EOF)
+                                retval = EINV;
+                        break;
+                }
+
+                /* The records of a torn transaction are read up to the end, but only to check their length. */
+                if (torn)
+                        continue;
+
+                if (read_buffer[0] == 'G') {
+                        active = strtoul(read_buffer + 2, NULL, 10) >= db->gen;
+                        continue;
+                }
+
+                if (read_buffer[0] == 'T') {
+                        torn = !fh_jrnl_complete(src, strtoul(read_buffer + 2, NULL, 10));
+                        continue;
+                }
+
+                if (active)
+                        retval = fh_jrnl_apply(db, read_buffer);
+        }
+
+        db->journal = journal;
+        fclose(src);
+        return retval;
+}
+
+/**
+ * @brief Opens the journal for appending and attaches it to the database.
+ * @param db The pointer to the database.
+ * @retval 0 On success.
+ * @retval EFPERM If the journal cannot be opened/created for writing.
+ * @note From now on the database owns the stream, \c db_del() closes it.
+ */
+int fh_jrnl_open(database *db)
+{
+        char path[FILENAME_MAX];
+        fh_path(path, JOURNAL_FILE);
+
+        FILE *journal = fopen(path, "a");
+        if (!journal)
+                return EFPERM;
+
+        /* Mark the current generation, otherwise the new records could be skipped if the file has older ones only. */
+        fprintf(journal, "G>%lu\n", db->gen);
+        fflush(journal);
+
+        db->journal = journal;
+        return 0;
+}
+
+/**
+ * @brief Folds the journal into a new snapshot.
+ * @details The journal is marked with the next generation, then a snapshot of that generation is exported. The journal
+ *          is only truncated after the export succeeded.
+ * @param db The pointer to the database.
+ * @retval 0 On success.
+ * @retval EFPERM If the snapshot cannot be written, or the journal cannot be truncated after it. The journal is kept
+ *                intact (and open) in this case.
+ */
+int fh_jrnl_checkpoint(database *db)
+{
+        TRACE("fh_jrnl_checkpoint");
+        db->gen++;
+        db_journal(db, "G>%lu\n", db->gen);
+
+        int retval = fh_export(db);
+        if (retval)
+                return retval;
+
+        if (db->journal) {
+                char path[FILENAME_MAX];
+                fh_path(path, JOURNAL_FILE);
+
+                /* If the journal cannot be truncated, the old stream is kept, its records are skipped by generation. */
+                FILE *journal = fopen(path, "w");
+                if (!journal)
+                        return EFPERM;
+
+                fclose(db->journal);
+                db->journal = journal;
+                db_journal(db, "G>%lu\n", db->gen);
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Drops the records that are already in the snapshot from the journal.
+ * @details Used after a snapshot has been saved in the background, since the journal has new records after its
+ *          generation marker. Those (and the marker) are copied to a new journal, which then replaces the old one.
+ * @param db The pointer to the database.
+ * @param gen The generation of the saved snapshot.
+ * @retval 0 On success, or if there is no journal.
+ * @retval EFPERM If the new journal cannot be written or opened. The old one is kept in this case.
+ */
+int fh_jrnl_compact(database *db, unsigned long gen)
+{
+        if (!db->journal)
+                return 0;
+
+        char path[FILENAME_MAX];
+        char tmp[FILENAME_MAX + 4];
+        fh_path(path, JOURNAL_FILE);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+        fflush(db->journal);
+        FILE *src = fopen(path, "r");
+        FILE *dst = fopen(tmp, "w");
+        if (!src || !dst) {
+                if (src)
+                        fclose(src);
+                if (dst)
+                        fclose(dst);
+                remove(tmp);
+                return EFPERM;
+        }
+
+        char read_buffer[LONGEST_JOURNAL_LINE] = "\0";
+        bool active = false;
+        bool line_start = true;
+
+        while (fgets(read_buffer, LONGEST_JOURNAL_LINE, src) != NULL) {
+                if (line_start && read_buffer[0] == 'G' && strtoul(read_buffer + 2, NULL, 10) >= gen)
+                        active = true;
+
+                if (active)
+                        fputs(read_buffer, dst);
+
+                line_start = strchr(read_buffer, '\n') != NULL;
+        }
+
+        int retval = !active || ferror(src) || ferror(dst) || fh_sync(dst) ? EFPERM : 0;
+        fclose(src);
+        if (fclose(dst))
+                retval = EFPERM;
+
+#ifdef _WIN32
+        /* rename() doesn't overwrite existing files on Windows. */
+        if (!retval) {
+                fclose(db->journal);
+                db->journal = NULL;
+                remove(path);
+        }
+
+        if (retval || rename(tmp, path)) {
+                remove(tmp);
+                return EFPERM;
+        }
+
+        db->journal = fopen(path, "a");
+        if (!db->journal)
+                return EFPERM;
+#else
+        /* The new stream is opened before the rename, so the old journal is kept in use if it cannot be opened. */
+        FILE *journal = retval ? NULL : fopen(tmp, "a");
+        if (!journal || rename(tmp, path)) {
+                if (journal)
+                        fclose(journal);
+                remove(tmp);
+                return EFPERM;
+        }
+
+        /* The old stream still points to the replaced file. */
+        fclose(db->journal);
+        db->journal = journal;
+#endif
+        return fh_sync_dir(path);
+}
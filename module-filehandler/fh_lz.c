@@ -0,0 +1,548 @@
+/**
+ * @file fh_lz.c
+ * @brief Function definitions for the block compressed snapshot backups.
+ * @details The snapshot is highly repetitive (car models, descriptions and date prefixes appear over and over), so a
+ *          simple LZ77 compressor shrinks it well. The file is split into blocks of \c LZ_BLOCK_SIZE bytes, every block
+ *          is compressed on its own, so they can be decompressed independently and in parallel.\n
+ *          File layout (every number is a little-endian 32 bit unsigned integer):\n
+ *          \c RSLZ magic, block count, then a \c raw_len , \c packed_len pair per block, then the blocks. If a block's
+ *          \c packed_len equals its \c raw_len , the block is stored uncompressed.\n
+ *          Block format: a sequence of tokens. The high nibble of the token byte is the number of literals, the low
+ *          nibble is the match length minus \c LZ_MIN_MATCH . A nibble of \c 15 is continued by bytes of \c 255 and
+ *          a closing byte below \c 255 . The literals follow the token, then a 2 byte offset of the match. The last
+ *          sequence only has literals.
+ */
+
+#include "../include/platform.h"
+
+#include <stdint.h>
+
+#include "include/fh.h"
+
+#define LZ_BLOCK_SIZE (1 << 18)         /**< Size of an uncompressed block. */
+#define LZ_MIN_MATCH 4                  /**< Shorter matches are stored as literals. */
+#define LZ_MAX_OFFSET 65535             /**< Matches must be closer than this. */
+#define LZ_HASH_BITS 14                 /**< The match finder's hash table has 2^LZ_HASH_BITS entries. */
+#define LZ_MAGIC "RSLZ"                 /**< The first 4 bytes of a compressed file. */
+
+/**
+ * @struct lz_block fh_lz.c
+ * @brief A block of a compressed file.
+ */
+typedef struct lz_block {
+        const uint8_t *src;     /**< Pointer to the compressed block. */
+        uint32_t packed_len;    /**< Size of the compressed block. */
+        uint8_t *dst;           /**< Pointer to the block's place in the decompressed file. */
+        uint32_t raw_len;       /**< Size of the decompressed block. */
+        int err;                /**< Error code of the decompression. */
+} lz_block;
+
+/**
+ * @brief Writes a 32 bit unsigned integer in little-endian order.
+ * @param dst The destination, at least 4 bytes long.
+ * @param val The number to be written.
+ */
+void lz_put32(uint8_t *dst, uint32_t val)
+{
+        for (int i = 0; i < 4; i++)
+                dst[i] = (uint8_t)(val >> (8 * i));
+}
+
+/**
+ * @brief Reads a 32 bit unsigned integer in little-endian order.
+ * @param src The source, at least 4 bytes long.
+ * @return The number.
+ */
+uint32_t lz_get32(const uint8_t *src)
+{
+        return src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+/**
+ * @brief Writes the continuation bytes of a length, which doesn't fit into a token's nibble.
+ * @param dst The destination.
+ * @param len The remainder of the length (the full length minus \c 15 ).
+ * @return Pointer to the byte after the length.
+ */
+uint8_t *lz_put_len(uint8_t *dst, size_t len)
+{
+        for (; len >= 255; len -= 255)
+                *dst++ = 255;
+
+        *dst++ = (uint8_t)len;
+        return dst;
+}
+
+/**
+ * @brief Compresses a block.
+ * @param src The block to be compressed.
+ * @param len The size of \c src , at most \c LZ_BLOCK_SIZE .
+ * @param dst The destination, it must be at least \c lz_bound(len) bytes long.
+ * @return The size of the compressed block.
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+        uint32_t table[1 << LZ_HASH_BITS] = {0};
+        const uint8_t *anchor = src;
+        uint8_t *out = dst;
+        size_t pos = 1;
+
+        /* Leave room at the end, so that reading 4 bytes for the hash is always in bounds. */
+        while (len > LZ_MIN_MATCH && pos < len - LZ_MIN_MATCH) {
+                uint32_t seq = lz_get32(src + pos);
+                uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+                size_t cand = table[h];
+                table[h] = (uint32_t)pos;
+
+                if (cand == 0 || pos - cand > LZ_MAX_OFFSET || lz_get32(src + cand) != seq) {
+                        pos++;
+                        continue;
+                }
+
+                size_t match = LZ_MIN_MATCH;
+                while (pos + match < len && src[cand + match] == src[pos + match])
+                        match++;
+
+                size_t lit = (size_t)(src + pos - anchor);
+                uint8_t *token = out++;
+                *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+                if (lit >= 15)
+                        out = lz_put_len(out, lit - 15);
+
+                memcpy(out, anchor, lit);
+                out += lit;
+
+                *out++ = (uint8_t)(pos - cand);
+                *out++ = (uint8_t)((pos - cand) >> 8);
+
+                size_t mlen = match - LZ_MIN_MATCH;
+                *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+                if (mlen >= 15)
+                        out = lz_put_len(out, mlen - 15);
+
+                pos += match;
+                anchor = src + pos;
+        }
+
+        /* The last sequence only has literals. */
+        size_t lit = (size_t)(src + len - anchor);
+        uint8_t *token = out++;
+        *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+        if (lit >= 15)
+                out = lz_put_len(out, lit - 15);
+
+        memcpy(out, anchor, lit);
+        out += lit;
+
+        return (size_t)(out - dst);
+}
+
+/**
+ * @brief Calculates the worst case size of a compressed block.
+ * @param len The size of the uncompressed block.
+ * @return The maximum size of the compressed block.
+ */
+size_t lz_bound(size_t len)
+{
+        return len + len / 255 + 16;
+}
+
+/**
+ * @brief Reads the continuation bytes of a length.
+ * @param src Pointer to the source pointer, it will be advanced.
+ * @param end The end of the source.
+ * @param len Pointer to the length to be increased.
+ * @return \c 0 if it's successful, \c EINV if the source ended.
+ */
+int lz_get_len(const uint8_t **src, const uint8_t *end, size_t *len)
+{
+        uint8_t b;
+        do {
+                if (*src >= end)
+                        return EINV;
+
+                b = *(*src)++;
+                *len += b;
+        }
+        while (b == 255);
+
+        return 0;
+}
+
+/**
+ * @brief Decompresses a block.
+ * @param b The block to be decompressed.
+ * @retval 0 On success.
+ * @retval EINV If the block is corrupted.
+ */
+int lz_decompress(lz_block *b)
+{
+        if (b->packed_len == b->raw_len) {
+                memcpy(b->dst, b->src, b->raw_len);
+                return 0;
+        }
+
+        const uint8_t *in = b->src;
+        const uint8_t *in_end = b->src + b->packed_len;
+        uint8_t *out = b->dst;
+        uint8_t *out_end = b->dst + b->raw_len;
+
+        while (in < in_end) {
+                uint8_t token = *in++;
+
+                size_t lit = token >> 4;
+                if (lit == 15 && lz_get_len(&in, in_end, &lit))
+                        return EINV;
+
+                if (lit > (size_t)(in_end - in) || lit > (size_t)(out_end - out))
+                        return EINV;
+
+                memcpy(out, in, lit);
+                in += lit;
+                out += lit;
+
+                /* The last sequence has no match. */
+                if (in == in_end)
+                        break;
+
+                if (in_end - in < 2)
+                        return EINV;
+
+                size_t offset = in[0] | (size_t)in[1] << 8;
+                in += 2;
+
+                size_t match = token & 15;
+                if (match == 15 && lz_get_len(&in, in_end, &match))
+                        return EINV;
+
+                match += LZ_MIN_MATCH;
+                if (offset == 0 || offset > (size_t)(out - b->dst) || match > (size_t)(out_end - out))
+                        return EINV;
+
+                /* An overlapping match repeats the bytes before it, so it has to be copied byte by byte. */
+                if (offset >= match) {
+                        memcpy(out, out - offset, match);
+                        out += match;
+                }
+                else {
+                        for (const uint8_t *from = out - offset; match--; )
+                                *out++ = *from++;
+                }
+        }
+
+        return out == out_end ? 0 : EINV;
+}
+
+/**
+ * @brief A decompressor task, see \c pool_for() .
+ * @param arg The blocks of the file.
+ * @param from The first block to be decompressed.
+ * @param to The end of the blocks to be decompressed.
+ */
+void lz_unpack_part(void *arg, size_t from, size_t to)
+{
+        lz_block *blocks = arg;
+
+        for (size_t i = from; i < to; i++)
+                blocks[i].err = lz_decompress(&blocks[i]);
+}
+
+/**
+ * @brief Compresses a file.
+ * @param src_path The file to be compressed.
+ * @param dst_path The compressed file. It's written to a temporary file and synced to the disk first, then renamed.
+ * @param raw Pointer to the destination of the uncompressed size.
+ * @param packed Pointer to the destination of the compressed size.
+ * @retval 0 On success.
+ * @retval EFPERM If a file cannot be read or written.
+ * @retval EMALLOC If the buffers cannot be allocated.
+ */
+int fh_lz_pack(const char *src_path, const char *dst_path, size_t *raw, size_t *packed)
+{
+        size_t len = 0;
+        uint8_t *data = fh_read_file(src_path, &len);
+        if (!data)
+                return EFPERM;
+
+        size_t cnt = (len + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+        uint8_t *header = malloc(8 + 8 * cnt);
+        uint8_t *out = malloc(lz_bound(LZ_BLOCK_SIZE) * (cnt ? cnt : 1));
+        if (!header || !out) {
+                free(data);
+                free(header);
+                free(out);
+                return EMALLOC;
+        }
+
+        memcpy(header, LZ_MAGIC, 4);
+        lz_put32(header + 4, (uint32_t)cnt);
+
+        size_t out_len = 0;
+        for (size_t i = 0; i < cnt; i++) {
+                size_t raw_len = len - i * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? len - i * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+                const uint8_t *block = data + i * LZ_BLOCK_SIZE;
+                size_t packed_len = lz_compress(block, raw_len, out + out_len);
+
+                /* Incompressible blocks are stored as they are. */
+                if (packed_len >= raw_len) {
+                        memcpy(out + out_len, block, raw_len);
+                        packed_len = raw_len;
+                }
+
+                lz_put32(header + 8 + 8 * i, (uint32_t)raw_len);
+                lz_put32(header + 12 + 8 * i, (uint32_t)packed_len);
+                out_len += packed_len;
+        }
+
+        char tmp_path[FILENAME_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dst_path);
+
+        int retval = 0;
+        FILE *dst = fopen(tmp_path, "wb");
+        if (!dst) {
+                retval = EFPERM;
+        }
+        else {
+                if (fwrite(header, 1, 8 + 8 * cnt, dst) != 8 + 8 * cnt || fwrite(out, 1, out_len, dst) != out_len ||
+                    fh_sync(dst))
+                        retval = EFPERM;
+
+                if (fclose(dst))
+                        retval = EFPERM;
+        }
+
+#ifdef _WIN32
+        if (!retval)
+                remove(dst_path);
+#endif
+        if (!retval && (rename(tmp_path, dst_path) || fh_sync_dir(dst_path)))
+                retval = EFPERM;
+
+        if (retval)
+                remove(tmp_path);
+
+        *raw = len;
+        *packed = 8 + 8 * cnt + out_len;
+
+        free(data);
+        free(header);
+        free(out);
+        return retval;
+}
+
+/**
+ * @brief Decompresses a file made by \c fh_lz_pack() . The blocks are decompressed in parallel.
+ * @param src_path The compressed file.
+ * @param dst_path The decompressed file. It's written to a temporary file and synced to the disk first, then renamed.
+ * @retval 0 On success.
+ * @retval EFPERM If a file cannot be read or written.
+ * @retval EINV If the compressed file is corrupted.
+ * @retval EMALLOC If the buffers cannot be allocated.
+ */
+int fh_lz_unpack(const char *src_path, const char *dst_path)
+{
+        size_t len = 0;
+        uint8_t *data = fh_read_file(src_path, &len);
+        if (!data)
+                return EFPERM;
+
+        size_t cnt = len >= 8 ? lz_get32(data + 4) : 0;
+        if (len < 8 || memcmp(data, LZ_MAGIC, 4) || cnt > (len - 8) / 8) {
+                free(data);
+                return EINV;
+        }
+
+        lz_block *blocks = malloc((cnt ? cnt : 1) * sizeof(lz_block));
+        if (!blocks) {
+                free(data);
+                return EMALLOC;
+        }
+
+        /* Check the block table and calculate where every block starts in both files. */
+        int retval = 0;
+        size_t in_pos = 8 + 8 * cnt;
+        size_t out_len = 0;
+        for (size_t i = 0; i < cnt; i++) {
+                lz_block *b = &blocks[i];
+                b->raw_len = lz_get32(data + 8 + 8 * i);
+                b->packed_len = lz_get32(data + 12 + 8 * i);
+                b->err = 0;
+
+                if (b->raw_len > LZ_BLOCK_SIZE || b->packed_len > len - in_pos)
+                        retval = EINV;
+
+                b->src = data + in_pos;
+                in_pos += retval ? 0 : b->packed_len;
+                out_len += b->raw_len;
+        }
+
+        uint8_t *out = retval ? NULL : malloc(out_len ? out_len : 1);
+        if (!retval && !out)
+                retval = EMALLOC;
+
+        if (!retval) {
+                for (size_t i = 0, pos = 0; i < cnt; pos += blocks[i++].raw_len)
+                        blocks[i].dst = out + pos;
+
+                pool_for("lz", cnt, 1, lz_unpack_part, blocks);
+
+                for (size_t i = 0; i < cnt && !retval; i++)
+                        retval = blocks[i].err;
+        }
+
+        if (!retval) {
+                char tmp_path[FILENAME_MAX];
+                snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dst_path);
+
+                FILE *dst = fopen(tmp_path, "wb");
+                if (!dst || fwrite(out, 1, out_len, dst) != out_len || fh_sync(dst))
+                        retval = EFPERM;
+
+                if (dst && fclose(dst))
+                        retval = EFPERM;
+
+#ifdef _WIN32
+                if (!retval)
+                        remove(dst_path);
+#endif
+                if (!retval && (rename(tmp_path, dst_path) || fh_sync_dir(dst_path)))
+                        retval = EFPERM;
+
+                if (retval)
+                        remove(tmp_path);
+        }
+
+        free(out);
+        free(blocks);
+        free(data);
+        return retval;
+}
+
+/**
+ * @brief Restores the snapshot's files from their compressed backups, if only the backups exist.
+ * @param db Unused, it's here to match the signature of the other filehandler entry points.
+ * @retval 0 On success or if there is nothing to restore.
+ * @retval EINV If a backup or the manifest is corrupted.
+ * @retval EMALLOC If the buffers cannot be allocated.
+ * @note The manifest of a database directory isn't compressed, it must exist.
+ */
+int fh_lz_restore(database *db)
+{
+        (void)db;
+        TRACE("fh_lz_restore");
+
+        unsigned shards = 1;
+        if (fh_config.dir[0] != '\0') {
+                char *order = NULL;
+                size_t cnt = 0;
+                int retval = fh_manifest_read(&order, &cnt);
+                if (retval)
+                        return retval == EFPERM ? 0 : retval;
+
+                free(order);
+                shards = fh_config.disk_shards;
+        }
+
+        for (unsigned s = 0; s < shards; s++) {
+                char path[FILENAME_MAX];
+                char lz_path[FILENAME_MAX];
+                fh_shard_path(path, s, fh_config.disk_gen, false);
+                fh_shard_path(lz_path, s, fh_config.disk_gen, true);
+
+                FILE *snapshot = fopen(path, "rb");
+                if (snapshot) {
+                        fclose(snapshot);
+                        continue;
+                }
+
+                int retval = fh_lz_unpack(lz_path, path);
+                if (retval && retval != EFPERM)
+                        return retval;
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Records the backup of the snapshot on the disk in \c backup.txt , and removes the previous backup's files.
+ * @details The shards of a snapshot are removed by the next export, but their backups are kept until the next backup
+ *          replaces them, like \c export.lz without a database directory.
+ * @retval 0 On success.
+ * @retval EFPERM If \c backup.txt cannot be written.
+ * @note The old files are removed after the new record is in place, a crash in between only leaves them behind.
+ */
+int fh_lz_rotate(void)
+{
+        char path[FILENAME_MAX];
+        char tmp[FILENAME_MAX + 4];
+        fh_path(path, BACKUP_FILE);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+        unsigned shards = 0;
+        unsigned long gen = 0;
+        FILE *src = fopen(path, "r");
+        if (src) {
+                if (fscanf(src, "S>%u\nG>%lu", &shards, &gen) != 2 || shards > FH_MAX_SHARDS)
+                        shards = 0;
+                fclose(src);
+        }
+
+        FILE *dst = fopen(tmp, "w");
+        if (!dst)
+                return EFPERM;
+
+        fprintf(dst, "S>%u\nG>%lu\n", fh_config.disk_shards, fh_config.disk_gen);
+        int retval = ferror(dst) || fh_sync(dst) ? EFPERM : 0;
+        if (fclose(dst))
+                retval = EFPERM;
+
+#ifdef _WIN32
+        /* rename() doesn't overwrite existing files on Windows. */
+        if (!retval)
+                remove(path);
+#endif
+        if (retval || rename(tmp, path) || fh_sync_dir(path)) {
+                remove(tmp);
+                return EFPERM;
+        }
+
+        for (unsigned s = 0; s < shards && gen != fh_config.disk_gen; s++) {
+                fh_shard_path(path, s, gen, true);
+                remove(path);
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Compresses every file of the snapshot on the disk.
+ * @param raw Pointer to the destination of the total uncompressed size.
+ * @param packed Pointer to the destination of the total compressed size.
+ * @retval 0 On success.
+ * @retval EFPERM If a file cannot be read or written.
+ * @retval EMALLOC If the buffers cannot be allocated.
+ * @note In a database directory the previous backup is removed, see \c fh_lz_rotate() .
+ */
+int fh_lz_backup(size_t *raw, size_t *packed)
+{
+        *raw = 0;
+        *packed = 0;
+
+        for (unsigned s = 0; s < fh_config.disk_shards; s++) {
+                char path[FILENAME_MAX];
+                char lz_path[FILENAME_MAX];
+                size_t shard_raw = 0;
+                size_t shard_packed = 0;
+                fh_shard_path(path, s, fh_config.disk_gen, false);
+                fh_shard_path(lz_path, s, fh_config.disk_gen, true);
+
+                int retval = fh_lz_pack(path, lz_path, &shard_raw, &shard_packed);
+                if (retval)
+                        return retval;
+
+                *raw += shard_raw;
+                *packed += shard_packed;
+        }
+
+        return fh_config.dir[0] != '\0' ? fh_lz_rotate() : 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * @file fh_shard.c
+ * @brief Function definitions for the sharded database directory.
+ * @details By default the snapshot is a single \c export.txt in the working directory. A database directory splits it
+ *          into \c fh_config.shards files instead (\c shard-NNN-GEN.txt ), which are loaded and saved in parallel.
+ *          Every shard has the same format as \c export.txt . A client belongs to the shard chosen by the FNV-1a hash of
+ *          its name.\n
+ *          The directory also holds the journal and \c manifest.txt , which describes the snapshot:\n
+ *          \c S>shards , \c G>gen , \c O>order \n
+ *          The order line has a character per client, the shard of the client in the database's order. The journal
+ *          refers to the clients by index, so the merged shards must have the same order as the exported database.\n
+ *          The shard files of a new snapshot get new names (the generation is part of it), and the snapshot only
+ *          takes effect when the new manifest is renamed to \c manifest.txt . A crash during the export leaves the
+ *          previous snapshot intact, its files are removed after the rename.
+ */
+
+#include "../include/platform.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+
+#include "include/fh.h"
+
+/** The digits of the shard numbers in the manifest's order line. */
+static const char shard_digits[FH_MAX_SHARDS + 1] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+/** The storage layout. The default is a single \c export.txt in the working directory. */
+fh_cfg fh_config = {"", 1, 0, 0, false};
+
+/**
+ * @brief Sets up the database directory.
+ * @param dir The database directory. \c NULL keeps the single \c export.txt in the working directory.
+ * @param shards The number of shards of a new database. An existing directory keeps its own, see \c fh_import() .
+ * @retval 0 On success.
+ * @retval EINV If \c shards is out of range, or \c dir is too long.
+ * @retval EFPERM If the directory cannot be created.
+ * @note Must be called before the import.
+ */
+int fh_setup(const char *dir, unsigned shards)
+{
+        if (shards == 0 || shards > FH_MAX_SHARDS || (!dir && shards != 1))
+                return EINV;
+
+        fh_config.shards = shards;
+        if (!dir)
+                return 0;
+
+        /* The file names are appended to the directory, so it can only take half of a path. */
+        if (strlen(dir) == 0 || strlen(dir) >= sizeof(fh_config.dir))
+                return EINV;
+
+#ifdef _WIN32
+        int retval = _mkdir(dir);
+#else
+        int retval = mkdir(dir, 0777);
+#endif
+        if (retval && errno != EEXIST)
+                return EFPERM;
+
+        strcpy(fh_config.dir, dir);
+        return 0;
+}
+
+/**
+ * @brief Creates the path of a file in the database directory.
+ * @param dst The destination, at least \c FILENAME_MAX long.
+ * @param name The file's name.
+ */
+void fh_path(char *dst, const char *name)
+{
+        if (fh_config.dir[0] == '\0')
+                snprintf(dst, FILENAME_MAX, "%s", name);
+        else
+                snprintf(dst, FILENAME_MAX, "%s/%s", fh_config.dir, name);
+}
+
+/**
+ * @brief Creates the path of a shard file.
+ * @param dst The destination, at least \c FILENAME_MAX long.
+ * @param shard The shard's number.
+ * @param gen The generation of the snapshot.
+ * @param lz If \c true , the path of the shard's compressed backup is created.
+ * @note Without a database directory the path is always \c export.txt or \c export.lz .
+ */
+void fh_shard_path(char *dst, unsigned shard, unsigned long gen, bool lz)
+{
+        if (fh_config.dir[0] == '\0')
+                snprintf(dst, FILENAME_MAX, "%s", lz ? EXPORT_LZ_FILE : EXPORT_FILE);
+        else
+                snprintf(dst, FILENAME_MAX, "%s/shard-%03u-%lu.%s", fh_config.dir, shard, gen, lz ? "lz" : "txt");
+}
+
+/**
+ * @brief Selects the shard of a client.
+ * @param name The client's name.
+ * @return The shard's number, less than \c fh_config.shards .
+ */
+unsigned fh_shard_of(const char *name)
+{
+        /* 32 bit FNV-1a */
+        unsigned long hash = 2166136261UL;
+        for (const unsigned char *c = (const unsigned char *)name; *c; c++)
+                hash = ((hash ^ *c) * 16777619UL) & 0xffffffffUL;
+
+        return (unsigned)(hash % fh_config.shards);
+}
+
+/**
+ * @brief Reads a line of arbitrary length.
+ * @param src The source file.
+ * @param len Pointer to the destination of the line's length, without the line break.
+ * @return The line on the heap, \c NULL at the end of the file or if it cannot be allocated.
+ */
+char *fh_read_line(FILE *src, size_t *len)
+{
+        size_t cap = DEFAULT_BUF_SIZE;
+        char *line = malloc(cap);
+        int c = 0;
+        *len = 0;
+
+        while (line && (c = getc(src)) != EOF && c != '\n') {
+                if (*len + 1 == cap) {
+                        char *tmp = realloc(line, cap * 2);
+                        if (!tmp) {
+                                free(line);
+                                return NULL;
+                        }
+                        line = tmp;
+                        cap *= 2;
+                }
+                line[(*len)++] = (char)c;
+        }
+
+        if (line && c == EOF && *len == 0) {
+                free(line);
+                return NULL;
+        }
+
+        if (line)
+                line[*len] = '\0';
+
+        return line;
+}
+
+/**
+ * @brief Reads a whole file into memory.
+ * @param path The file to be read.
+ * @param len Pointer to the destination of the file's size.
+ * @return The file's contents followed by a \c \0 , or \c NULL if it cannot be read.
+ */
+void *fh_read_file(const char *path, size_t *len)
+{
+        FILE *src = fopen(path, "rb");
+        if (!src)
+                return NULL;
+
+        char *data = NULL;
+        long size = -1;
+        if (!fseek(src, 0, SEEK_END) && (size = ftell(src)) >= 0 && !fseek(src, 0, SEEK_SET))
+                data = malloc((size_t)size + 1);
+
+        if (data && fread(data, 1, (size_t)size, src) != (size_t)size) {
+                free(data);
+                data = NULL;
+        }
+
+        if (data)
+                data[size] = '\0';
+
+        fclose(src);
+        *len = (size_t)size;
+        return data;
+}
+
+/**
+ * @brief Reads \c manifest.txt into \c fh_config .
+ * @param order Pointer to the destination of the client order: the shard number of every client, in order.
+ * @param cnt Pointer to the destination of the number of clients.
+ * @retval 0 On success. The caller must free \c *order .
+ * @retval EFPERM If there is no manifest (a new database).
+ * @retval EINV If the manifest is malformed.
+ * @retval EMALLOC If the client order cannot be allocated.
+ */
+int fh_manifest_read(char **order, size_t *cnt)
+{
+        char path[FILENAME_MAX];
+        fh_path(path, MANIFEST_FILE);
+
+        FILE *src = fopen(path, "r");
+        if (!src)
+                return EFPERM;
+
+        unsigned long shards = 0;
+        unsigned long gen = 0;
+        *order = NULL;
+        *cnt = 0;
+
+        int retval = 0;
+        size_t len = 0;
+        char *line = NULL;
+        while (!retval && (line = fh_read_line(src, &len)) != NULL) {
+                if (len < 2 || line[1] != '>') {
+                        retval = EINV;
+                }
+                else if (line[0] == 'S') {
+                        shards = strtoul(line + 2, NULL, 10);
+                }
+                else if (line[0] == 'G') {
+                        gen = strtoul(line + 2, NULL, 10);
+                }
+                else if (line[0] == 'O' && !*order) {
+                        /* Convert the digits to shard numbers in place. */
+                        for (size_t i = 2; i < len && !retval; i++) {
+                                const char *digit = memchr(shard_digits, line[i], FH_MAX_SHARDS);
+                                if (!digit || (unsigned long)(digit - shard_digits) >= shards)
+                                        retval = EINV;
+                                else
+                                        line[i - 2] = (char)(digit - shard_digits);
+                        }
+
+                        *order = line;
+                        *cnt = len - 2;
+                        continue;
+                }
+
+                free(line);
+        }
+
+        if (ferror(src) || shards == 0 || shards > FH_MAX_SHARDS || !*order)
+                retval = retval ? retval : EINV;
+
+        fclose(src);
+
+        if (retval) {
+                free(*order);
+                *order = NULL;
+                return retval;
+        }
+
+        fh_config.disk_shards = (unsigned)shards;
+        fh_config.disk_gen = gen;
+        return 0;
+}
+
+/**
+ * @brief Writes the manifest of a new snapshot, then replaces \c manifest.txt with it.
+ * @param db Pointer to the exported database.
+ * @param shard_of The shard number of every client in the new snapshot.
+ * @retval 0 On success.
+ * @retval EFPERM If the manifest cannot be written or renamed.
+ */
+int fh_manifest_write(const database *db, const unsigned *shard_of)
+{
+        char path[FILENAME_MAX];
+        char tmp[FILENAME_MAX];
+        fh_path(path, MANIFEST_FILE);
+        fh_path(tmp, MANIFEST_FILE ".tmp");
+
+        FILE *dst = fopen(tmp, "w");
+        if (!dst)
+                return EFPERM;
+
+        fprintf(dst, "S>%u\nG>%lu\nO>", fh_config.shards, db->gen);
+        for (idx i = 0; i < db->cl->size; i++)
+                putc(shard_digits[shard_of[i]], dst);
+        putc('\n', dst);
+
+        int retval = ferror(dst) || fh_sync(dst) ? EFPERM : 0;
+        if (fclose(dst))
+                retval = EFPERM;
+
+#ifdef _WIN32
+        /* rename() doesn't overwrite existing files on Windows. */
+        if (!retval)
+                remove(path);
+#endif
+        if (retval || rename(tmp, path)) {
+                remove(tmp);
+                return EFPERM;
+        }
+
+        return fh_sync_dir(path);
+}
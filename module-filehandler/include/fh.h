@@ -6,8 +6,12 @@
 #ifndef REPAIRSHOP_FH_EXPORT_H
 #define REPAIRSHOP_FH_EXPORT_H
 
+#include <stdint.h>
+
 #include "../../module-database/include/database.h"
+#include "../../module-database/include/tx.h"
 #include "../../include/errorcodes.h"
+#include "../../module-pool/include/pool.h"
 #include "../../module-interface/include/intf_io.h"
 
 /** Format requirement: 1 ID char + 1 \c > char + 3 \c | chars + 1 \c \0 at end */
@@ -15,7 +19,148 @@
 /** A constant for the \c read_buffer maximum. */
 #define LONGEST_VALID_LINE (NAME_SIZE + EMAIL_SIZE + PHNUM_SIZE + FORMAT_RQ)
 
+/** The snapshot's file name, if the database isn't sharded. */
+#define EXPORT_FILE "export.txt"
+/** The compressed backup of the snapshot. See \c fh_lz.c . */
+#define EXPORT_LZ_FILE "export.lz"
+/** The manifest of a sharded database directory. See \c fh_shard.c . */
+#define MANIFEST_FILE "manifest.txt"
+/** The shard count and the generation of the compressed backup in a database directory. See \c fh_lz.c . */
+#define BACKUP_FILE "backup.txt"
+/** The maximum number of shards. A shard is identified by a single character in the manifest. */
+#define FH_MAX_SHARDS 62
+/** A constant for the journal's \c read_buffer maximum. Records carry up to 3 database indexes. */
+#define LONGEST_JOURNAL_LINE (LONGEST_VALID_LINE + 3 * DEFAULT_BUF_SIZE)
+/** The journal's file name. */
+#define JOURNAL_FILE "journal.txt"
+
+/** Size of the export buffer. The snapshot is written in chunks of this size. */
+#define EXPORT_BUF_SIZE (1 << 16)
+
+/**
+ * @struct fh_buf fh.h
+ * @brief An output buffer for the export. The records are formatted into it by hand and written out in large chunks.
+ */
+typedef struct fh_buf {
+        char data[EXPORT_BUF_SIZE];     /**< The buffered bytes. */
+        size_t len;                     /**< Number of buffered bytes. */
+        long pos;                       /**< Number of bytes written to the buffer since it was opened. */
+        FILE *target;                   /**< The destination file. */
+        bool err;                       /**< Set if a write to \c target has failed. */
+        uint32_t crc;                   /**< The checksum of the current block up to \c data + \c mark . */
+        size_t mark;                    /**< The buffered bytes from here on are not in \c crc yet. */
+} fh_buf;
+
+/**
+ * @struct fh_cfg fh.h
+ * @brief The storage layout of the database. See \c fh_shard.c .
+ */
+typedef struct fh_cfg {
+        char dir[FILENAME_MAX / 2];     /**< The database directory, empty if the snapshot is a single \c export.txt . */
+        unsigned shards;                /**< Number of shards written by the next export. */
+        unsigned disk_shards;           /**< Number of shards of the snapshot on the disk, \c 0 if there is none. */
+        unsigned long disk_gen;         /**< Generation of the snapshot on the disk, the shard file names contain it. */
+        bool sealed;                    /**< Set if the snapshot on the disk has checksums, see \c fh_crc.c . */
+} fh_cfg;
+
+extern fh_cfg fh_config;
+
+/** The length of a block's checksum line, \c C>xxxxxxxx and a line break. See \c fh_crc.c . */
+#define FH_CRC_LINE 11
+/** Number of damaged blocks whose location is kept by the import. */
+#define FH_DAMAGE_LOG 10
+
+/**
+ * @struct fh_damage fh.h
+ * @brief A damaged block of a snapshot file.
+ */
+typedef struct fh_damage {
+        unsigned shard;         /**< The shard of the file. */
+        size_t line;            /**< The line number of the block's first line. */
+        size_t off;             /**< The offset of the block in the file. */
+        size_t len;             /**< The length of the block, including its checksum line. */
+        size_t first;           /**< The number of clients in the file before the block. */
+        size_t clients;         /**< The number of clients in the block. */
+} fh_damage;
+
+/**
+ * @struct fh_integrity fh.h
+ * @brief The result of the integrity checks of the last import. See \c fh_crc.c .
+ */
+typedef struct fh_integrity {
+        size_t blocks;                  /**< Number of verified blocks. */
+        size_t damaged;                 /**< Number of damaged blocks. */
+        size_t lost;                    /**< Number of clients in the damaged blocks, they are not loaded. */
+        size_t unchecked;               /**< Number of files without checksums, written by an older version. */
+        fh_damage log[FH_DAMAGE_LOG];   /**< The first damaged blocks. */
+} fh_integrity;
+
+extern fh_integrity fh_check;
+
+/** Number of rejected rows whose line number is kept by the CSV ingest. */
+#define FH_CSV_REJECT_LOG 10
+
+/**
+ * @struct fh_csv_stats fh.h
+ * @brief The result of a CSV ingest. See \c fh_csv.c .
+ */
+typedef struct fh_csv_stats {
+        size_t rows;                            /**< Number of rows read, without the header and the empty lines. */
+        size_t rejected;                        /**< Number of invalid rows, and rows of clients taking a unique key. */
+        size_t reject_lines[FH_CSV_REJECT_LOG]; /**< The line numbers of the first rejected rows. */
+        size_t clients;                         /**< Number of new clients. */
+        size_t cars;                            /**< Number of new cars. */
+        size_t ops;                             /**< Number of new operations. */
+        double secs;                            /**< The duration of the ingest in seconds. */
+} fh_csv_stats;
+
+int fh_setup(const char *dir, unsigned shards);
+void fh_path(char *dst, const char *name);
+void fh_shard_path(char *dst, unsigned shard, unsigned long gen, bool lz);
+unsigned fh_shard_of(const char *name);
+void *fh_read_file(const char *path, size_t *len);
+int fh_manifest_read(char **order, size_t *cnt);
+int fh_manifest_write(const database *db, const unsigned *shard_of);
+
+int fh_buffer_filler(char *str, char **buf, size_t *buf_size, size_t buf_cnt);
+int fh_parse_price(const char *str, double *dst);
+int fh_db_car_add(const database *db, idx cl, const char *name, const char *plate);
+int fh_db_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+                 const char *date_exp);
+int fh_op_new(const char *desc, double price, const char *date_cr, const char *date_exp, operation **dst);
+
+uint32_t fh_crc32c(uint32_t crc, const void *data, size_t n);
+void fh_crc_line(char *dst, uint32_t crc);
+int fh_crc_check(const char *blk, size_t len);
+int fh_verify(const char *data, size_t len, unsigned shard, fh_damage **bad, size_t *cnt);
+
 int fh_import(database *dst);
+int fh_import_lazy(database *dst);
+int fh_cl_load(const database *db, idx cl);
+int fh_sync(FILE *target);
+int fh_sync_dir(const char *path);
 int fh_export(database *db);
 
+int fh_csv_ingest(database *db, const char *path, const char *mapping, fh_csv_stats *stats);
+
+int fh_lz_pack(const char *src_path, const char *dst_path, size_t *raw, size_t *packed);
+int fh_lz_unpack(const char *src_path, const char *dst_path);
+int fh_lz_restore(database *db);
+int fh_lz_rotate(void);
+int fh_lz_backup(size_t *raw, size_t *packed);
+
+int fh_jrnl_parse(char *str, char f[6][DESC_SIZE + 1], idx i[3]);
+int fh_jrnl_apply(database *db, char *str);
+int fh_jrnl_stage(db_tx *tx, char *str);
+int fh_jrnl_op_add(const database *db, idx cl, idx cr, const char *desc, double price, const char *date_cr,
+                   const char *date_exp);
+int fh_jrnl_exec(database *db, const char *record);
+int fh_jrnl_replay(database *db);
+int fh_jrnl_open(database *db);
+int fh_jrnl_checkpoint(database *db);
+int fh_jrnl_compact(database *db, unsigned long gen);
+
+void fh_autosave_start(database *db, unsigned interval, unsigned threshold);
+int fh_autosave_stop(database *db);
+
 #endif //REPAIRSHOP_FH_EXPORT_H
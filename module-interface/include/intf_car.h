@@ -9,7 +9,7 @@
 #include "../../module-database/include/database.h"
 #include "intf_io.h"
 
-void intf_car_txt(const database *db, idx cl);
+void intf_car_txt(const database *db, idx cl, idx *top);
 int intf_car(const database *db, idx cl);
 
 int intf_car_add_mod(const database *db, idx cl, bool mod, idx car);
@@ -10,11 +10,13 @@
 
 #include "../../include/errorcodes.h"
 #include "../../module-database/include/database.h"
+#include "../../module-database/include/tx.h"
 #include "intf_io.h"
 #include "intf_car.h"
 
-void intf_cl_txt(const database *db);
+void intf_cl_txt(const database *db, idx *top);
 int intf_cl(const database *db);
 int intf_cl_add_mod(const database *db, bool mod, idx cl);
+int intf_cl_add(const database *db);
 
 #endif //REPAIRSHOP_INTF_CLIENT_H
@@ -0,0 +1,40 @@
+/**
+ * @file intf_frame.h
+ * @brief Header for the menus' frame rendering.
+ * @details See \c intf_frame.c .
+ */
+
+#ifndef REPAIRSHOP_INTF_FRAME_H
+#define REPAIRSHOP_INTF_FRAME_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+/** The rows of a list in a frame, if the output is not a terminal. */
+#define INTF_PAGE_ROWS 20
+/** The fewest rows of a list, even on a small terminal. */
+#define INTF_MIN_PAGE 3
+/** The rows kept free below a frame for the prompts of a menu option, so the frame doesn't scroll away. */
+#define INTF_SPARE_ROWS 8
+/** The longest pending message, see \c intf_frame_msg() . */
+#define INTF_MSG_SIZE 512
+
+/** \c intf_io_opt() result of \c + , the list's next page. */
+#define INTF_OPT_NEXT (-2)
+/** \c intf_io_opt() result of \c - , the list's previous page. */
+#define INTF_OPT_PREV (-3)
+
+void intf_frame_begin(void);
+void intf_frame_printf(const char *fmt, ...);
+void intf_frame_puts(const char *str);
+size_t intf_frame_list(size_t *top, size_t cnt, size_t item_rows, size_t after);
+void intf_frame_footer(size_t top, size_t shown, size_t cnt);
+void intf_frame_end(void);
+
+bool intf_frame_screen(void);
+bool intf_frame_scroll(size_t *top, int opt);
+void intf_frame_msg(const char *fmt, ...);
+void intf_frame_input(void);
+
+#endif //REPAIRSHOP_INTF_FRAME_H
@@ -10,13 +10,22 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "intf_frame.h"
+#include "../../module-probe/include/probe.h"
+
 /**
  * A general buffer size, must not be lower than 32 to avoid breaking
  * functionality.
  */
 #define DEFAULT_BUF_SIZE 32
 
+extern void (*intf_io_refresh)(void);
+
 void intf_io_fgets(char *buffer, size_t size);
 int intf_io_opt(void);
+void intf_io_sync(void);
+
+bool intf_io_raw(bool on);
+int intf_io_key(void);
 
 #endif //REPAIRSHOP_INTF_IO_H
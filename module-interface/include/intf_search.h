@@ -6,6 +6,8 @@
 #ifndef REPAIRSHOP_INTF_SEARCH_H
 #define REPAIRSHOP_INTF_SEARCH_H
 
+#include <ctype.h>
+
 #include "../../module-database/include/database.h"
 #include "../../include/search.h"
 #include "intf_io.h"
@@ -17,5 +19,9 @@ int intf_search(database *db);
 sres intf_search_cl(database *db);
 sres intf_search_plate(database *db);
 sres intf_search_exp(database *db);
+sres intf_search_suggest(database *db, bool plates);
+
+/** The number of suggestions shown by the type-ahead search. */
+#define INTF_SUGGEST_ROWS 10
 
 #endif //REPAIRSHOP_INTF_SEARCH_H
@@ -3,24 +3,29 @@
  * @brief Mainloop UI code.
  */
 
+#include "../include/platform.h"
+
 #include "include/intf.h"
 
 void intf_db_namechange(database *db);
+void intf_probe(void);
 
 /**
  * @brief Prints the main menu's text to \c stdout .
  */
 void intf_main_txt(database *db)
 {
-        puts("--------------------- repairshop ---------------------");
-        printf("Adatbazis: %s | %s\n", db->name, db->desc);
-        puts("------------------------------------------------------");
-        puts("[0] Kilepes");
-        puts("[1] Ugyfelek kezelese");
-        puts("[2] Kereses");
-        puts("[3] Adatbazis nevenek, leirasanak modositasa");
-        puts("------------------------------------------------------");
-        printf("Opcio: ");
+        intf_frame_begin();
+        intf_frame_puts("--------------------- repairshop ---------------------");
+        intf_frame_printf("Adatbazis: %s | %s\n", db->name, db->desc);
+        intf_frame_puts("------------------------------------------------------");
+        intf_frame_puts("[0] Kilepes");
+        intf_frame_puts("[1] Ugyfelek kezelese");
+        intf_frame_puts("[2] Kereses");
+        intf_frame_puts("[3] Adatbazis nevenek, leirasanak modositasa");
+        intf_frame_puts("------------------------------------------------------");
+        intf_frame_printf("Opcio: ");
+        intf_frame_end();
 }
 
 /**
@@ -31,8 +36,13 @@ void intf_main_txt(database *db)
  */
 int intf_main(database *db)
 {
+        /* The client list is shown in the order of the names. */
+        if (db_order(db))
+                return EMALLOC;
+
         bool menu_active = true;
         while (menu_active) {
+                intf_io_sync();
                 intf_main_txt(db);
                 int s = intf_io_opt();
                 int retval = 0;
@@ -50,9 +60,13 @@ int intf_main(database *db)
                         case 3:
                                 intf_db_namechange(db);
                                 break;
+                        case 9:
+                                /* Hidden: the latency report of the database, see probe.c . */
+                                intf_probe();
+                                break;
 
                         default:
-                                puts("Nincs ilyen opcio.");
+                                intf_frame_msg("Nincs ilyen opcio.");
                                 break;
                 }
 
@@ -78,6 +92,46 @@ void intf_db_namechange(database *db)
         printf("Adatbazis leirasa (max %d karakter, formatum: nincs): ", DESC_SIZE);
         intf_io_fgets(desc, DESC_SIZE + 1);
 
-        strcpy(db->name, name);
-        strcpy(db->desc, desc);
-}
\ No newline at end of file
+        db_mod(db, name, desc);
+}
+/**
+ * @brief Shows the latency report of the timed functions and the memory report until the user presses Enter. The
+ *        hidden option \c 9 of the main menu.
+ */
+void intf_probe(void)
+{
+        char row[PROBE_ROW_SIZE];
+        bool any = false;
+
+        intf_frame_begin();
+        intf_frame_puts("------------------------ idomeres ------------------------");
+        intf_frame_puts(PROBE_HEADER);
+        for (int id = 0; id < PROBE_CNT; id++) {
+                if (probe_row(id, row, sizeof(row))) {
+                        intf_frame_puts(row);
+                        any = true;
+                }
+        }
+
+        if (!any)
+                intf_frame_puts("Nincs meres (kikapcsolva, vagy meg nem futott ilyen muvelet).");
+
+        if (probe_mem_total(row, sizeof(row))) {
+                intf_frame_puts("------------------------ memoria -------------------------");
+                intf_frame_puts(PROBE_MEM_HEADER);
+                for (int kind = 0; kind < PROBE_MEM_CNT; kind++) {
+                        probe_mem_row(kind, row, sizeof(row));
+                        intf_frame_puts(row);
+                }
+
+                probe_mem_total(row, sizeof(row));
+                intf_frame_puts(row);
+        }
+
+        intf_frame_puts("----------------------------------------------------------");
+        intf_frame_printf("Enter: vissza ");
+        intf_frame_end();
+
+        char buf[DEFAULT_BUF_SIZE + 1];
+        intf_io_fgets(buf, sizeof(buf));
+}
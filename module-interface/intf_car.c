@@ -3,57 +3,82 @@
  * @brief The car/operation management menu's UI code.
  */
 
+#include "../include/platform.h"
+
 #include "include/intf_car.h"
 
 /**
  * @brief Prints the car/operation management menu's text to \c stdout .
+ * @param db The database pointer.
+ * @param cl The client's index.
+ * @param top Pointer to the first row of the list's page. The list has a row for every car and operation.
  */
-void intf_car_txt(const database *db, idx cl)
+void intf_car_txt(const database *db, idx cl, idx *top)
 {
         client *cl_ = db_cl_get(db, cl);
 
-        puts("\n------------------ Autok kezelese -------------------");
-        puts("[0] Vissza");
-        puts("[1] Auto hozzadasa");
-        puts("[2] Auto adatainak modositasa");
-        puts("[3] Auto eltavolitasa");
-        puts("[4] Javitas/vizsga hozzadasa");
-        puts("[5] Javitas/vizsga adatainak modositasa");
-        puts("[6] Javitas/vizsga eltavolitasa");
-        puts("------------------------------------------------------");
-        printf("[%s][%s][%s]\n", cl_->name, cl_->email, cl_->phone);
-        puts("------------------------------------------------------");
+        intf_frame_begin();
+        intf_frame_puts("\n------------------ Autok kezelese -------------------");
+        intf_frame_puts("[0] Vissza");
+        intf_frame_puts("[1] Auto hozzadasa");
+        intf_frame_puts("[2] Auto adatainak modositasa");
+        intf_frame_puts("[3] Auto eltavolitasa");
+        intf_frame_puts("[4] Javitas/vizsga hozzadasa");
+        intf_frame_puts("[5] Javitas/vizsga adatainak modositasa");
+        intf_frame_puts("[6] Javitas/vizsga eltavolitasa");
+        intf_frame_puts("------------------------------------------------------");
+        intf_frame_printf("[%s][%s][%s]\n", cl_->name, cl_->email, cl_->phone);
+        intf_frame_puts("------------------------------------------------------");
 
         if (cl_->cars->size == 0) {
-                puts("Ennek az ugyfelnek nincsenek hozzadott autoi.");
+                intf_frame_puts("Ennek az ugyfelnek nincsenek hozzadott autoi.");
                 goto txt_end;
         }
 
-        for (idx i = 0; i < cl_->cars->size; i++) {
+        size_t cnt = cl_->cars->size;
+        for (idx i = 0; i < cl_->cars->size; i++)
+                cnt += db_car_get(db, cl, i)->operations->size;
+
+        size_t shown = intf_frame_list(top, cnt, 1, 2);
+        size_t row = 0;
+
+        /* The cars before the page are skipped with all of their operations. */
+        for (idx i = 0; i < cl_->cars->size && row < *top + shown; i++) {
                 car *car = db_car_get(db, cl, i);
-                printf("[%zu][%s][%s]\n", i, car->name, car->plate);
+                if (row + 1 + car->operations->size <= *top) {
+                        row += 1 + car->operations->size;
+                        continue;
+                }
+
+                if (row++ >= *top)
+                        intf_frame_printf("[%zu][%s][%s]\n", i, car->name, car->plate);
+
+                for (idx j = 0; j < car->operations->size && row < *top + shown; j++) {
+                        if (row++ < *top)
+                                continue;
 
-                for (idx j = 0; j < car->operations->size; j++) {
                         operation *op = db_op_get(db, cl, i, j);
                         char date_str[17];
                         date_printf(&op->date_cr, date_str);
 
-                        printf("\t\t[%zu][%s][%.2f][%s]", j, op->desc, op->price, date_str);
+                        intf_frame_printf("\t\t[%zu][%s][%.2f][%s]", j, op->desc, op->price, date_str);
 
                         if (op->date_exp.y != 0) {
                                 char date_str2[17];
                                 date_printf(&op->date_exp, date_str2);
-                                printf("->[%s]", date_str2);
+                                intf_frame_printf("->[%s]", date_str2);
                         }
 
-                        puts("");
+                        intf_frame_puts("");
                 }
         }
 
-        txt_end:
-                puts("------------------------------------------------------");
-                printf("Opcio: ");
+        intf_frame_footer(*top, shown, cnt);
 
+        txt_end:
+                intf_frame_puts("------------------------------------------------------");
+                intf_frame_printf("Opcio: ");
+                intf_frame_end();
 }
 
 /**
@@ -69,13 +94,27 @@ int intf_car(const database *db, idx cl)
         if (!db_cl_get(db, cl))
                 return EOOB;
 
+        /* The menu lists every car and operation of the client. */
+        int load_err = db_cl_load(db, cl);
+        if (load_err)
+                return load_err == EMALLOC ? EMALLOC : EOOB;
+
         bool menu_active = true;
+        idx top = 0;
         while (menu_active) {
-                intf_car_txt(db, cl);
+                /* The client may have been removed by another terminal. */
+                intf_io_sync();
+                if (!db_cl_get(db, cl))
+                        return EOOB;
+
+                intf_car_txt(db, cl, &top);
                 int s = intf_io_opt();
                 int s2 = 0;
                 int retval = 0;
 
+                if (intf_frame_scroll(&top, s))
+                        continue;
+
                 switch (s) {
                         case 0:
                                 menu_active = false;
@@ -121,7 +160,7 @@ int intf_car(const database *db, idx cl)
                                 retval = db_op_rm(db, cl, s, s2);
                                 break;
                         default:
-                                puts("\nErvenytelen opcio.\n");
+                                intf_frame_msg("Ervenytelen opcio.");
                                 break;
                 }
 
@@ -129,7 +168,9 @@ int intf_car(const database *db, idx cl)
                         return EMALLOC;
 
                 if (retval == EOOB)
-                        puts("\nAz auto/javitas nem talalhato.");
+                        intf_frame_msg("Az auto/javitas nem talalhato.");
+                else if (retval == EINV)
+                        intf_frame_msg("Hibas ar vagy datum.");
         }
         return 0;
 }
@@ -179,6 +220,7 @@ int intf_op_add_mod(const database *db, idx cl, idx car, bool mod, idx op)
         char desc_buffer[DESC_SIZE + 1] = "\0";
         char price_buffer[DEFAULT_BUF_SIZE + 1] = "\0";
         char date_buffer[DEFAULT_BUF_SIZE + 1] = "\0";
+        char *end = NULL;
         double price = 0;
 
         printf("Javitas/vizsga leirasa (max. %d karakter, formatum: nincs): ", DESC_SIZE);
@@ -186,20 +228,17 @@ int intf_op_add_mod(const database *db, idx cl, idx car, bool mod, idx op)
 
         printf("Javitas/vizsga (forintban, formatum: csak szam): ");
         intf_io_fgets(price_buffer, DEFAULT_BUF_SIZE + 1);
-        price = strtod(price_buffer, NULL);
+        price = strtod(price_buffer, &end);
+        if (end == price_buffer || *end != '\0')
+                return EINV;
 
-        printf("Vizsga eseten ervenyesseg lejarta (formatum: EEEE-HH-NN OO-PP): ");
+        printf("Vizsga eseten ervenyesseg lejarta (formatum: EEEE-HH-NN OO:PP, ures, ha nincs): ");
         intf_io_fgets(date_buffer, DEFAULT_BUF_SIZE + 1);
 
-        if (mod) {
-                if (date_buffer[0] == '\n')
-                        return db_op_mod(db, cl, car, op, desc_buffer, price, NULL);
-
-                return db_op_mod(db, cl, car, op, desc_buffer, price, date_buffer);
-        }
-
-        if (date_buffer[0] == '\n')
-                return db_op_add(db, cl, car, desc_buffer, price, NULL);
+        /* The price and the date are checked by the database, see db_op_check(). */
+        const char *date_exp = date_buffer[0] != '\0' ? date_buffer : NULL;
+        if (mod)
+                return db_op_mod(db, cl, car, op, desc_buffer, price, date_exp);
 
-        return db_op_add(db, cl, car, desc_buffer, price, date_buffer);
+        return db_op_add(db, cl, car, desc_buffer, price, date_exp);
 }
\ No newline at end of file
@@ -2,34 +2,57 @@
  * @file intf_client.c
  * @brief The client management menu's UI code.
  */
+#include "../include/platform.h"
+
 #include "include/intf_client.h"
 
 /**
  * @brief Prints the client management menu's text to \c stdout .
+ * @param db The database pointer.
+ * @param top Pointer to the first client of the list's page, see \c intf_frame_list() .
  */
-void intf_cl_txt(const database *db)
+void intf_cl_txt(const database *db, idx *top)
 {
-        puts("------------------ Ugyfelek kezelese -----------------");
-        puts("[0] Vissza");
-        puts("[1] Ugyfel hozzadasa");
-        puts("[2] Ugyfel adatainak modositasa");
-        puts("[3] Ugyfel eltavolitasa");
-        puts("[4] Ugyfel autoinak es szerviztortenetenek lekerdezese");
-        puts("------------------------------------------------------");
-
-        if (db->cl->size == 0) {
-                puts("Nincsenek hozzaadott ugyfelek.\n");
+        intf_frame_begin();
+        intf_frame_puts("------------------ Ugyfelek kezelese -----------------");
+        intf_frame_puts("[0] Vissza");
+        intf_frame_puts("[1] Ugyfel hozzadasa");
+        intf_frame_puts("[2] Ugyfel adatainak modositasa");
+        intf_frame_puts("[3] Ugyfel eltavolitasa");
+        intf_frame_puts("[4] Ugyfel autoinak es szerviztortenetenek lekerdezese");
+        intf_frame_puts("[5] Ugyfel hozzadasa az elso autojaval es javitasaval");
+        intf_frame_puts("------------------------------------------------------");
+
+        size_t cnt = db_cl_cnt(db);
+        if (cnt == 0) {
+                intf_frame_puts("Nincsenek hozzaadott ugyfelek.\n");
         }
         else {
-                for (idx i = 0; i < db->cl->size; i++) {
-                        client *cl = db_cl_get(db, i);
-                        printf("[%zu][%s][%s][%s][auto(k): %zu]\n", i,
-                                cl->name, cl->email, cl->phone, cl->cars->size);
+                /* Only the clients of the visible page are formatted, in the order of their names (see db_order()). */
+                size_t shown = intf_frame_list(top, cnt, 1, 3);
+                idx page[INTF_PAGE_ROWS];
+                for (idx rank = *top; rank < *top + shown; ) {
+                        size_t n = *top + shown - rank < INTF_PAGE_ROWS ? *top + shown - rank : INTF_PAGE_ROWS;
+                        size_t got = db_cl_ordered(db, rank, page, n);
+                        for (size_t k = 0; k < got; k++) {
+                                client *cl = db_cl_get(db, page[k]);
+                                if (cl)
+                                        intf_frame_printf("[%zu][%s][%s][%s][auto(k): %zu]\n", page[k],
+                                                          cl->name, cl->email, cl->phone, db_car_cnt(db, page[k]));
+                        }
+
+                        if (got < n)
+                                break;
+
+                        rank += got;
                 }
+
+                intf_frame_footer(*top, shown, cnt);
         }
 
-        puts("------------------------------------------------------");
-        printf("\nOpcio: ");
+        intf_frame_puts("------------------------------------------------------");
+        intf_frame_printf("\nOpcio: ");
+        intf_frame_end();
 }
 
 /**
@@ -41,11 +64,16 @@ void intf_cl_txt(const database *db)
 int intf_cl(const database *db)
 {
         bool submenu_active = true;
+        idx top = 0;
         while (submenu_active) {
-                intf_cl_txt(db);
+                intf_io_sync();
+                intf_cl_txt(db, &top);
                 int s = intf_io_opt();
                 int retval = 0;
 
+                if (intf_frame_scroll(&top, s))
+                        continue;
+
                 switch (s) {
                         case 0:
                                 submenu_active = false;
@@ -72,8 +100,11 @@ int intf_cl(const database *db)
 
                                 retval = intf_car(db, s);
                                 break;
+                        case 5:
+                                retval = intf_cl_add(db);
+                                break;
                         default:
-                                puts("\nErvenytelen opcio.");
+                                intf_frame_msg("Ervenytelen opcio.");
                                 break;
                 }
 
@@ -81,7 +112,15 @@ int intf_cl(const database *db)
                         return EMALLOC;
 
                 if (retval == EOOB)
-                        puts("\nAz ugyfel nem talalhato.");
+                        intf_frame_msg("Az ugyfel nem talalhato.");
+                else if (retval == EDUP)
+                        intf_frame_msg("Az email cim vagy a telefonszam mar egy masik ugyfele.");
+                else if (retval == EINV)
+                        intf_frame_msg("Hibas adatok, semmi nem lett mentve.");
+                else if (retval == ECONFL)
+                        intf_frame_msg("Az adatbazis kozben megvaltozott, semmi nem lett mentve.");
+                else if (retval)
+                        intf_frame_msg("A muvelet nem sikerult (hibakod: %d).", retval);
         }
         return 0;
 }
@@ -115,4 +154,74 @@ int intf_cl_add_mod(const database *db, bool mod, idx cl)
                 return db_cl_mod(db, cl, name, email, phone);
 
         return db_cl_add(db, name, email, phone);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief The frontend for client addition. The client's first car and the car's first operation can be given too.
+ * @details They are added by a single transaction (see \c tx.c ), so an invalid car or operation doesn't leave the
+ *          client in the database without them.
+ * @param db The destination database.
+ * @retval 0 On success.
+ * @retval EINV If a field is invalid, e.g. the price isn't a number. Nothing is added.
+ * @return For the other return values see \c db_tx_commit() .
+ */
+int intf_cl_add(const database *db)
+{
+        char name[NAME_SIZE + 1] = "\0";
+        char email[EMAIL_SIZE + 1] = "\0";
+        char phone[PHNUM_SIZE + 1] = "\0";
+
+        printf("Ugyfel neve (max. %d karakter): ", NAME_SIZE);
+        intf_io_fgets(name, NAME_SIZE + 1);
+
+        printf("Ugyfel email cime (max. %d karater): ", EMAIL_SIZE);
+        intf_io_fgets(email, EMAIL_SIZE + 1);
+
+        printf("Ugyfel telefonszama (max. %d karakter): ", PHNUM_SIZE);
+        intf_io_fgets(phone, PHNUM_SIZE + 1);
+
+        db_tx *tx = db_tx_begin(db);
+        if (!tx)
+                return EMALLOC;
+
+        /* A failed step is remembered by the transaction, the commit returns its error. */
+        idx cl = tx->base;
+        db_tx_cl_add(tx, name, email, phone);
+
+        char car_name[NAME_SIZE + 1] = "\0";
+        char plate[PLATE_SIZE + 1] = "\0";
+
+        printf("Elso auto tipusa (max. %d karakter, ures, ha nincs): ", NAME_SIZE);
+        intf_io_fgets(car_name, NAME_SIZE + 1);
+        if (car_name[0] == '\0')
+                return db_tx_commit(tx, NULL);
+
+        printf("Auto rendszama (max. %d karakter, formatum: ABCD123): ", PLATE_SIZE);
+        intf_io_fgets(plate, PLATE_SIZE + 1);
+        db_tx_car_add(tx, cl, car_name, plate);
+
+        char desc[DESC_SIZE + 1] = "\0";
+        char price_buffer[DEFAULT_BUF_SIZE + 1] = "\0";
+        char date_buffer[DEFAULT_BUF_SIZE + 1] = "\0";
+        char *end = NULL;
+
+        printf("Elso javitas/vizsga leirasa (max. %d karakter, ures, ha nincs): ", DESC_SIZE);
+        intf_io_fgets(desc, DESC_SIZE + 1);
+        if (desc[0] == '\0')
+                return db_tx_commit(tx, NULL);
+
+        printf("Javitas/vizsga (forintban, formatum: csak szam): ");
+        intf_io_fgets(price_buffer, DEFAULT_BUF_SIZE + 1);
+        double price = strtod(price_buffer, &end);
+        if (end == price_buffer || *end != '\0') {
+                db_tx_abort(tx);
+                return EINV;
+        }
+
+        printf("Vizsga eseten ervenyesseg lejarta (formatum: EEEE-HH-NN OO:PP, ures, ha nincs): ");
+        intf_io_fgets(date_buffer, DEFAULT_BUF_SIZE + 1);
+
+        /* The price and the date are checked by the transaction, see db_op_check(). */
+        db_tx_op_add(tx, cl, 0, desc, price, date_buffer[0] != '\0' ? date_buffer : NULL);
+        return db_tx_commit(tx, NULL);
+}
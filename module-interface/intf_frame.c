@@ -0,0 +1,414 @@
+/**
+ * @file intf_frame.c
+ * @brief Renders the menus' frames.
+ * @details A menu's text (a frame) is built in a buffer and written at once, instead of a \c write() per line. The
+ *          lists only show a page of their rows: \c intf_frame_list() chooses the page's size, \c + and \c - turn the
+ *          pages (see \c intf_frame_scroll() ).\n
+ *          If both \c stdin and \c stdout are terminals, the frames are drawn from the top of the screen, and only the
+ *          rows which differ from the previous frame are rewritten. The messages of the menus are shown in the next
+ *          frame (see \c intf_frame_msg() ), above the prompt. Otherwise the frames are printed one after the other,
+ *          like a plain text log, and the pages have \c INTF_PAGE_ROWS rows.
+ * @note The prompts of a menu option are printed below the frame. A list leaves \c INTF_SPARE_ROWS rows for them and
+ *       the messages. If the inputs don't fit on the screen anymore, it has scrolled, and the next frame is drawn in
+ *       full.
+ */
+
+#include "../include/platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "include/intf_frame.h"
+
+/**
+ * @struct intf_text intf_frame.c
+ * @brief A growable text buffer.
+ */
+typedef struct intf_text {
+        char *data;     /**< The text, \c NULL until the first append. Not terminated. */
+        size_t len;     /**< The length of the text. */
+        size_t cap;     /**< The allocated size. */
+        bool err;       /**< Set if an append has failed. */
+} intf_text;
+
+/** The state of the rendering. */
+static struct {
+        intf_text cur;          /**< The frame being built. */
+        intf_text shown;        /**< The rows on the screen, without the prompt. Only in screen mode. */
+        intf_text msg;          /**< The messages for the next frame. Only in screen mode. */
+        int mode;               /**< \c 0 : not decided yet, \c 1 : plain text, \c 2 : screen. */
+        bool valid;             /**< Set if the screen shows \c shown from its first row. */
+        size_t rows;            /**< The terminal's height. */
+        size_t cols;            /**< The terminal's width. */
+        size_t inputs;          /**< The number of inputs read since the last frame. */
+        size_t free;            /**< The rows below the last frame's prompt. */
+        size_t page;            /**< The page size of the last frame's list. */
+        size_t cnt;             /**< The number of items of the last frame's list. */
+} frame;
+
+/**
+ * @brief Makes space for more bytes in a text buffer.
+ * @param t Pointer to the buffer.
+ * @param n The number of bytes to be appended.
+ * @return \c true on success, \c false if the buffer cannot grow. \c t->err is set too.
+ */
+bool intf_text_reserve(intf_text *t, size_t n)
+{
+        if (t->len + n <= t->cap)
+                return true;
+
+        size_t new_cap = t->cap ? t->cap : 4096;
+        while (new_cap < t->len + n)
+                new_cap *= 2;
+
+        char *tmp = realloc(t->data, new_cap);
+        if (!tmp) {
+                t->err = true;
+                return false;
+        }
+
+        t->data = tmp;
+        t->cap = new_cap;
+        return true;
+}
+
+/**
+ * @brief Appends bytes to a text buffer.
+ * @param t Pointer to the buffer.
+ * @param src The bytes.
+ * @param n The number of bytes.
+ */
+void intf_text_put(intf_text *t, const char *src, size_t n)
+{
+        if (n == 0 || !intf_text_reserve(t, n))
+                return;
+
+        memcpy(t->data + t->len, src, n);
+        t->len += n;
+}
+
+/**
+ * @brief Appends formatted text to a text buffer.
+ * @param t Pointer to the buffer.
+ * @param fmt The format string.
+ * @param ap The arguments.
+ */
+void intf_text_vprintf(intf_text *t, const char *fmt, va_list ap)
+{
+        va_list copy;
+        va_copy(copy, ap);
+        int n = vsnprintf(NULL, 0, fmt, copy);
+        va_end(copy);
+
+        if (n < 0)
+                return;
+
+        /* One more byte for the terminating null, which is not part of the text. */
+        if (!intf_text_reserve(t, (size_t)n + 1))
+                return;
+
+        vsnprintf(t->data + t->len, (size_t)n + 1, fmt, ap);
+        t->len += (size_t)n;
+}
+
+/**
+ * @brief Counts the rows of a text.
+ * @param t Pointer to the text.
+ * @return The number of newlines.
+ */
+size_t intf_text_rows(const intf_text *t)
+{
+        size_t rows = 0;
+        for (size_t i = 0; i < t->len; i++)
+                rows += t->data[i] == '\n';
+
+        return rows;
+}
+
+/**
+ * @brief Appends a row to a text in the way the terminal shows it: the tabs are expanded, and the row is cut at the
+ *        terminal's width, so every row takes exactly one line of the screen.
+ * @param t Pointer to the text.
+ * @param row The row, without the newline.
+ * @param len The row's length.
+ */
+void intf_text_row(intf_text *t, const char *row, size_t len)
+{
+        static const char spaces[8] = "        ";
+        size_t width = frame.cols > 1 ? frame.cols - 1 : 1;
+        size_t col = 0;
+
+        for (size_t i = 0; i < len && col < width; i++) {
+                size_t n = row[i] == '\t' ? 8 - col % 8 : 1;
+                if (n > width - col)
+                        n = width - col;
+
+                intf_text_put(t, row[i] == '\t' ? spaces : &row[i], n);
+                col += n;
+        }
+}
+
+/**
+ * @brief Starts a new frame.
+ * @details Decides the rendering mode at the first frame, and reads the terminal's size.
+ */
+void intf_frame_begin(void)
+{
+        if (frame.mode == 0) {
+                frame.mode = 1;
+#ifndef _WIN32
+                const char *term = getenv("TERM");
+                if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && term && strcmp(term, "dumb") != 0)
+                        frame.mode = 2;
+#endif
+        }
+
+        size_t rows = 24;
+        size_t cols = 80;
+#if !defined(_WIN32) && defined(TIOCGWINSZ)
+        struct winsize ws;
+        if (frame.mode == 2 && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+                rows = ws.ws_row;
+                cols = ws.ws_col;
+        }
+#endif
+
+        /* The rows of a resized terminal are rewrapped. */
+        if (rows != frame.rows || cols != frame.cols)
+                frame.valid = false;
+
+        frame.rows = rows;
+        frame.cols = cols;
+        frame.cur.len = 0;
+        frame.cur.err = false;
+}
+
+/**
+ * @brief Appends formatted text to the frame, like \c printf() .
+ * @param fmt The format string.
+ */
+void intf_frame_printf(const char *fmt, ...)
+{
+        va_list ap;
+        va_start(ap, fmt);
+        intf_text_vprintf(&frame.cur, fmt, ap);
+        va_end(ap);
+}
+
+/**
+ * @brief Appends a row to the frame, like \c puts() .
+ * @param str The row, without the newline.
+ */
+void intf_frame_puts(const char *str)
+{
+        intf_text_put(&frame.cur, str, strlen(str));
+        intf_text_put(&frame.cur, "\n", 1);
+}
+
+/**
+ * @brief Chooses the page of a list, which fits into the frame. Call it where the list starts in the frame.
+ * @param top Pointer to the first item of the page. It's moved back if the list has become shorter.
+ * @param cnt The number of items in the list.
+ * @param item_rows The number of rows of an item.
+ * @param after The number of rows the frame has after the list (the footer excluded).
+ * @return The number of items on the page, starting with \c *top .
+ */
+size_t intf_frame_list(size_t *top, size_t cnt, size_t item_rows, size_t after)
+{
+        size_t avail = INTF_PAGE_ROWS;
+        if (frame.mode == 2) {
+                /* The messages are not counted, they take from the spare rows, so the page size stays the same. */
+                size_t used = intf_text_rows(&frame.cur) + after + 1 + INTF_SPARE_ROWS;
+                avail = frame.rows > used ? frame.rows - used : 0;
+        }
+
+        size_t items = avail / (item_rows ? item_rows : 1);
+        if (items < INTF_MIN_PAGE)
+                items = INTF_MIN_PAGE;
+
+        if (*top >= cnt)
+                *top = cnt ? (cnt - 1) / items * items : 0;
+
+        frame.page = items;
+        frame.cnt = cnt;
+        return cnt - *top < items ? cnt - *top : items;
+}
+
+/**
+ * @brief Appends the page's position to the frame, if the list has more than one page.
+ * @param top The first item of the page.
+ * @param shown The number of items on the page.
+ * @param cnt The number of items in the list.
+ */
+void intf_frame_footer(size_t top, size_t shown, size_t cnt)
+{
+        if (cnt > shown)
+                intf_frame_printf("(%zu-%zu. / %zu) [+] kovetkezo oldal, [-] elozo oldal\n", top + 1, top + shown,
+                                  cnt);
+}
+
+/**
+ * @brief Draws the frame on the screen, rewriting only the changed rows.
+ * @details The frame's last, unterminated row is the prompt. It's always rewritten, since it has the previous input
+ *          on the screen, and everything below it is cleared.
+ */
+void intf_frame_draw(void)
+{
+        intf_text rows = {0};
+        intf_text out = {0};
+
+        /* The rows as the terminal shows them, then the messages. */
+        const char *pos = frame.cur.data;
+        const char *end = frame.cur.data + frame.cur.len;
+        const char *nl;
+        while (pos && (nl = memchr(pos, '\n', (size_t)(end - pos)))) {
+                intf_text_row(&rows, pos, (size_t)(nl - pos));
+                intf_text_put(&rows, "\n", 1);
+                pos = nl + 1;
+        }
+
+        const char *msg = frame.msg.data;
+        const char *msg_end = frame.msg.data + frame.msg.len;
+        while (msg && (nl = memchr(msg, '\n', (size_t)(msg_end - msg)))) {
+                intf_text_row(&rows, msg, (size_t)(nl - msg));
+                intf_text_put(&rows, "\n", 1);
+                msg = nl + 1;
+        }
+
+        if (!frame.valid)
+                intf_text_put(&out, "\033[H\033[2J", 7);
+
+        /* The rows of the previous frame are compared one by one. */
+        const char *row = rows.data;
+        const char *old = frame.valid ? frame.shown.data : NULL;
+        const char *old_end = frame.shown.data + frame.shown.len;
+        size_t r = 0;
+        for (; row && row < rows.data + rows.len; r++) {
+                size_t len = (size_t)((char *)memchr(row, '\n', (size_t)(rows.data + rows.len - row)) - row);
+                size_t old_len = 0;
+                bool same = false;
+                if (old && old < old_end) {
+                        old_len = (size_t)((char *)memchr(old, '\n', (size_t)(old_end - old)) - old);
+                        same = old_len == len && !memcmp(old, row, len);
+                        old += old_len + 1;
+                }
+
+                if (!same) {
+                        char move[32];
+                        intf_text_put(&out, move, (size_t)snprintf(move, sizeof(move), "\033[%zu;1H", r + 1));
+                        intf_text_put(&out, row, len);
+                        intf_text_put(&out, "\033[K", 3);
+                }
+
+                row += len + 1;
+        }
+
+        char move[32];
+        intf_text_put(&out, move, (size_t)snprintf(move, sizeof(move), "\033[%zu;1H", r + 1));
+        intf_text_row(&out, pos, (size_t)(end - pos));
+        intf_text_put(&out, "\033[J", 3);
+
+        if (rows.err || out.err) {
+                /* Not enough memory for the comparison, the frame is printed as it is. */
+                fwrite(frame.cur.data, 1, frame.cur.len, stdout);
+                frame.valid = false;
+        }
+        else {
+                fwrite(out.data, 1, out.len, stdout);
+
+                /* A frame taller than the screen scrolls, so its rows are not where they were drawn. */
+                frame.valid = r + 1 <= frame.rows;
+                frame.free = frame.valid ? frame.rows - r - 1 : 0;
+        }
+
+        free(frame.shown.data);
+        frame.shown = rows;
+        free(out.data);
+}
+
+/**
+ * @brief Writes the frame and the pending messages to \c stdout at once.
+ */
+void intf_frame_end(void)
+{
+        if (frame.mode == 2 && !frame.cur.err)
+                intf_frame_draw();
+        else if (frame.cur.len)
+                fwrite(frame.cur.data, 1, frame.cur.len, stdout);
+
+        fflush(stdout);
+
+        frame.msg.len = 0;
+        frame.msg.err = false;
+        frame.inputs = 0;
+}
+
+/**
+ * @brief Tells whether the frames are drawn on the screen, i.e. the output is an interactive terminal.
+ * @return \c true in screen mode. Decided at the first frame.
+ */
+bool intf_frame_screen(void)
+{
+        return frame.mode == 2;
+}
+
+/**
+ * @brief Turns the page of the last frame's list, if the user has chosen to.
+ * @param top Pointer to the first item of the list's page.
+ * @param opt The option the user has entered, see \c INTF_OPT_NEXT and \c INTF_OPT_PREV .
+ * @return \c true if the option was a page turn.
+ */
+bool intf_frame_scroll(size_t *top, int opt)
+{
+        if (opt == INTF_OPT_NEXT) {
+                if (*top + frame.page < frame.cnt)
+                        *top += frame.page;
+
+                return true;
+        }
+
+        if (opt == INTF_OPT_PREV) {
+                *top = *top > frame.page ? *top - frame.page : 0;
+                return true;
+        }
+
+        return false;
+}
+
+/**
+ * @brief Shows a message to the user, e.g. the result of a menu option.
+ * @details In screen mode the message is shown in the next frame, above its prompt, otherwise it's printed right away.
+ * @param fmt The format string of the message, without the newline.
+ */
+void intf_frame_msg(const char *fmt, ...)
+{
+        char msg[INTF_MSG_SIZE];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+
+        if (frame.mode != 2) {
+                printf("\n%s\n", msg);
+                return;
+        }
+
+        intf_text_put(&frame.msg, msg, strlen(msg));
+        intf_text_put(&frame.msg, "\n", 1);
+}
+
+/**
+ * @brief Called before every input: shows the prompt, and counts the rows the input takes below the frame.
+ */
+void intf_frame_input(void)
+{
+        fflush(stdout);
+
+        /* Every input ends with a new row, the screen scrolls once they don't fit below the frame. */
+        if (++frame.inputs > frame.free)
+                frame.valid = false;
+}
@@ -2,7 +2,19 @@
  * @file intf_io.c
  * @brief Functions for user input management.
  */
+#include "../include/platform.h"
+
 #include "include/intf_io.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <termios.h>
+
+/** The terminal's settings before \c intf_io_raw() . */
+static struct termios intf_io_saved;
+#endif
+
+/** Called before a menu is drawn, \c NULL if unused. The thin client applies the changes of others here. */
+void (*intf_io_refresh)(void) = NULL;
 
 /**
  * @brief \c fgets() wrapper that clears stdin, if the input is too large.
@@ -13,6 +25,7 @@
 void intf_io_fgets(char *buffer, size_t size)
 {
         do {
+                intf_frame_input();
                 fgets(buffer, size, stdin);
 
                 if (strcspn(buffer, "\r\n") == size - 1) {
@@ -35,7 +48,8 @@ void intf_io_fgets(char *buffer, size_t size)
 
 /**
  * @brief Gets \c option from the user. Used in interface driver codes.
- * @return The option, that user have entered.
+ * @return The option, that user have entered. \c + and \c - turn the pages of a list, see \c INTF_OPT_NEXT and
+ *         \c INTF_OPT_PREV .
  */
 int intf_io_opt(void)
 {
@@ -43,7 +57,61 @@ int intf_io_opt(void)
         char input_buf[DEFAULT_BUF_SIZE + 1] = "\0";
 
         intf_io_fgets(input_buf, DEFAULT_BUF_SIZE + 1);
+
+        if (!strcmp(input_buf, "+"))
+                return INTF_OPT_NEXT;
+        if (!strcmp(input_buf, "-"))
+                return INTF_OPT_PREV;
+
         sscanf(input_buf, "%d", &opt);
 
         return opt;
 }
+
+/**
+ * @brief Brings the displayed data up to date, see \c intf_io_refresh . Called at the top of every menu loop.
+ * @note The latency report requested by \c SIGUSR1 is printed here, see \c probe_poll() .
+ */
+void intf_io_sync(void)
+{
+        probe_poll(stderr);
+        if (intf_io_refresh)
+                intf_io_refresh();
+}
+
+/**
+ * @brief Switches the terminal to reading the keys one by one, without echo, or restores it.
+ * @param on Set to \c true for raw input, \c false to restore the previous settings.
+ * @return \c true on success, \c false if \c stdin is not a terminal.
+ * @note The signal keys (e.g. Ctrl+C) keep working in raw mode.
+ */
+bool intf_io_raw(bool on)
+{
+#ifndef _WIN32
+        if (!on)
+                return tcsetattr(STDIN_FILENO, TCSAFLUSH, &intf_io_saved) == 0;
+
+        if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &intf_io_saved) != 0)
+                return false;
+
+        struct termios raw = intf_io_saved;
+        raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+
+        return tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+#else
+        (void)on;
+        return false;
+#endif
+}
+
+/**
+ * @brief Reads a key in raw mode, see \c intf_io_raw() . The output is flushed first.
+ * @return The key's character, or \c EOF .
+ */
+int intf_io_key(void)
+{
+        fflush(stdout);
+        return getchar();
+}
@@ -1,3 +1,5 @@
+#include "../include/platform.h"
+
 #include "include/intf_search.h"
 
 /**
@@ -5,57 +7,71 @@
  * @param db The source database pointer.
  * @param res Pointer to last search result.
  * @param depth Determines how many database indexes \c res->map->items contains per index.
+ * @param top Pointer to the first match of the result's page, see \c intf_frame_list() .
  * @return  -
  */
-void intf_search_txt(database *db, sres *res, int depth)
+void intf_search_txt(database *db, sres *res, int depth, idx *top)
 {
-        puts("----------------------- Kereses ----------------------");
-        puts("[0] Vissza");
-        puts("[1] Ugyfel keresese");
-        puts("[2] Rendszam keresese");
-        puts("[3] 30 napon belul lejaro vizsgak listazasa");
-        puts("-------------------");
-        puts("[4] Tovabblepes az ugyfelek kezelehez.");
-        puts("[5] Tovabblepes az autok/javitasok kezelesehez.");
-        puts("------------------------------------------------------");
+        intf_frame_begin();
+        intf_frame_puts("----------------------- Kereses ----------------------");
+        intf_frame_puts("[0] Vissza");
+        intf_frame_puts("[1] Ugyfel keresese");
+        intf_frame_puts("[2] Rendszam keresese");
+        intf_frame_puts("[3] 30 napon belul lejaro vizsgak listazasa");
+        intf_frame_puts("-------------------");
+        intf_frame_puts("[4] Tovabblepes az ugyfelek kezelehez.");
+        intf_frame_puts("[5] Tovabblepes az autok/javitasok kezelesehez.");
+        intf_frame_puts("-------------------");
+        intf_frame_puts("[6] Gyorskereses ugyfelnevre (gepeles kozben)");
+        intf_frame_puts("[7] Gyorskereses rendszamra (gepeles kozben)");
+        intf_frame_puts("------------------------------------------------------");
 
         if (depth == 0) {
-                puts("A talalatok *itt* fognak megjelenni.");
+                intf_frame_puts("A talalatok *itt* fognak megjelenni.");
                 goto txt_end;
         }
 
         if (res->map->size == 0) {
-                puts("Nincs talalat.");
+                intf_frame_puts("Nincs talalat.");
                 goto txt_end;
         }
 
-        for (idx i = 0; i < res->map->size; i++) {
+        /* A match takes a row for each of its indexes. */
+        size_t shown = intf_frame_list(top, res->map->size, (size_t)depth, 2);
+        for (idx i = *top; i < *top + shown; i++) {
                 idx *db_idx = vct_subptr(res->map, i);
 
                 client *cl = db_cl_get(db, db_idx[0]);
-                printf("[%zu][%s][%s][%s]\n", db_idx[0], cl->name, cl->email, cl->phone);
+                car *car = depth > 1 ? db_car_get(db, *db_idx, db_idx[1]) : NULL;
+                operation *op = depth > 2 ? db_op_get(db, db_idx[0], db_idx[1], db_idx[2]) : NULL;
+
+                /* The result may have been removed by another terminal since the search. */
+                if (!cl || (depth > 1 && !car) || (depth > 2 && !op))
+                        continue;
+
+                intf_frame_printf("[%zu][%s][%s][%s]\n", db_idx[0], cl->name, cl->email, cl->phone);
 
                 if (depth > 1) {
-                        car *car = db_car_get(db, *db_idx, db_idx[1]);
-                        printf("\t[%zu][%s][%s]\n", db_idx[1], car->name, car->plate);
+                        intf_frame_printf("\t[%zu][%s][%s]\n", db_idx[1], car->name, car->plate);
 
                         if (depth > 2) {
-                                operation *op = db_op_get(db, db_idx[0], db_idx[1], db_idx[2]);
-
                                 char date_cr[17] = "\0";
                                 char date_exp[17] = "\0";
                                 date_printf(&op->date_cr, date_cr);
                                 date_printf(&op->date_exp, date_exp);
 
-                                printf("\t\t[%zu][%s][%lf][%s]->[%s]\n", db_idx[2], op->desc, op->price, date_cr,
-                                        date_exp);
+                                intf_frame_printf("\t\t[%zu][%s][%lf][%s]->[%s]\n", db_idx[2], op->desc, op->price,
+                                        date_cr, date_exp);
                         }
                 }
         }
 
+        intf_frame_footer(*top, shown, res->map->size);
+
         txt_end:
-                puts("------------------------------------------------------");
-                printf("Opcio: ");
+                intf_frame_puts("------------------------------------------------------");
+                intf_frame_printf("Opcio: ");
+                intf_frame_end();
 }
 
 /**
@@ -69,38 +85,42 @@ int intf_search(database *db)
         bool active = true;
         sres result = {.map = NULL, .err = 0};
         int depth = 0;
+        idx top = 0;
 
         while (active) {
                 if (result.err == EMALLOC)
                         return EMALLOC;
 
-                intf_search_txt(db, &result, depth);
+                intf_io_sync();
+                intf_search_txt(db, &result, depth, &top);
                 int s = intf_io_opt();
                 int retval = 0;
 
+                if (intf_frame_scroll(&top, s))
+                        continue;
+
                 switch (s) {
                         case 0:
                                 active = false;
-                                if (result.map)
-                                        vct_del(result.map);
+                                search_res_del(result.map, depth);
                                 break;
                         case 1:
-                                if (result.map)
-                                        vct_del(result.map);
+                                search_res_del(result.map, depth);
                                 result = intf_search_cl(db);
                                 depth = 1;
+                                top = 0;
                                 break;
                         case 2:
-                                if (result.map)
-                                        vct_del(result.map);
+                                search_res_del(result.map, depth);
                                 result = intf_search_plate(db);
                                 depth = 2;
+                                top = 0;
                                 break;
                         case 3:
-                                if (result.map)
-                                        vct_del(result.map);
+                                search_res_del(result.map, depth);
                                 result = search_expiration(db);
                                 depth = 3;
+                                top = 0;
                                 break;
                         case 4:
                                 retval = intf_cl(db);
@@ -110,13 +130,27 @@ int intf_search(database *db)
                                 s = intf_io_opt();
                                 retval = intf_car(db, s);
                                 break;
+                        case 6:
+                        case 7: {
+                                sres next = intf_search_suggest(db, s == 7);
+
+                                /* Cancelled, the last result stays. */
+                                if (!next.map && !next.err)
+                                        break;
+
+                                search_res_del(result.map, depth);
+                                result = next;
+                                depth = s == 7 ? 2 : 1;
+                                top = 0;
+                                break;
+                        }
                         default:
-                                puts("Nincs ilyen opcio.");
+                                intf_frame_msg("Nincs ilyen opcio.");
                                 break;
                 }
 
                 if (retval == EOOB)
-                        puts("Az ugyfel nem talalhato.");
+                        intf_frame_msg("Az ugyfel nem talalhato.");
 
                 if (retval == EMALLOC)
                         return EMALLOC;
@@ -154,3 +188,116 @@ sres intf_search_plate(database *db)
 
         return search_plate(db, term);
 }
+
+/**
+ * @brief Prints the type-ahead search's text: the prefix typed so far, and the first entries starting with it.
+ * @param db The source database pointer.
+ * @param p Pointer to the prefix.
+ */
+void intf_suggest_txt(database *db, const sprefix *p)
+{
+        size_t lo = p->lo[p->len];
+        size_t hi = p->hi[p->len];
+
+        intf_frame_begin();
+        intf_frame_puts("-------------------- Gyorskereses --------------------");
+        intf_frame_puts(p->ix->depth == 1 ? "Ugyfel nevenek kezdete, kis- es nagybetu mindegy."
+                                          : "Rendszam kezdete, kis- es nagybetu mindegy.");
+        intf_frame_puts("[Enter] talalatok listazasa, [Esc] vissza");
+        intf_frame_puts("------------------------------------------------------");
+
+        if (lo == hi)
+                intf_frame_puts("Nincs talalat.");
+
+        for (idx i = lo; i < hi && i < lo + INTF_SUGGEST_ROWS; i++) {
+                const sentry *e = &p->ix->items[i];
+                client *cl = db_cl_get(db, e->cl);
+                car *car = p->ix->depth > 1 ? db_car_get(db, e->cl, e->car) : NULL;
+
+                /* The index is not updated, the entry may have been removed since. */
+                if (!cl || (p->ix->depth > 1 && !car))
+                        continue;
+
+                if (p->ix->depth == 1)
+                        intf_frame_printf("[%zu][%s][%s][%s]\n", e->cl, cl->name, cl->email, cl->phone);
+                else
+                        intf_frame_printf("[%zu][%s][%s] -> [%zu][%s]\n", e->car, car->plate, car->name, e->cl,
+                                          cl->name);
+        }
+
+        if (hi - lo > INTF_SUGGEST_ROWS)
+                intf_frame_printf("... es meg %zu talalat.\n", hi - lo - INTF_SUGGEST_ROWS);
+
+        intf_frame_puts("------------------------------------------------------");
+        intf_frame_printf("Keresett: %s", p->term);
+        intf_frame_end();
+}
+
+/**
+ * @brief Frontend for the type-ahead search by client name or plate number.
+ * @details The suggestions are updated after every key. Without a terminal, the beginning of the name or plate is
+ *          read as a line.
+ * @param db The database pointer which the user will search in.
+ * @param plates Set to \c true to search the plates, \c false for the client names.
+ * @return A search result structure with corresponding database indexes (see \c search_prefix_res() ). If the user
+ *         has cancelled, both \c map and \c err are zero.
+ */
+sres intf_search_suggest(database *db, bool plates)
+{
+        sres res = {.map = NULL, .err = 0};
+        sindex ix;
+        sprefix p;
+
+        res.err = search_index(db, &ix, plates);
+        if (res.err)
+                goto suggest_end;
+
+        search_prefix_init(&p, &ix);
+
+        if (!intf_frame_screen() || !intf_io_raw(true)) {
+                char term[NAME_SIZE + 1] = "\0";
+                printf(plates ? "Rendszam kezdete: " : "Ugyfel nevenek kezdete: ");
+                intf_io_fgets(term, NAME_SIZE + 1);
+
+                for (idx i = 0; term[i]; i++)
+                        search_prefix_push(&p, term[i]);
+
+                res = search_prefix_res(&p);
+                goto suggest_end;
+        }
+
+        bool active = true;
+        bool cancel = false;
+        while (active) {
+                intf_suggest_txt(db, &p);
+                int c = intf_io_key();
+
+                switch (c) {
+                        case '\n':
+                        case '\r':
+                                active = false;
+                                break;
+                        case EOF:
+                        case 27:
+                                active = false;
+                                cancel = true;
+                                break;
+                        case 127:
+                        case '\b':
+                                search_prefix_pop(&p);
+                                break;
+                        default:
+                                if (isprint(c))
+                                        search_prefix_push(&p, (char)c);
+                                break;
+                }
+        }
+
+        intf_io_raw(false);
+        if (!cancel)
+                res = search_prefix_res(&p);
+
+        suggest_end:
+                search_index_del(&ix);
+                return res;
+}
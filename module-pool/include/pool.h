@@ -0,0 +1,45 @@
+/**
+ * @file pool.h
+ * @brief Module header file. Include this to run parallel jobs on the process-wide worker threads.
+ * @details See \c pool.c for the scheduler.
+ */
+
+#ifndef REPAIRSHOP_POOL_H
+#define REPAIRSHOP_POOL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The largest number of threads working on the parallel jobs, the calling thread included. */
+#define POOL_MAX_THREADS 64
+/** The number of different task names whose timing is kept by a worker. The rest are counted as \c "egyeb" . */
+#define POOL_KINDS 8
+
+/**
+ * @brief The function of a task. A task works on the items \c [from, to) of a job.
+ * @param arg The job, shared by its tasks.
+ * @param from The first item of the task.
+ * @param to The end of the task's items.
+ */
+typedef void (*pool_fn)(void *arg, size_t from, size_t to);
+
+/**
+ * @struct pool_group pool.h
+ * @brief A fork-join scope: the tasks spawned into the group are waited for by \c pool_join() .
+ * @note Zero-initialize it before the first spawn.
+ */
+typedef struct pool_group {
+        size_t pending;         /**< The number of the group's unfinished tasks. */
+} pool_group;
+
+void pool_setup(unsigned threads);
+
+void pool_spawn(pool_group *g, const char *name, pool_fn fn, void *arg, size_t from, size_t to);
+void pool_join(pool_group *g);
+void pool_for(const char *name, size_t cnt, size_t grain, pool_fn fn, void *arg);
+
+void pool_report(FILE *dst);
+void pool_stop(void);
+
+#endif //REPAIRSHOP_POOL_H
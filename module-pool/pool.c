@@ -0,0 +1,521 @@
+/**
+ * @file pool.c
+ * @brief The process-wide work-stealing scheduler of the parallel jobs.
+ * @details The snapshot's verification, the shards' import and export, the decompression of the backups and the
+ *          searches' full scans are split into tasks, which are run by a single set of worker threads instead of
+ *          every job starting its own threads.\n
+ *          Every worker has its own deque: it pushes and pops its tasks at the bottom, so a task's subtasks are run
+ *          by the same thread while they're in its cache. An idle worker steals from the top of the others' deques,
+ *          where the oldest, usually the largest pieces of the job are. The threads outside of the pool (the menus,
+ *          the server, the background save) share an extra deque.\n
+ *          A job is a fork-join scope (\c pool_group ): the tasks are spawned into the group, then \c pool_join()
+ *          runs tasks until every task of the group is finished, so the waiting thread works too, and nested jobs
+ *          don't need extra threads. \c pool_for() splits a range of items this way.\n
+ *          The workers are started by the first spawn. Their number is set by \c pool_setup() , the default is one
+ *          less than the number of CPUs, since the thread waiting for a job works too. Without workers the tasks are
+ *          run by the joining thread.\n
+ *          Every worker times its tasks, by the tasks' names, see \c pool_report() . The time of a task includes the
+ *          tasks it has run while it was joining a group.
+ * @note The deques are protected by mutexes, the tasks are large enough (thousands of blocks or clients) for that not
+ *       to matter. A task must not hold a lock while it joins a group, the joining thread may run any task.
+ */
+
+#include "../include/platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/pool.h"
+#include "../module-probe/include/probe.h"
+
+/**
+ * @struct pool_task pool.c
+ * @brief A spawned task.
+ */
+typedef struct pool_task {
+        pool_fn fn;             /**< The task's function. */
+        void *arg;              /**< The job, passed to \c fn . */
+        size_t from;            /**< The first item of the task. */
+        size_t to;              /**< The end of the task's items. */
+        const char *name;       /**< The task's name in the statistics. */
+        pool_group *group;      /**< The group the task belongs to. */
+} pool_task;
+
+/**
+ * @struct pool_deque pool.c
+ * @brief A double-ended queue of tasks. The owner uses the bottom, the thieves the top.
+ */
+typedef struct pool_deque {
+        pthread_mutex_t lock;   /**< Protects the deque. */
+        pool_task *ring;        /**< The tasks, \c NULL until the first push. */
+        size_t cap;             /**< The size of \c ring , a power of 2. */
+        size_t top;             /**< The position of the oldest task. */
+        size_t bottom;          /**< The position after the newest task. */
+} pool_deque;
+
+/**
+ * @struct pool_kind pool.c
+ * @brief The timing of the tasks of the same name, run by a worker.
+ */
+typedef struct pool_kind {
+        const char *name;       /**< The tasks' name, \c NULL if the entry is unused. */
+        size_t cnt;             /**< The number of tasks. */
+        uint64_t total_ns;      /**< The tasks' running time in nanoseconds. */
+        uint64_t max_ns;        /**< The longest task in nanoseconds. */
+} pool_kind;
+
+/**
+ * @struct pool_worker pool.c
+ * @brief A worker thread, with its deque and its statistics.
+ * @note The first one stands for the threads outside of the pool, which share it.
+ */
+typedef struct pool_worker {
+        pthread_t tid;                  /**< The thread. */
+        pool_deque dq;                  /**< The worker's tasks. */
+        size_t tasks;                   /**< The number of tasks run. */
+        size_t stolen;                  /**< The number of tasks taken from the other threads' deques. */
+        uint64_t busy_ns;               /**< The running time of the tasks in nanoseconds. */
+        pool_kind kinds[POOL_KINDS];    /**< The timing of the tasks by their names. */
+} pool_worker;
+
+/** The scheduler. */
+static struct {
+        unsigned threads;       /**< The configured number of threads, the waiting one included. \c 0 : default. */
+        unsigned slots;         /**< The number of entries in \c w . */
+        unsigned workers;       /**< The number of running workers. */
+        pool_worker *w;         /**< The outside threads' entry, then the workers. \c NULL if the pool is down. */
+        size_t queued;          /**< The number of tasks in the deques. */
+        unsigned idle;          /**< The number of sleeping workers. */
+        unsigned joiners;       /**< The number of sleeping \c pool_join() calls. */
+        bool stop;              /**< Set by \c pool_stop() . */
+        pthread_mutex_t lock;   /**< Protects the sleeping, and orders it with the spawns. */
+        pthread_cond_t wake;    /**< Signaled for the idle workers, when a task is spawned. */
+        pthread_cond_t done;    /**< Signaled for the joiners, when a group is finished or a task is spawned. */
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/** The worker of the current thread, \c NULL for the threads outside of the pool. */
+static THREAD_LOCAL pool_worker *pool_me;
+
+/**
+ * @brief Sets the number of threads working on the parallel jobs. Call it before the first job.
+ * @param threads The number of threads, the one waiting for the job included. \c 1 runs every job on the calling
+ *                thread, \c 0 selects the default: the number of CPUs.
+ */
+void pool_setup(unsigned threads)
+{
+        pool.threads = threads < POOL_MAX_THREADS ? threads : POOL_MAX_THREADS;
+}
+
+/**
+ * @brief Returns a monotonic time for the statistics.
+ * @return Nanoseconds since an arbitrary point in time.
+ */
+uint64_t pool_clock(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Pushes a task to the bottom of a deque.
+ * @param dq Pointer to the deque.
+ * @param t The task.
+ * @return \c true on success, \c false if the deque cannot grow.
+ */
+bool pool_push(pool_deque *dq, pool_task t)
+{
+        pthread_mutex_lock(&dq->lock);
+
+        if (dq->bottom - dq->top == dq->cap) {
+                size_t new_cap = dq->cap ? dq->cap * 2 : 64;
+                pool_task *ring = malloc(new_cap * sizeof(pool_task));
+                if (!ring) {
+                        pthread_mutex_unlock(&dq->lock);
+                        return false;
+                }
+
+                for (size_t i = dq->top; i < dq->bottom; i++)
+                        ring[i & (new_cap - 1)] = dq->ring[i & (dq->cap - 1)];
+
+                free(dq->ring);
+                dq->ring = ring;
+                dq->cap = new_cap;
+        }
+
+        dq->ring[dq->bottom++ & (dq->cap - 1)] = t;
+        pthread_mutex_unlock(&dq->lock);
+        return true;
+}
+
+/**
+ * @brief Takes a task from a deque.
+ * @param dq Pointer to the deque.
+ * @param bottom \c true to take the newest task (the owner), \c false to take the oldest one (a thief).
+ * @param t Pointer to the destination of the task.
+ * @return \c true if a task was taken, \c false if the deque is empty.
+ */
+bool pool_pop(pool_deque *dq, bool bottom, pool_task *t)
+{
+        pthread_mutex_lock(&dq->lock);
+
+        bool found = dq->bottom != dq->top;
+        if (found && bottom)
+                *t = dq->ring[--dq->bottom & (dq->cap - 1)];
+        else if (found)
+                *t = dq->ring[dq->top++ & (dq->cap - 1)];
+
+        pthread_mutex_unlock(&dq->lock);
+        return found;
+}
+
+/**
+ * @brief Finds a task for a thread: its own newest one, the outside threads' oldest one, or steals one.
+ * @param self The thread's entry.
+ * @param t Pointer to the destination of the task.
+ * @param stolen Pointer to the destination of whether the task was taken from another thread's deque.
+ * @return \c true if a task was found.
+ */
+bool pool_take(pool_worker *self, pool_task *t, bool *stolen)
+{
+        unsigned cnt = __atomic_load_n(&pool.workers, __ATOMIC_ACQUIRE) + 1;
+        size_t me = (size_t)(self - pool.w);
+
+        *stolen = false;
+        bool found = pool_pop(&self->dq, true, t);
+        if (!found && me != 0)
+                found = *stolen = pool_pop(&pool.w[0].dq, false, t);
+
+        /* The victims are tried starting from the next worker, so the thieves don't all go for the same one. */
+        for (unsigned i = 1; !found && i < cnt; i++) {
+                size_t victim = (me + i) % cnt;
+                if (victim != 0 && victim != me)
+                        found = *stolen = pool_pop(&pool.w[victim].dq, false, t);
+        }
+
+        if (found)
+                __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_RELAXED);
+
+        return found;
+}
+
+/**
+ * @brief Finds the timing entry of a task name, or claims a new one.
+ * @param self The thread's entry.
+ * @param name The task's name.
+ * @return The entry. The last one collects the names that don't fit.
+ */
+pool_kind *pool_kind_of(pool_worker *self, const char *name)
+{
+        for (int i = 0; i < POOL_KINDS - 1; i++) {
+                pool_kind *k = &self->kinds[i];
+                const char *cur = __atomic_load_n(&k->name, __ATOMIC_ACQUIRE);
+
+                /* The outside threads share their entry, so claiming a free one may race. */
+                if (!cur && __atomic_compare_exchange_n(&k->name, &cur, name, false, __ATOMIC_ACQ_REL,
+                                                        __ATOMIC_ACQUIRE))
+                        return k;
+
+                if (!strcmp(cur, name))
+                        return k;
+        }
+
+        return &self->kinds[POOL_KINDS - 1];
+}
+
+/**
+ * @brief Runs a task, records its timing, and finishes it in its group.
+ * @param self The running thread's entry, \c NULL if the pool is down.
+ * @param t The task.
+ * @param stolen Whether the task was taken from another thread's deque.
+ */
+void pool_run(pool_worker *self, pool_task t, bool stolen)
+{
+        uint64_t start = pool_clock();
+        TRACE_BEGIN(span, t.name);
+        t.fn(t.arg, t.from, t.to);
+        TRACE_END(span);
+        uint64_t ns = pool_clock() - start;
+
+        if (self) {
+                __atomic_add_fetch(&self->tasks, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&self->stolen, stolen, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&self->busy_ns, ns, __ATOMIC_RELAXED);
+
+                pool_kind *k = pool_kind_of(self, t.name);
+                __atomic_add_fetch(&k->cnt, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&k->total_ns, ns, __ATOMIC_RELAXED);
+
+                uint64_t max = __atomic_load_n(&k->max_ns, __ATOMIC_RELAXED);
+                while (ns > max && !__atomic_compare_exchange_n(&k->max_ns, &max, ns, true, __ATOMIC_RELAXED,
+                                                                 __ATOMIC_RELAXED))
+                        ;
+        }
+
+        /* The group may be freed as soon as it's finished, only the scheduler's lock is used afterward. */
+        if (__atomic_sub_fetch(&t.group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+                pthread_mutex_lock(&pool.lock);
+                pthread_cond_broadcast(&pool.done);
+                pthread_mutex_unlock(&pool.lock);
+        }
+}
+
+/**
+ * @brief A worker thread. Runs tasks, sleeps if there are none, until \c pool_stop() .
+ * @param arg Pointer to the worker's entry.
+ * @return \c NULL
+ */
+void *pool_worker_main(void *arg)
+{
+        pool_me = arg;
+
+        for (;;) {
+                pool_task t;
+                bool stolen;
+                if (pool_take(pool_me, &t, &stolen)) {
+                        pool_run(pool_me, t, stolen);
+                        continue;
+                }
+
+                pthread_mutex_lock(&pool.lock);
+                while (__atomic_load_n(&pool.queued, __ATOMIC_RELAXED) == 0 && !pool.stop) {
+                        pool.idle++;
+                        pthread_cond_wait(&pool.wake, &pool.lock);
+                        pool.idle--;
+                }
+
+                bool quit = pool.stop && __atomic_load_n(&pool.queued, __ATOMIC_RELAXED) == 0;
+                pthread_mutex_unlock(&pool.lock);
+
+                if (quit)
+                        break;
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Starts the workers. Called once, by the first spawn.
+ * @note If the entries cannot be allocated, the tasks are run by the spawning thread without statistics. If a worker
+ *       cannot be started, the pool runs with the ones already started.
+ */
+void pool_start(void)
+{
+        unsigned threads = pool.threads;
+        if (threads == 0) {
+                long cpus = 4;
+#ifdef _SC_NPROCESSORS_ONLN
+                cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+                threads = cpus < 1 ? 1 : cpus > POOL_MAX_THREADS ? POOL_MAX_THREADS : (unsigned)cpus;
+        }
+
+        pool_worker *w = calloc(threads, sizeof(pool_worker));
+        if (!w)
+                return;
+
+        for (unsigned i = 0; i < threads; i++)
+                pthread_mutex_init(&w[i].dq.lock, NULL);
+
+        w[0].kinds[POOL_KINDS - 1].name = "egyeb";
+        pool.w = w;
+        pool.slots = threads;
+
+        for (unsigned i = 1; i < threads; i++) {
+                w[i].kinds[POOL_KINDS - 1].name = "egyeb";
+                if (pthread_create(&w[i].tid, NULL, pool_worker_main, &w[i]))
+                        break;
+
+                __atomic_store_n(&pool.workers, i, __ATOMIC_RELEASE);
+        }
+}
+
+/**
+ * @brief Spawns a task into a group. The task may run on any thread, right away or by \c pool_join() .
+ * @param g Pointer to the group.
+ * @param name The task's name in the statistics. It must stay valid until the end of the program (a literal).
+ * @param fn The task's function.
+ * @param arg The job, passed to \c fn .
+ * @param from The first item of the task.
+ * @param to The end of the task's items.
+ * @note If the pool is down, or the task cannot be queued, it's run by the calling thread before returning.
+ */
+void pool_spawn(pool_group *g, const char *name, pool_fn fn, void *arg, size_t from, size_t to)
+{
+        pthread_once(&pool_once, pool_start);
+
+        pool_task t = {fn, arg, from, to, name, g};
+        __atomic_add_fetch(&g->pending, 1, __ATOMIC_RELAXED);
+
+        pool_worker *self = pool_me ? pool_me : pool.w;
+        if (!pool.w || __atomic_load_n(&pool.stop, __ATOMIC_RELAXED)) {
+                pool_run(self, t, false);
+                return;
+        }
+
+        /* Counted before it's pushed, so the count never drops below zero. A woken thread may spin until the push. */
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.queued, 1, __ATOMIC_RELAXED);
+        if (pool.idle)
+                pthread_cond_signal(&pool.wake);
+        if (pool.joiners)
+                pthread_cond_broadcast(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (!pool_push(&self->dq, t)) {
+                __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_RELAXED);
+                pool_run(self, t, false);
+        }
+}
+
+/**
+ * @brief Waits until every task of a group is finished. The calling thread runs tasks in the meantime.
+ * @param g Pointer to the group. It can be reused afterward.
+ */
+void pool_join(pool_group *g)
+{
+        pool_worker *self = pool_me ? pool_me : pool.w;
+
+        while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0) {
+                pool_task t;
+                bool stolen;
+                if (self && pool_take(self, &t, &stolen)) {
+                        pool_run(self, t, stolen);
+                        continue;
+                }
+
+                /* The group's last tasks are running on other threads. */
+                pthread_mutex_lock(&pool.lock);
+                while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0 &&
+                       __atomic_load_n(&pool.queued, __ATOMIC_RELAXED) == 0) {
+                        pool.joiners++;
+                        pthread_cond_wait(&pool.done, &pool.lock);
+                        pool.joiners--;
+                }
+                pthread_mutex_unlock(&pool.lock);
+        }
+}
+
+/**
+ * @struct pool_range pool.c
+ * @brief A job split by \c pool_for() .
+ */
+typedef struct pool_range {
+        pool_group group;       /**< The job's tasks. */
+        const char *name;       /**< The tasks' name. */
+        pool_fn fn;             /**< The function of the pieces. */
+        void *arg;              /**< The job, passed to \c fn . */
+        size_t grain;           /**< The size of a piece. */
+} pool_range;
+
+/**
+ * @brief A task of \c pool_for() . Halves its range, spawning the upper half, until it's a single piece.
+ * @param arg Pointer to the \c pool_range .
+ * @param from The first item of the range.
+ * @param to The end of the range.
+ */
+void pool_split(void *arg, size_t from, size_t to)
+{
+        pool_range *r = arg;
+
+        while (to - from > r->grain) {
+                size_t pieces = (to - from + r->grain - 1) / r->grain;
+                size_t mid = from + pieces / 2 * r->grain;
+                pool_spawn(&r->group, r->name, pool_split, r, mid, to);
+                to = mid;
+        }
+
+        r->fn(r->arg, from, to);
+}
+
+/**
+ * @brief Runs a function on the pieces of a range of items in parallel, and waits for them.
+ * @details The range is halved recursively, so the first steals take the largest pieces.
+ * @param name The tasks' name in the statistics, see \c pool_spawn() .
+ * @param cnt The number of items.
+ * @param grain The largest number of items in a piece. \c fn is called with the pieces \c [k*grain, (k+1)*grain) ,
+ *              so the pieces can have their own results, indexed by \c from/grain .
+ * @param fn The function of the pieces. It's called from multiple threads at the same time.
+ * @param arg The job, passed to \c fn .
+ */
+void pool_for(const char *name, size_t cnt, size_t grain, pool_fn fn, void *arg)
+{
+        if (cnt == 0)
+                return;
+
+        pool_range r = {{0}, name, fn, arg, grain ? grain : 1};
+        pool_spawn(&r.group, name, pool_split, &r, 0, cnt);
+        pool_join(&r.group);
+}
+
+/**
+ * @brief Prints the statistics of the workers' tasks.
+ * @param dst The destination stream.
+ */
+void pool_report(FILE *dst)
+{
+        if (!pool.w)
+                return;
+
+        unsigned workers = __atomic_load_n(&pool.workers, __ATOMIC_ACQUIRE);
+        fprintf(dst, "Parhuzamos feladatok (%u szal):\n", workers + 1);
+
+        for (unsigned i = 0; i <= workers; i++) {
+                pool_worker *w = &pool.w[i];
+                size_t tasks = __atomic_load_n(&w->tasks, __ATOMIC_RELAXED);
+                if (i == 0)
+                        fprintf(dst, "  Hivo szalak: ");
+                else
+                        fprintf(dst, "  %u. szal: ", i);
+
+                fprintf(dst, "%zu feladat (ebbol lopott: %zu), %.3f ms\n", tasks,
+                        __atomic_load_n(&w->stolen, __ATOMIC_RELAXED),
+                        (double)__atomic_load_n(&w->busy_ns, __ATOMIC_RELAXED) / 1e6);
+
+                for (int k = 0; k < POOL_KINDS; k++) {
+                        pool_kind *kind = &w->kinds[k];
+                        size_t cnt = __atomic_load_n(&kind->cnt, __ATOMIC_RELAXED);
+                        if (cnt == 0)
+                                continue;
+
+                        double total = (double)__atomic_load_n(&kind->total_ns, __ATOMIC_RELAXED) / 1e6;
+                        fprintf(dst, "    %s: %zu db, osszesen %.3f ms, atlag %.3f ms, max %.3f ms\n", kind->name, cnt,
+                                total, total / (double)cnt,
+                                (double)__atomic_load_n(&kind->max_ns, __ATOMIC_RELAXED) / 1e6);
+                }
+        }
+}
+
+/**
+ * @brief Stops the workers after the queued tasks, and frees the scheduler.
+ * @note No other thread may use the pool at the same time. The later jobs run on the calling thread.
+ */
+void pool_stop(void)
+{
+        if (!pool.w)
+                return;
+
+        pthread_mutex_lock(&pool.lock);
+        __atomic_store_n(&pool.stop, true, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+
+        unsigned workers = __atomic_load_n(&pool.workers, __ATOMIC_ACQUIRE);
+        for (unsigned i = 1; i <= workers; i++)
+                pthread_join(pool.w[i].tid, NULL);
+
+        for (unsigned i = 0; i < pool.slots; i++) {
+                pthread_mutex_destroy(&pool.w[i].dq.lock);
+                free(pool.w[i].dq.ring);
+        }
+
+        free(pool.w);
+        pool.w = NULL;
+        __atomic_store_n(&pool.workers, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,139 @@
+/**
+ * @file probe.h
+ * @brief Module header file. Include this to time the hot paths of the database, the searches and the filehandler.
+ * @details See \c probe.c for the counters. A function is timed by putting \c PROBE() at its top.\n
+ *          The memory held by the objects is accounted by \c PROBE_ALLOC() and \c PROBE_FREE() , see
+ *          \c probe_mem.c .\n
+ *          The timeline of the program is recorded by \c probe_trace_start() , the spans are marked by \c TRACE() and
+ *          \c TRACE_BEGIN() , see \c probe_trace.c .\n
+ *          Define \c REPAIRSHOP_NO_PROBES to compile the probes out: the macros expand to nothing, and the reports
+ *          only say that the probes are disabled.
+ */
+
+#ifndef REPAIRSHOP_PROBE_H
+#define REPAIRSHOP_PROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** The number of latency buckets. Bucket \c b counts the calls of \c [2^b,2^(b+1)) ns, the last one the rest. */
+#define PROBE_BUCKETS 40
+/** The size of a row of the report, see \c probe_row() . */
+#define PROBE_ROW_SIZE 96
+/** The columns of the report. */
+#define PROBE_HEADER "Muvelet               hivasok   atlag us     p50 us     p99 us     max us"
+/** The number of threads with their own counters. The threads after these share an extra set of counters. */
+#define PROBE_SLOTS 32
+/** The bytes a thread accounts before they're added to the totals, see \c probe_mem() . */
+#define PROBE_MEM_BATCH 65536
+/** The columns of the memory report. */
+#define PROBE_MEM_HEADER "Tipus              objektumok        KiB   csucs KiB"
+/** The largest number of the timeline's events, the later ones are dropped. About 50 MB of memory. */
+#define PROBE_TRACE_MAX 2000000
+
+/**
+ * @enum probe_id probe.h
+ * @brief The timed functions. See \c probe_names in \c probe.c for their names in the report.
+ */
+typedef enum probe_id {
+        PROBE_DB_CL_ADD,
+        PROBE_DB_CL_MOD,
+        PROBE_DB_CL_RM,
+        PROBE_DB_CL_LOAD,
+        PROBE_DB_CAR_ADD,
+        PROBE_DB_CAR_MOD,
+        PROBE_DB_CAR_RM,
+        PROBE_DB_OP_ADD,
+        PROBE_DB_OP_MOD,
+        PROBE_DB_OP_RM,
+        PROBE_DB_TX_COMMIT,
+        PROBE_SEARCH_CL,
+        PROBE_SEARCH_PLATE,
+        PROBE_SEARCH_EXPIRATION,
+        PROBE_SEARCH_INDEX,
+        PROBE_SEARCH_PREFIX,
+        PROBE_FH_IMPORT,
+        PROBE_FH_IMPORT_LAZY,
+        PROBE_FH_EXPORT,
+        PROBE_CNT               /**< The number of the timed functions, not a probe. */
+} probe_id;
+
+/**
+ * @enum probe_mem_kind probe.h
+ * @brief The owners of the accounted memory. See \c probe_mem_names in \c probe_mem.c for their names in the report.
+ */
+typedef enum probe_mem_kind {
+        PROBE_MEM_CLIENT,       /**< The clients' structs. */
+        PROBE_MEM_CAR,          /**< The cars' structs. */
+        PROBE_MEM_OP,           /**< The operations' structs. */
+        PROBE_MEM_VECTOR,       /**< The vectors' structs and pointer arrays, of every owner. */
+        PROBE_MEM_RESULT,       /**< The matches of the search results, the vectors holding them are not included. */
+        PROBE_MEM_INDEX,        /**< The prefix indexes of the searches and the hash maps of the CSV ingest. */
+        PROBE_MEM_CNT           /**< The number of the owners, not an owner. */
+} probe_mem_kind;
+
+#ifndef REPAIRSHOP_NO_PROBES
+/**
+ * @struct probe_scope probe.h
+ * @brief A running measurement. Recorded by \c probe_end() when the timed function returns.
+ */
+typedef struct probe_scope {
+        probe_id id;            /**< The timed function. */
+        uint64_t start;         /**< The start of the call, see \c probe_now() . */
+} probe_scope;
+
+uint64_t probe_now(void);
+void probe_end(probe_scope *s);
+
+/** Times the rest of the enclosing block, i.e. the function if it's at the top. Recorded on every return. */
+#define PROBE(id) probe_scope probe_scope_ __attribute__((cleanup(probe_end))) = {(id), probe_now()}
+
+void probe_mem(probe_mem_kind kind, long long bytes, long long objects);
+
+/** Accounts \c objects new objects of \c bytes bytes in total, owned by \c kind . */
+#define PROBE_ALLOC(kind, bytes, objects) probe_mem((kind), (long long)(bytes), (long long)(objects))
+/** Accounts \c objects freed objects of \c bytes bytes in total, owned by \c kind . */
+#define PROBE_FREE(kind, bytes, objects) probe_mem((kind), -(long long)(bytes), -(long long)(objects))
+
+/**
+ * @struct probe_span probe.h
+ * @brief A running span of the timeline. Recorded by \c probe_span_end() if tracing is on.
+ */
+typedef struct probe_span {
+        const char *name;       /**< The span's name, a string literal. */
+        uint64_t start;         /**< The start of the span, \c 0 if tracing is off. */
+} probe_span;
+
+void probe_trace_add(const char *name, uint64_t start, uint64_t ns);
+probe_span probe_span_begin(const char *name);
+void probe_span_end(probe_span *s);
+
+/** Records the rest of the enclosing block as a span of the timeline. */
+#define TRACE(name) probe_span probe_span_ __attribute__((cleanup(probe_span_end))) = probe_span_begin(name)
+/** Starts a span of the timeline in the variable \c span , it's recorded by \c TRACE_END() . */
+#define TRACE_BEGIN(span, name) probe_span span = probe_span_begin(name)
+/** Records a span started by \c TRACE_BEGIN() . */
+#define TRACE_END(span) probe_span_end(&(span))
+#else
+#define PROBE(id) ((void)0)
+/* The arguments are not evaluated, they're only referenced so the variables counting them aren't unused. */
+#define PROBE_ALLOC(kind, bytes, objects) ((void)sizeof((bytes) + (objects)))
+#define PROBE_FREE(kind, bytes, objects) ((void)sizeof((bytes) + (objects)))
+#define TRACE(name) ((void)0)
+#define TRACE_BEGIN(span, name) ((void)0)
+#define TRACE_END(span) ((void)0)
+#endif
+
+void probe_signals(void);
+void probe_poll(FILE *dst);
+bool probe_row(probe_id id, char *dst, size_t size);
+void probe_report(FILE *dst);
+
+bool probe_mem_row(probe_mem_kind kind, char *dst, size_t size);
+bool probe_mem_total(char *dst, size_t size);
+void probe_mem_report(FILE *dst);
+
+bool probe_trace_start(const char *path);
+
+#endif //REPAIRSHOP_PROBE_H
@@ -0,0 +1,260 @@
+/**
+ * @file probe.c
+ * @brief The latency counters of the hot paths.
+ * @details Every timed call (see \c PROBE() ) is counted by the calling thread in its own slot: the number of calls,
+ *          their total and longest duration, and a histogram with logarithmic buckets (the calls of 1-2 us, 2-4 us and
+ *          so on). A thread gets its slot on its first timed call, and gives it back when it exits, the next thread
+ *          keeps counting in it. The threads after \c PROBE_SLOTS share an extra slot.\n
+ *          A call costs two readings of the monotonic clock and a few uncontended atomic additions in the thread's own
+ *          cache lines, no locks. The report merges the slots, so the median and the 99th percentile are accurate up
+ *          to their buckets' size (a factor of 2), the maximum is exact.\n
+ *          The report is printed by the hidden \c 9 option of the main menu, by \c -v on exit and by \c SIGUSR1 , with
+ *          the memory report of \c probe_mem.c . The signal only sets a flag, the reports are printed by
+ *          \c probe_poll() at the next safe point (the menus and the server's event loop call it).\n
+ *          The timed calls are also the spans of the timeline, see \c probe_trace.c .
+ * @note The getters ( \c db_cl_get() etc.) and the checks of the loaded clients are not timed: they are called in
+ *       every loop, and they cost about as much as the clock itself. \c db_cl_load is timed when a client is actually
+ *       loaded from the snapshot.
+ */
+
+#include "../include/platform.h"
+
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "include/probe.h"
+
+/** The names of the timed functions in the report, in the order of \c probe_id . */
+static const char *probe_names[PROBE_CNT] = {
+        "db_cl_add", "db_cl_mod", "db_cl_rm", "db_cl_load", "db_car_add", "db_car_mod", "db_car_rm", "db_op_add",
+        "db_op_mod", "db_op_rm", "db_tx_commit", "search_cl", "search_plate", "search_expiration", "search_index",
+        "search_prefix", "fh_import", "fh_import_lazy", "fh_export"
+};
+
+/** Set by \c SIGUSR1 , cleared by \c probe_poll() . */
+static volatile sig_atomic_t probe_requested;
+
+#ifndef REPAIRSHOP_NO_PROBES
+/**
+ * @struct probe_counter probe.c
+ * @brief The calls of a timed function, by a thread.
+ */
+typedef struct probe_counter {
+        uint64_t calls;                         /**< The number of calls. */
+        uint64_t total;                         /**< The total duration of the calls in nanoseconds. */
+        uint64_t max;                           /**< The longest call in nanoseconds. */
+        uint64_t buckets[PROBE_BUCKETS];        /**< The histogram of the durations. */
+} probe_counter;
+
+/**
+ * @struct probe_slot probe.c
+ * @brief A thread's counters. Aligned to a cache line, so the threads don't share lines.
+ */
+typedef struct probe_slot {
+        probe_counter counters[PROBE_CNT];      /**< The counters, by \c probe_id . */
+        bool used;                              /**< Set if a thread owns the slot. */
+} __attribute__((aligned(64))) probe_slot;
+
+/** The slots of the threads, the last one is shared by the threads that didn't get their own. */
+static probe_slot probe_slots[PROBE_SLOTS + 1];
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static pthread_key_t probe_key;
+static THREAD_LOCAL probe_slot *probe_self;
+
+/**
+ * @brief Gives a slot back when its thread exits. The destructor of \c probe_key . The counters are kept.
+ * @param slot Pointer to the slot.
+ */
+void probe_release(void *slot)
+{
+        probe_slot *self = slot;
+        __atomic_store_n(&self->used, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates \c probe_key . Called once.
+ */
+void probe_init(void)
+{
+        pthread_key_create(&probe_key, probe_release);
+}
+
+/**
+ * @brief Finds a free slot for the calling thread.
+ * @return Pointer to the slot, the shared one if every slot is taken.
+ */
+probe_slot *probe_claim(void)
+{
+        pthread_once(&probe_once, probe_init);
+
+        for (size_t i = 0; i < PROBE_SLOTS; i++) {
+                bool expected = false;
+                if (__atomic_compare_exchange_n(&probe_slots[i].used, &expected, true, false, __ATOMIC_ACQ_REL,
+                                                __ATOMIC_RELAXED)) {
+                        pthread_setspecific(probe_key, &probe_slots[i]);
+                        return &probe_slots[i];
+                }
+        }
+
+        return &probe_slots[PROBE_SLOTS];
+}
+
+/**
+ * @brief Returns the current time.
+ * @return The nanoseconds since an arbitrary point of time, for measuring durations.
+ */
+uint64_t probe_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Records a timed call. Called by the cleanup of \c PROBE() when the function returns.
+ * @param s The running measurement.
+ * @note The additions are atomic because of the shared slot, the thread's own slot is never contended.
+ */
+void probe_end(probe_scope *s)
+{
+        uint64_t ns = probe_now() - s->start;
+
+        if (!probe_self)
+                probe_self = probe_claim();
+
+        probe_counter *c = &probe_self->counters[s->id];
+        unsigned bucket = ns ? 63 - (unsigned)__builtin_clzll(ns) : 0;
+        if (bucket >= PROBE_BUCKETS)
+                bucket = PROBE_BUCKETS - 1;
+
+        __atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->total, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+        while (ns > max && !__atomic_compare_exchange_n(&c->max, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        probe_trace_add(probe_names[s->id], s->start, ns);
+}
+
+/**
+ * @brief Estimates a percentile of the durations from the merged histogram.
+ * @param c The merged counter.
+ * @param pct The percentile, e.g. \c 99 .
+ * @return The upper bound of the percentile's bucket in nanoseconds, at most the longest call.
+ */
+uint64_t probe_pct(const probe_counter *c, unsigned pct)
+{
+        uint64_t target = (c->calls * pct + 99) / 100;
+        uint64_t seen = 0;
+
+        for (unsigned b = 0; b < PROBE_BUCKETS; b++) {
+                seen += c->buckets[b];
+                if (seen >= target) {
+                        uint64_t bound = b + 1 < 64 ? (uint64_t)1 << (b + 1) : UINT64_MAX;
+                        return bound < c->max ? bound : c->max;
+                }
+        }
+
+        return c->max;
+}
+#endif
+
+/**
+ * @brief Sets a report request. The handler of \c SIGUSR1 .
+ * @param sig The signal's number.
+ */
+void probe_on_signal(int sig)
+{
+        (void)sig;
+        probe_requested = 1;
+}
+
+/**
+ * @brief Sets the handler of \c SIGUSR1 , which requests a report, see \c probe_poll() .
+ */
+void probe_signals(void)
+{
+        struct sigaction sa = {0};
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = probe_on_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &sa, NULL);
+}
+
+/**
+ * @brief Prints the latency and the memory report if they were requested by \c SIGUSR1 since the last call.
+ * @param dst The destination of the reports.
+ */
+void probe_poll(FILE *dst)
+{
+        if (!probe_requested)
+                return;
+
+        probe_requested = 0;
+        probe_report(dst);
+        probe_mem_report(dst);
+}
+
+/**
+ * @brief Formats the report's row of a timed function: the number of calls and the latencies in microseconds.
+ * @param id The timed function.
+ * @param dst The destination of the row, without a newline. See \c PROBE_HEADER for the columns.
+ * @param size The size of \c dst .
+ * @return \c true on success, \c false if the function wasn't called, or if the timing is disabled.
+ * @note The counters keep running while they're read, so a row may miss the calls in progress.
+ */
+bool probe_row(probe_id id, char *dst, size_t size)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        probe_counter sum = {0};
+
+        for (size_t s = 0; s <= PROBE_SLOTS; s++) {
+                const probe_counter *c = &probe_slots[s].counters[id];
+                sum.calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+                sum.total += __atomic_load_n(&c->total, __ATOMIC_RELAXED);
+
+                uint64_t max = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+                if (max > sum.max)
+                        sum.max = max;
+
+                for (unsigned b = 0; b < PROBE_BUCKETS; b++)
+                        sum.buckets[b] += __atomic_load_n(&c->buckets[b], __ATOMIC_RELAXED);
+        }
+
+        if (!sum.calls)
+                return false;
+
+        snprintf(dst, size, "%-18s %10llu %10.1f %10.1f %10.1f %10.1f", probe_names[id], (unsigned long long)sum.calls,
+                 sum.total / 1e3 / sum.calls, probe_pct(&sum, 50) / 1e3, probe_pct(&sum, 99) / 1e3, sum.max / 1e3);
+        return true;
+#else
+        (void)probe_names;
+        (void)id;
+        (void)dst;
+        (void)size;
+        return false;
+#endif
+}
+
+/**
+ * @brief Prints the number of calls and the latencies of the timed functions since the start of the program.
+ * @param dst The destination of the report.
+ * @note The functions that weren't called are left out.
+ */
+void probe_report(FILE *dst)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        fprintf(dst, "%s\n", PROBE_HEADER);
+
+        char row[PROBE_ROW_SIZE];
+        for (int id = 0; id < PROBE_CNT; id++) {
+                if (probe_row(id, row, sizeof(row)))
+                        fprintf(dst, "%s\n", row);
+        }
+#else
+        fprintf(dst, "Az idomeres ki van kapcsolva (REPAIRSHOP_NO_PROBES).\n");
+#endif
+}
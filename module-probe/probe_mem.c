@@ -0,0 +1,261 @@
+/**
+ * @file probe_mem.c
+ * @brief The memory accounting of the objects, by their owners.
+ * @details The allocations and frees of the clients, cars, operations, vectors, search results and indexes are
+ *          accounted where they happen (see \c PROBE_ALLOC() and \c PROBE_FREE() ): the number of live objects and
+ *          their bytes, without the allocator's overhead. The largest number of bytes (the high-water mark) is kept for
+ *          every owner and for the total.\n
+ *          A thread collects its changes in its own slot, and adds them to the shared totals once they reach
+ *          \c PROBE_MEM_BATCH bytes, so the threads importing a database don't fight over the totals' cache lines. The
+ *          report adds the slots to the totals, so the live objects are exact (up to the changes in progress). The
+ *          peaks are measured on the totals, so they may miss up to \c PROBE_MEM_BATCH bytes per thread.
+ * @note The accounted bytes are what the code asks for (e.g. a vector's capacity), not what the allocator uses. The
+ *       retired blocks of the concurrent databases are accounted as freed when they're retired.
+ */
+
+#include "../include/platform.h"
+
+#include <pthread.h>
+
+#include "include/probe.h"
+
+/** The names of the owners in the report, in the order of \c probe_mem_kind . */
+static const char *probe_mem_names[PROBE_MEM_CNT] = {
+        "ugyfelek", "autok", "javitasok", "vektorok", "talalatok", "indexek"
+};
+
+#ifndef REPAIRSHOP_NO_PROBES
+/**
+ * @struct probe_mem_sum probe_mem.c
+ * @brief The shared totals of an owner. Aligned to a cache line, so the owners don't share lines.
+ */
+typedef struct probe_mem_sum {
+        long long bytes;        /**< The bytes of the live objects. */
+        long long objects;      /**< The number of the live objects. */
+        long long peak;         /**< The largest value of \c bytes . */
+} __attribute__((aligned(64))) probe_mem_sum;
+
+/**
+ * @struct probe_mem_slot probe_mem.c
+ * @brief A thread's changes, not added to the totals yet. Aligned to a cache line, so the threads don't share lines.
+ */
+typedef struct probe_mem_slot {
+        long long bytes[PROBE_MEM_CNT];         /**< The change of the bytes, by owner. */
+        long long objects[PROBE_MEM_CNT];       /**< The change of the objects, by owner. */
+        bool used;                              /**< Set if a thread owns the slot. */
+} __attribute__((aligned(64))) probe_mem_slot;
+
+static probe_mem_sum probe_mem_sums[PROBE_MEM_CNT];
+static probe_mem_sum probe_mem_all;     /**< The totals of every owner, \c objects is unused. */
+
+/** The slots of the threads, the last one is shared by the threads that didn't get their own. */
+static probe_mem_slot probe_mem_slots[PROBE_SLOTS + 1];
+
+static pthread_once_t probe_mem_once = PTHREAD_ONCE_INIT;
+static pthread_key_t probe_mem_key;
+static THREAD_LOCAL probe_mem_slot *probe_mem_self;
+
+/**
+ * @brief Adds a change to a total, and raises its peak if needed.
+ * @param sum Pointer to the total.
+ * @param bytes The change of the bytes.
+ * @param objects The change of the objects.
+ */
+void probe_mem_apply(probe_mem_sum *sum, long long bytes, long long objects)
+{
+        long long now = __atomic_add_fetch(&sum->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&sum->objects, objects, __ATOMIC_RELAXED);
+
+        long long peak = __atomic_load_n(&sum->peak, __ATOMIC_RELAXED);
+        while (now > peak && !__atomic_compare_exchange_n(&sum->peak, &peak, now, true, __ATOMIC_RELAXED,
+                                                          __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Moves a slot's changes of an owner to the totals.
+ * @param slot Pointer to the slot.
+ * @param kind The owner.
+ */
+void probe_mem_flush(probe_mem_slot *slot, probe_mem_kind kind)
+{
+        long long bytes = __atomic_exchange_n(&slot->bytes[kind], 0, __ATOMIC_RELAXED);
+        long long objects = __atomic_exchange_n(&slot->objects[kind], 0, __ATOMIC_RELAXED);
+        if (!bytes && !objects)
+                return;
+
+        probe_mem_apply(&probe_mem_sums[kind], bytes, objects);
+        probe_mem_apply(&probe_mem_all, bytes, 0);
+}
+
+/**
+ * @brief Moves the changes of an exiting thread to the totals, and gives its slot back. The destructor of
+ *        \c probe_mem_key .
+ * @param slot Pointer to the slot.
+ */
+void probe_mem_release(void *slot)
+{
+        for (int kind = 0; kind < PROBE_MEM_CNT; kind++)
+                probe_mem_flush(slot, kind);
+
+        __atomic_store_n(&((probe_mem_slot *)slot)->used, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates \c probe_mem_key . Called once.
+ */
+void probe_mem_init(void)
+{
+        pthread_key_create(&probe_mem_key, probe_mem_release);
+}
+
+/**
+ * @brief Finds a free slot for the calling thread.
+ * @return Pointer to the slot, the shared one if every slot is taken.
+ */
+probe_mem_slot *probe_mem_claim(void)
+{
+        pthread_once(&probe_mem_once, probe_mem_init);
+
+        for (size_t i = 0; i < PROBE_SLOTS; i++) {
+                bool expected = false;
+                if (__atomic_compare_exchange_n(&probe_mem_slots[i].used, &expected, true, false, __ATOMIC_ACQ_REL,
+                                                __ATOMIC_RELAXED)) {
+                        pthread_setspecific(probe_mem_key, &probe_mem_slots[i]);
+                        return &probe_mem_slots[i];
+                }
+        }
+
+        return &probe_mem_slots[PROBE_SLOTS];
+}
+
+/**
+ * @brief Accounts allocated or freed objects. Use \c PROBE_ALLOC() and \c PROBE_FREE() instead.
+ * @param kind The owner of the objects.
+ * @param bytes The change of the bytes, negative for frees.
+ * @param objects The change of the number of objects, negative for frees.
+ * @note The additions are atomic because of the shared slot and the reports, the thread's own slot is not contended.
+ */
+void probe_mem(probe_mem_kind kind, long long bytes, long long objects)
+{
+        if (!probe_mem_self)
+                probe_mem_self = probe_mem_claim();
+
+        long long pending = __atomic_add_fetch(&probe_mem_self->bytes[kind], bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&probe_mem_self->objects[kind], objects, __ATOMIC_RELAXED);
+
+        if (pending >= PROBE_MEM_BATCH || pending <= -PROBE_MEM_BATCH)
+                probe_mem_flush(probe_mem_self, kind);
+}
+
+/**
+ * @brief Sums the totals of an owner and the changes of the threads not added to them yet.
+ * @param kind The owner, \c PROBE_MEM_CNT for every owner.
+ * @param dst The destination of the sums. The peak is the totals' peak.
+ */
+void probe_mem_sum_of(int kind, probe_mem_sum *dst)
+{
+        const probe_mem_sum *total = kind == PROBE_MEM_CNT ? &probe_mem_all : &probe_mem_sums[kind];
+        probe_mem_sum sum = {
+                __atomic_load_n(&total->bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&total->objects, __ATOMIC_RELAXED),
+                __atomic_load_n(&total->peak, __ATOMIC_RELAXED)
+        };
+
+        for (size_t s = 0; s <= PROBE_SLOTS; s++) {
+                for (int k = 0; k < PROBE_MEM_CNT; k++) {
+                        if (k != kind && kind != PROBE_MEM_CNT)
+                                continue;
+
+                        sum.bytes += __atomic_load_n(&probe_mem_slots[s].bytes[k], __ATOMIC_RELAXED);
+                        sum.objects += __atomic_load_n(&probe_mem_slots[s].objects[k], __ATOMIC_RELAXED);
+                }
+        }
+
+        if (sum.bytes > sum.peak)
+                sum.peak = sum.bytes;
+
+        *dst = sum;
+}
+
+/**
+ * @brief Formats a row of the memory report.
+ * @param dst The destination of the row, without a newline.
+ * @param size The size of \c dst .
+ * @param name The name of the row.
+ * @param sum The totals of the row.
+ * @param objects Set to \c false to leave the number of objects out.
+ */
+void probe_mem_fmt(char *dst, size_t size, const char *name, const probe_mem_sum *sum, bool objects)
+{
+        char cnt[24] = "-";
+        if (objects)
+                snprintf(cnt, sizeof(cnt), "%lld", sum->objects);
+
+        snprintf(dst, size, "%-18s %10s %10.1f %11.1f", name, cnt, sum->bytes / 1024.0, sum->peak / 1024.0);
+}
+#endif
+
+/**
+ * @brief Formats the memory report's row of an owner: its live objects, their size and its peak.
+ * @param kind The owner.
+ * @param dst The destination of the row, without a newline. See \c PROBE_MEM_HEADER for the columns.
+ * @param size The size of \c dst .
+ * @return \c true on success, \c false if the accounting is disabled.
+ */
+bool probe_mem_row(probe_mem_kind kind, char *dst, size_t size)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        probe_mem_sum sum;
+        probe_mem_sum_of(kind, &sum);
+        probe_mem_fmt(dst, size, probe_mem_names[kind], &sum, true);
+        return true;
+#else
+        (void)probe_mem_names;
+        (void)kind;
+        (void)dst;
+        (void)size;
+        return false;
+#endif
+}
+
+/**
+ * @brief Formats the memory report's last row: the size of every owner's objects, and the peak of their sum.
+ * @param dst The destination of the row, without a newline.
+ * @param size The size of \c dst .
+ * @return \c true on success, \c false if the accounting is disabled.
+ */
+bool probe_mem_total(char *dst, size_t size)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        probe_mem_sum sum;
+        probe_mem_sum_of(PROBE_MEM_CNT, &sum);
+        probe_mem_fmt(dst, size, "osszesen", &sum, false);
+        return true;
+#else
+        (void)dst;
+        (void)size;
+        return false;
+#endif
+}
+
+/**
+ * @brief Prints the memory held by every owner's objects, and the peaks since the start of the program.
+ * @param dst The destination of the report.
+ */
+void probe_mem_report(FILE *dst)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        char row[PROBE_ROW_SIZE];
+        fprintf(dst, "%s\n", PROBE_MEM_HEADER);
+
+        for (int kind = 0; kind < PROBE_MEM_CNT; kind++) {
+                probe_mem_row(kind, row, sizeof(row));
+                fprintf(dst, "%s\n", row);
+        }
+
+        probe_mem_total(row, sizeof(row));
+        fprintf(dst, "%s\n", row);
+#else
+        fprintf(dst, "A memoria szamlalas ki van kapcsolva (REPAIRSHOP_NO_PROBES).\n");
+#endif
+}
@@ -0,0 +1,224 @@
+/**
+ * @file probe_trace.c
+ * @brief The timeline of the startup, the saves and the queries, in the Chrome trace-event format.
+ * @details The tracing is started by \c probe_trace_start() (the \c -T switch). From then on every timed call (see
+ *          \c PROBE() ), every span (see \c TRACE() ) and every task of the parallel jobs is recorded with its start
+ *          and duration, by the thread that ran it. The spans of a thread nest by their times, so the viewer shows the
+ *          phases and their sub-steps (e.g. \c fh_import , the shards' \c import tasks and their \c fh_read ,
+ *          \c fh_verify and \c fh_parse ) on the threads' own rows.\n
+ *          The events are kept in memory, in the threads' own buffers, and written to the file when the program exits.
+ *          Nothing is written while it runs, so the timeline isn't disturbed by the tracing's I/O. At most
+ *          \c PROBE_TRACE_MAX events are kept, the later ones are only counted.\n
+ *          The file can be opened in \c chrome://tracing or in Perfetto.
+ * @note The buffers are written by an \c atexit() handler, after the workers have stopped. A thread's buffer is only
+ *       written by its thread, so recording an event takes no locks, only the first event of a thread does.
+ */
+
+#include "../include/platform.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "include/probe.h"
+
+#ifndef REPAIRSHOP_NO_PROBES
+/**
+ * @struct probe_event probe_trace.c
+ * @brief A recorded span.
+ */
+typedef struct probe_event {
+        const char *name;       /**< The span's name, a string literal. */
+        uint64_t start;         /**< The start of the span, see \c probe_now() . */
+        uint64_t dur;           /**< The duration of the span in nanoseconds. */
+} probe_event;
+
+/**
+ * @struct probe_trace_buf probe_trace.c
+ * @brief The events of a thread. Kept after the thread exits, until they're written.
+ */
+typedef struct probe_trace_buf {
+        probe_event *events;            /**< The events, in the order of their ends. */
+        size_t cnt;                     /**< Number of events. */
+        size_t capacity;                /**< The size of \c events . */
+        unsigned tid;                   /**< The thread's number in the file, \c 1 is the one that started tracing. */
+        struct probe_trace_buf *next;   /**< The next thread's buffer. */
+} probe_trace_buf;
+
+/** Set while the events are recorded. */
+static bool probe_tracing;
+/** The start of the tracing, the timestamps of the file are relative to it. */
+static uint64_t probe_trace_origin;
+/** The destination of the events, opened by \c probe_trace_start() . */
+static FILE *probe_trace_file;
+/** The number of the recorded events, of every thread. */
+static size_t probe_trace_cnt;
+/** The number of the events dropped after \c PROBE_TRACE_MAX , or after a failed allocation. */
+static size_t probe_trace_dropped;
+
+/** The buffers of the threads, guarded by \c probe_trace_lock . */
+static probe_trace_buf *probe_trace_bufs;
+static unsigned probe_trace_threads;
+static pthread_mutex_t probe_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static THREAD_LOCAL probe_trace_buf *probe_trace_self;
+
+/**
+ * @brief Creates the calling thread's buffer and adds it to the list.
+ * @return Pointer to the buffer, \c NULL if it cannot be allocated.
+ */
+probe_trace_buf *probe_trace_claim(void)
+{
+        probe_trace_buf *buf = calloc(1, sizeof(probe_trace_buf));
+        if (!buf)
+                return NULL;
+
+        pthread_mutex_lock(&probe_trace_lock);
+        buf->tid = ++probe_trace_threads;
+        buf->next = probe_trace_bufs;
+        probe_trace_bufs = buf;
+        pthread_mutex_unlock(&probe_trace_lock);
+
+        return buf;
+}
+
+/**
+ * @brief Records a span, if tracing is on.
+ * @param name The span's name. It must live until the program exits, e.g. a string literal.
+ * @param start The start of the span, see \c probe_now() .
+ * @param ns The duration of the span in nanoseconds.
+ */
+void probe_trace_add(const char *name, uint64_t start, uint64_t ns)
+{
+        if (!__atomic_load_n(&probe_tracing, __ATOMIC_ACQUIRE))
+                return;
+
+        if (__atomic_fetch_add(&probe_trace_cnt, 1, __ATOMIC_RELAXED) >= PROBE_TRACE_MAX)
+                goto dropped;
+
+        if (!probe_trace_self && !(probe_trace_self = probe_trace_claim()))
+                goto dropped;
+
+        probe_trace_buf *buf = probe_trace_self;
+        if (buf->cnt == buf->capacity) {
+                size_t capacity = buf->capacity ? buf->capacity * 2 : 1024;
+                probe_event *events = realloc(buf->events, capacity * sizeof(probe_event));
+                if (!events)
+                        goto dropped;
+
+                buf->events = events;
+                buf->capacity = capacity;
+        }
+
+        buf->events[buf->cnt++] = (probe_event){name, start, ns};
+        return;
+
+dropped:
+        __atomic_fetch_add(&probe_trace_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Starts a span. Use \c TRACE() or \c TRACE_BEGIN() instead.
+ * @param name The span's name, a string literal.
+ * @return The running span. Its start is \c 0 if tracing is off, then it's not recorded.
+ */
+probe_span probe_span_begin(const char *name)
+{
+        probe_span s = {name, 0};
+        if (__atomic_load_n(&probe_tracing, __ATOMIC_RELAXED))
+                s.start = probe_now();
+
+        return s;
+}
+
+/**
+ * @brief Records a span. Called by the cleanup of \c TRACE() , or by \c TRACE_END() .
+ * @param s The running span.
+ */
+void probe_span_end(probe_span *s)
+{
+        if (s->start)
+                probe_trace_add(s->name, s->start, probe_now() - s->start);
+}
+
+/**
+ * @brief Writes the recorded events to the file and frees the buffers. Registered with \c atexit() .
+ */
+void probe_trace_flush(void)
+{
+        __atomic_store_n(&probe_tracing, false, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&probe_trace_lock);
+        FILE *dst = probe_trace_file;
+        probe_trace_file = NULL;
+
+        if (dst)
+                fprintf(dst, "{\"traceEvents\":[\n");
+
+        bool first = true;
+        for (probe_trace_buf *buf = probe_trace_bufs; buf; ) {
+                if (dst) {
+                        char name[24];
+                        snprintf(name, sizeof(name), buf->tid == 1 ? "fo szal" : "%u. szal", buf->tid);
+                        fprintf(dst, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                                     "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buf->tid, name);
+                        first = false;
+                }
+
+                for (size_t i = 0; dst && i < buf->cnt; i++) {
+                        const probe_event *e = &buf->events[i];
+                        /* A timed call that was running when the tracing started is cut at its start. */
+                        uint64_t start = e->start > probe_trace_origin ? e->start - probe_trace_origin : 0;
+                        uint64_t end = e->start + e->dur > probe_trace_origin ? e->start + e->dur - probe_trace_origin
+                                                                               : 0;
+
+                        fprintf(dst, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                                e->name, buf->tid, start / 1e3, (end - start) / 1e3);
+                }
+
+                probe_trace_buf *next = buf->next;
+                free(buf->events);
+                free(buf);
+                buf = next;
+        }
+
+        probe_trace_bufs = NULL;
+        probe_trace_self = NULL;
+        pthread_mutex_unlock(&probe_trace_lock);
+
+        if (!dst)
+                return;
+
+        fprintf(dst, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu}}\n",
+                __atomic_load_n(&probe_trace_dropped, __ATOMIC_RELAXED));
+
+        if (fclose(dst))
+                fprintf(stderr, "Nem sikerult kiirni az idovonalat.\n");
+}
+#endif
+
+/**
+ * @brief Starts recording the timeline. It's written to a file when the program exits.
+ * @param path The file's path. It's created (or truncated) now, so an unusable path is reported early.
+ * @return \c true on success, \c false if the file cannot be created, or if the probes are disabled.
+ * @note Call it once, before the threads of the parallel jobs start working, so their spans are recorded.
+ */
+bool probe_trace_start(const char *path)
+{
+#ifndef REPAIRSHOP_NO_PROBES
+        if (probe_trace_file)
+                return false;
+
+        probe_trace_file = fopen(path, "w");
+        if (!probe_trace_file)
+                return false;
+
+        /* The starting thread gets its buffer first, so it's the first row of the viewer. */
+        probe_trace_self = probe_trace_claim();
+        probe_trace_origin = probe_now();
+        atexit(probe_trace_flush);
+        __atomic_store_n(&probe_tracing, true, __ATOMIC_RELEASE);
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+}
@@ -0,0 +1,79 @@
+/**
+ * @file srv.h
+ * @brief Module header file. Include this to serve a database over a Unix socket, to use a served one, or to run
+ *        command scripts.
+ * @details See \c srv.c for the protocol, \c srv_client.c for the thin client and \c srv_batch.c for the batch mode.
+ */
+
+#ifndef REPAIRSHOP_SRV_H
+#define REPAIRSHOP_SRV_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "../../module-database/include/database.h"
+#include "../../module-filehandler/include/fh.h"
+#include "../../include/errorcodes.h"
+#include "../../include/search.h"
+#include "../../module-probe/include/probe.h"
+
+/** The longest request or response line, without the newline. */
+#define SRV_LINE_MAX (LONGEST_JOURNAL_LINE + 32)
+/** The most records a transaction request may have, see \c srv_tx() . */
+#define SRV_TX_MAX 64
+/** The requests of a connection are not read while it has more unsent output than this. */
+#define SRV_OUT_HIGH (1 << 20)
+/** A watching connection is dropped if it has more unsent output than this, see \c srv_notify() . */
+#define SRV_OUT_MAX (64 << 20)
+/** The number of clients a dump sends before the server turns to the other connections. */
+#define SRV_DUMP_STEP 256
+/** The number of bytes read from a socket at once. */
+#define SRV_READ_SIZE (1 << 16)
+
+/** Number of failed commands whose line number is kept by the batch mode. */
+#define SRV_BATCH_ERROR_LOG 10
+
+/**
+ * @struct srv_buf srv.h
+ * @brief A growable byte buffer. Data is appended at the end and consumed from the front.
+ */
+typedef struct srv_buf {
+        char *data;     /**< The buffer, \c NULL until the first append. */
+        size_t off;     /**< The offset of the first unconsumed byte. */
+        size_t len;     /**< The end of the data. */
+        size_t cap;     /**< The allocated size. */
+} srv_buf;
+
+/**
+ * @struct srv_batch_stats srv.h
+ * @brief The result of a command script. See \c srv_batch.c .
+ */
+typedef struct srv_batch_stats {
+        size_t cmds;                            /**< Number of commands, without the empty lines and comments. */
+        size_t failed;                          /**< Number of failed commands. */
+        size_t fail_lines[SRV_BATCH_ERROR_LOG]; /**< The line numbers of the first failed commands. */
+        int fail_codes[SRV_BATCH_ERROR_LOG];    /**< The error codes of the first failed commands. */
+        double secs;                            /**< The duration of the script in seconds. */
+} srv_batch_stats;
+
+int srv_buf_reserve(srv_buf *b, size_t n);
+int srv_buf_put(srv_buf *b, const char *src, size_t n);
+int srv_buf_printf(srv_buf *b, const char *fmt, ...);
+void srv_buf_take(srv_buf *b, size_t n);
+void srv_buf_free(srv_buf *b);
+
+int srv_dump_head(const database *db, srv_buf *out);
+int srv_dump_part(const database *db, srv_buf *out, idx from, idx to);
+int srv_cmd(database *db, srv_buf *out, const char *line);
+int srv_tx(database *db, const char *block, size_t cnt);
+
+int srv_batch(database *db, const char *path, srv_batch_stats *stats);
+
+int srv_run(database *db, const char *path);
+
+int srv_connect(database *db, const char *path);
+void srv_pull(void);
+void srv_disconnect(database *db);
+
+#endif //REPAIRSHOP_SRV_H
@@ -0,0 +1,765 @@
+/**
+ * @file srv.c
+ * @brief Serves a database to several terminals over a Unix domain socket.
+ * @details The server is an event loop: \c poll() waits on the listening socket and every connection, then the requests
+ *          of the connections are answered in parallel by the worker pool (see \c pool.c ). The database is concurrent
+ *          (see \c db_concurrent() ), so the queries don't wait for each other or for the changes. The changes are
+ *          applied one at a time, in the order of their sequence numbers.\n
+ *          The protocol is line based, and the changes use the journal's record formats (see \c fh_journal.c ), so a
+ *          change is applied the same way it's replayed. Every request line is answered with zero or more data lines
+ *          and a status line:\n
+ *          \c =err|seq , where \c err is an error code (\c 0 on success) and \c seq is the number of changes applied
+ *          since the server started. A query answers with the number before it started, its result may already contain
+ *          the changes made during it.\n
+ *          Requests:\n
+ *          \c record : applies a journal record, e.g. \c +U>name|email|phone .\n
+ *          \c #seq \c record : applies the record only if the database is still at \c seq , \c ECONFL otherwise. The
+ *          record's indexes are only meaningful for the state the client has seen.\n
+ *          \c #seq \c T>n and \c n records on the next lines: applies the records of a transaction as a whole or not
+ *          at all (see \c srv_tx() ), with a single status. They count as \c n changes, and they are notified one by
+ *          one. The \c #seq prefix is optional, like for a single record.\n
+ *          \c ?U>name : the clients with the name, as \c U>cl|name|email|phone lines.\n
+ *          \c ?A>plate : the cars with the plate, as \c A>cl|cr|name|plate lines.\n
+ *          \c ?J> : the inspections expiring within 30 days, as \c J>cl|cr|op|desc|price|date_cr|date_exp lines.\n
+ *          \c ?D> : the whole database as journal records, which rebuild it on an empty database. The connection
+ *          receives every later change of the other connections as \c !seq|record lines, between two responses.\n
+ *          A client may send several requests without waiting for the answers, they are answered in order.\n
+ *          A dump is read from a pinned version of the database (see \c db_pin() ) and sent in parts, while the other
+ *          connections are served. The changes made in the meantime are not in the dump, they are notified after it.
+ * @note A connection that doesn't read its notifications is dropped, see \c SRV_OUT_MAX .
+ */
+
+#include "../include/platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "include/srv.h"
+#include "../module-pool/include/pool.h"
+
+/**
+ * @struct srv_conn srv.c
+ * @brief A client connection.
+ */
+typedef struct srv_conn {
+        int fd;         /**< The connection's socket. */
+        srv_buf in;     /**< The received bytes that aren't a complete request yet. */
+        srv_buf out;    /**< The responses and notifications not sent yet. */
+        bool watch;     /**< Set if the connection receives the changes of the others. */
+        bool eof;       /**< Set if the peer has closed its side. The connection is closed after the output is sent. */
+        bool dead;      /**< Set if the connection has failed. It's closed right away. */
+        bool ready;     /**< Set if new bytes were read, so the requests are answered, see \c srv_process_part() . */
+        database *dump;         /**< The pinned version being dumped, \c NULL if there is no dump in progress. */
+        idx dump_pos;           /**< The next client of the dump. */
+        unsigned long dump_seq; /**< The sequence number of the dumped version. */
+        srv_buf held;           /**< The notifications of the changes made during the dump, sent after it. */
+} srv_conn;
+
+/**
+ * @struct srv_ctx srv.c
+ * @brief The state of the event loop.
+ * @details While the requests are answered, \c lock protects \c seq and every connection's \c out , \c held ,
+ *          \c watch , \c dump and \c dead fields, since the changes are notified to the other connections.
+ */
+typedef struct srv_ctx {
+        database *db;           /**< The served database. */
+        vector *conns;          /**< The open connections (\c srv_conn pointers). */
+        unsigned long seq;      /**< The number of changes applied. */
+        pthread_mutex_t lock;   /**< Serializes the changes and the output of the connections. */
+} srv_ctx;
+
+/** A signal handler writes into it to stop the event loop. */
+static int srv_stop_pipe[2] = {-1, -1};
+
+/**
+ * @brief Makes sure that the buffer has room for \c n more bytes. Consumed bytes are reused first.
+ * @param b Pointer to the buffer.
+ * @param n The number of bytes.
+ * @retval 0 On success.
+ * @retval EMALLOC If the buffer can't be grown.
+ */
+int srv_buf_reserve(srv_buf *b, size_t n)
+{
+        if (b->off == b->len) {
+                b->off = 0;
+                b->len = 0;
+        }
+        else if (b->off > 0 && b->len + n > b->cap) {
+                memmove(b->data, b->data + b->off, b->len - b->off);
+                b->len -= b->off;
+                b->off = 0;
+        }
+
+        if (b->len + n <= b->cap)
+                return 0;
+
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n)
+                cap *= 2;
+
+        char *tmp = realloc(b->data, cap);
+        if (!tmp)
+                return EMALLOC;
+
+        b->data = tmp;
+        b->cap = cap;
+        return 0;
+}
+
+/**
+ * @brief Appends bytes to a buffer.
+ * @param b Pointer to the buffer.
+ * @param src The bytes to be appended.
+ * @param n The number of bytes.
+ * @retval 0 On success.
+ * @retval EMALLOC If the buffer can't be grown.
+ */
+int srv_buf_put(srv_buf *b, const char *src, size_t n)
+{
+        if (srv_buf_reserve(b, n))
+                return EMALLOC;
+
+        memcpy(b->data + b->len, src, n);
+        b->len += n;
+        return 0;
+}
+
+/**
+ * @brief Appends a \c printf() style formatted string to a buffer.
+ * @param b Pointer to the buffer.
+ * @param fmt The format string.
+ * @retval 0 On success.
+ * @retval EMALLOC If the buffer can't be grown.
+ * @retval EINV If the string can't be formatted.
+ */
+int srv_buf_printf(srv_buf *b, const char *fmt, ...)
+{
+        /* Most lines fit into the spare room, so they are formatted only once. */
+        if (srv_buf_reserve(b, 256))
+                return EMALLOC;
+
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+        va_end(args);
+
+        if (n < 0)
+                return EINV;
+
+        if ((size_t)n >= b->cap - b->len) {
+                if (srv_buf_reserve(b, (size_t)n + 1))
+                        return EMALLOC;
+
+                va_start(args, fmt);
+                vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+                va_end(args);
+        }
+
+        b->len += (size_t)n;
+        return 0;
+}
+
+/**
+ * @brief Consumes bytes from the front of a buffer.
+ * @param b Pointer to the buffer.
+ * @param n The number of bytes, at most the number of unconsumed bytes.
+ */
+void srv_buf_take(srv_buf *b, size_t n)
+{
+        b->off += n;
+
+        if (b->off == b->len) {
+                b->off = 0;
+                b->len = 0;
+        }
+}
+
+/**
+ * @brief Frees the buffer's memory. The buffer can be used again.
+ * @param b Pointer to the buffer.
+ */
+void srv_buf_free(srv_buf *b)
+{
+        free(b->data);
+        *b = (srv_buf){0};
+}
+
+/**
+ * @brief Stops the event loop. The handler of \c SIGINT and \c SIGTERM .
+ * @param sig The signal's number.
+ */
+void srv_on_signal(int sig)
+{
+        (void)sig;
+        int saved = errno;
+
+        /* If the pipe is full, the loop is stopping anyway. */
+        ssize_t n = write(srv_stop_pipe[1], "", 1);
+        (void)n;
+
+        errno = saved;
+}
+
+/**
+ * @brief Puts a file descriptor into non-blocking mode.
+ * @param fd The file descriptor.
+ * @return \c 0 on success, \c -1 on failure.
+ */
+int srv_nonblock(int fd)
+{
+        int flags = fcntl(fd, F_GETFL);
+        return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief Creates the listening socket.
+ * @param path The socket's path.
+ * @return The socket, \c -1 on failure.
+ * @note A socket file left behind by a stopped server is removed, but a running server's socket and other files are
+ *       not touched.
+ */
+int srv_listen(const char *path)
+{
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(path) >= sizeof(addr.sun_path))
+                return -1;
+
+        strcpy(addr.sun_path, path);
+
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+                if (!S_ISSOCK(st.st_mode))
+                        return -1;
+
+                int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+                bool alive = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+                if (probe >= 0)
+                        close(probe);
+
+                if (alive)
+                        return -1;
+
+                unlink(path);
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                return -1;
+
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, SOMAXCONN) || srv_nonblock(fd)) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/**
+ * @brief Sends a change to every other watching connection.
+ * @param ctx Pointer to the event loop's state.
+ * @param from The connection that made the change.
+ * @param record The change's journal record.
+ * @note The caller must hold \c ctx->lock .
+ */
+void srv_notify(srv_ctx *ctx, const srv_conn *from, const char *record)
+{
+        for (idx i = 0; i < ctx->conns->size; i++) {
+                srv_conn *c = vct_subptr(ctx->conns, i);
+                if (c == from || !c->watch || c->dead)
+                        continue;
+
+                /* A terminal that doesn't read its notifications would make the server buffer every change. */
+                srv_buf *dst = c->dump ? &c->held : &c->out;
+                if (dst->len - dst->off > SRV_OUT_MAX || srv_buf_printf(dst, "!%lu|%s\n", ctx->seq, record))
+                        c->dead = true;
+        }
+}
+
+/**
+ * @brief Reads the number of records of a transaction request.
+ * @param line The request's first line.
+ * @return The \c n of the request's \c T>n marker, \c 0 if the request isn't a transaction.
+ */
+size_t srv_tx_header(const char *line)
+{
+        if (line[0] == '#') {
+                line += 1 + strspn(line + 1, "0123456789");
+                if (*line++ != ' ')
+                        return 0;
+        }
+
+        if (line[0] != 'T' || line[1] != '>' || line[2] < '0' || line[2] > '9')
+                return 0;
+
+        return strtoul(line + 2, NULL, 10);
+}
+
+/**
+ * @brief Applies a change.
+ * @param ctx Pointer to the event loop's state.
+ * @param c The connection.
+ * @param line The request, a journal record or a transaction with an optional \c #seq prefix.
+ * @retval 0 On success.
+ * @retval ECONFL If the database has changed since the requested state.
+ * @return For the other return values see \c fh_jrnl_exec() and \c srv_tx() .
+ * @note The caller must hold \c ctx->lock .
+ */
+int srv_mutate(srv_ctx *ctx, srv_conn *c, char *line)
+{
+        char *record = line;
+
+        if (line[0] == '#') {
+                char *end = NULL;
+                unsigned long base = strtoul(line + 1, &end, 10);
+                if (end == line + 1 || *end != ' ')
+                        return EINV;
+
+                if (base != ctx->seq)
+                        return ECONFL;
+
+                record = end + 1;
+        }
+
+        if (record[0] == 'T' && record[1] == '>') {
+                size_t cnt = strtoul(record + 2, NULL, 10);
+                char *block = strchr(record, '\n');
+                int retval = block ? srv_tx(ctx->db, block + 1, cnt) : EINV;
+                if (retval)
+                        return retval;
+
+                /* The others apply the records one after the other, which gives the same result, see tx.c. */
+                for (size_t k = 0; k < cnt; k++) {
+                        record = block + 1;
+                        block = strchr(record, '\n');
+                        if (block)
+                                *block = '\0';
+
+                        size_t len = strlen(record);
+                        if (len > 0 && record[len - 1] == '\r')
+                                record[len - 1] = '\0';
+
+                        ctx->seq++;
+                        srv_notify(ctx, c, record);
+                }
+
+                return 0;
+        }
+
+        int retval = fh_jrnl_exec(ctx->db, record);
+        if (retval)
+                return retval;
+
+        ctx->seq++;
+        srv_notify(ctx, c, record);
+        return 0;
+}
+
+/**
+ * @brief Finishes a dump: sends its status and the changes made during it.
+ * @param c The connection.
+ * @param err The error code of the dump.
+ */
+void srv_dump_end(srv_conn *c, int err)
+{
+        if (srv_buf_printf(&c->out, "=%d|%lu\n", err, c->dump_seq) ||
+            (c->held.len > c->held.off && srv_buf_put(&c->out, c->held.data + c->held.off, c->held.len - c->held.off)))
+                c->dead = true;
+
+        srv_buf_free(&c->held);
+        db_snap_rel(c->dump);
+        c->dump = NULL;
+}
+
+/**
+ * @brief Starts a dump of the current version of the database.
+ * @param ctx Pointer to the event loop's state.
+ * @param c The connection.
+ * @note The caller must hold \c ctx->lock .
+ */
+void srv_dump_begin(srv_ctx *ctx, srv_conn *c)
+{
+        c->dump_pos = 0;
+        c->dump_seq = ctx->seq;
+        c->watch = true;
+        c->dump = db_pin(ctx->db);
+
+        if (!c->dump) {
+                if (srv_buf_printf(&c->out, "=%d|%lu\n", EMALLOC, ctx->seq))
+                        c->dead = true;
+                return;
+        }
+
+        if (srv_dump_head(c->dump, &c->out))
+                srv_dump_end(c, EMALLOC);
+}
+
+/**
+ * @brief Sends the next part of a dump.
+ * @param c The connection.
+ * @return \c true if the dump has finished.
+ */
+bool srv_dump_step(srv_conn *c)
+{
+        idx cnt = db_cl_cnt(c->dump);
+        idx to = c->dump_pos + SRV_DUMP_STEP < cnt ? c->dump_pos + SRV_DUMP_STEP : cnt;
+
+        int retval = srv_dump_part(c->dump, &c->out, c->dump_pos, to);
+        c->dump_pos = to;
+
+        if (retval || to == cnt) {
+                srv_dump_end(c, retval);
+                return true;
+        }
+
+        return false;
+}
+
+/**
+ * @brief Answers every complete request of a connection, in order.
+ * @details The queries run without \c ctx->lock , into a buffer of their own, so the connections' queries run in
+ *          parallel. A result is appended to the output together with its status line, so the notifications of the
+ *          others only come between two responses.
+ * @param ctx Pointer to the event loop's state.
+ * @param c The connection.
+ */
+void srv_process(srv_ctx *ctx, srv_conn *c)
+{
+        srv_buf res = {0};
+        bool dead = false;
+        size_t limit = SRV_LINE_MAX;
+
+        /* The requests after a dump wait for it. */
+        while (!c->dump && !dead) {
+                char *start = c->in.data + c->in.off;
+                char *nl = c->in.len > c->in.off ? memchr(start, '\n', c->in.len - c->in.off) : NULL;
+                if (!nl)
+                        break;
+
+                /* A transaction's records belong to its request, it's answered when all of them have arrived. */
+                size_t recs = srv_tx_header(start);
+                if (recs > SRV_TX_MAX) {
+                        limit = 0;
+                        break;
+                }
+
+                for (size_t k = 0; k < recs && nl; k++)
+                        nl = memchr(nl + 1, '\n', (size_t)(c->in.data + c->in.len - nl - 1));
+
+                if (!nl) {
+                        limit = (SRV_TX_MAX + 1) * (SRV_LINE_MAX + 1);
+                        break;
+                }
+
+                size_t len = (size_t)(nl - start);
+                *nl = '\0';
+                if (len > 0 && start[len - 1] == '\r')
+                        start[len - 1] = '\0';
+
+                if (!strcmp(start, "?D>")) {
+                        srv_buf_take(&c->in, len + 1);
+                        pthread_mutex_lock(&ctx->lock);
+                        srv_dump_begin(ctx, c);
+                        dead = c->dead;
+                        pthread_mutex_unlock(&ctx->lock);
+                        continue;
+                }
+
+                int retval = EINV;
+                bool change = start[0] == '#' || start[0] == '+' || start[0] == '~' || start[0] == '-' ||
+                              start[0] == 'T';
+
+                pthread_mutex_lock(&ctx->lock);
+                unsigned long seq = ctx->seq;
+                if (len < (recs + 1) * (SRV_LINE_MAX + 1) && change) {
+                        retval = srv_mutate(ctx, c, start);
+                        seq = ctx->seq;
+                }
+                else if (len <= SRV_LINE_MAX && start[0] == '?') {
+                        pthread_mutex_unlock(&ctx->lock);
+                        retval = srv_cmd(ctx->db, &res, start);
+                        pthread_mutex_lock(&ctx->lock);
+                }
+
+                if ((res.len > res.off && srv_buf_put(&c->out, res.data + res.off, res.len - res.off)) ||
+                    srv_buf_printf(&c->out, "=%d|%lu\n", retval, seq))
+                        c->dead = true;
+
+                dead = c->dead;
+                pthread_mutex_unlock(&ctx->lock);
+
+                srv_buf_take(&res, res.len - res.off);
+                srv_buf_take(&c->in, len + 1);
+        }
+
+        srv_buf_free(&res);
+
+        /* A line or a transaction can't be this long, the peer doesn't speak the protocol. */
+        if (c->in.len - c->in.off > limit) {
+                pthread_mutex_lock(&ctx->lock);
+                c->dead = true;
+                pthread_mutex_unlock(&ctx->lock);
+        }
+}
+
+/**
+ * @brief Answers the requests of the connections that have received new bytes. A task of \c pool_for() .
+ * @param arg Pointer to the event loop's state.
+ * @param from The index of the first connection.
+ * @param to The index after the last connection.
+ */
+void srv_process_part(void *arg, size_t from, size_t to)
+{
+        srv_ctx *ctx = arg;
+
+        for (idx i = from; i < to; i++) {
+                srv_conn *c = vct_subptr(ctx->conns, i);
+                if (c->ready && !c->dead)
+                        srv_process(ctx, c);
+
+                c->ready = false;
+        }
+}
+
+/**
+ * @brief Reads the available bytes of a connection. Its requests are answered by \c srv_process_part() .
+ * @param c The connection.
+ */
+void srv_read(srv_conn *c)
+{
+        if (srv_buf_reserve(&c->in, SRV_READ_SIZE)) {
+                c->dead = true;
+                return;
+        }
+
+        ssize_t n = read(c->fd, c->in.data + c->in.len, SRV_READ_SIZE);
+        if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        c->dead = true;
+                return;
+        }
+
+        if (n == 0) {
+                c->eof = true;
+                return;
+        }
+
+        c->in.len += (size_t)n;
+        c->ready = true;
+}
+
+/**
+ * @brief Sends as much of a connection's output as the socket takes.
+ * @param c The connection.
+ */
+void srv_write(srv_conn *c)
+{
+        while (c->out.len > c->out.off) {
+                ssize_t n = write(c->fd, c->out.data + c->out.off, c->out.len - c->out.off);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                c->dead = true;
+                        return;
+                }
+
+                srv_buf_take(&c->out, (size_t)n);
+        }
+
+        /* A dump can be large, its buffer is not kept. */
+        if (c->out.cap > SRV_OUT_HIGH)
+                srv_buf_free(&c->out);
+}
+
+/**
+ * @brief Accepts the waiting connections.
+ * @param ctx Pointer to the event loop's state.
+ * @param fd The listening socket.
+ */
+void srv_accept(srv_ctx *ctx, int fd)
+{
+        for (;;) {
+                int cfd = accept(fd, NULL, NULL);
+                if (cfd < 0)
+                        return;
+
+                srv_conn *c = calloc(1, sizeof(srv_conn));
+                if (!c || srv_nonblock(cfd) || vct_push(ctx->conns, c)) {
+                        free(c);
+                        close(cfd);
+                        continue;
+                }
+
+                c->fd = cfd;
+        }
+}
+
+/**
+ * @brief Closes a connection and removes it from the event loop.
+ * @param ctx Pointer to the event loop's state.
+ * @param pos The connection's index in \c ctx->conns .
+ */
+void srv_close(srv_ctx *ctx, idx pos)
+{
+        srv_conn *c = vct_subptr(ctx->conns, pos);
+        close(c->fd);
+        srv_buf_free(&c->in);
+        srv_buf_free(&c->out);
+        srv_buf_free(&c->held);
+        db_snap_rel(c->dump);
+        vct_rm(ctx->conns, pos);
+}
+
+/**
+ * @brief Sets the signal handlers of the server, or restores the defaults.
+ * @param on \c true to set the handlers.
+ */
+void srv_signals(bool on)
+{
+        struct sigaction sa = {0};
+        sigemptyset(&sa.sa_mask);
+
+        sa.sa_handler = on ? srv_on_signal : SIG_DFL;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        /* A closed connection is noticed by write(), not by a signal. */
+        sa.sa_handler = on ? SIG_IGN : SIG_DFL;
+        sigaction(SIGPIPE, &sa, NULL);
+}
+
+/**
+ * @brief Serves a database on a Unix socket until \c SIGINT or \c SIGTERM .
+ * @param db The pointer to the database. Its journal and autosave work as usual.
+ * @param path The socket's path. It's removed when the server stops.
+ * @retval 0 If the server was stopped by a signal.
+ * @retval EFPERM If the socket can't be created or waiting for the connections has failed.
+ * @retval EMALLOC If the event loop's state can't be allocated.
+ */
+int srv_run(database *db, const char *path)
+{
+        int lfd = srv_listen(path);
+        if (lfd < 0)
+                return EFPERM;
+
+        srv_ctx ctx = {.db = db, .conns = vct(), .seq = 0};
+        if (!ctx.conns || pipe(srv_stop_pipe) || pthread_mutex_init(&ctx.lock, NULL)) {
+                vct_del(ctx.conns);
+                close(lfd);
+                unlink(path);
+                return ctx.conns ? EFPERM : EMALLOC;
+        }
+
+        srv_nonblock(srv_stop_pipe[1]);
+        srv_signals(true);
+
+        struct pollfd *fds = NULL;
+        size_t fds_cap = 0;
+        int retval = 0;
+
+        for (;;) {
+                /* SIGUSR1 interrupts poll(), so a requested report is printed right away. */
+                probe_poll(stderr);
+
+                size_t n = ctx.conns->size;
+                if (n + 2 > fds_cap) {
+                        struct pollfd *tmp = realloc(fds, (n + 2) * 2 * sizeof(struct pollfd));
+                        if (!tmp) {
+                                retval = EMALLOC;
+                                break;
+                        }
+
+                        fds = tmp;
+                        fds_cap = (n + 2) * 2;
+                }
+
+                fds[0] = (struct pollfd){.fd = srv_stop_pipe[0], .events = POLLIN};
+                fds[1] = (struct pollfd){.fd = lfd, .events = POLLIN};
+
+                /* A dump in progress doesn't wait for the sockets, only for the peer to read its previous parts. */
+                int timeout = -1;
+
+                for (idx i = 0; i < n; i++) {
+                        srv_conn *c = vct_subptr(ctx.conns, i);
+                        size_t pending = c->out.len - c->out.off;
+
+                        if (c->dump && pending < SRV_OUT_HIGH)
+                                timeout = 0;
+
+                        /* New requests wait until the peer reads the answers of the old ones. */
+                        fds[i + 2] = (struct pollfd){.fd = c->fd, .events = 0};
+                        if (!c->eof && pending < SRV_OUT_HIGH)
+                                fds[i + 2].events |= POLLIN;
+                        if (pending)
+                                fds[i + 2].events |= POLLOUT;
+                }
+
+                if (poll(fds, n + 2, timeout) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        retval = EFPERM;
+                        break;
+                }
+
+                if (fds[0].revents)
+                        break;
+
+                for (idx i = 0; i < n; i++) {
+                        srv_conn *c = vct_subptr(ctx.conns, i);
+                        short ev = fds[i + 2].revents;
+
+                        if (ev & (POLLERR | POLLNVAL))
+                                c->dead = true;
+                        else if (ev & (POLLIN | POLLHUP) && fds[i + 2].events & POLLIN)
+                                srv_read(c);
+                        else if (ev & POLLHUP)
+                                c->eof = true;
+                }
+
+                pool_for("srv", n, 1, srv_process_part, &ctx);
+
+                for (idx i = 0; i < n; i++) {
+                        srv_conn *c = vct_subptr(ctx.conns, i);
+                        if (c->dump && !c->dead && c->out.len - c->out.off < SRV_OUT_HIGH && srv_dump_step(c))
+                                srv_process(&ctx, c);
+                }
+
+                /* The answers (and the notifications of the others) are sent right away, if the sockets take them. */
+                for (idx i = 0; i < n; i++) {
+                        srv_conn *c = vct_subptr(ctx.conns, i);
+                        if (!c->dead)
+                                srv_write(c);
+                }
+
+                if (fds[1].revents & POLLIN)
+                        srv_accept(&ctx, lfd);
+
+                for (idx i = ctx.conns->size; i > 0; i--) {
+                        srv_conn *c = vct_subptr(ctx.conns, i - 1);
+                        if (c->dead || (c->eof && c->out.len == c->out.off))
+                                srv_close(&ctx, i - 1);
+                }
+        }
+
+        while (ctx.conns->size)
+                srv_close(&ctx, ctx.conns->size - 1);
+
+        srv_signals(false);
+        pthread_mutex_destroy(&ctx.lock);
+        free(fds);
+        vct_del(ctx.conns);
+        close(lfd);
+        unlink(path);
+        close(srv_stop_pipe[0]);
+        close(srv_stop_pipe[1]);
+        srv_stop_pipe[0] = -1;
+        srv_stop_pipe[1] = -1;
+        return retval;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file srv_batch.c
+ * @brief Runs a script of commands without the menus.
+ * @details Every line of the script is a command of the server's protocol (see \c srv.c and \c srv_cmd.c ), or \c !E> ,
+ *          which saves the database. Nothing is printed but the results of the queries, the failed commands are counted
+ *          and their line numbers are kept for the report. Empty lines and lines starting with \c ; are skipped.\n
+ *          Like the CSV ingest, the commands are not journaled one by one: the database is saved at the end, or by
+ *          \c !E> .
+ */
+
+#include "../include/platform.h"
+
+#include <time.h>
+
+#include "include/srv.h"
+
+/**
+ * @brief Returns the current time in seconds, for the throughput report.
+ * @return Seconds since an arbitrary point in time.
+ */
+double srv_clock(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Executes a command script.
+ * @param db Pointer to the database.
+ * @param path The script's path, \c - for the standard input.
+ * @param stats Pointer to the destination of the statistics.
+ * @retval 0 On success, even if some commands have failed. See \c stats .
+ * @retval EFPERM If the script cannot be opened.
+ * @retval EMALLOC If a memory allocation has failed. The script is stopped, the database is saved with the commands
+ *                 executed before.
+ */
+int srv_batch(database *db, const char *path, srv_batch_stats *stats)
+{
+        *stats = (srv_batch_stats){0};
+
+        FILE *script = strcmp(path, "-") != 0 ? fopen(path, "r") : stdin;
+        if (!script)
+                return EFPERM;
+
+        /* Every change is in the snapshot written at the end, recording them one by one is a waste. */
+        FILE *journal = db->journal;
+        db->journal = NULL;
+
+        srv_buf out = {0};
+        char line[SRV_LINE_MAX + 2];
+        size_t line_no = 0;
+        int retval = 0;
+        double start = srv_clock();
+
+        while (fgets(line, sizeof(line), script)) {
+                line_no++;
+
+                /* A line longer than any valid command is rejected as a whole. */
+                size_t len = strcspn(line, "\r\n");
+                bool whole = line[len] != '\0' || feof(script);
+                if (!whole) {
+                        int ch;
+                        while ((ch = fgetc(script)) != EOF && ch != '\n')
+                                ;
+                }
+
+                line[len] = '\0';
+                if (len == 0 || line[0] == ';')
+                        continue;
+
+                stats->cmds++;
+
+                int err = EINV;
+                if (whole && !strcmp(line, "!E>"))
+                        err = fh_jrnl_checkpoint(db);
+                else if (whole)
+                        err = srv_cmd(db, &out, line);
+
+                if (err) {
+                        if (stats->failed < SRV_BATCH_ERROR_LOG) {
+                                stats->fail_lines[stats->failed] = line_no;
+                                stats->fail_codes[stats->failed] = err;
+                        }
+
+                        stats->failed++;
+                }
+
+                if (err == EMALLOC) {
+                        retval = EMALLOC;
+                        break;
+                }
+
+                if (out.len - out.off >= EXPORT_BUF_SIZE) {
+                        fwrite(out.data + out.off, 1, out.len - out.off, stdout);
+                        srv_buf_take(&out, out.len - out.off);
+                }
+        }
+
+        if (out.len > out.off)
+                fwrite(out.data + out.off, 1, out.len - out.off, stdout);
+        srv_buf_free(&out);
+
+        stats->secs = srv_clock() - start;
+        db->journal = journal;
+
+        /* The commands before the failed one aren't journaled, and the caller exits on this error. */
+        if (retval)
+                fh_jrnl_checkpoint(db);
+
+        if (script != stdin)
+                fclose(script);
+
+        return retval;
+}
@@ -0,0 +1,360 @@
+/**
+ * @file srv_client.c
+ * @brief Runs the menus as a thin client of a server, see \c srv.c .
+ * @details The menus work on a local mirror of the served database. The mirror is built from the server's dump, and
+ *          the changes of the other terminals are applied to it before the menus are redrawn (\c srv_pull() ).\n
+ *          The mirror's journal is captured in memory, and every change is sent to the server with the sequence number
+ *          of the state it was made on (\c srv_forward() ). If somebody else has changed the database in the meantime,
+ *          the server rejects it, since the indexes the user has typed may point to other objects by now. The mirror is
+ *          rebuilt from a new dump in that case, and the user is told to repeat the change.
+ * @note There is a single connection per process.
+ */
+
+#include "../include/platform.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "include/srv.h"
+#include "../module-interface/include/intf_frame.h"
+
+/**
+ * @struct srv_link srv_client.c
+ * @brief The thin client's connection.
+ */
+typedef struct srv_link {
+        int fd;                 /**< The socket, \c -1 if not connected. */
+        database *db;           /**< The mirror. */
+        srv_buf in;             /**< The received bytes that haven't been processed yet. */
+        unsigned long seq;      /**< The server's sequence number the mirror is at. */
+        FILE *capture;          /**< The mirror's journal, collects the records of the local changes. */
+        char *rec;              /**< The captured records, owned by \c capture . */
+        size_t rec_len;         /**< The length of the captured records. */
+} srv_link;
+
+static srv_link srv_self = {.fd = -1};
+
+/**
+ * @brief Exits the program when the server is gone. The changes have been saved by the server.
+ */
+void srv_lost(void)
+{
+        fprintf(stderr, "\nMegszakadt a kapcsolat a szerverrel.\n");
+        exit(EFPERM);
+}
+
+/**
+ * @brief Reads the next line from the server.
+ * @param wait \c true to wait for the line, \c false to return only an already available one.
+ * @return The line without the newline, valid until the next call. \c NULL if there is no line (without waiting).
+ * @note Exits the program if the connection is lost, see \c srv_lost() .
+ */
+char *srv_link_line(bool wait)
+{
+        srv_buf *in = &srv_self.in;
+
+        for (;;) {
+                char *start = in->data + in->off;
+                char *nl = in->len > in->off ? memchr(start, '\n', in->len - in->off) : NULL;
+                if (nl) {
+                        *nl = '\0';
+                        srv_buf_take(in, (size_t)(nl - start) + 1);
+                        return start;
+                }
+
+                if (in->len - in->off > SRV_LINE_MAX)
+                        srv_lost();
+
+                if (!wait) {
+                        struct pollfd p = {.fd = srv_self.fd, .events = POLLIN};
+                        if (poll(&p, 1, 0) <= 0)
+                                return NULL;
+                }
+
+                if (srv_buf_reserve(in, SRV_READ_SIZE))
+                        srv_lost();
+
+                ssize_t n = read(srv_self.fd, in->data + in->len, SRV_READ_SIZE);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        srv_lost();
+
+                in->len += (size_t)n;
+        }
+}
+
+/**
+ * @brief Sends a request to the server.
+ * @param line The request, with the newline.
+ * @param len The request's length.
+ */
+void srv_send(const char *line, size_t len)
+{
+        while (len > 0) {
+                ssize_t n = write(srv_self.fd, line, len);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        srv_lost();
+
+                line += n;
+                len -= (size_t)n;
+        }
+}
+
+/**
+ * @brief Parses a status line, and updates the mirror's sequence number.
+ * @param reply The status line.
+ * @return The status' error code.
+ */
+int srv_status(const char *reply)
+{
+        char *end = NULL;
+        int err = (int)strtol(reply + 1, &end, 10);
+        if (*end != '|')
+                srv_lost();
+
+        srv_self.seq = strtoul(end + 1, NULL, 10);
+        return err;
+}
+
+/**
+ * @brief Sends a change based on the mirror's state and waits for its status.
+ * @param line The request, with the newline.
+ * @param len The request's length.
+ * @return The status' error code.
+ * @note The notifications received before the answer are dropped. They are already in the mirror, or they make the
+ *       change rejected.
+ */
+int srv_request(const char *line, size_t len)
+{
+        srv_send(line, len);
+
+        char *reply;
+        while ((reply = srv_link_line(true))[0] != '=')
+                ;
+
+        return srv_status(reply);
+}
+
+/**
+ * @brief Applies a record of the server to the mirror, without sending it back.
+ * @param record The journal record.
+ * @return See \c fh_jrnl_apply() .
+ */
+int srv_mirror_apply(char *record)
+{
+        database *db = srv_self.db;
+        FILE *journal = db->journal;
+        void (*on_change)(const database *) = db->on_change;
+
+        db->journal = NULL;
+        db->on_change = NULL;
+        int retval = fh_jrnl_apply(db, record);
+        db->journal = journal;
+        db->on_change = on_change;
+
+        return retval;
+}
+
+/**
+ * @brief Rebuilds the mirror from a dump of the server.
+ * @retval 0 On success.
+ * @retval EINV If the dump is malformed.
+ * @retval EMALLOC If the mirror can't be built.
+ */
+int srv_resync(void)
+{
+        database *db = srv_self.db;
+        FILE *journal = db->journal;
+        void (*on_change)(const database *) = db->on_change;
+        db->journal = NULL;
+        db->on_change = NULL;
+
+        /* Removing the last client doesn't shift the others. */
+        while (db_cl_cnt(db) > 0)
+                db_cl_rm(db, db_cl_cnt(db) - 1);
+
+        srv_send("?D>\n", 4);
+
+        /* The changes notified before the dump's answer are in the dump. */
+        int retval = 0;
+        char *line;
+        while ((line = srv_link_line(true))[0] != '=') {
+                if (line[0] != '!' && !retval)
+                        retval = fh_jrnl_apply(db, line);
+        }
+
+        int err = srv_status(line);
+
+        db->journal = journal;
+        db->on_change = on_change;
+        return err ? err : retval;
+}
+
+/**
+ * @brief Rebuilds the mirror, exits the program if it fails.
+ */
+void srv_resync_or_exit(void)
+{
+        int retval = srv_resync();
+        if (retval) {
+                fprintf(stderr, "\nNem sikerult frissiteni az adatbazist a szerverrol (hiba: %d).\n", retval);
+                exit(retval);
+        }
+}
+
+/**
+ * @brief Sends the mirror's captured changes to the server. Set as the mirror's \c on_change hook.
+ * @param db The pointer to the mirror.
+ */
+void srv_forward(const database *db)
+{
+        (void)db;
+
+        fflush(srv_self.capture);
+        char *record = srv_self.rec;
+        char *end = srv_self.rec + srv_self.rec_len;
+
+        while (record < end) {
+                char *nl = memchr(record, '\n', (size_t)(end - record));
+                if (!nl)
+                        break;
+
+                /* The records of a transaction are sent in one request, so the server applies them as a whole too. */
+                size_t cnt = record[0] == 'T' && record[1] == '>' ? strtoul(record + 2, NULL, 10) : 0;
+                char *last = nl;
+                for (size_t k = 0; k < cnt && last; k++)
+                        last = memchr(last + 1, '\n', (size_t)(end - last - 1));
+
+                if (!last)
+                        break;
+
+                char line[SRV_LINE_MAX + 2];
+                int len = snprintf(line, sizeof(line), "#%lu %.*s\n", srv_self.seq, (int)(nl - record), record);
+                record = last + 1;
+
+                int err = EINV;
+                if (len > 0 && (size_t)len < sizeof(line) && cnt <= SRV_TX_MAX) {
+                        if (cnt > 0)
+                                srv_send(line, (size_t)len);
+
+                        err = cnt > 0 ? srv_request(nl + 1, (size_t)(last - nl)) : srv_request(line, (size_t)len);
+                }
+
+                if (err == 0)
+                        continue;
+
+                /* Shown above the next menu, so the redraw doesn't hide it. */
+                if (err == ECONFL)
+                        intf_frame_msg("Kozben valaki mas modositotta az adatbazist, a valtoztatas nem lett "
+                                       "elmentve. Ellenorizze az adatokat, es ismetelje meg.");
+                else if (err == EDUP)
+                        intf_frame_msg("Az email cim vagy a telefonszam mar egy masik ugyfele, a valtoztatas nem lett "
+                                       "elmentve.");
+                else
+                        intf_frame_msg("A szerver elutasitotta a valtoztatast (hiba: %d).", err);
+
+                srv_resync_or_exit();
+                break;
+        }
+
+        /* The next change overwrites the captured ones. */
+        rewind(srv_self.capture);
+}
+
+/**
+ * @brief Applies the changes of the other terminals to the mirror. Called before the menus are drawn.
+ */
+void srv_pull(void)
+{
+        if (srv_self.fd < 0)
+                return;
+
+        char *line;
+        while ((line = srv_link_line(false))) {
+                char *end = NULL;
+                unsigned long seq = strtoul(line + 1, &end, 10);
+                if (line[0] != '!' || *end != '|' || seq <= srv_self.seq)
+                        continue;
+
+                /* A missing change or one that doesn't fit means the mirror has diverged. */
+                if (seq != srv_self.seq + 1 || srv_mirror_apply(end + 1)) {
+                        srv_resync_or_exit();
+                        return;
+                }
+
+                srv_self.seq = seq;
+        }
+}
+
+/**
+ * @brief Connects to a server and builds the mirror.
+ * @param db The pointer to the mirror, an empty database. Its changes are sent to the server until
+ *           \c srv_disconnect() .
+ * @param path The server's socket.
+ * @retval 0 On success.
+ * @retval EFPERM If the server can't be reached.
+ * @retval EINV If the dump is malformed.
+ * @retval EMALLOC If the mirror can't be built.
+ */
+int srv_connect(database *db, const char *path)
+{
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(path) >= sizeof(addr.sun_path))
+                return EFPERM;
+
+        strcpy(addr.sun_path, path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                return EFPERM;
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+                close(fd);
+                return EFPERM;
+        }
+
+        srv_self.fd = fd;
+        srv_self.db = db;
+
+        int retval = srv_resync();
+        if (!retval) {
+                srv_self.capture = open_memstream(&srv_self.rec, &srv_self.rec_len);
+                retval = srv_self.capture ? 0 : EMALLOC;
+        }
+
+        if (retval) {
+                srv_disconnect(db);
+                return retval;
+        }
+
+        db->journal = srv_self.capture;
+        db->on_change = srv_forward;
+        return 0;
+}
+
+/**
+ * @brief Closes the connection. The mirror is a plain database afterward.
+ * @param db The pointer to the mirror.
+ */
+void srv_disconnect(database *db)
+{
+        db->journal = NULL;
+        db->on_change = NULL;
+
+        if (srv_self.capture)
+                fclose(srv_self.capture);
+
+        free(srv_self.rec);
+        srv_buf_free(&srv_self.in);
+
+        if (srv_self.fd >= 0)
+                close(srv_self.fd);
+
+        srv_self = (srv_link){.fd = -1};
+}
@@ -0,0 +1,208 @@
+/**
+ * @file srv_cmd.c
+ * @brief Executes the commands shared by the server and the batch mode.
+ * @details A command is a query ( \c ?U>name , \c ?A>plate , \c ?J> , \c ?D> ) or a journal record. The queries'
+ *          results are journal-like lines, see \c srv.c for the formats. The records of a transaction are applied
+ *          together, see \c srv_tx() .
+ */
+
+#include "../include/platform.h"
+
+#include "include/srv.h"
+
+/**
+ * @brief Writes a search result into the output.
+ * @param db The pointer to the database.
+ * @param out The output buffer.
+ * @param res The search result.
+ * @param depth The number of indexes per result, see \c intf_search_txt() .
+ * @retval 0 On success.
+ * @retval EMALLOC If the output or the search has failed.
+ * @note The matches are looked up again, in a read section, since other threads may modify the database.
+ */
+int srv_results(const database *db, srv_buf *out, sres res, int depth)
+{
+        if (res.err)
+                return res.err;
+
+        int retval = 0;
+        db_read_begin(db);
+        for (idx i = 0; i < res.map->size && !retval; i++) {
+                idx *db_idx = vct_subptr(res.map, i);
+                client *cl = db_cl_get(db, db_idx[0]);
+                car *car = depth > 1 ? db_car_get(db, db_idx[0], db_idx[1]) : NULL;
+                operation *op = depth > 2 ? db_op_get(db, db_idx[0], db_idx[1], db_idx[2]) : NULL;
+
+                /* A match removed since the search is left out. */
+                if (!cl || (depth > 1 && !car) || (depth > 2 && !op))
+                        continue;
+
+                if (depth == 1) {
+                        retval = srv_buf_printf(out, "U>%zu|%s|%s|%s\n", db_idx[0], cl->name, cl->email, cl->phone);
+                }
+                else if (depth == 2) {
+                        retval = srv_buf_printf(out, "A>%zu|%zu|%s|%s\n", db_idx[0], db_idx[1], car->name, car->plate);
+                }
+                else {
+                        char date_cr[17];
+                        char date_exp[17];
+                        db_journal_date(&op->date_cr, date_cr);
+                        db_journal_date(&op->date_exp, date_exp);
+
+                        retval = srv_buf_printf(out, "J>%zu|%zu|%zu|%s|%f|%s|%s\n", db_idx[0], db_idx[1], db_idx[2],
+                                                op->desc, op->price, date_cr, date_exp);
+                }
+        }
+        db_read_end(db);
+
+        search_res_del(res.map, depth);
+        return retval;
+}
+
+/**
+ * @brief Writes the first record of a dump, the database's name and description.
+ * @param db The pointer to the database.
+ * @param out The output buffer.
+ * @retval 0 On success.
+ * @retval EMALLOC If the output cannot be grown.
+ */
+int srv_dump_head(const database *db, srv_buf *out)
+{
+        /* The default description ends with a newline, it would end the record. */
+        int desc_len = (int)strcspn(db->desc, "\r\n");
+        return srv_buf_printf(out, "~D>%s|%.*s\n", db->name, desc_len, db->desc) ? EMALLOC : 0;
+}
+
+/**
+ * @brief Writes a range of clients into the output as journal records.
+ * @param db The pointer to the database.
+ * @param out The output buffer.
+ * @param from The index of the first client.
+ * @param to The index after the last client.
+ * @retval 0 On success.
+ * @retval EMALLOC If the output or a client's loading has failed.
+ * @retval EINV If a client can't be loaded.
+ */
+int srv_dump_part(const database *db, srv_buf *out, idx from, idx to)
+{
+        for (idx i = from; i < to; i++) {
+                int retval = db_cl_load(db, i);
+                if (retval)
+                        return retval == EMALLOC ? EMALLOC : EINV;
+
+                const client *cl = db_cl_get(db, i);
+                if (srv_buf_printf(out, "+U>%s|%s|%s\n", cl->name, cl->email, cl->phone))
+                        return EMALLOC;
+
+                for (idx j = 0; j < cl->cars->size; j++) {
+                        const car *car = vct_subptr(cl->cars, j);
+                        if (srv_buf_printf(out, "+A>%zu|%s|%s\n", i, car->name, car->plate))
+                                return EMALLOC;
+
+                        for (idx k = 0; k < car->operations->size; k++) {
+                                const operation *op = vct_subptr(car->operations, k);
+                                char date_cr[17];
+                                char date_exp[17];
+                                db_journal_date(&op->date_cr, date_cr);
+                                db_journal_date(&op->date_exp, date_exp);
+
+                                if (srv_buf_printf(out, "+J>%zu|%zu|%s|%f|%s|%s\n", i, j, op->desc, op->price,
+                                                   date_cr, date_exp))
+                                        return EMALLOC;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Executes a command: a query or a journal record. See \c srv.c for the formats.
+ * @param db The pointer to the database.
+ * @param out The output buffer, the query's result lines are appended to it.
+ * @param line The command, without the newline.
+ * @retval 0 On success.
+ * @retval EINV If the command is unknown or malformed.
+ * @retval EMALLOC If the output or the search has failed.
+ * @return For the return values of the records see \c fh_jrnl_exec() .
+ */
+int srv_cmd(database *db, srv_buf *out, const char *line)
+{
+        if (line[0] != '?')
+                return fh_jrnl_exec(db, line);
+
+        if (line[1] == '\0' || line[2] != '>')
+                return EINV;
+
+        switch (line[1]) {
+                case 'U':
+                        return srv_results(db, out, search_cl(db, line + 3), 1);
+                case 'A':
+                        return srv_results(db, out, search_plate(db, line + 3), 2);
+                case 'J':
+                        return srv_results(db, out, search_expiration(db), 3);
+                case 'D':
+                        return srv_dump_head(db, out) ? EMALLOC : srv_dump_part(db, out, 0, db_cl_cnt(db));
+                default:
+                        return EINV;
+        }
+}
+
+/**
+ * @brief Applies the records of a transaction as a whole or not at all, see \c tx.c .
+ * @details The records are the ones a commit journals after its \c T>n marker, so the removed clients' records come
+ *          last, from the last client to the first. Their indexes are the same for the steps and one after the other.
+ * @param db The pointer to the database.
+ * @param block The records, separated by newlines.
+ * @param cnt The number of the records.
+ * @retval 0 On success.
+ * @retval EINV If there are fewer or longer records than \c cnt , a record is malformed, or a record follows the
+ *              removal of a client in another order.
+ * @return For the other return values see \c db_tx_commit() .
+ */
+int srv_tx(database *db, const char *block, size_t cnt)
+{
+        db_tx *tx = db_tx_begin(db);
+        if (!tx)
+                return EMALLOC;
+
+        char record[LONGEST_JOURNAL_LINE + 1];
+        idx removed = 0;
+        bool removing = false;
+        int retval = 0;
+
+        for (size_t k = 0; k < cnt && !retval; k++) {
+                const char *nl = strchr(block, '\n');
+                size_t len = nl ? (size_t)(nl - block) : strlen(block);
+                const char *next = nl ? nl + 1 : block + len;
+                if (len > 0 && block[len - 1] == '\r')
+                        len--;
+
+                if (len == 0 || len > LONGEST_JOURNAL_LINE) {
+                        retval = EINV;
+                        break;
+                }
+
+                memcpy(record, block, len);
+                record[len] = '\0';
+                block = next;
+
+                /* The clients are removed at the end of the commit, so only their removals may follow them. */
+                bool rm = record[0] == '-' && record[1] == 'U';
+                idx cl = rm ? strtoul(record + 3, NULL, 10) : 0;
+                if (removing && (!rm || cl >= removed))
+                        retval = EINV;
+                else
+                        retval = fh_jrnl_stage(tx, record);
+
+                removing = rm;
+                removed = cl;
+        }
+
+        if (retval || *block != '\0') {
+                db_tx_abort(tx);
+                return retval ? retval : EINV;
+        }
+
+        return db_tx_commit(tx, NULL);
+}
@@ -0,0 +1,40 @@
+/**
+ * @file test.h
+ * @brief Module header file. Include this to write and run the self-tests.
+ * @details See \c test.c for the runner. Every \c test_*.c file holds a suite, a function calling its cases with
+ *          \c test_case() .
+ */
+
+#ifndef REPAIRSHOP_TEST_H
+#define REPAIRSHOP_TEST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "../../module-database/include/database.h"
+#include "../../module-filehandler/include/fh.h"
+#include "../../include/errorcodes.h"
+
+/** Checks a condition of a test case. A failed check is reported with its location, the case goes on. */
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+/** A test case. It gets an empty database in an empty database directory, both are cleaned up after it. */
+typedef void (*test_fn)(database *db);
+
+bool test_check(bool ok, const char *expr, const char *file, int line);
+void test_case(const char *name, test_fn fn);
+int test_write(const char *name, const char *text);
+bool test_tx_journal(char *dst, size_t size);
+void test_clean(void);
+int test_run(const char *suites, FILE *out, size_t *failed);
+
+void test_journal(void);
+void test_ops(void);
+void test_backup(void);
+void test_concurrent(void);
+void test_tx(void);
+void test_order(void);
+void test_purge(void);
+void test_uniq(void);
+
+#endif //REPAIRSHOP_TEST_H
@@ -0,0 +1,178 @@
+/**
+ * @file test.c
+ * @brief The runner of the self-tests.
+ * @details The suites run one after the other, their cases get an empty database in the database directory, which
+ *          must not hold a database. Every case and every failed check is reported, the files written by a case are
+ *          removed after it.
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+
+/**
+ * @struct test_suite test.c
+ * @brief A suite of test cases, see the \c test_*.c files.
+ */
+typedef struct test_suite {
+        const char *name;       /**< The name of the suite on the command line. */
+        void (*run)(void);      /**< Calls the cases of the suite. */
+} test_suite;
+
+static const test_suite suites[] = {
+        {"journal", test_journal},
+        {"ops", test_ops},
+        {"backup", test_backup},
+        {"concurrent", test_concurrent},
+        {"tx", test_tx},
+        {"order", test_order},
+        {"purge", test_purge},
+        {"uniq", test_uniq},
+};
+
+static FILE *test_out = NULL;   /**< The destination of the report. */
+static size_t case_failed = 0;  /**< Number of failed checks of the running case. */
+static size_t cases_failed = 0; /**< Number of failed cases. */
+
+/**
+ * @brief Records the result of a check, see \c TEST_CHECK() .
+ * @param ok The result of the check.
+ * @param expr The checked condition.
+ * @param file The source file of the check.
+ * @param line The line of the check.
+ * @return \c ok , so the checks can guard the next steps of a case.
+ */
+bool test_check(bool ok, const char *expr, const char *file, int line)
+{
+        if (!ok) {
+                fprintf(test_out, "    %s:%d: %s\n", file, line, expr);
+                case_failed++;
+        }
+
+        return ok;
+}
+
+/**
+ * @brief Runs a test case on an empty database, then removes the files it has written.
+ * @param name The name of the case in the report.
+ * @param fn The case.
+ */
+void test_case(const char *name, test_fn fn)
+{
+        database *db = db_init("teszt", "teszt");
+        case_failed = 0;
+
+        if (test_check(db != NULL, "db_init()", __FILE__, __LINE__)) {
+                fn(db);
+                db_del(db);
+        }
+
+        test_clean();
+        fprintf(test_out, "  %s: %s\n", name, case_failed ? "HIBA" : "OK");
+        if (case_failed)
+                cases_failed++;
+}
+
+/**
+ * @brief Writes a file into the database directory.
+ * @param name The file's name.
+ * @param text The content of the file.
+ * @return \c 0 on success, \c EFPERM if the file cannot be written.
+ */
+int test_write(const char *name, const char *text)
+{
+        char path[FILENAME_MAX];
+        fh_path(path, name);
+
+        FILE *dst = fopen(path, "w");
+        if (!dst)
+                return EFPERM;
+
+        int retval = fputs(text, dst) == EOF ? EFPERM : 0;
+        if (fclose(dst))
+                retval = EFPERM;
+
+        return retval;
+}
+
+/**
+ * @brief Removes the files of the database directory and forgets the snapshot on the disk.
+ */
+void test_clean(void)
+{
+        char path[FILENAME_MAX];
+        for (unsigned s = 0; s < fh_config.disk_shards; s++) {
+                fh_shard_path(path, s, fh_config.disk_gen, false);
+                remove(path);
+                fh_shard_path(path, s, fh_config.disk_gen, true);
+                remove(path);
+        }
+
+        const char *names[] = {MANIFEST_FILE, BACKUP_FILE, JOURNAL_FILE, JOURNAL_FILE ".bad", EXPORT_LZ_FILE};
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+                fh_path(path, names[i]);
+                remove(path);
+        }
+
+        fh_config.disk_shards = 0;
+        fh_config.disk_gen = 0;
+        fh_config.sealed = false;
+        memset(&fh_check, 0, sizeof(fh_check));
+}
+
+/**
+ * @brief Runs the self-tests and reports the results.
+ * @param names The suites, separated by commas, or \c all .
+ * @param out The destination of the report.
+ * @param failed The number of failed cases is written here.
+ * @retval 0 If the suites have run, even if some of their cases have failed.
+ * @retval EINV If \c names contains an unknown suite.
+ * @retval ECONFL If the database directory already holds a database.
+ */
+int test_run(const char *names, FILE *out, size_t *failed)
+{
+        size_t cnt = sizeof(suites) / sizeof(suites[0]);
+        bool run[sizeof(suites) / sizeof(suites[0])] = {false};
+
+        for (const char *pos = names; *pos;) {
+                size_t len = strcspn(pos, ",");
+                bool found = false;
+
+                for (size_t i = 0; i < cnt; i++) {
+                        if ((len == 3 && !strncmp(pos, "all", 3)) ||
+                            (strlen(suites[i].name) == len && !strncmp(pos, suites[i].name, len)))
+                                run[i] = found = true;
+                }
+
+                if (!found)
+                        return EINV;
+
+                pos += pos[len] ? len + 1 : len;
+        }
+
+        char path[FILENAME_MAX];
+        const char *taken[] = {MANIFEST_FILE, JOURNAL_FILE};
+        for (size_t i = 0; i < sizeof(taken) / sizeof(taken[0]); i++) {
+                fh_path(path, taken[i]);
+                FILE *file = fopen(path, "r");
+                if (file) {
+                        fclose(file);
+                        return ECONFL;
+                }
+        }
+
+        test_out = out;
+        cases_failed = 0;
+        for (size_t i = 0; i < cnt; i++) {
+                if (!run[i])
+                        continue;
+
+                fprintf(out, "%s:\n", suites[i].name);
+                suites[i].run();
+        }
+
+        fprintf(out, "Sikertelen esetek: %zu\n", cases_failed);
+        fflush(out);
+        *failed = cases_failed;
+        return 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file test_backup.c
+ * @brief The tests of the compressed backups of a database directory, see \c fh_lz.c .
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+
+/**
+ * @brief Checks if the backup of a shard exists.
+ * @return \c true if the file can be opened.
+ */
+bool test_backup_exists(unsigned shard, unsigned long gen)
+{
+        char path[FILENAME_MAX];
+        fh_shard_path(path, shard, gen, true);
+
+        FILE *file = fopen(path, "rb");
+        if (file)
+                fclose(file);
+
+        return file != NULL;
+}
+
+/**
+ * @brief The backup outlives the export of the next generation, and it's replaced by the next backup only.
+ */
+void test_backup_rotation(database *db)
+{
+        size_t raw = 0;
+        size_t packed = 0;
+
+        if (!TEST_CHECK(!db_cl_add(db, "Kiss Anna", "anna@posta.hu", "1")))
+                return;
+
+        db->gen = 1;
+        TEST_CHECK(!fh_export(db));
+        TEST_CHECK(!fh_lz_backup(&raw, &packed));
+        TEST_CHECK(test_backup_exists(0, 1));
+
+        db->gen = 2;
+        TEST_CHECK(!db_cl_add(db, "Nagy Bela", "bela@posta.hu", "2"));
+        TEST_CHECK(!fh_export(db));
+        TEST_CHECK(test_backup_exists(0, 1));
+
+        TEST_CHECK(!fh_lz_backup(&raw, &packed));
+        TEST_CHECK(test_backup_exists(0, 2));
+        TEST_CHECK(!test_backup_exists(0, 1));
+}
+
+/**
+ * @brief The backup suite.
+ */
+void test_backup(void)
+{
+        test_case("megorzes", test_backup_rotation);
+}
@@ -0,0 +1,192 @@
+/**
+ * @file test_concurrent.c
+ * @brief The stress test of a concurrent database, see \c db_concurrent() .
+ * @details Writer threads add, modify and remove clients, cars and operations, while reader threads look them up and
+ *          search them without locks. Build with \c -fsanitize=thread to find the data races, the checks only find
+ *          the torn objects.
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+#include "../include/search.h"
+
+#define TEST_WRITERS 4          /**< The number of writer threads. */
+#define TEST_READERS 4          /**< The number of reader threads. */
+#define TEST_ROUNDS 300         /**< The number of clients a writer adds. */
+
+/**
+ * @struct test_stress test_concurrent.c
+ * @brief The state shared by the threads of the stress test.
+ */
+typedef struct test_stress {
+        database *db;           /**< The concurrent database. */
+        size_t removed;         /**< The number of removed clients. Updated atomically. */
+        size_t torn;            /**< The number of torn objects seen by the readers. Updated atomically. */
+        size_t failed;          /**< The number of unexpected errors. Updated atomically. */
+        bool done;              /**< Set when the writers have finished. Accessed atomically. */
+} test_stress;
+
+/**
+ * @struct test_writer test_concurrent.c
+ * @brief A writer thread's job.
+ */
+typedef struct test_writer {
+        test_stress *st;        /**< The shared state. */
+        unsigned id;            /**< The writer's number, it's in the names it writes. */
+} test_writer;
+
+/**
+ * @brief Counts an error of a mutation. The indexes are shifted by the other writers' removals, so \c EOOB is fine.
+ * @param st The shared state.
+ * @param err The mutation's error code.
+ */
+void test_stress_err(test_stress *st, int err)
+{
+        if (err && err != EOOB)
+                __atomic_add_fetch(&st->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief A writer thread: adds clients with a car and operations, modifies them, and removes every fourth one.
+ * @param arg Pointer to the \c test_writer .
+ * @return \c NULL
+ */
+void *test_stress_writer(void *arg)
+{
+        test_writer *w = arg;
+        test_stress *st = w->st;
+        database *db = st->db;
+        char name[DEFAULT_BUF_SIZE];
+        char email[DEFAULT_BUF_SIZE];
+
+        for (unsigned i = 0; i < TEST_ROUNDS; i++) {
+                snprintf(name, sizeof(name), "Ugyfel %u %u", w->id, i);
+                snprintf(email, sizeof(email), "u%u_%u@posta.hu", w->id, i);
+                test_stress_err(st, db_cl_add(db, name, email, "06301234567"));
+
+                idx cl = (w->id * 7919 + i * 31) % (db_cl_cnt(db) + 1);
+                test_stress_err(st, db_cl_mod(db, cl, name, email, "06307654321"));
+                test_stress_err(st, db_car_add(db, cl, "Opel Astra", "ABC-123"));
+                test_stress_err(st, db_op_add(db, cl, 0, "olajcsere", i, NULL));
+                test_stress_err(st, db_op_mod(db, cl, 0, 0, "fekbetet", i + 1, "2030-01-01 08:00"));
+
+                if (i % 4 == 3) {
+                        int retval = db_cl_rm(db, cl);
+                        if (!retval)
+                                __atomic_add_fetch(&st->removed, 1, __ATOMIC_RELAXED);
+
+                        test_stress_err(st, retval);
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Checks a client and its subtree, the way a listing reads them. The caller is in a read section.
+ * @param client_ The client.
+ * @return \c true if every field is a complete value written by a writer.
+ */
+bool test_stress_whole(const client *client_)
+{
+        if (strncmp(client_->name, "Ugyfel ", 7) || !strchr(client_->email, '@'))
+                return false;
+
+        for (idx j = 0; j < client_->cars->size; j++) {
+                const car *car_ = vct_subptr(client_->cars, j);
+                if (!car_ || strcmp(car_->plate, "ABC-123"))
+                        return false;
+
+                for (idx k = 0; k < car_->operations->size; k++) {
+                        const operation *op = vct_subptr(car_->operations, k);
+                        if (!op || (strcmp(op->desc, "olajcsere") && strcmp(op->desc, "fekbetet")))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * @brief A reader thread: walks the clients and searches them until the writers have finished.
+ * @param arg Pointer to the shared \c test_stress .
+ * @return \c NULL
+ */
+void *test_stress_reader(void *arg)
+{
+        test_stress *st = arg;
+        database *db = st->db;
+
+        while (!__atomic_load_n(&st->done, __ATOMIC_ACQUIRE)) {
+                db_read_begin(db);
+                for (idx i = 0;; i++) {
+                        const client *client_ = db_cl_get(db, i);
+                        if (!client_)
+                                break;
+
+                        if (!test_stress_whole(client_))
+                                __atomic_add_fetch(&st->torn, 1, __ATOMIC_RELAXED);
+                }
+                db_read_end(db);
+
+                sres res = search_cl(db, "Ugyfel 0 0");
+                if (res.err)
+                        __atomic_add_fetch(&st->failed, 1, __ATOMIC_RELAXED);
+
+                search_res_del(res.map, 1);
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Readers and writers run at the same time, every client is whole and none of them is lost.
+ */
+void test_concurrent_stress(database *db)
+{
+        test_stress st = {.db = db};
+        test_writer jobs[TEST_WRITERS];
+        pthread_t writers[TEST_WRITERS];
+        pthread_t readers[TEST_READERS];
+        size_t started_w = 0;
+        size_t started_r = 0;
+
+        db_concurrent(db);
+
+        for (; started_r < TEST_READERS; started_r++) {
+                if (pthread_create(&readers[started_r], NULL, test_stress_reader, &st))
+                        break;
+        }
+
+        for (; started_w < TEST_WRITERS; started_w++) {
+                jobs[started_w] = (test_writer){&st, (unsigned)started_w};
+                if (pthread_create(&writers[started_w], NULL, test_stress_writer, &jobs[started_w]))
+                        break;
+        }
+
+        for (size_t i = 0; i < started_w; i++)
+                pthread_join(writers[i], NULL);
+
+        __atomic_store_n(&st.done, true, __ATOMIC_RELEASE);
+        for (size_t i = 0; i < started_r; i++)
+                pthread_join(readers[i], NULL);
+
+        TEST_CHECK(started_w == TEST_WRITERS && started_r == TEST_READERS);
+        TEST_CHECK(st.failed == 0);
+        TEST_CHECK(st.torn == 0);
+        TEST_CHECK(db_cl_cnt(db) == started_w * TEST_ROUNDS - st.removed);
+
+        for (idx i = 0; i < db_cl_cnt(db); i++) {
+                if (!TEST_CHECK(test_stress_whole(db_cl_get(db, i))))
+                        break;
+        }
+}
+
+/**
+ * @brief The concurrency suite.
+ */
+void test_concurrent(void)
+{
+        test_case("olvasok es irok", test_concurrent_stress);
+}
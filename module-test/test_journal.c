@@ -0,0 +1,150 @@
+/**
+ * @file test_journal.c
+ * @brief The tests of the journal replay, see \c fh_journal.c .
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+
+/**
+ * @brief The records of the snapshot's generation are applied in order.
+ */
+void test_jrnl_records(database *db)
+{
+        test_write(JOURNAL_FILE, "G>0\n"
+                                 "+U>Kiss Anna|anna@posta.hu|06301234567\n"
+                                 "+A>0|Opel Astra|ABC-123\n"
+                                 "+J>0|0|olajcsere|15000.000000|2026-01-01 08:00|0\n"
+                                 "~U>0|Kiss Anna|anna@mail.hu|06301234567\n");
+
+        TEST_CHECK(fh_jrnl_replay(db) == 0);
+        if (!TEST_CHECK(db_cl_cnt(db) == 1) || !TEST_CHECK(db_car_cnt(db, 0) == 1))
+                return;
+
+        TEST_CHECK(!strcmp(db_cl_get(db, 0)->email, "anna@mail.hu"));
+        TEST_CHECK(!strcmp(db_car_get(db, 0, 0)->plate, "ABC-123"));
+
+        operation *op = db_op_get(db, 0, 0, 0);
+        if (TEST_CHECK(op != NULL)) {
+                TEST_CHECK(op->price == 15000.0);
+                TEST_CHECK(op->date_cr.y == 2026 && op->date_cr.h == 8);
+                TEST_CHECK(op->date_exp.y == 0);
+        }
+}
+
+/**
+ * @brief The records before the snapshot's generation are already in the snapshot, they are skipped.
+ */
+void test_jrnl_generation(database *db)
+{
+        test_write(JOURNAL_FILE, "G>1\n"
+                                 "+U>Regi|regi@posta.hu|1\n"
+                                 "G>2\n"
+                                 "+U>Uj|uj@posta.hu|2\n");
+
+        db->gen = 2;
+        TEST_CHECK(fh_jrnl_replay(db) == 0);
+        if (TEST_CHECK(db_cl_cnt(db) == 1))
+                TEST_CHECK(!strcmp(db_cl_get(db, 0)->name, "Uj"));
+}
+
+/**
+ * @brief A record torn by a crash is the last line without a line break, it's ignored.
+ */
+void test_jrnl_torn(database *db)
+{
+        test_write(JOURNAL_FILE, "G>0\n"
+                                 "+U>Kiss Anna|anna@posta.hu|1\n"
+                                 "+U>Nagy Bel");
+
+        TEST_CHECK(fh_jrnl_replay(db) == 0);
+        TEST_CHECK(db_cl_cnt(db) == 1);
+}
+
+/**
+ * @brief A line longer than \c LONGEST_JOURNAL_LINE is torn at the end, but corrupt anywhere else.
+ */
+void test_jrnl_overlong(database *db)
+{
+        char text[2 * LONGEST_JOURNAL_LINE];
+        char desc[LONGEST_JOURNAL_LINE + 1];
+        memset(desc, 'x', LONGEST_JOURNAL_LINE);
+        desc[LONGEST_JOURNAL_LINE] = '\0';
+
+        snprintf(text, sizeof(text), "G>0\n+U>Kiss Anna|anna@posta.hu|1\n+U>%s", desc);
+        test_write(JOURNAL_FILE, text);
+        TEST_CHECK(fh_jrnl_replay(db) == 0);
+        TEST_CHECK(db_cl_cnt(db) == 1);
+
+        snprintf(text, sizeof(text), "G>0\n+U>%s\n+U>Kiss Anna|anna@posta.hu|1\n", desc);
+        test_write(JOURNAL_FILE, text);
+        TEST_CHECK(fh_jrnl_replay(db) == EINV);
+}
+
+/**
+ * @brief The records of a transaction are applied only if all of them have been written.
+ */
+void test_jrnl_tx(database *db)
+{
+        test_write(JOURNAL_FILE, "G>0\n"
+                                 "T>2\n"
+                                 "+U>Kiss Anna|anna@posta.hu|1\n"
+                                 "+A>0|Opel Astra|ABC-123\n"
+                                 "T>3\n"
+                                 "+U>Nagy Bela|bela@posta.hu|2\n"
+                                 "+A>1|Suzuki Swift|DEF-456\n");
+
+        TEST_CHECK(fh_jrnl_replay(db) == 0);
+        TEST_CHECK(db_cl_cnt(db) == 1);
+        TEST_CHECK(db_car_cnt(db, 0) == 1);
+}
+
+/**
+ * @brief A malformed record stops the replay.
+ */
+void test_jrnl_malformed(database *db)
+{
+        test_write(JOURNAL_FILE, "G>0\n"
+                                 "+A>7|Opel Astra|ABC-123\n");
+
+        TEST_CHECK(fh_jrnl_replay(db) == EINV);
+}
+
+/**
+ * @brief A record applied as a new change is journaled once, with its own creation date.
+ */
+void test_jrnl_exec(database *db)
+{
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(!fh_jrnl_exec(db, "+U>Kiss Anna|anna@posta.hu|1")) ||
+            !TEST_CHECK(!fh_jrnl_exec(db, "+A>0|Opel Astra|ABC-123")))
+                return;
+
+        TEST_CHECK(!fh_jrnl_exec(db, "+J>0|0|olajcsere|15000.000000|2020-05-04 08:00|0"));
+        TEST_CHECK(fh_jrnl_exec(db, "+J>0|1|olajcsere|15000.000000|2020-05-04 08:00|0") == EINV);
+        fflush(db->journal);
+
+        database *replayed = db_init("teszt", "teszt");
+        if (!TEST_CHECK(replayed != NULL))
+                return;
+
+        TEST_CHECK(!fh_jrnl_replay(replayed));
+        if (TEST_CHECK(db_car_cnt(replayed, 0) == 1) && TEST_CHECK(db_car_get(replayed, 0, 0)->operations->size == 1))
+                TEST_CHECK(db_op_get(replayed, 0, 0, 0)->date_cr.y == 2020);
+
+        db_del(replayed);
+}
+
+/**
+ * @brief The journal suite.
+ */
+void test_journal(void)
+{
+        test_case("rekordok", test_jrnl_records);
+        test_case("generaciok", test_jrnl_generation);
+        test_case("szakadt sor", test_jrnl_torn);
+        test_case("tul hosszu sor", test_jrnl_overlong);
+        test_case("tranzakcio", test_jrnl_tx);
+        test_case("hibas rekord", test_jrnl_malformed);
+        test_case("uj valtozas", test_jrnl_exec);
+}
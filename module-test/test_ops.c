@@ -0,0 +1,149 @@
+/**
+ * @file test_ops.c
+ * @brief The tests of the operations' prices and dates: everything the mutations accept must load again.
+ */
+
+#include "../include/platform.h"
+
+#include <stdlib.h>
+
+#include "include/test.h"
+#include "../module-database/include/tx.h"
+
+/** The expiration dates the mutations must reject. */
+static const char *bad_dates[] = {"26-1-1 8:00", "2026-13-01 00:00", "2026-01-01", "2026-01-01 24:00", "",
+                                  "0000-05-01 10:00", "2024-02-31 08:00", "2024-04-31 08:00", "2100-02-29 08:00"};
+/** The prices the mutations must reject, as text, since \c strtod() is the UI's parser. */
+static const char *bad_prices[] = {"1e400", "-1e400", "nan", "1e13", "-1000000000000.5"};
+
+/**
+ * @brief Adds a client with a car to a database.
+ * @return \c true on success.
+ */
+bool test_ops_owner(database *db)
+{
+        return !db_cl_add(db, "Kiss Anna", "anna@posta.hu", "06301234567") &&
+               !db_car_add(db, 0, "Opel Astra", "ABC-123");
+}
+
+/**
+ * @brief Checks if two databases hold the same operations of their first car.
+ * @return \c true if the descriptions, and the journaled form of the prices and the dates are the same.
+ */
+bool test_ops_same(const database *db, const database *other)
+{
+        const car *a = db_car_get(db, 0, 0);
+        const car *b = db_car_get(other, 0, 0);
+        if (!a || !b || a->operations->size != b->operations->size)
+                return false;
+
+        for (idx i = 0; i < a->operations->size; i++) {
+                const operation *x = vct_subptr(a->operations, i);
+                const operation *y = vct_subptr(b->operations, i);
+                char fx[3][DEFAULT_BUF_SIZE * 2];
+                char fy[3][DEFAULT_BUF_SIZE * 2];
+                snprintf(fx[0], sizeof(fx[0]), "%f", x->price);
+                snprintf(fy[0], sizeof(fy[0]), "%f", y->price);
+                db_journal_date(&x->date_cr, fx[1]);
+                db_journal_date(&y->date_cr, fy[1]);
+                db_journal_date(&x->date_exp, fx[2]);
+                db_journal_date(&y->date_exp, fy[2]);
+
+                if (strcmp(x->desc, y->desc) || strcmp(fx[0], fy[0]) || strcmp(fx[1], fy[1]) || strcmp(fx[2], fy[2]))
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * @brief The invalid prices and dates are rejected by every mutation, nothing is changed or journaled.
+ */
+void test_ops_rejected(database *db)
+{
+        if (!TEST_CHECK(test_ops_owner(db)) || !TEST_CHECK(!db_op_add(db, 0, 0, "olajcsere", 15000, NULL)))
+                return;
+
+        for (size_t i = 0; i < sizeof(bad_dates) / sizeof(bad_dates[0]); i++) {
+                TEST_CHECK(db_op_add(db, 0, 0, "olajcsere", 15000, bad_dates[i]) == EINV);
+                TEST_CHECK(db_op_mod(db, 0, 0, 0, "olajcsere", 15000, bad_dates[i]) == EINV);
+        }
+
+        for (size_t i = 0; i < sizeof(bad_prices) / sizeof(bad_prices[0]); i++) {
+                double price = strtod(bad_prices[i], NULL);
+                TEST_CHECK(db_op_add(db, 0, 0, "olajcsere", price, NULL) == EINV);
+                TEST_CHECK(db_op_mod(db, 0, 0, 0, "olajcsere", price, NULL) == EINV);
+
+                double parsed = 0;
+                TEST_CHECK(fh_parse_price(bad_prices[i], &parsed) == EINV);
+        }
+
+        db_tx *tx = db_tx_begin(db);
+        if (TEST_CHECK(tx != NULL)) {
+                TEST_CHECK(db_tx_op_add(tx, 0, 0, "olajcsere", 15000, bad_dates[0]) == EINV);
+                TEST_CHECK(db_tx_commit(tx, NULL) == EINV);
+        }
+
+        tx = db_tx_begin(db);
+        if (TEST_CHECK(tx != NULL)) {
+                TEST_CHECK(db_tx_op_mod(tx, 0, 0, 0, "olajcsere", strtod(bad_prices[0], NULL), NULL) == EINV);
+                TEST_CHECK(db_tx_commit(tx, NULL) == EINV);
+        }
+
+        const operation *op = db_op_get(db, 0, 0, 0);
+        TEST_CHECK(db_car_get(db, 0, 0)->operations->size == 1);
+        TEST_CHECK(op && op->price == 15000 && op->date_exp.y == 0);
+}
+
+/**
+ * @brief The accepted prices and dates load again, both from the journal and from the snapshot.
+ */
+void test_ops_roundtrip(database *db)
+{
+        static const double prices[] = {0, 5.5, -1500.25, 123456789.99, PRICE_MAX, -PRICE_MAX};
+        static const char *dates[] = {NULL, "2026-02-28 23:59", "2024-02-29 12:00", "2000-02-29 00:00",
+                                      "0001-01-01 00:00", "9999-12-31 23:59"};
+
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_ops_owner(db)))
+                return;
+
+        for (size_t i = 0; i < sizeof(prices) / sizeof(prices[0]); i++) {
+                for (size_t j = 0; j < sizeof(dates) / sizeof(dates[0]); j++)
+                        TEST_CHECK(!db_op_add(db, 0, 0, "javitas", prices[i], dates[j]));
+        }
+
+        TEST_CHECK(!db_op_mod(db, 0, 0, 0, "atirt javitas", PRICE_MAX, "2030-06-15 12:30"));
+
+        db_tx *tx = db_tx_begin(db);
+        if (TEST_CHECK(tx != NULL)) {
+                TEST_CHECK(!db_tx_op_add(tx, 0, 0, "tranzakcio", -PRICE_MAX, "2027-01-01 00:00"));
+                TEST_CHECK(!db_tx_op_mod(tx, 0, 0, 1, "atirt tranzakcio", 0.75, NULL));
+                TEST_CHECK(!db_tx_commit(tx, NULL));
+        }
+
+        fflush(db->journal);
+
+        database *replayed = db_init("teszt", "teszt");
+        if (TEST_CHECK(replayed != NULL)) {
+                TEST_CHECK(!fh_jrnl_replay(replayed));
+                TEST_CHECK(test_ops_same(db, replayed));
+                db_del(replayed);
+        }
+
+        database *imported = db_init("teszt", "teszt");
+        if (TEST_CHECK(imported != NULL)) {
+                TEST_CHECK(!fh_export(db));
+                TEST_CHECK(!fh_import(imported));
+                TEST_CHECK(test_ops_same(db, imported));
+                db_del(imported);
+        }
+}
+
+/**
+ * @brief The operation suite.
+ */
+void test_ops(void)
+{
+        test_case("elutasitott arak es datumok", test_ops_rejected);
+        test_case("visszatoltes", test_ops_roundtrip);
+}
@@ -0,0 +1,187 @@
+/**
+ * @file test_order.c
+ * @brief The tests of the clients' order by name, see \c db_order() and \c btree.c .
+ */
+
+#include "../include/platform.h"
+
+#include <strings.h>
+
+#include "include/test.h"
+#include "../module-database/include/purge.h"
+#include "../module-database/include/tx.h"
+
+#define TEST_SAME_NAMES 2000    /**< The number of clients of the same name. */
+
+/**
+ * @brief Adds a client of a given name, with a unique email address and phone number.
+ * @param db The database.
+ * @param name The client's name.
+ * @param n The number in the email address and the phone number.
+ * @return \c true on success.
+ */
+bool test_order_add(database *db, const char *name, unsigned n)
+{
+        char email[EMAIL_SIZE + 1];
+        char phone[PHNUM_SIZE + 1];
+        snprintf(email, sizeof(email), "u%u@posta.hu", n);
+        snprintf(phone, sizeof(phone), "0630%07u", n);
+        return !db_cl_add(db, name, email, phone);
+}
+
+/**
+ * @brief Renames a client, keeping its email address and phone number.
+ * @param db The database.
+ * @param cl The client's index.
+ * @param name The client's new name.
+ * @return \c true on success.
+ */
+bool test_order_rename(database *db, idx cl, const char *name)
+{
+        char email[EMAIL_SIZE + 1];
+        char phone[PHNUM_SIZE + 1];
+        strcpy(email, db_cl_get(db, cl)->email);
+        strcpy(phone, db_cl_get(db, cl)->phone);
+        return !db_cl_mod(db, cl, name, email, phone);
+}
+
+/**
+ * @brief Checks that the order lists every client once, by name, and the clients of the same name by their indexes.
+ * @param db The database.
+ * @return \c true if the order is right.
+ */
+bool test_order_check(database *db)
+{
+        idx cnt = db_cl_cnt(db);
+        idx *list = malloc((cnt + 1) * sizeof(idx));
+        bool *seen = calloc(cnt + 1, sizeof(bool));
+        if (!TEST_CHECK(list && seen)) {
+                free(list);
+                free(seen);
+                return false;
+        }
+
+        /* Listed in pages, like the menu does. */
+        size_t listed = 0;
+        for (size_t got; (got = db_cl_ordered(db, listed, list + listed, 7)) > 0; )
+                listed += got;
+
+        bool ok = TEST_CHECK(listed == cnt) && TEST_CHECK(db->order->size == cnt);
+        for (size_t i = 0; ok && i < listed; i++) {
+                ok = TEST_CHECK(list[i] < cnt && !seen[list[i]]);
+                if (ok)
+                        seen[list[i]] = true;
+
+                if (ok && i > 0) {
+                        int diff = strcasecmp(db_cl_get(db, list[i - 1])->name, db_cl_get(db, list[i])->name);
+                        ok = TEST_CHECK(diff < 0 || (diff == 0 && list[i - 1] < list[i]));
+                }
+        }
+
+        free(list);
+        free(seen);
+        return ok;
+}
+
+/**
+ * @brief Selects the clients whose phone number ends in \c 3 , for \c db_cl_purge() .
+ * @param cl The client.
+ * @param arg Unused.
+ * @return \c true if the client is removed.
+ */
+bool test_order_pred(const client *cl, const void *arg)
+{
+        (void)arg;
+        return cl->phone[strlen(cl->phone) - 1] == '3';
+}
+
+/**
+ * @brief The order stays right after removals from anywhere, renames, a purge and a transaction.
+ */
+void test_order_rm(database *db)
+{
+        const char *names[] = {"Nagy Bela", "kiss anna", "Kovacs Eva", "Kiss Anna", "Szabo Jozsef", "nagy bela"};
+        size_t names_cnt = sizeof(names) / sizeof(names[0]);
+
+        for (unsigned i = 0; i < 300; i++) {
+                if (!TEST_CHECK(test_order_add(db, names[(i * 7) % names_cnt], i)))
+                        return;
+        }
+
+        if (!TEST_CHECK(!db_order(db)) || !TEST_CHECK(test_order_check(db)))
+                return;
+
+        for (unsigned i = 0; i < 40; i++)
+                TEST_CHECK(!db_cl_rm(db, (i * 37) % db_cl_cnt(db)));
+
+        TEST_CHECK(!db_cl_rm(db, db_cl_cnt(db) - 1));
+        TEST_CHECK(!db_cl_rm(db, 0));
+        if (!TEST_CHECK(test_order_check(db)))
+                return;
+
+        /* A rename keeps the client's place among the equal names, even if only the case changes. */
+        TEST_CHECK(test_order_rename(db, 10, "KISS ANNA"));
+        TEST_CHECK(test_order_rename(db, 11, "Abraham Anna"));
+        if (!TEST_CHECK(test_order_check(db)))
+                return;
+
+        db_purge_stats stats = {0};
+        TEST_CHECK(!db_cl_purge(db, test_order_pred, NULL, &stats));
+        TEST_CHECK(stats.clients > 0);
+        if (!TEST_CHECK(test_order_check(db)))
+                return;
+
+        db_tx *tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        TEST_CHECK(!db_tx_cl_rm(tx, 5));
+        TEST_CHECK(!db_tx_cl_add(tx, "Kiss Anna", "uj@posta.hu", "06309999999"));
+        TEST_CHECK(!db_tx_cl_mod(tx, 0, "Zold Peter", "zold@posta.hu", "06308888888"));
+        TEST_CHECK(!db_tx_cl_rm(tx, 2));
+        TEST_CHECK(!db_tx_commit(tx, NULL));
+        TEST_CHECK(test_order_check(db));
+}
+
+/**
+ * @brief Many clients of the same name are removed from the front, the back and the middle.
+ */
+void test_order_same(database *db)
+{
+        for (unsigned i = 0; i < TEST_SAME_NAMES; i++) {
+                if (!TEST_CHECK(test_order_add(db, "Kiss Anna", i)))
+                        return;
+        }
+
+        if (!TEST_CHECK(!db_order(db)))
+                return;
+
+        /* Every client is found by its own id among the equal names. */
+        for (idx i = 0; i < db_cl_cnt(db); i++) {
+                if (!TEST_CHECK(bt_find(db->order, "Kiss Anna", db_cl_get(db, i)->id)))
+                        return;
+        }
+
+        for (unsigned i = 0; i < TEST_SAME_NAMES / 4; i++) {
+                TEST_CHECK(!db_cl_rm(db, 0));
+                TEST_CHECK(!db_cl_rm(db, db_cl_cnt(db) - 1));
+                TEST_CHECK(!db_cl_rm(db, db_cl_cnt(db) / 2));
+        }
+
+        if (!TEST_CHECK(db_cl_cnt(db) == TEST_SAME_NAMES / 4) || !TEST_CHECK(test_order_check(db)))
+                return;
+
+        /* The first listed client is the oldest one left. */
+        idx first;
+        TEST_CHECK(db_cl_ordered(db, 0, &first, 1) == 1 && first == 0);
+        TEST_CHECK(!strcmp(db_cl_get(db, 0)->email, "u500@posta.hu"));
+}
+
+/**
+ * @brief The order suite.
+ */
+void test_order(void)
+{
+        test_case("torlesek utan", test_order_rm);
+        test_case("azonos nevek", test_order_same);
+}
@@ -0,0 +1,218 @@
+/**
+ * @file test_purge.c
+ * @brief The tests of the bulk deletions and the retention policies, see \c purge.c .
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+#include "../module-database/include/purge.h"
+#include "../module-database/include/uniq.h"
+
+#define TEST_MANY 5000          /**< The number of clients of the large purge. */
+
+/**
+ * @brief Fills a database: an active client with old and new operations, a client with old operations only, a client
+ *        without cars and a client whose operation has no creation date.
+ * @param db The database.
+ * @return \c true on success.
+ */
+bool test_purge_fill(database *db)
+{
+        bool ok = !db_cl_add(db, "Aktiv Adam", "adam@posta.hu", "06301111111") &&
+                  !db_cl_add(db, "Regi Rita", "rita@posta.hu", "06302222222") &&
+                  !db_cl_add(db, "Ures Ubul", "ubul@posta.hu", "06303333333") &&
+                  !db_cl_add(db, "Datum Nelkul", "nelkul@posta.hu", "06304444444") &&
+                  !db_car_add(db, 0, "Opel Astra", "ABC-123") &&
+                  !db_car_add(db, 1, "Suzuki Swift", "DEF-456") &&
+                  !db_car_add(db, 3, "Skoda Fabia", "GHI-789");
+
+        ok = ok && !fh_jrnl_op_add(db, 0, 0, "fekbetet", 20000, "2001-03-01 08:00", "0") &&
+             !db_op_add(db, 0, 0, "olajcsere", 15000, NULL) &&
+             !fh_jrnl_op_add(db, 0, 0, "gumicsere", 8000, "2002-10-01 08:00", "0") &&
+             !fh_jrnl_op_add(db, 1, 0, "vizsga", 30000, "2003-05-01 08:00", "2005-05-01 08:00") &&
+             !fh_jrnl_op_add(db, 3, 0, "mosas", 3000, "2004-01-01 08:00", "0");
+
+        /* The snapshots of old versions may hold operations without a creation date. */
+        if (ok)
+                db_op_get(db, 3, 0, 0)->date_cr.y = 0;
+
+        return ok;
+}
+
+/**
+ * @brief Replays the journal of the database directory into a new database.
+ * @param db The database writing the journal.
+ * @return The replayed database, \c NULL on failure.
+ */
+database *test_purge_replay(database *db)
+{
+        fflush(db->journal);
+
+        database *replayed = db_init("teszt", "teszt");
+        if (replayed && fh_jrnl_replay(replayed)) {
+                db_del(replayed);
+                return NULL;
+        }
+
+        return replayed;
+}
+
+/**
+ * @brief The operations created before a date are removed, the rest keep their order, and the replay does the same.
+ */
+void test_purge_ops(database *db)
+{
+        date limit;
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_purge_fill(db)) ||
+            !TEST_CHECK(!date_parse_strict("2010-01-01 00:00", &limit)))
+                return;
+
+        db_purge_stats stats = {0};
+        TEST_CHECK(!db_op_purge(db, db_op_older, &limit, &stats));
+        TEST_CHECK(stats.ops == 3 && stats.clients == 0 && stats.bytes == 3 * sizeof(operation));
+
+        TEST_CHECK(db_cl_cnt(db) == 4);
+        if (TEST_CHECK(db_car_get(db, 0, 0)->operations->size == 1))
+                TEST_CHECK(!strcmp(db_op_get(db, 0, 0, 0)->desc, "olajcsere"));
+
+        TEST_CHECK(db_car_get(db, 1, 0)->operations->size == 0);
+        TEST_CHECK(db_car_get(db, 3, 0)->operations->size == 1);
+
+        /* Nothing matches the second time. */
+        db_purge_stats again = {0};
+        TEST_CHECK(!db_op_purge(db, db_op_older, &limit, &again) && again.ops == 0);
+
+        database *replayed = test_purge_replay(db);
+        if (!TEST_CHECK(replayed != NULL))
+                return;
+
+        if (TEST_CHECK(db_cl_cnt(replayed) == 4) && TEST_CHECK(db_car_get(replayed, 0, 0)->operations->size == 1)) {
+                TEST_CHECK(!strcmp(db_op_get(replayed, 0, 0, 0)->desc, "olajcsere"));
+                TEST_CHECK(db_car_get(replayed, 1, 0)->operations->size == 0);
+        }
+
+        db_del(replayed);
+}
+
+/**
+ * @brief The idle clients are removed with their cars and operations, and their unique keys are given up.
+ */
+void test_purge_idle(database *db)
+{
+        size_t dups;
+        date limit;
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_purge_fill(db)) ||
+            !TEST_CHECK(!db_unique(db, 1u << DB_UNIQ_EMAIL, &dups)) ||
+            !TEST_CHECK(!date_parse_strict("2010-01-01 00:00", &limit)))
+                return;
+
+        db_purge_stats stats = {0};
+        TEST_CHECK(!db_cl_purge(db, db_cl_idle, &limit, &stats));
+        TEST_CHECK(stats.clients == 2 && stats.cars == 1 && stats.ops == 1);
+        TEST_CHECK(stats.bytes == 2 * sizeof(client) + sizeof(car) + sizeof(operation));
+
+        if (!TEST_CHECK(db_cl_cnt(db) == 2))
+                return;
+
+        TEST_CHECK(!strcmp(db_cl_get(db, 0)->name, "Aktiv Adam"));
+        TEST_CHECK(!strcmp(db_cl_get(db, 1)->name, "Datum Nelkul"));
+        TEST_CHECK(db_car_get(db, 0, 0)->operations->size == 3);
+
+        TEST_CHECK(!db_cl_add(db, "Uj Rita", "rita@posta.hu", "06305555555"));
+        TEST_CHECK(db_cl_add(db, "Uj Adam", "adam@posta.hu", "06306666666") == EDUP);
+
+        database *replayed = test_purge_replay(db);
+        if (!TEST_CHECK(replayed != NULL))
+                return;
+
+        if (TEST_CHECK(db_cl_cnt(replayed) == 3)) {
+                TEST_CHECK(!strcmp(db_cl_get(replayed, 1)->name, "Datum Nelkul"));
+                TEST_CHECK(!strcmp(db_cl_get(replayed, 2)->name, "Uj Rita"));
+        }
+
+        db_del(replayed);
+}
+
+/**
+ * @brief The retention policies are parsed strictly, and applied relative to the current date.
+ */
+void test_purge_retention(database *db)
+{
+        static const char *bad[] = {"", "ops", "ops=", "ops=0", "ops=x", "ops=5x", "nap=1", "ops=5;idle=3", "ops=1001"};
+
+        db_retention policy;
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+                TEST_CHECK(db_retention_parse(bad[i], &policy) == EINV);
+
+        TEST_CHECK(!db_retention_parse("idle=3", &policy) && policy.idle == 3 && policy.ops == 0);
+        if (!TEST_CHECK(!db_retention_parse("ops=5,idle=5", &policy)) || !TEST_CHECK(test_purge_fill(db)))
+                return;
+
+        /* The clients are purged first, so the old operations of the idle ones are counted with them. */
+        db_purge_stats stats = {0};
+        TEST_CHECK(!db_retention_run(db, &policy, &stats));
+        TEST_CHECK(stats.clients == 2 && stats.cars == 1 && stats.ops == 3);
+
+        if (TEST_CHECK(db_cl_cnt(db) == 2)) {
+                TEST_CHECK(db_car_get(db, 0, 0)->operations->size == 1);
+                TEST_CHECK(db_car_get(db, 1, 0)->operations->size == 1);
+        }
+}
+
+/**
+ * @brief Selects the clients of an even number, for \c db_cl_purge() .
+ * @param cl The client.
+ * @param arg Unused.
+ * @return \c true if the client is removed.
+ */
+bool test_purge_even(const client *cl, const void *arg)
+{
+        (void)arg;
+        return (cl->phone[strlen(cl->phone) - 1] - '0') % 2 == 0;
+}
+
+/**
+ * @brief Half of many clients are removed in one pass, the rest keep their order.
+ */
+void test_purge_many(database *db)
+{
+        char email[EMAIL_SIZE + 1];
+        char phone[PHNUM_SIZE + 1];
+
+        for (unsigned i = 0; i < TEST_MANY; i++) {
+                snprintf(email, sizeof(email), "u%u@posta.hu", i);
+                snprintf(phone, sizeof(phone), "0630%07u", i);
+                if (!TEST_CHECK(!db_cl_add(db, "Kiss Anna", email, phone)))
+                        return;
+        }
+
+        if (!TEST_CHECK(!db_order(db)))
+                return;
+
+        db_purge_stats stats = {0};
+        TEST_CHECK(!db_cl_purge(db, test_purge_even, NULL, &stats));
+        if (!TEST_CHECK(stats.clients == TEST_MANY / 2) || !TEST_CHECK(db_cl_cnt(db) == TEST_MANY / 2))
+                return;
+
+        for (idx i = 0; i < db_cl_cnt(db); i++) {
+                snprintf(email, sizeof(email), "u%zu@posta.hu", 2 * i + 1);
+                if (!TEST_CHECK(!strcmp(db_cl_get(db, i)->email, email)))
+                        break;
+        }
+
+        idx first[2];
+        TEST_CHECK(db->order->size == TEST_MANY / 2);
+        TEST_CHECK(db_cl_ordered(db, 0, first, 2) == 2 && first[0] == 0 && first[1] == 1);
+}
+
+/**
+ * @brief The purge suite.
+ */
+void test_purge(void)
+{
+        test_case("regi muveletek", test_purge_ops);
+        test_case("inaktiv ugyfelek", test_purge_idle);
+        test_case("megorzesi szabaly", test_purge_retention);
+        test_case("sok ugyfel", test_purge_many);
+}
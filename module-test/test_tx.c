@@ -0,0 +1,212 @@
+/**
+ * @file test_tx.c
+ * @brief The tests of the transactions, see \c tx.c .
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+#include "../module-database/include/tx.h"
+#include "../module-server/include/srv.h"
+
+/**
+ * @brief Reads the journal of the database directory.
+ * @param dst The destination of the journal's text.
+ * @param size The size of \c dst .
+ * @return \c true if the whole journal has been read.
+ */
+bool test_tx_journal(char *dst, size_t size)
+{
+        char path[FILENAME_MAX];
+        fh_path(path, JOURNAL_FILE);
+
+        FILE *src = fopen(path, "r");
+        if (!src)
+                return false;
+
+        size_t len = fread(dst, 1, size - 1, src);
+        bool whole = feof(src) && !ferror(src);
+        fclose(src);
+
+        dst[len] = '\0';
+        return whole;
+}
+
+/**
+ * @brief Adds a client with a car to a database.
+ * @return \c true on success.
+ */
+bool test_tx_owner(database *db)
+{
+        return !db_cl_add(db, "Kiss Anna", "anna@posta.hu", "06301234567") &&
+               !db_car_add(db, 0, "Opel Astra", "ABC-123");
+}
+
+/**
+ * @brief A committed transaction applies every step, and it's replayed from the journal the same way.
+ */
+void test_tx_all(database *db)
+{
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_tx_owner(db)))
+                return;
+
+        db_tx *tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        idx cl = tx->base;
+        TEST_CHECK(!db_tx_cl_add(tx, "Nagy Bela", "bela@posta.hu", "06307654321"));
+        TEST_CHECK(!db_tx_car_add(tx, cl, "Suzuki Swift", "DEF-456"));
+        TEST_CHECK(!db_tx_op_add(tx, cl, 0, "olajcsere", 15000, "2030-01-01 08:00"));
+        TEST_CHECK(!db_tx_car_mod(tx, 0, 0, "Opel Corsa", "ABC-124"));
+        TEST_CHECK(!db_tx_commit(tx, NULL));
+
+        if (!TEST_CHECK(db_cl_cnt(db) == 2) || !TEST_CHECK(db_car_cnt(db, 1) == 1))
+                return;
+
+        TEST_CHECK(!strcmp(db_car_get(db, 0, 0)->plate, "ABC-124"));
+        TEST_CHECK(!strcmp(db_car_get(db, 1, 0)->plate, "DEF-456"));
+        TEST_CHECK(db_car_get(db, 1, 0)->operations->size == 1);
+
+        database *replayed = db_init("teszt", "teszt");
+        if (!TEST_CHECK(replayed != NULL))
+                return;
+
+        TEST_CHECK(!fh_jrnl_replay(replayed));
+        if (TEST_CHECK(db_cl_cnt(replayed) == 2) && TEST_CHECK(db_car_cnt(replayed, 1) == 1)) {
+                TEST_CHECK(!strcmp(db_car_get(replayed, 0, 0)->plate, "ABC-124"));
+                TEST_CHECK(db_car_get(replayed, 1, 0)->operations->size == 1);
+        }
+
+        db_del(replayed);
+}
+
+/**
+ * @brief A step failing during the commit applies none of the steps, and nothing is journaled.
+ */
+void test_tx_none(database *db)
+{
+        char before[4096];
+        char after[4096];
+
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_tx_owner(db)) ||
+            !TEST_CHECK(test_tx_journal(before, sizeof(before))))
+                return;
+
+        db_tx *tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        /* The car's index is only checked by the commit. */
+        idx failed = 0;
+        TEST_CHECK(!db_tx_cl_add(tx, "Nagy Bela", "bela@posta.hu", "06307654321"));
+        TEST_CHECK(!db_tx_cl_mod(tx, 0, "Kiss Anna", "anna@mail.hu", "06301234567"));
+        TEST_CHECK(!db_tx_op_add(tx, 0, 0, "olajcsere", 15000, NULL));
+        TEST_CHECK(!db_tx_car_rm(tx, 0, 5));
+        TEST_CHECK(db_tx_commit(tx, &failed) == EOOB);
+        TEST_CHECK(failed == 3);
+
+        TEST_CHECK(db_cl_cnt(db) == 1);
+        TEST_CHECK(!strcmp(db_cl_get(db, 0)->email, "anna@posta.hu"));
+        TEST_CHECK(db_car_get(db, 0, 0)->operations->size == 0);
+        TEST_CHECK(test_tx_journal(after, sizeof(after)) && !strcmp(before, after));
+}
+
+/**
+ * @brief A transaction torn by a crash is left out of the replay, the records before it are applied.
+ */
+void test_tx_torn(database *db)
+{
+        char text[4096];
+
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_tx_owner(db)))
+                return;
+
+        db_tx *tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        TEST_CHECK(!db_tx_cl_add(tx, "Nagy Bela", "bela@posta.hu", "06307654321"));
+        TEST_CHECK(!db_tx_car_add(tx, 1, "Suzuki Swift", "DEF-456"));
+        TEST_CHECK(!db_tx_op_add(tx, 0, 0, "olajcsere", 15000, NULL));
+        TEST_CHECK(!db_tx_commit(tx, NULL));
+
+        if (!TEST_CHECK(test_tx_journal(text, sizeof(text))))
+                return;
+
+        /* The crash has written the last record halfway. */
+        char *last = strrchr(text, '>');
+        if (!TEST_CHECK(last != NULL) || !TEST_CHECK(strstr(text, "T>3\n") != NULL))
+                return;
+
+        last[2] = '\0';
+        fclose(db->journal);
+        db->journal = NULL;
+        TEST_CHECK(!test_write(JOURNAL_FILE, text));
+
+        database *replayed = db_init("teszt", "teszt");
+        if (!TEST_CHECK(replayed != NULL))
+                return;
+
+        TEST_CHECK(!fh_jrnl_replay(replayed));
+        if (TEST_CHECK(db_cl_cnt(replayed) == 1) && TEST_CHECK(db_car_cnt(replayed, 0) == 1))
+                TEST_CHECK(db_car_get(replayed, 0, 0)->operations->size == 0);
+
+        db_del(replayed);
+}
+
+/**
+ * @brief The journaled records of a transaction are applied by \c srv_tx() as a whole, with the same result, or not at
+ *        all.
+ */
+void test_tx_forward(database *db)
+{
+        char text[4096];
+        database *copy = db_init("teszt", "teszt");
+        if (!TEST_CHECK(copy != NULL))
+                return;
+
+        db_tx *tx = NULL;
+        if (!TEST_CHECK(!fh_jrnl_open(db)) || !TEST_CHECK(test_tx_owner(db)) || !TEST_CHECK(test_tx_owner(copy)) ||
+            !TEST_CHECK((tx = db_tx_begin(db)) != NULL)) {
+                db_del(copy);
+                return;
+        }
+
+        idx cl = tx->base;
+        TEST_CHECK(!db_tx_cl_add(tx, "Nagy Bela", "bela@posta.hu", "06307654321"));
+        TEST_CHECK(!db_tx_car_add(tx, cl, "Suzuki Swift", "DEF-456"));
+        TEST_CHECK(!db_tx_op_add(tx, cl, 0, "olajcsere", 15000, "2030-01-01 08:00"));
+        TEST_CHECK(!db_tx_cl_rm(tx, 0));
+        TEST_CHECK(!db_tx_commit(tx, NULL));
+
+        char *block = test_tx_journal(text, sizeof(text)) ? strstr(text, "T>4\n") : NULL;
+        if (!TEST_CHECK(block != NULL) || !TEST_CHECK(!srv_tx(copy, block + 4, 4))) {
+                db_del(copy);
+                return;
+        }
+
+        /* The operation keeps its creation date, it isn't made again by the copy. */
+        if (TEST_CHECK(db_cl_cnt(copy) == 1) && TEST_CHECK(db_car_cnt(copy, 0) == 1)) {
+                TEST_CHECK(!strcmp(db_cl_get(copy, 0)->name, "Nagy Bela"));
+                TEST_CHECK(date_diff(&db_op_get(copy, 0, 0, 0)->date_cr, &db_op_get(db, 0, 0, 0)->date_cr) == 0);
+        }
+
+        TEST_CHECK(srv_tx(copy, "+U>Kovacs Eva|eva@posta.hu|06301111111\n-A>0|5", 2) == EOOB);
+        TEST_CHECK(srv_tx(copy, "-U>0\n+U>Kovacs Eva|eva@posta.hu|06301111111", 2) == EINV);
+        TEST_CHECK(srv_tx(copy, "+U>Kovacs Eva|eva@posta.hu|06301111111\n", 2) == EINV);
+        TEST_CHECK(db_cl_cnt(copy) == 1 && db_car_cnt(copy, 0) == 1);
+
+        db_del(copy);
+}
+
+/**
+ * @brief The transaction suite.
+ */
+void test_tx(void)
+{
+        test_case("minden lepes", test_tx_all);
+        test_case("egy lepes sem", test_tx_none);
+        test_case("szakadt tranzakcio", test_tx_torn);
+        test_case("tovabbitott tranzakcio", test_tx_forward);
+}
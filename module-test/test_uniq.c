@@ -0,0 +1,241 @@
+/**
+ * @file test_uniq.c
+ * @brief The tests of the unique indexes of the email addresses and phone numbers, see \c uniq.c .
+ */
+
+#include "../include/platform.h"
+
+#include "include/test.h"
+#include "../module-database/include/uniq.h"
+#include "../module-database/include/tx.h"
+
+#define TEST_DUPES 8            /**< The most duplicates recorded by \c test_uniq_dup() . */
+
+/**
+ * @struct test_dupes test_uniq.c
+ * @brief The duplicates reported by \c db_dupes() .
+ */
+typedef struct test_dupes {
+        size_t cnt;                             /**< The number of duplicates. */
+        db_uniq_field field[TEST_DUPES];        /**< The field of every duplicate. */
+        idx first[TEST_DUPES];                  /**< The client first holding the key. */
+        idx dup[TEST_DUPES];                    /**< The client holding it again. */
+} test_dupes;
+
+/**
+ * @brief Records a duplicate, a \c db_dup_fn .
+ * @param arg Pointer to the \c test_dupes .
+ * @param field The field of the key.
+ * @param key The key.
+ * @param first The client first holding the key.
+ * @param dup The client holding it again.
+ */
+void test_uniq_dup(void *arg, db_uniq_field field, const char *key, idx first, idx dup)
+{
+        test_dupes *d = arg;
+        (void)key;
+        if (d->cnt < TEST_DUPES) {
+                d->field[d->cnt] = field;
+                d->first[d->cnt] = first;
+                d->dup[d->cnt] = dup;
+        }
+
+        d->cnt++;
+}
+
+/**
+ * @brief Checks the key of a value.
+ * @param field The field of the value.
+ * @param val The value.
+ * @param key The expected key.
+ * @return \c true if the value's key is \c key .
+ */
+bool test_uniq_key(db_uniq_field field, const char *val, const char *key)
+{
+        char dst[DB_UNIQ_KEY_SIZE];
+        db_uniq_key(field, val, dst);
+        return !strcmp(dst, key);
+}
+
+/**
+ * @brief The email addresses and phone numbers are compared by their keys, and the fields are parsed strictly.
+ */
+void test_uniq_keys(database *db)
+{
+        (void)db;
+        TEST_CHECK(test_uniq_key(DB_UNIQ_EMAIL, " Kiss.Anna@Posta.HU ", "kiss.anna@posta.hu"));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_EMAIL, "kiss anna@posta.hu", "kissanna@posta.hu"));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_EMAIL, "   ", ""));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_PHONE, "+36 (30) 123-4567", "+36301234567"));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_PHONE, "06-30/123 4567", "06301234567"));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_PHONE, "36+30", "3630"));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_PHONE, "+", ""));
+        TEST_CHECK(test_uniq_key(DB_UNIQ_PHONE, "nincs", ""));
+
+        unsigned fields = 0;
+        TEST_CHECK(!db_unique_parse("email", &fields) && fields == 1u << DB_UNIQ_EMAIL);
+        TEST_CHECK(!db_unique_parse("phone,email", &fields) && fields == (1u << DB_UNIQ_EMAIL | 1u << DB_UNIQ_PHONE));
+
+        static const char *bad[] = {"", "mail", "email,", ",email", "email,,phone", "Email"};
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+                TEST_CHECK(db_unique_parse(bad[i], &fields) == EINV);
+}
+
+/**
+ * @brief The existing duplicates are counted and listed, the new ones are rejected by the additions and the
+ *        modifications, and nothing is journaled for them.
+ */
+void test_uniq_collide(database *db)
+{
+        if (!TEST_CHECK(!fh_jrnl_open(db)) ||
+            !TEST_CHECK(!db_cl_add(db, "Kiss Anna", "anna@posta.hu", "06301234567")) ||
+            !TEST_CHECK(!db_cl_add(db, "Nagy Bela", "bela@posta.hu", "06307654321")) ||
+            !TEST_CHECK(!db_cl_add(db, "Kiss Anna", "ANNA@posta.hu", "")) ||
+            !TEST_CHECK(!db_cl_add(db, "Toth Eva", "", "06-30-765-4321")))
+                return;
+
+        /* The duplicates from before are kept. */
+        size_t dups = 0;
+        if (!TEST_CHECK(!db_unique(db, 1u << DB_UNIQ_EMAIL | 1u << DB_UNIQ_PHONE, &dups)) || !TEST_CHECK(dups == 2))
+                return;
+
+        test_dupes d = {0};
+        size_t cnt = 0;
+        TEST_CHECK(!db_dupes(db, test_uniq_dup, &d, &cnt) && cnt == 2 && d.cnt == 2);
+        TEST_CHECK(d.field[0] == DB_UNIQ_EMAIL && d.first[0] == 0 && d.dup[0] == 2);
+        TEST_CHECK(d.field[1] == DB_UNIQ_PHONE && d.first[1] == 1 && d.dup[1] == 3);
+
+        char before[4096];
+        char after[4096];
+        fflush(db->journal);
+        if (!TEST_CHECK(test_tx_journal(before, sizeof(before))))
+                return;
+
+        TEST_CHECK(db_cl_add(db, "Szabo Jozsef", " Bela@Posta.hu", "06201111111") == EDUP);
+        TEST_CHECK(db_cl_add(db, "Szabo Jozsef", "jozsef@posta.hu", "06 30 123 4567") == EDUP);
+        TEST_CHECK(db_cl_mod(db, 1, "Nagy Bela", "anna@posta.hu", "06307654321") == EDUP);
+        TEST_CHECK(db_cl_mod(db, 3, "Toth Eva", "eva@posta.hu", "06301234567") == EDUP);
+        TEST_CHECK(!strcmp(db_cl_get(db, 1)->email, "bela@posta.hu"));
+        TEST_CHECK(!strcmp(db_cl_get(db, 3)->email, ""));
+        TEST_CHECK(db_cl_cnt(db) == 4);
+
+        fflush(db->journal);
+        TEST_CHECK(test_tx_journal(after, sizeof(after)) && !strcmp(before, after));
+
+        /* A client keeps its own keys, even the duplicated ones, and may write them differently. */
+        TEST_CHECK(!db_cl_mod(db, 1, "Nagy Bela", "BELA@posta.hu", "06 30 765 4321"));
+        TEST_CHECK(!db_cl_mod(db, 2, "Kiss Anna Maria", "anna@posta.hu", ""));
+
+        /* The empty keys aren't indexed. */
+        TEST_CHECK(!db_cl_add(db, "Ures Ubul", "", ""));
+        TEST_CHECK(!db_cl_add(db, "Ures Ubulne", " ", "nincs"));
+
+        /* A key is free once all of its holders are gone. */
+        TEST_CHECK(!db_cl_rm(db, 0));
+        TEST_CHECK(db_cl_add(db, "Szabo Jozsef", "anna@posta.hu", "") == EDUP);
+        TEST_CHECK(!db_cl_add(db, "Szabo Jozsef", "jozsef@posta.hu", "06301234567"));
+        TEST_CHECK(!db_cl_rm(db, 1));
+        TEST_CHECK(!db_cl_add(db, "Kovacs Eva", "anna@posta.hu", ""));
+}
+
+/**
+ * @brief A transaction may pass the keys between its clients, but not take a key twice or from another client.
+ */
+void test_uniq_tx(database *db)
+{
+        size_t dups = 0;
+        if (!TEST_CHECK(!db_cl_add(db, "Kiss Anna", "anna@posta.hu", "06301234567")) ||
+            !TEST_CHECK(!db_cl_add(db, "Nagy Bela", "bela@posta.hu", "06307654321")) ||
+            !TEST_CHECK(!db_cl_add(db, "Toth Eva", "eva@posta.hu", "06201111111")) ||
+            !TEST_CHECK(!db_unique(db, 1u << DB_UNIQ_EMAIL | 1u << DB_UNIQ_PHONE, &dups)))
+                return;
+
+        /* Two clients swap their phone numbers, a removed client's address goes to a new one. */
+        db_tx *tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        TEST_CHECK(!db_tx_cl_mod(tx, 0, "Kiss Anna", "anna@posta.hu", "06307654321"));
+        TEST_CHECK(!db_tx_cl_mod(tx, 1, "Nagy Bela", "bela@posta.hu", "06301234567"));
+        TEST_CHECK(!db_tx_cl_rm(tx, 2));
+        TEST_CHECK(!db_tx_cl_add(tx, "Toth Eva", "Eva@Posta.hu", ""));
+        if (!TEST_CHECK(!db_tx_commit(tx, NULL)) || !TEST_CHECK(db_cl_cnt(db) == 3))
+                return;
+
+        TEST_CHECK(!strcmp(db_cl_get(db, 0)->phone, "06307654321"));
+        TEST_CHECK(!strcmp(db_cl_get(db, 1)->phone, "06301234567"));
+        TEST_CHECK(db_cl_add(db, "Toth Eva", "eva@posta.hu", "") == EDUP);
+        TEST_CHECK(!db_cl_add(db, "Szabo Jozsef", "jozsef@posta.hu", "06201111111"));
+
+        /* Two new clients taking the same key fail the whole transaction. */
+        tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        TEST_CHECK(!db_tx_cl_mod(tx, 0, "Kiss Anna", "anna@mail.hu", "06307654321"));
+        TEST_CHECK(!db_tx_cl_add(tx, "Uj Ugyfel", "uj@posta.hu", ""));
+        TEST_CHECK(!db_tx_cl_add(tx, "Uj Ugyfel", "UJ@posta.hu", ""));
+        TEST_CHECK(db_tx_commit(tx, NULL) == EDUP);
+        TEST_CHECK(db_cl_cnt(db) == 4 && !strcmp(db_cl_get(db, 0)->email, "anna@posta.hu"));
+
+        /* So does a key held by a client outside of the transaction. */
+        tx = db_tx_begin(db);
+        if (!TEST_CHECK(tx != NULL))
+                return;
+
+        TEST_CHECK(!db_tx_cl_mod(tx, 1, "Nagy Bela", "jozsef@posta.hu", "06301234567"));
+        TEST_CHECK(db_tx_commit(tx, NULL) == EDUP);
+        TEST_CHECK(!strcmp(db_cl_get(db, 1)->email, "bela@posta.hu"));
+
+        /* The keys given up by the failed transactions are still held. */
+        TEST_CHECK(!db_cl_add(db, "Uj Ugyfel", "uj@posta.hu", ""));
+        TEST_CHECK(db_cl_add(db, "Uj Ugyfel", "anna@posta.hu", "") == EDUP);
+}
+
+/**
+ * @brief The CSV ingest rejects the rows of the new clients taking a key, and keeps the rest.
+ */
+void test_uniq_csv(database *db)
+{
+        size_t dups = 0;
+        if (!TEST_CHECK(!db_cl_add(db, "Szabo Jozsef", "jozsef@posta.hu", "06201111111")) ||
+            !TEST_CHECK(!db_unique(db, 1u << DB_UNIQ_EMAIL | 1u << DB_UNIQ_PHONE, &dups)))
+                return;
+
+        const char *rows = "name,email,phone,car,plate\n"
+                           "Kiss Anna,anna@posta.hu,06301234567,Opel Astra,ABC-123\n"
+                           "Nagy Bela,ANNA@posta.hu,06307654321,Suzuki Swift,DEF-456\n"
+                           "Kiss Anna,anna@posta.hu,06301234567,Skoda Fabia,GHI-789\n"
+                           "Toth Eva,eva@posta.hu,06-30-123-4567,Fiat Punto,JKL-012\n"
+                           "Uj Ember,Jozsef@Posta.hu,,Lada Niva,MNO-345\n"
+                           "Kovacs Eva,kovacs@posta.hu,,Ford Focus,PQR-678\n";
+
+        char path[FILENAME_MAX];
+        fh_path(path, "teszt.csv");
+        if (!TEST_CHECK(!test_write("teszt.csv", rows)))
+                return;
+
+        fh_csv_stats stats;
+        TEST_CHECK(!fh_csv_ingest(db, path, NULL, &stats));
+        remove(path);
+
+        TEST_CHECK(stats.rows == 6 && stats.rejected == 3);
+        TEST_CHECK(stats.reject_lines[0] == 3 && stats.reject_lines[1] == 5 && stats.reject_lines[2] == 6);
+        TEST_CHECK(stats.clients == 2 && stats.cars == 3);
+
+        if (TEST_CHECK(db_cl_cnt(db) == 3)) {
+                TEST_CHECK(!strcmp(db_cl_get(db, 1)->name, "Kiss Anna") && db_car_cnt(db, 1) == 2);
+                TEST_CHECK(!strcmp(db_cl_get(db, 2)->name, "Kovacs Eva"));
+        }
+}
+
+/**
+ * @brief The unique index suite.
+ */
+void test_uniq(void)
+{
+        test_case("kulcsok", test_uniq_keys);
+        test_case("utkozesek", test_uniq_collide);
+        test_case("tranzakcio", test_uniq_tx);
+        test_case("csv betoltes", test_uniq_csv);
+}
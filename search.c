@@ -1,9 +1,193 @@
 /**
  * @file search.c
  * @brief Functions definitions for searching a given database.
- * @note These functions return \b exact \b matches . Wildcards are \b not supported.
+ * @note These functions return \b exact \b matches . Wildcards are \b not supported.\n
+ *       The clients are scanned in parallel, in pieces of \c SEARCH_GRAIN clients (see \c pool.c ), and the matches
+ *       of the pieces are merged in the database's order. Every piece runs in a read section, so the searches can run
+ *       while other threads modify a concurrent database. The clients added or removed in the meantime may or may not
+ *       be in the result.\n
+ *       The type-ahead search uses a prefix index instead (\c search_index() ), a sorted copy of the names or plates.
+ *       Each typed character narrows the range of the previous prefix (\c search_prefix_push() ), so a keystroke
+ *       costs a binary search within that range, not a scan.
  */
+#include "include/platform.h"
+
+#include <ctype.h>
+#include <strings.h>
+
 #include "include/search.h"
+#include "module-pool/include/pool.h"
+#include "module-probe/include/probe.h"
+
+#define SEARCH_GRAIN 4096 /**< Number of clients scanned by a task. */
+#define SEARCH_BLOCK 65536 /**< Size of a key storage block of a prefix index. */
+
+/**
+ * @brief Appends the matches within a client to a vector.
+ * @param db The pointer to the database.
+ * @param cl The client's index.
+ * @param term The search term.
+ * @param out Pointer to the vector of the matches, \c NULL until the first match.
+ * @retval 0 On success.
+ * @retval EOOB If the client doesn't exist (anymore). The scan is stopped.
+ * @retval EMALLOC If a match cannot be stored.
+ */
+typedef int (*search_fn)(database *db, idx cl, const void *term, vector **out);
+
+/**
+ * @struct search_job search.c
+ * @brief A scan shared by the search tasks.
+ */
+typedef struct search_job {
+        database *db;           /**< The database to search in. */
+        search_fn match;        /**< Finds the matches within a client. */
+        const void *term;       /**< The search term, passed to \c match . */
+        vector **parts;         /**< The matches of every piece. */
+        int *errs;              /**< The error code of every piece. */
+} search_job;
+
+/**
+ * @brief Stores a match.
+ * @param out Pointer to the vector of the matches, created by the first match.
+ * @param pos The database indexes of the match.
+ * @param n The number of indexes.
+ * @retval 0 On success.
+ * @retval EMALLOC If the match cannot be stored.
+ */
+int search_add(vector **out, const idx *pos, size_t n)
+{
+        if (!*out && !(*out = vct()))
+                return EMALLOC;
+
+        idx *db_index = malloc(n * sizeof(idx));
+        if (!db_index)
+                return EMALLOC;
+
+        memcpy(db_index, pos, n * sizeof(idx));
+
+        if (vct_push(*out, db_index) == EREALLOC) {
+                free(db_index);
+                return EREALLOC;
+        }
+
+        PROBE_ALLOC(PROBE_MEM_RESULT, n * sizeof(idx), 1);
+        return 0;
+}
+
+/**
+ * @brief Frees the matches of a search result.
+ * @param map The matches, \c res.map of the result. Can be \c NULL .
+ * @param depth The number of indexes of a match: \c 1 for the clients, \c 2 for the cars, \c 3 for the operations.
+ */
+void search_res_del(vector *map, int depth)
+{
+        if (!map)
+                return;
+
+        PROBE_FREE(PROBE_MEM_RESULT, map->size * (size_t)depth * sizeof(idx), map->size);
+        vct_del(map);
+}
+
+/**
+ * @brief A search task, scans a piece of the clients. See \c pool_for() .
+ * @param arg Pointer to the shared \c search_job .
+ * @param from The first client of the piece.
+ * @param to The end of the piece.
+ */
+void search_part(void *arg, size_t from, size_t to)
+{
+        search_job *job = arg;
+        size_t piece = from / SEARCH_GRAIN;
+
+        db_read_begin(job->db);
+        for (idx i = from; i < to; i++) {
+                int retval = job->match(job->db, i, job->term, &job->parts[piece]);
+                if (retval == EOOB)
+                        break;
+
+                if (retval) {
+                        job->errs[piece] = retval;
+                        break;
+                }
+        }
+        db_read_end(job->db);
+}
+
+/**
+ * @brief Scans every client of a database in parallel.
+ * @param db The pointer to the database to search in.
+ * @param match Finds the matches within a client.
+ * @param term The search term, passed to \c match .
+ * @param depth The number of indexes of a match, see \c search_res_del() .
+ * @return A \c sres structure containing the result. On error, the matches before the failed client are kept, except
+ *         for \c EMALLOC , which deletes the result.
+ */
+sres search_scan(database *db, search_fn match, const void *term, int depth)
+{
+        sres res = {.map = vct(), .err = 0};
+
+        size_t cnt = db_cl_cnt(db);
+        size_t pieces = cnt / SEARCH_GRAIN + 1;
+        search_job job = {db, match, term, calloc(pieces, sizeof(vector*)), calloc(pieces, sizeof(int))};
+
+        if (!res.map || !job.parts || !job.errs)
+                res.err = EMALLOC;
+        else
+                pool_for("search", cnt, SEARCH_GRAIN, search_part, &job);
+
+        /* The pieces are merged until the first failed one, which has the matches before the error. */
+        size_t total = 0;
+        size_t last = 0;
+        for (; !res.err && last < pieces; last++) {
+                total += job.parts[last] ? job.parts[last]->size : 0;
+                if (job.errs[last])
+                        break;
+        }
+
+        if (!res.err && vct_reserve(res.map, total))
+                res.err = EMALLOC;
+
+        for (size_t p = 0; job.parts && p < pieces; p++) {
+                vector *part = job.parts[p];
+                if (!part)
+                        continue;
+
+                /* The moved matches belong to the result, the rest are deleted with the piece. */
+                if (!res.err && p <= last) {
+                        for (idx i = 0; i < part->size; i++)
+                                res.map->items[res.map->size++] = part->items[i];
+
+                        part->size = 0;
+                }
+
+                search_res_del(part, depth);
+        }
+
+        if (!res.err && last < pieces)
+                res.err = job.errs[last];
+
+        if (res.err == EMALLOC && res.map) {
+                search_res_del(res.map, depth);
+                res.map = NULL;
+        }
+
+        free(job.parts);
+        free(job.errs);
+        return res;
+}
+
+/**
+ * @brief Matches a client by its name.
+ * @return See \c search_fn .
+ */
+int search_cl_match(database *db, idx cl, const void *term, vector **out)
+{
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return EOOB;
+
+        return strcmp(client_->name, term) ? 0 : search_add(out, &cl, 1);
+}
 
 /**
  * @brief Searches a database by a client's name.
@@ -13,29 +197,33 @@
  */
 sres search_cl(database *db, const char *term)
 {
-        sres res = {.map = vct(), .err = 0};
+        PROBE(PROBE_SEARCH_CL);
+        return search_scan(db, search_cl_match, term, 1);
+}
 
-        for (idx i = 0; i < db->cl->size; i++) {
-                client *cl = db_cl_get(db, i);
-                if (!strcmp(cl->name, term)) {
-                        idx *db_index = malloc(sizeof(idx));
-                        if (!db_index) {
-                                res.err = EMALLOC;
-                                vct_del(res.map);
-                                break;
-                        }
-
-                        db_index[0] = i;
-
-                        if (vct_push(res.map, db_index) == EREALLOC) {
-                                res.err = EREALLOC;
-                                vct_del(res.map);
-                                break;
-                        }
-                }
+/**
+ * @brief Matches the cars of a client by their plate number.
+ * @return See \c search_fn , or the error code of \c db_cl_load() .
+ */
+int search_plate_match(database *db, idx cl, const void *term, vector **out)
+{
+        int retval = db_cl_load(db, cl);
+        if (retval)
+                return retval;
+
+        /* Loading a shared client replaces it with its copy. */
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return EOOB;
+
+        for (idx j = 0; j < client_->cars->size && !retval; j++) {
+                car *car = vct_subptr(client_->cars, j);
+
+                if (!strcmp(car->plate, term))
+                        retval = search_add(out, (idx[]){cl, j}, 2);
         }
 
-        return res;
+        return retval;
 }
 
 /**
@@ -47,35 +235,44 @@ sres search_cl(database *db, const char *term)
  */
 sres search_plate(database *db, const char *term)
 {
-        sres res = {.map = vct(), .err = 0};
+        PROBE(PROBE_SEARCH_PLATE);
+        return search_scan(db, search_plate_match, term, 2);
+}
+
+/**
+ * @brief Matches the operations of a client, which have date_exp due in 30 days.
+ * @param term Pointer to the current date.
+ * @return See \c search_fn , or the error code of \c db_cl_load() .
+ */
+int search_expiration_match(database *db, idx cl, const void *term, vector **out)
+{
+        const date *now = term;
+
+        int retval = db_cl_load(db, cl);
+        if (retval)
+                return retval;
+
+        const client *client_ = db_cl_get(db, cl);
+        if (!client_)
+                return EOOB;
+
+        /* [O(n^3) oof.] */
+        for (idx j = 0; j < client_->cars->size && !retval; j++) {
+                car *car = vct_subptr(client_->cars, j);
+
+                for (idx k = 0; k < car->operations->size && !retval; k++) {
+                        operation *op = vct_subptr(car->operations, k);
+                        if (op->date_exp.y == 0)
+                                continue;
 
-        for (idx i = 0; i < db->cl->size; i++) {
-                client *cl = db_cl_get(db, i);
-
-                for (idx j = 0; j < cl->cars->size; j++) {
-                        car *car = db_car_get(db, i, j);
-
-                        if (!strcmp(car->plate, term)) {
-                                idx *db_index = malloc(2 * sizeof(idx));
-                                if (!db_index) {
-                                        res.err = EMALLOC;
-                                        vct_del(res.map);
-                                        break;
-                                }
-
-                                db_index[0] = i;
-                                db_index[1] = j;
-
-                                if (vct_push(res.map, db_index) == EREALLOC) {
-                                        res.err = EREALLOC;
-                                        vct_del(res.map);
-                                        break;
-                                }
-                        }
+                        double diff = date_diff(&op->date_exp, now);
+
+                        if (0 < diff && diff < 30.0)
+                                retval = search_add(out, (idx[]){cl, j, k}, 3);
                 }
         }
 
-        return res;
+        return retval;
 }
 
 /**
@@ -87,46 +284,242 @@ sres search_plate(database *db, const char *term)
  */
 sres search_expiration(database *db)
 {
-        sres res = {.map = vct(), .err = 0};
-
+        PROBE(PROBE_SEARCH_EXPIRATION);
         date now = date_now();
+        return search_scan(db, search_expiration_match, &now, 3);
+}
+
+/**
+ * @brief Adds a key to a prefix index, unsorted.
+ * @param ix Pointer to the index.
+ * @param key The key, copied into the index's storage.
+ * @param cl The client's index.
+ * @param car The car's index.
+ * @retval 0 On success.
+ * @retval EMALLOC If the key cannot be stored.
+ */
+int search_index_add(sindex *ix, const char *key, idx cl, idx car)
+{
+        size_t len = strlen(key) + 1;
+
+        /* The blocks are never moved, so the keys can be pointed to. */
+        if (ix->blocks->size == 0 || ix->used + len > SEARCH_BLOCK) {
+                char *block = malloc(SEARCH_BLOCK);
+                if (!block)
+                        return EMALLOC;
+
+                if (vct_push(ix->blocks, block) == EREALLOC) {
+                        free(block);
+                        return EREALLOC;
+                }
+
+                PROBE_ALLOC(PROBE_MEM_INDEX, SEARCH_BLOCK, 0);
+
+                ix->used = 0;
+        }
 
-        /* Start the database iteration [O(n^3) oof.]*/
-        for (idx i = 0; i < db->cl->size; i++) {
-                client *cl = db_cl_get(db, i);
+        if (ix->size == ix->capacity) {
+                size_t new_cap = ix->capacity ? ix->capacity * 2 : 1024;
+                sentry *tmp = realloc(ix->items, new_cap * sizeof(sentry));
+                if (!tmp)
+                        return EREALLOC;
 
-                for (idx j = 0; j < cl->cars->size; j++) {
-                        car *car = db_car_get(db, i, j);
+                PROBE_ALLOC(PROBE_MEM_INDEX, (new_cap - ix->capacity) * sizeof(sentry), 0);
+                ix->items = tmp;
+                ix->capacity = new_cap;
+        }
+
+        char *dst = (char *)ix->blocks->items[ix->blocks->size - 1] + ix->used;
+        memcpy(dst, key, len);
+        ix->used += len;
+
+        ix->items[ix->size++] = (sentry){dst, cl, car};
+        PROBE_ALLOC(PROBE_MEM_INDEX, 0, 1);
+        return 0;
+}
+
+/**
+ * @brief Orders the entries of a prefix index: by their keys case-insensitively, then in the database's order.
+ */
+int search_entry_cmp(const void *a, const void *b)
+{
+        const sentry *x = a;
+        const sentry *y = b;
+
+        int diff = strcasecmp(x->key, y->key);
+        if (diff)
+                return diff;
+
+        if (x->cl != y->cl)
+                return x->cl < y->cl ? -1 : 1;
 
-                        for (idx k = 0; k < car->operations->size; k++) {
-                                operation *op = db_op_get(db, i, j, k);
-                                if (op->date_exp.y == 0)
-                                        continue;
+        return x->car < y->car ? -1 : x->car > y->car;
+}
 
-                                double diff = date_diff(&op->date_exp, &now);
+/**
+ * @brief Builds a prefix index of a database.
+ * @param db The pointer to the database.
+ * @param ix Pointer to the index to be built. It must be deleted by \c search_index_del() , even on error.
+ * @param plates Set to \c true to index the cars' plates, \c false for the clients' names.
+ * @retval 0 On success.
+ * @retval EMALLOC If the index cannot be allocated.
+ * @retval EINV If a client cannot be loaded, see \c db_cl_load() .
+ * @note The clients are loaded for their plates, like by \c search_plate() . The clients added or removed while the
+ *       index is built may or may not be in it.
+ */
+int search_index(database *db, sindex *ix, bool plates)
+{
+        PROBE(PROBE_SEARCH_INDEX);
+        *ix = (sindex){.blocks = vct(), .depth = plates ? 2 : 1};
+        if (!ix->blocks)
+                return EMALLOC;
 
-                                if (0 < diff && diff < 30.0) {
+        int retval = 0;
+        db_read_begin(db);
+        for (idx i = 0; !retval; i++) {
+                if (plates)
+                        retval = db_cl_load(db, i);
 
-                                        idx *db_index = malloc(3 * sizeof(idx));
-                                        if (!db_index) {
-                                                res.err = EMALLOC;
-                                                vct_del(res.map);
-                                                break;
-                                        }
+                const client *client_ = retval ? NULL : db_cl_get(db, i);
+                if (!client_)
+                        break;
 
-                                        db_index[0] = i;
-                                        db_index[1] = j;
-                                        db_index[2] = k;
+                if (!plates) {
+                        retval = search_index_add(ix, client_->name, i, 0);
+                        continue;
+                }
 
-                                        if (vct_push(res.map, db_index) == EREALLOC) {
-                                                res.err = EREALLOC;
-                                                vct_del(res.map);
-                                                break;
-                                        }
-                                }
-                        }
+                for (idx j = 0; j < client_->cars->size && !retval; j++) {
+                        car *car = vct_subptr(client_->cars, j);
+                        retval = search_index_add(ix, car->plate, i, j);
                 }
         }
+        db_read_end(db);
+
+        if (retval == EOOB)
+                retval = 0;
+
+        if (!retval) {
+                TRACE("search_sort");
+                qsort(ix->items, ix->size, sizeof(sentry), search_entry_cmp);
+        }
+
+        return retval;
+}
+
+/**
+ * @brief Frees a prefix index.
+ * @param ix Pointer to the index.
+ */
+void search_index_del(sindex *ix)
+{
+        if (ix->blocks) {
+                PROBE_FREE(PROBE_MEM_INDEX, ix->blocks->size * SEARCH_BLOCK + ix->capacity * sizeof(sentry), ix->size);
+                vct_del(ix->blocks);
+        }
+
+        free(ix->items);
+        *ix = (sindex){0};
+}
+
+/**
+ * @brief Starts an empty prefix, which matches every entry of an index.
+ * @param p Pointer to the prefix.
+ * @param ix The index to search in. It must outlive the prefix.
+ */
+void search_prefix_init(sprefix *p, const sindex *ix)
+{
+        p->ix = ix;
+        p->term[0] = '\0';
+        p->len = 0;
+        p->lo[0] = 0;
+        p->hi[0] = ix->size;
+}
+
+/**
+ * @brief Appends a character to a prefix, and narrows its range.
+ * @details The entries in the range share the prefix, so they are ordered by their next character: the new range is
+ *          found by two binary searches on that single character.
+ * @param p Pointer to the prefix.
+ * @param c The character.
+ * @return \c false if the prefix is at its longest, or \c c is the terminating null.
+ */
+bool search_prefix_push(sprefix *p, char c)
+{
+        PROBE(PROBE_SEARCH_PREFIX);
+        if (p->len == NAME_SIZE || c == '\0')
+                return false;
+
+        size_t k = p->len;
+        int ch = tolower((unsigned char)c);
+        const sentry *items = p->ix->items;
+
+        size_t lo = p->lo[k];
+        size_t hi = p->hi[k];
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (tolower((unsigned char)items[mid].key[k]) < ch)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        size_t end = p->hi[k];
+        hi = end;
+        for (size_t l = lo; l < hi;) {
+                size_t mid = l + (hi - l) / 2;
+                if (tolower((unsigned char)items[mid].key[k]) <= ch)
+                        l = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        p->term[k] = c;
+        p->term[k + 1] = '\0';
+        p->len++;
+        p->lo[k + 1] = lo;
+        p->hi[k + 1] = hi;
+        return true;
+}
+
+/**
+ * @brief Removes the last character of a prefix, its previous range is restored.
+ * @param p Pointer to the prefix.
+ * @return \c false if the prefix is empty.
+ */
+bool search_prefix_pop(sprefix *p)
+{
+        if (p->len == 0)
+                return false;
+
+        p->term[--p->len] = '\0';
+        return true;
+}
+
+/**
+ * @brief Lists the entries matching a prefix as a search result.
+ * @param p Pointer to the prefix.
+ * @return A \c sres structure containing the result, with the index's depth: client indexes for names, client and car
+ *         indexes for plates (see \c search_plate() ).
+ */
+sres search_prefix_res(const sprefix *p)
+{
+        sres res = {.map = vct(), .err = 0};
+        size_t lo = p->lo[p->len];
+        size_t hi = p->hi[p->len];
+
+        if (!res.map || vct_reserve(res.map, hi - lo))
+                res.err = EMALLOC;
+
+        for (idx i = lo; i < hi && !res.err; i++) {
+                const sentry *e = &p->ix->items[i];
+                res.err = search_add(&res.map, (idx[]){e->cl, e->car}, (size_t)p->ix->depth);
+        }
+
+        if (res.err && res.map) {
+                search_res_del(res.map, p->ix->depth);
+                res.map = NULL;
+        }
 
         return res;
 }